@@ -22,6 +22,7 @@
 #include "dns.h"
 #include "provider.h"
 #include "notice.h"
+#include "verdict.h"
 
 #define MAXPARA 10
 
@@ -41,11 +42,13 @@ authd_cmd_handler authd_cmd_handlers[256] = {
 };
 
 authd_stat_handler authd_stat_handlers[256] = {
+	['C'] = stats_dns_cache,
 	['D'] = enumerate_nameservers,
 };
 
 authd_reload_handler authd_reload_handlers[256] = {
 	['D'] = reload_nameservers,
+	['V'] = flush_verdicts,
 };
 
 rb_dictionary *authd_option_handlers;
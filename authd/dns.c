@@ -295,6 +295,15 @@ enumerate_nameservers(uint32_t rid, const char letter)
 	stats_result(rid, letter, "%s", buf);
 }
 
+void
+stats_dns_cache(uint32_t rid, const char letter)
+{
+	stats_result(rid, letter, "%u %u %lu %lu %lu %lu",
+		res_cache_stats.entries, res_cache_stats.max,
+		res_cache_stats.hits, res_cache_stats.negative_hits,
+		res_cache_stats.misses, res_cache_stats.evictions);
+}
+
 void
 reload_nameservers(const char letter)
 {
@@ -52,6 +52,7 @@
 #include "authd.h"
 #include "provider.h"
 #include "notice.h"
+#include "verdict.h"
 
 static EVH provider_timeout_event;
 
@@ -91,6 +92,7 @@ init_providers(void)
 {
 	auth_clients = rb_dictionary_create("pending auth clients", rb_uint32cmp);
 	timeout_ev = rb_event_addish("provider_timeout_event", provider_timeout_event, NULL, 1);
+	init_verdicts();
 
 	/* FIXME must be started before rdns to receive completion notification from it */
 	load_provider(&dnsbl_provider);
@@ -255,7 +257,10 @@ reject_client(struct auth_client *auth, uint32_t id, const char *data, const cha
 		data == NULL ? "*" : data, buf);
 
 	if(id != UINT32_MAX)
+	{
+		verdict_reject(auth, auth->data[id].provider->letter, data, buf);
 		set_provider_done(auth, id);
+	}
 
 	cancel_providers(auth);
 }
@@ -265,6 +270,7 @@ void
 accept_client(struct auth_client *auth)
 {
 	rb_helper_write(authd_helper, "A %x * %s", auth->cid, auth->hostname);
+	verdict_accept(auth);
 	cancel_providers(auth);
 }
 
@@ -305,6 +311,10 @@ start_auth(const char *cid, const char *l_ip, const char *l_port, const char *c_
 
 	rb_strlcpy(auth->hostname, "*", sizeof(auth->hostname));
 
+	/* Seen recently, no need to look again */
+	if(verdict_replay(auth))
+		goto done;
+
 	auth->data = rb_malloc(allocated_pids * sizeof(struct auth_client_data));
 
 	auth->providers_starting = true;
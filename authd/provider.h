@@ -40,6 +40,7 @@ struct auth_client_data
 	time_t timeout;			/* Provider timeout */
 	void *data;			/* Provider data */
 	provider_status_t status;	/* Provider status */
+	bool inconclusive;		/* Provider gave up without an answer */
 };
 
 struct auth_client
@@ -203,6 +204,20 @@ run_after_provider(struct auth_client *auth, const char *name)
 	}
 }
 
+/* Mark the provider as having given up without an answer */
+static inline void
+set_provider_inconclusive(struct auth_client *auth, uint32_t provider)
+{
+	auth->data[provider].inconclusive = true;
+}
+
+/* Check if provider gave up on this client without an answer */
+static inline bool
+is_provider_inconclusive(struct auth_client *auth, uint32_t provider)
+{
+	return auth->data[provider].inconclusive;
+}
+
 /* Get provider auth client data */
 static inline void *
 get_provider_data(struct auth_client *auth, uint32_t id)
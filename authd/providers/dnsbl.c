@@ -442,6 +442,7 @@ dnsbls_generic_cancel(struct auth_client *auth, const char *message)
 static void
 dnsbls_timeout(struct auth_client *auth)
 {
+	set_provider_inconclusive(auth, SELF_PID);
 	dnsbls_generic_cancel(auth, "*** No response from DNSBLs");
 }
 
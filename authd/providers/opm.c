@@ -41,11 +41,39 @@ typedef enum protocol_t
 	PROTO_HTTPS_CONNECT,
 } protocol_t;
 
+/*
+ * Scans are scheduled in groups: every client in the same prefix (a /24 or
+ * a /64 by default) that arrives while a group is scanning joins it rather
+ * than being scanned again.  A group makes one connection per proxy type,
+ * to the address of the client that started it, and a proxy found by it
+ * rejects every client in the group.
+ *
+ * At most opm_max_scans connections are open at once.  Groups that have
+ * started are given the free slots before groups that are still waiting,
+ * so a flood delays new scans rather than starving the ones under way.
+ * A client whose group does not get going in time is let through by the
+ * provider timeout, as before.
+ */
+struct opm_group
+{
+	rb_patricia_node_t *pnode;	/* NULL once superseded */
+	struct rb_sockaddr_storage addr;	/* address being scanned */
+	time_t started;
+
+	rb_dlink_list clients;		/* struct opm_lookup */
+	rb_dlink_list scans;		/* connections open */
+	rb_dlink_node *next;		/* next proxy scanner to connect to */
+
+	rb_dlink_list *queue;		/* opm_running/opm_waiting, or NULL */
+	rb_dlink_node qnode;
+};
+
 /* Lookup data associated with auth client */
 struct opm_lookup
 {
-	rb_dlink_list scans;	/* List of scans */
-	bool in_progress;
+	struct auth_client *auth;
+	struct opm_group *group;	/* NULL until scanning */
+	rb_dlink_node node;		/* in group->clients */
 };
 
 struct opm_scan;
@@ -77,7 +105,7 @@ struct opm_listener
 /* An individual proxy scan */
 struct opm_scan
 {
-	struct auth_client *auth;
+	struct opm_group *group;
 	rb_fde_t *F;			/* fd for scan */
 
 	struct opm_proxy *proxy;	/* Associated proxy */
@@ -100,6 +128,23 @@ static bool create_listener(const char *ip, uint16_t port);
 static int opm_timeout = OPM_TIMEOUT_DEFAULT;
 static bool opm_enable = false;
 
+static rb_patricia_tree_t *opm_groups;
+static rb_dlink_list opm_running;	/* groups with connections left to make */
+static rb_dlink_list opm_waiting;	/* groups not started yet */
+
+static unsigned int opm_max_scans = OPM_MAX_SCANS_DEFAULT;
+static int opm_ipv4_bitlen = OPM_IPV4_BITLEN_DEFAULT;
+static int opm_ipv6_bitlen = OPM_IPV6_BITLEN_DEFAULT;
+
+static unsigned int opm_inflight;	/* connections open */
+static unsigned int opm_group_count;
+static unsigned long opm_scans_started;
+static unsigned long opm_clients_joined;	/* scanned by someone else's group */
+static unsigned long opm_proxies_found;
+
+static void opm_dispatch(void);
+static void opm_group_release(struct opm_group *group);
+
 enum
 {
 	LISTEN_IPV4,
@@ -141,23 +186,50 @@ find_proxy_scanner(protocol_t proto, uint16_t port)
 	return NULL;
 }
 
+static struct opm_group *
+find_group(struct sockaddr *addr)
+{
+	rb_patricia_node_t *pnode;
+
+	if(opm_groups == NULL || (pnode = rb_match_ip(opm_groups, addr)) == NULL)
+		return NULL;
+
+	return pnode->data;
+}
+
+/* Take a client out of its group; the group may now be empty */
+static struct opm_group *
+opm_detach(struct auth_client *auth)
+{
+	struct opm_lookup *lookup = get_provider_data(auth, SELF_PID);
+	struct opm_group *group;
+
+	lrb_assert(lookup != NULL);
+
+	if((group = lookup->group) != NULL)
+		rb_dlinkDelete(&lookup->node, &group->clients);
+
+	rb_free(lookup);
+	set_provider_data(auth, SELF_PID, NULL);
+	set_provider_timeout_absolute(auth, SELF_PID, 0);
+
+	return group;
+}
+
 /* This is called when an open proxy connects to us */
 static void
 read_opm_reply(rb_fde_t *F, void *data)
 {
 	rb_dlink_node *ptr;
-	struct auth_client *auth = data;
-	struct opm_lookup *lookup;
+	struct opm_group *group;
+	struct rb_sockaddr_storage addr;
+	rb_socklen_t addrlen = sizeof(addr);
 	char readbuf[OPM_READSIZE];
 	ssize_t len;
 
-	lrb_assert(auth != NULL);
-	lookup = get_provider_data(auth, SELF_PID);
-	lrb_assert(lookup != NULL);
-
-	if((len = rb_read(F, readbuf, sizeof(readbuf))) < 0 && rb_ignore_errno(errno))
+	if((len = rb_read(F, readbuf, sizeof(readbuf) - 1)) < 0 && rb_ignore_errno(errno))
 	{
-		rb_setselect(F, RB_SELECT_READ, read_opm_reply, auth);
+		rb_setselect(F, RB_SELECT_READ, read_opm_reply, NULL);
 		return;
 	}
 	else if(len <= 0)
@@ -167,6 +239,16 @@ read_opm_reply(rb_fde_t *F, void *data)
 		return;
 	}
 
+	readbuf[len] = '\0';
+
+	/* The group may have finished while we waited */
+	if(getpeername(rb_get_fd(F), (struct sockaddr *)&addr, &addrlen) != 0 ||
+		(group = find_group((struct sockaddr *)&addr)) == NULL)
+	{
+		rb_close(F);
+		return;
+	}
+
 	RB_DLINK_FOREACH(ptr, proxy_scanners.head)
 	{
 		struct opm_proxy *proxy = ptr->data;
@@ -175,19 +257,20 @@ read_opm_reply(rb_fde_t *F, void *data)
 		{
 			rb_dlink_node *ptr2, *nptr;
 
-			/* Cancel outstanding lookups */
-			RB_DLINK_FOREACH_SAFE(ptr2, nptr, lookup->scans.head)
+			opm_proxies_found++;
+
+			/* Everyone scanned by this group is going away */
+			RB_DLINK_FOREACH_SAFE(ptr2, nptr, group->clients.head)
 			{
-				struct opm_scan *scan = ptr2->data;
+				struct opm_lookup *lookup = ptr2->data;
+				struct auth_client *auth = lookup->auth;
 
-				rb_close(scan->F);
-				rb_free(scan);
+				(void)opm_detach(auth);
+				reject_client(auth, SELF_PID, readbuf, "Open proxy detected");
+				auth_client_unref(auth);
 			}
 
-			/* No longer needed, client is going away */
-			rb_free(lookup);
-
-			reject_client(auth, SELF_PID, readbuf, "Open proxy detected");
+			opm_group_release(group);
 			break;
 		}
 	}
@@ -198,11 +281,7 @@ read_opm_reply(rb_fde_t *F, void *data)
 static void
 accept_opm(rb_fde_t *F, int status, struct sockaddr *addr, rb_socklen_t len, void *data)
 {
-	struct auth_client *auth = NULL;
 	struct opm_listener *listener = data;
-	struct rb_sockaddr_storage localaddr;
-	unsigned int llen = sizeof(struct rb_sockaddr_storage);
-	rb_dictionary_iter iter;
 
 	if(status != 0 || listener == NULL)
 	{
@@ -210,72 +289,39 @@ accept_opm(rb_fde_t *F, int status, struct sockaddr *addr, rb_socklen_t len, voi
 		return;
 	}
 
-	if(getsockname(rb_get_fd(F), (struct sockaddr *)&localaddr, &llen))
+	/* Correlate the connection with a scan by where it came from */
+	if(find_group(addr) == NULL)
 	{
-		/* This can happen if the client goes away after accept */
+		/* We don't care about the socket if we get here */
 		rb_close(F);
 		return;
 	}
 
-	/* Correlate connection with client(s) */
-	RB_DICTIONARY_FOREACH(auth, &iter, auth_clients)
-	{
-		if(GET_SS_FAMILY(&auth->c_addr) != GET_SS_FAMILY(&localaddr))
-			continue;
-
-		/* Compare the addresses */
-		switch(GET_SS_FAMILY(&localaddr))
-		{
-		case AF_INET:
-			{
-				struct sockaddr_in *s = (struct sockaddr_in *)&localaddr, *c = (struct sockaddr_in *)&auth->c_addr;
-
-				if(s->sin_addr.s_addr == c->sin_addr.s_addr)
-				{
-					/* Match... check if it's real */
-					rb_setselect(F, RB_SELECT_READ, read_opm_reply, auth);
-					return;
-				}
-				break;
-			}
-		case AF_INET6:
-			{
-				struct sockaddr_in6 *s = (struct sockaddr_in6 *)&localaddr, *c = (struct sockaddr_in6 *)&auth->c_addr;
-
-				if(IN6_ARE_ADDR_EQUAL(&s->sin6_addr, &c->sin6_addr))
-				{
-					rb_setselect(F, RB_SELECT_READ, read_opm_reply, auth);
-					return;
-				}
-				break;
-			}
-		default:
-			warn_opers(L_CRIT, "OPM: unknown address type in listen function");
-			exit(EX_PROVIDER_ERROR);
-		}
-	}
-
-	/* We don't care about the socket if we get here */
-	rb_close(F);
+	rb_setselect(F, RB_SELECT_READ, read_opm_reply, NULL);
 }
 
 /* Scanners */
 
+static void
+scan_free(struct opm_scan *scan)
+{
+	rb_close(scan->F);
+	rb_dlinkDelete(&scan->node, &scan->group->scans);
+	rb_free(scan);
+	opm_inflight--;
+}
+
 static void
 opm_connected(rb_fde_t *F, int error, void *data)
 {
 	struct opm_scan *scan = data;
 	struct opm_proxy *proxy = scan->proxy;
-	struct auth_client *auth = scan->auth;
-	struct opm_lookup *lookup = get_provider_data(auth, SELF_PID);
+	struct opm_group *group = scan->group;
 
 	if(error || !opm_enable)
-	{
-		//notice_client(scan->auth->cid, "*** Scan not connected: %s", proxy->note);
 		goto end;
-	}
 
-	switch(GET_SS_FAMILY(&auth->c_addr))
+	switch(GET_SS_FAMILY(&group->addr))
 	{
 	case AF_INET:
 		if(listeners[LISTEN_IPV4].F == NULL)
@@ -300,9 +346,10 @@ opm_connected(rb_fde_t *F, int error, void *data)
 	proxy->callback(scan);
 
 end:
-	rb_close(scan->F);
-	rb_dlinkDelete(&scan->node, &lookup->scans);
-	rb_free(scan);
+	scan_free(scan);
+
+	/* the group lives on until its clients are done; a slot is free */
+	opm_dispatch();
 }
 
 static void
@@ -328,7 +375,6 @@ socks4_connected(struct opm_scan *scan)
 static void
 socks5_connected(struct opm_scan *scan)
 {
-	struct auth_client *auth = scan->auth;
 	uint8_t sendbuf[25]; /* Size we're building */
 	uint8_t *c = sendbuf;
 
@@ -338,7 +384,7 @@ socks5_connected(struct opm_scan *scan)
 	 */
 	memcpy(c, "\x05\x01\x00\x05\x01\x00", 6); c += 6;
 
-	switch(GET_SS_FAMILY(&auth->c_addr))
+	switch(GET_SS_FAMILY(&scan->group->addr))
 	{
 	case AF_INET:
 		*(c++) = '\x01'; /* Address type (1 = IPv4) */
@@ -384,49 +430,42 @@ http_connect_connected(struct opm_scan *scan)
 		return;
 }
 
-/* Establish connections */
-static inline void
-establish_connection(struct auth_client *auth, struct opm_proxy *proxy)
+/* Establish connections; false if this proxy type does not apply */
+static bool
+establish_connection(struct opm_group *group, struct opm_proxy *proxy)
 {
-	struct opm_lookup *lookup = get_provider_data(auth, SELF_PID);
-	struct opm_scan *scan = rb_malloc(sizeof(struct opm_scan));
+	struct opm_scan *scan;
 	struct opm_listener *listener;
 	struct rb_sockaddr_storage c_a, l_a;
 	int opt = 1;
 
-	lrb_assert(lookup != NULL);
-
-	if(GET_SS_FAMILY(&auth->c_addr) == AF_INET6)
+	if(GET_SS_FAMILY(&group->addr) == AF_INET6)
 	{
 		if(proxy->proto == PROTO_SOCKS4)
-		{
 			/* SOCKS4 doesn't support IPv6 */
-			rb_free(scan);
-			return;
-		}
+			return false;
+
 		listener = &listeners[LISTEN_IPV6];
 	}
 	else
 		listener = &listeners[LISTEN_IPV4];
 
 	if(listener->F == NULL)
-	{
 		/* We can't respond */
-		rb_free(scan);
-		return;
-	}
+		return false;
 
-	c_a = auth->c_addr;	/* Client */
+	c_a = group->addr;	/* Client */
 	l_a = listener->addr;	/* Listener (connect using its IP) */
 
-	scan->auth = auth;
+	scan = rb_malloc(sizeof(struct opm_scan));
+	scan->group = group;
 	scan->proxy = proxy;
 	scan->listener = listener;
-	if((scan->F = rb_socket(GET_SS_FAMILY(&auth->c_addr), SOCK_STREAM, 0, proxy->note)) == NULL)
+	if((scan->F = rb_socket(GET_SS_FAMILY(&group->addr), SOCK_STREAM, 0, proxy->note)) == NULL)
 	{
 		warn_opers(L_WARN, "OPM: could not create OPM socket (proto %s): %s", proxy->note, strerror(errno));
 		rb_free(scan);
-		return;
+		return false;
 	}
 
 	/* Disable Nagle's algorithim - buffering could affect scans */
@@ -435,7 +474,9 @@ establish_connection(struct auth_client *auth, struct opm_proxy *proxy)
 	SET_SS_PORT(&l_a, 0);
 	SET_SS_PORT(&c_a, htons(proxy->port));
 
-	rb_dlinkAdd(scan, &scan->node, &lookup->scans);
+	rb_dlinkAdd(scan, &scan->node, &group->scans);
+	opm_inflight++;
+	opm_scans_started++;
 
 	if(!proxy->ssl)
 		rb_connect_tcp(scan->F,
@@ -447,6 +488,112 @@ establish_connection(struct auth_client *auth, struct opm_proxy *proxy)
 				(struct sockaddr *)&c_a,
 				(struct sockaddr *)&l_a,
 				opm_connected, scan, opm_timeout);
+
+	return true;
+}
+
+static void
+group_dequeue(struct opm_group *group)
+{
+	if(group->queue != NULL)
+	{
+		rb_dlinkDelete(&group->qnode, group->queue);
+		group->queue = NULL;
+	}
+}
+
+/* Start as many connections as the limit allows */
+static void
+opm_dispatch(void)
+{
+	while(opm_max_scans == 0 || opm_inflight < opm_max_scans)
+	{
+		struct opm_group *group;
+		struct opm_proxy *proxy;
+
+		if(opm_running.head != NULL)
+			group = opm_running.head->data;
+		else if(opm_waiting.head != NULL)
+		{
+			group = opm_waiting.head->data;
+			rb_dlinkMoveNode(&group->qnode, &opm_waiting, &opm_running);
+			group->queue = &opm_running;
+		}
+		else
+			break;
+
+		if(group->next == NULL)
+		{
+			group_dequeue(group);
+			continue;
+		}
+
+		proxy = group->next->data;
+		group->next = group->next->next;
+		if(group->next == NULL)
+			group_dequeue(group);
+
+		(void)establish_connection(group, proxy);
+	}
+}
+
+/* Free a group once nobody is waiting on it */
+static void
+opm_group_release(struct opm_group *group)
+{
+	rb_dlink_node *ptr, *nptr;
+
+	if(rb_dlink_list_length(&group->clients) > 0)
+		return;
+
+	RB_DLINK_FOREACH_SAFE(ptr, nptr, group->scans.head)
+		scan_free(ptr->data);
+
+	group_dequeue(group);
+
+	if(group->pnode != NULL)
+		rb_patricia_remove(opm_groups, group->pnode);
+
+	rb_free(group);
+	opm_group_count--;
+
+	opm_dispatch();
+}
+
+static struct opm_group *
+opm_group_find_or_create(struct auth_client *auth)
+{
+	rb_patricia_node_t *pnode;
+	struct opm_group *group;
+	int bitlen;
+
+	bitlen = GET_SS_FAMILY(&auth->c_addr) == AF_INET6 ? opm_ipv6_bitlen : opm_ipv4_bitlen;
+	if((pnode = make_and_lookup_ip(opm_groups, (struct sockaddr *)&auth->c_addr, bitlen)) == NULL)
+		return NULL;
+
+	if((group = pnode->data) != NULL)
+	{
+		/* join it, unless it is stale enough to want a fresh look */
+		if(group->started + opm_timeout > rb_current_time())
+		{
+			opm_clients_joined++;
+			return group;
+		}
+
+		group->pnode = NULL;
+	}
+
+	group = rb_malloc(sizeof(struct opm_group));
+	group->pnode = pnode;
+	pnode->data = group;
+	group->addr = auth->c_addr;
+	group->started = rb_current_time();
+	group->next = proxy_scanners.head;
+	group->queue = &opm_waiting;
+	rb_dlinkAddTail(group, &group->qnode, &opm_waiting);
+	opm_group_count++;
+
+	return group;
 }
 
 static bool
@@ -562,24 +709,26 @@ create_listener(const char *ip, uint16_t port)
 static void
 opm_scan(struct auth_client *auth)
 {
-	rb_dlink_node *ptr;
 	struct opm_lookup *lookup;
+	struct opm_group *group;
 
 	lrb_assert(auth != NULL);
 
 	lookup = get_provider_data(auth, SELF_PID);
 	set_provider_timeout_relative(auth, SELF_PID, opm_timeout);
 
-	lookup->in_progress = true;
-
-	RB_DLINK_FOREACH(ptr, proxy_scanners.head)
+	if((group = opm_group_find_or_create(auth)) == NULL)
 	{
-		struct opm_proxy *proxy = ptr->data;
-		//notice_client(auth->cid, "*** Scanning for proxy type %s", proxy->note);
-		establish_connection(auth, proxy);
+		opm_cancel(auth);
+		return;
 	}
 
+	lookup->group = group;
+	rb_dlinkAdd(lookup, &lookup->node, &group->clients);
+
 	notice_client(auth->cid, "*** Scanning for open proxies...");
+
+	opm_dispatch();
 }
 
 /* This is called every time a provider is completed as long as we are marked not done */
@@ -592,7 +741,7 @@ opm_initiate(struct auth_client *auth, uint32_t provider)
 	lrb_assert(!is_provider_done(auth, SELF_PID));
 	lrb_assert(rb_dlink_list_length(&proxy_scanners) > 0);
 
-	if (lookup == NULL || lookup->in_progress) {
+	if (lookup == NULL || lookup->group != NULL) {
 		/* Nothing to do */
 		return;
 	} else if (run_after_provider(auth, "rdns")) {
@@ -614,7 +763,9 @@ opm_start(struct auth_client *auth)
 
 	auth_client_ref(auth);
 
-	set_provider_data(auth, SELF_PID, rb_malloc(sizeof(struct opm_lookup)));
+	struct opm_lookup *lookup = rb_malloc(sizeof(struct opm_lookup));
+	lookup->auth = auth;
+	set_provider_data(auth, SELF_PID, lookup);
 
 	if (run_after_provider(auth, "rdns")) {
 		/* Start scanning if rdns is finished, or not loaded. */
@@ -631,28 +782,26 @@ opm_cancel(struct auth_client *auth)
 
 	if(lookup != NULL)
 	{
-		rb_dlink_node *ptr, *nptr;
+		struct opm_group *group;
 
 		notice_client(auth->cid, "*** Did not detect open proxies");
 
-		RB_DLINK_FOREACH_SAFE(ptr, nptr, lookup->scans.head)
-		{
-			struct opm_scan *scan = ptr->data;
-
-			rb_close(scan->F);
-			rb_free(scan);
-		}
-
-		rb_free(lookup);
+		if((group = opm_detach(auth)) != NULL)
+			opm_group_release(group);
 
-		set_provider_data(auth, SELF_PID, NULL);
-		set_provider_timeout_absolute(auth, SELF_PID, 0);
 		provider_done(auth, SELF_PID);
 
 		auth_client_unref(auth);
 	}
 }
 
+static bool
+opm_init(void)
+{
+	opm_groups = rb_new_patricia(PATRICIA_BITS);
+	return true;
+}
+
 static void
 opm_destroy(void)
 {
@@ -665,6 +814,19 @@ opm_destroy(void)
 		opm_cancel(auth);
 		/* auth is now invalid as we have no reference */
 	}
+
+	rb_destroy_patricia(opm_groups, NULL);
+	opm_groups = NULL;
+}
+
+static void
+opm_stats(uint32_t rid, const char letter)
+{
+	stats_result(rid, letter, "%u %u %lu %lu %u %lu %lu %lu",
+		opm_inflight, opm_max_scans,
+		rb_dlink_list_length(&opm_running), rb_dlink_list_length(&opm_waiting),
+		opm_group_count, opm_scans_started, opm_clients_joined,
+		opm_proxies_found);
 }
 
 
@@ -682,6 +844,26 @@ add_conf_opm_timeout(const char *key __unused, int parc __unused, const char **p
 	opm_timeout = timeout;
 }
 
+static void
+set_opm_scan_limits(const char *key __unused, int parc __unused, const char **parv)
+{
+	int max_scans = atoi(parv[0]);
+	int v4 = atoi(parv[1]), v6 = atoi(parv[2]);
+
+	if(max_scans < 0 || v4 < 1 || v4 > 32 || v6 < 1 || v6 > 128)
+	{
+		warn_opers(L_CRIT, "opm: bad scan limits: %s %s %s", parv[0], parv[1], parv[2]);
+		return;
+	}
+
+	opm_max_scans = max_scans;
+	opm_ipv4_bitlen = v4;
+	opm_ipv6_bitlen = v6;
+
+	/* a raised limit lets queued groups go now */
+	opm_dispatch();
+}
+
 static void
 set_opm_enabled(const char *key __unused, int parc __unused, const char **parv)
 {
@@ -823,35 +1005,30 @@ delete_opm_scanner(const char *key __unused, int parc __unused, const char **par
 		exit(EX_PROVIDER_ERROR);
 	}
 
-	/* Abort remaining clients on this scanner */
+	/* Abort scans to it; groups still to connect skip it */
 	RB_DICTIONARY_FOREACH(auth, &iter, auth_clients)
 	{
-		rb_dlink_node *ptr;
+		rb_dlink_node *ptr, *nptr;
 		struct opm_lookup *lookup = get_provider_data(auth, SELF_PID);
+		struct opm_group *group;
 
-		if(lookup == NULL)
+		if(lookup == NULL || (group = lookup->group) == NULL)
 			continue;
 
-		auth_client_ref(auth);
+		if(group->next == &proxy->node)
+		{
+			group->next = proxy->node.next;
+			if(group->next == NULL)
+				group_dequeue(group);
+		}
 
-		RB_DLINK_FOREACH(ptr, lookup->scans.head)
+		RB_DLINK_FOREACH_SAFE(ptr, nptr, group->scans.head)
 		{
 			struct opm_scan *scan = ptr->data;
 
-			if(scan->proxy->port == proxy->port && scan->proxy->proto == proxy->proto)
-			{
-				/* Match */
-				rb_dlinkDelete(&scan->node, &lookup->scans);
-				rb_free(scan);
-
-				if(rb_dlink_list_length(&lookup->scans) == 0)
-					opm_cancel(auth);
-
-				break;
-			}
+			if(scan->proxy == proxy)
+				scan_free(scan);
 		}
-
-		auth_client_unref(auth);
 	}
 
 	rb_dlinkDelete(&proxy->node, &proxy_scanners);
@@ -859,6 +1036,8 @@ delete_opm_scanner(const char *key __unused, int parc __unused, const char **par
 
 	if(rb_dlink_list_length(&proxy_scanners) == 0)
 		opm_enable = false;
+
+	opm_dispatch();
 }
 
 static void
@@ -868,18 +1047,19 @@ delete_opm_scanner_all(const char *key __unused, int parc __unused, const char *
 	rb_dlink_node *ptr, *nptr;
 	rb_dictionary_iter iter;
 
-	RB_DLINK_FOREACH_SAFE(ptr, nptr, proxy_scanners.head)
-	{
-		rb_free(ptr->data);
-		rb_dlinkDelete(ptr, &proxy_scanners);
-	}
-
+	/* Cancelling frees the groups, and with them every scan */
 	RB_DICTIONARY_FOREACH(auth, &iter, auth_clients)
 	{
 		opm_cancel(auth);
 		/* auth is now invalid as we have no reference */
 	}
 
+	RB_DLINK_FOREACH_SAFE(ptr, nptr, proxy_scanners.head)
+	{
+		rb_free(ptr->data);
+		rb_dlinkDelete(ptr, &proxy_scanners);
+	}
+
 	opm_enable = false;
 }
 
@@ -899,6 +1079,7 @@ delete_opm_listener_all(const char *key __unused, int parc __unused, const char
 struct auth_opts_handler opm_options[] =
 {
 	{ "opm_timeout", 1, add_conf_opm_timeout },
+	{ "opm_scan_limits", 3, set_opm_scan_limits },
 	{ "opm_enabled", 1, set_opm_enabled },
 	{ "opm_listener", 2, set_opm_listener },
 	{ "opm_listener_del_all", 0, delete_opm_listener_all },
@@ -912,10 +1093,12 @@ struct auth_provider opm_provider =
 {
 	.name = "opm",
 	.letter = 'O',
+	.init = opm_init,
 	.destroy = opm_destroy,
 	.start = opm_start,
 	.cancel = opm_cancel,
 	.timeout = opm_cancel,
 	.completed = opm_initiate,
+	.stats_handler = { 'O', opm_stats },
 	.opt_handlers = opm_options,
 };
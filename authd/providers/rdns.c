@@ -149,6 +149,13 @@ rdns_cancel(struct auth_client *auth)
 		client_fail(auth, REPORT_FAIL);
 }
 
+static void
+rdns_timedout(struct auth_client *auth)
+{
+	set_provider_inconclusive(auth, SELF_PID);
+	rdns_cancel(auth);
+}
+
 static void
 add_conf_dns_timeout(const char *key, int parc, const char **parv)
 {
@@ -176,6 +183,6 @@ struct auth_provider rdns_provider =
 	.destroy = rdns_destroy,
 	.start = rdns_start,
 	.cancel = rdns_cancel,
-	.timeout = rdns_cancel,
+	.timeout = rdns_timedout,
 	.opt_handlers = rdns_options,
 };
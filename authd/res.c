@@ -33,6 +33,8 @@
  */
 
 #include <rb_lib.h>
+#include <rb_dictionary.h>
+#include <stdbool.h>
 #include "setup.h"
 #include "res.h"
 #include "reslib.h"
@@ -45,6 +47,7 @@ static PF res_readreply;
 
 #define MAXPACKET      1024	/* rfc sez 512 but we expand names so ... */
 #define AR_TTL         600	/* TTL in seconds for dns cache entries */
+#define AR_CACHE_MAX   8192	/* dns cache entries */
 
 /* RFC 1104/1105 wasn't very helpful about what these fields
  * should be named, so for now, we'll just name them this way.
@@ -55,6 +58,7 @@ static PF res_readreply;
 #define TTL_SIZE          (size_t)4
 #define RDLENGTH_SIZE     (size_t)2
 #define ANSWER_FIXED_SIZE (TYPE_SIZE + CLASS_SIZE + TTL_SIZE + RDLENGTH_SIZE)
+#define SOA_FIXED_SIZE    (size_t)20	/* serial, refresh, retry, expire, minimum */
 
 struct in6_addr ipv6_addr;
 struct in_addr ipv4_addr;
@@ -74,10 +78,36 @@ struct reslist
 	struct rb_sockaddr_storage addr;
 	char *name;
 	struct DNSQuery *query;	/* query callback for this request */
+	bool cached;		/* answered from the cache, on cached_list */
+	bool negative;		/* ... with NXDOMAIN or no data */
 };
 
+/*
+ * Answers, and NXDOMAIN/NODATA with an SOA to say how long to believe
+ * them, are kept for their TTL (at most AR_TTL), keyed on type and name.
+ * The least recently used entry goes when the cache is full.
+ */
+struct res_cache
+{
+	rb_dlink_node node;	/* lru, most recent first */
+	char key[IRCD_RES_HOSTLEN + 8];
+	time_t expires;
+	bool negative;
+	struct rb_sockaddr_storage addr;	/* T_A, T_AAAA */
+	char *name;				/* T_PTR */
+};
+
+struct res_cache_stats res_cache_stats = { .max = AR_CACHE_MAX };
+
 static rb_fde_t *res_fd;
 static rb_dlink_list request_list = { NULL, NULL, 0 };
+
+/* answered from the cache, waiting to be called back */
+static rb_dlink_list cached_list = { NULL, NULL, 0 };
+static rb_fde_t *cached_wake[2];
+
+static rb_dictionary *res_cache_dict;
+static rb_dlink_list res_cache_lru = { NULL, NULL, 0 };
 static int ns_failure_count[IRCD_MAXNS]; /* timeouts and invalid/failed replies */
 
 static void rem_request(struct reslist *request);
@@ -95,6 +125,12 @@ static int proc_answer(struct reslist *request, HEADER * header, char *, char *)
 static struct reslist *find_id(int id);
 static struct DNSReply *make_dnsreply(struct reslist *request);
 static uint16_t generate_random_id(void);
+static bool res_cache_answer(struct reslist *request);
+static void res_cache_add(struct reslist *request, bool negative);
+static void res_cache_flush(void);
+static time_t negative_ttl(HEADER *header, char *buf, char *eob);
+static void answer_request(struct reslist *request);
+static PF res_cached_reply;
 
 /*
  * int
@@ -227,6 +263,9 @@ void init_resolver(void)
 #ifdef HAVE_SRAND48
 	srand48(rb_current_time());
 #endif
+	res_cache_dict = rb_dictionary_create("dns cache", (DCF) rb_strcasecmp);
+	if (rb_pipe(&cached_wake[0], &cached_wake[1], "dns cache wakeup") == 0)
+		rb_setselect(cached_wake[0], RB_SELECT_READ, res_cached_reply, NULL);
 	start_resolver();
 }
 
@@ -238,6 +277,7 @@ void restart_resolver(void)
 	rb_close(res_fd);
 	res_fd = NULL;
 	rb_event_delete(timeout_resolver_ev);	/* -ddosen */
+	res_cache_flush();
 	start_resolver();
 }
 
@@ -270,7 +310,7 @@ static void add_local_domain(char *hname, size_t size)
  */
 static void rem_request(struct reslist *request)
 {
-	rb_dlinkDelete(&request->node, &request_list);
+	rb_dlinkDelete(&request->node, request->cached ? &cached_list : &request_list);
 	rb_free(request->name);
 	rb_free(request);
 }
@@ -403,6 +443,215 @@ generate_random_id(void)
 	return id;
 }
 
+static void
+res_cache_key(char *key, size_t size, const struct reslist *request)
+{
+	snprintf(key, size, "%d %s", request->type, request->queryname);
+}
+
+static void
+res_cache_del(struct res_cache *entry)
+{
+	rb_dictionary_delete(res_cache_dict, entry->key);
+	rb_dlinkDelete(&entry->node, &res_cache_lru);
+	rb_free(entry->name);
+	rb_free(entry);
+	res_cache_stats.entries--;
+}
+
+static void
+res_cache_flush(void)
+{
+	while (res_cache_lru.head != NULL)
+		res_cache_del(res_cache_lru.head->data);
+}
+
+/*
+ * res_cache_answer - answer a new request from the cache if we can.
+ * The callback is made from res_cached_reply, never from inside the
+ * lookup call, as callers keep the query they get back.
+ */
+static bool
+res_cache_answer(struct reslist *request)
+{
+	char key[IRCD_RES_HOSTLEN + 8];
+	struct res_cache *entry;
+
+	if (res_cache_dict == NULL || cached_wake[1] == NULL)
+		return false;
+
+	res_cache_key(key, sizeof key, request);
+	entry = rb_dictionary_retrieve(res_cache_dict, key);
+	if (entry == NULL)
+	{
+		res_cache_stats.misses++;
+		return false;
+	}
+
+	if (entry->expires <= rb_current_time())
+	{
+		res_cache_del(entry);
+		res_cache_stats.misses++;
+		return false;
+	}
+
+	rb_dlinkMoveNode(&entry->node, &res_cache_lru, &res_cache_lru);
+	if (entry->negative)
+		res_cache_stats.negative_hits++;
+	else
+		res_cache_stats.hits++;
+
+	request->negative = entry->negative;
+	if (!entry->negative)
+	{
+		if (request->type == T_PTR)
+			rb_strlcpy(request->name, entry->name, IRCD_RES_HOSTLEN + 1);
+		else
+			memcpy(&request->addr, &entry->addr, sizeof(request->addr));
+	}
+
+	request->cached = true;
+	rb_dlinkMoveNode(&request->node, &request_list, &cached_list);
+	if (rb_dlink_list_length(&cached_list) == 1)
+		rb_write(cached_wake[1], "", 1);
+
+	return true;
+}
+
+/*
+ * res_cache_add - remember the answer to a request for request->ttl
+ */
+static void
+res_cache_add(struct reslist *request, bool negative)
+{
+	char key[IRCD_RES_HOSTLEN + 8];
+	struct res_cache *entry;
+
+	if (res_cache_dict == NULL || request->ttl <= 0)
+		return;
+
+	if (!negative)
+	{
+		switch (request->type)
+		{
+		case T_PTR:
+			if (request->name == NULL || request->name[0] == '\0')
+				return;
+			break;
+		case T_A:
+			if (GET_SS_FAMILY(&request->addr) != AF_INET)
+				return;
+			break;
+		case T_AAAA:
+			if (GET_SS_FAMILY(&request->addr) != AF_INET6)
+				return;
+			break;
+		default:
+			return;
+		}
+	}
+
+	res_cache_key(key, sizeof key, request);
+	entry = rb_dictionary_retrieve(res_cache_dict, key);
+	if (entry == NULL)
+	{
+		if (res_cache_stats.entries >= AR_CACHE_MAX)
+		{
+			res_cache_del(res_cache_lru.tail->data);
+			res_cache_stats.evictions++;
+		}
+
+		entry = rb_malloc(sizeof(struct res_cache));
+		rb_strlcpy(entry->key, key, sizeof entry->key);
+		rb_dictionary_add(res_cache_dict, entry->key, entry);
+		rb_dlinkAdd(entry, &entry->node, &res_cache_lru);
+		res_cache_stats.entries++;
+	}
+	else
+	{
+		rb_dlinkMoveNode(&entry->node, &res_cache_lru, &res_cache_lru);
+		rb_free(entry->name);
+		entry->name = NULL;
+	}
+
+	entry->expires = rb_current_time() + request->ttl;
+	entry->negative = negative;
+	if (!negative)
+	{
+		if (request->type == T_PTR)
+			entry->name = rb_strdup(request->name);
+		else
+			memcpy(&entry->addr, &request->addr, sizeof(entry->addr));
+	}
+}
+
+/*
+ * negative_ttl - how long an NXDOMAIN or empty answer may be cached,
+ * from the SOA in the authority section (RFC 2308).  0 if there is none.
+ */
+static time_t
+negative_ttl(HEADER *header, char *buf, char *eob)
+{
+	const unsigned char *eom = (unsigned char *)eob;
+	const unsigned char *current = (unsigned char *)buf + sizeof(HEADER);
+	unsigned int count = header->qdcount;
+	int n;
+
+	while (count-- > 0)
+	{
+		if ((n = irc_dn_skipname(current, eom)) < 0)
+			return 0;
+		current += (size_t) n + QFIXEDSZ;
+	}
+
+	count = header->ancount + header->nscount;
+	while (count-- > 0 && current < eom)
+	{
+		const unsigned char *rdata;
+		unsigned long ttl, minimum;
+		int type, rd_length;
+
+		if ((n = irc_dn_skipname(current, eom)) < 0)
+			return 0;
+		current += (size_t) n;
+
+		if (current + ANSWER_FIXED_SIZE > eom)
+			return 0;
+
+		type = irc_ns_get16(current);
+		current += TYPE_SIZE + CLASS_SIZE;
+		ttl = irc_ns_get32(current);
+		current += TTL_SIZE;
+		rd_length = irc_ns_get16(current);
+		current += RDLENGTH_SIZE;
+
+		rdata = current;
+		current += rd_length;
+		if (current > eom)
+			return 0;
+
+		if (type != T_SOA || count >= header->nscount)
+			continue;
+
+		/* mname and rname, then the fixed part */
+		if ((n = irc_dn_skipname(rdata, current)) < 0)
+			return 0;
+		rdata += n;
+		if ((n = irc_dn_skipname(rdata, current)) < 0)
+			return 0;
+		rdata += n;
+		if (rdata + SOA_FIXED_SIZE > current)
+			return 0;
+
+		minimum = irc_ns_get32(rdata + 16);
+		if (minimum < ttl)
+			ttl = minimum;
+		return ttl < AR_TTL ? ttl : AR_TTL;
+	}
+
+	return 0;
+}
+
 /*
  * gethost_byname_type - get host address from name, adding domain if needed
  */
@@ -448,6 +697,10 @@ static void do_query_name(struct DNSQuery *query, const char *name, struct resli
 
 	rb_strlcpy(request->queryname, name, sizeof(request->queryname));
 	request->type = type;
+
+	if (request->sends == 0 && res_cache_answer(request))
+		return;
+
 	query_name(request);
 }
 
@@ -517,6 +770,10 @@ static void do_query_number(struct DNSQuery *query, const struct rb_sockaddr_sto
 	build_rdns(request->queryname, sizeof request->queryname, addr, NULL);
 
 	request->type = T_PTR;
+
+	if (request->sends == 0 && res_cache_answer(request))
+		return;
+
 	query_name(request);
 }
 
@@ -602,6 +859,7 @@ static int proc_answer(struct reslist *request, HEADER * header, char *buf, char
 	int rd_length;
 	struct sockaddr_in *v4;	/* conversion */
 	struct sockaddr_in6 *v6;
+	unsigned long ttl;
 	current = (unsigned char *)buf + sizeof(HEADER);
 
 	for (; header->qdcount > 0; --header->qdcount)
@@ -654,7 +912,12 @@ static int proc_answer(struct reslist *request, HEADER * header, char *buf, char
 		(void) irc_ns_get16(current);
 		current += CLASS_SIZE;
 
-		request->ttl = irc_ns_get32(current);
+		/* the lowest along a CNAME chain; RFC 2181 says >2^31 means 0 */
+		ttl = irc_ns_get32(current);
+		if (ttl > INT32_MAX)
+			ttl = 0;
+		if ((time_t) ttl < request->ttl)
+			request->ttl = ttl;
 		current += TTL_SIZE;
 
 		rd_length = irc_ns_get16(current);
@@ -727,7 +990,6 @@ static int res_read_single_reply(rb_fde_t *F, void *data)
 		;
 	HEADER *header;
 	struct reslist *request = NULL;
-	struct DNSReply *reply = NULL;
 	int rc;
 	int answer_count;
 	socklen_t len = sizeof(struct rb_sockaddr_storage);
@@ -805,6 +1067,11 @@ static int res_read_single_reply(rb_fde_t *F, void *data)
 				/* If the rcode is NXDOMAIN, treat it as a good response. */
 				ns_failure_count[ns] /= 4;
 			}
+			if (NXDOMAIN == header->rcode || NO_ERRORS == header->rcode)
+			{
+				request->ttl = negative_ttl(header, buf, buf + rc);
+				res_cache_add(request, true);
+			}
 			(*request->query->callback) (request->query->ptr, NULL);
 			rem_request(request);
 		}
@@ -814,44 +1081,25 @@ static int res_read_single_reply(rb_fde_t *F, void *data)
 	 * If this fails there was an error decoding the received packet.
 	 * -- jilles
 	 */
+	request->ttl = AR_TTL;
 	answer_count = proc_answer(request, header, buf, buf + rc);
 
 	if (answer_count)
 	{
-		if (request->type == T_PTR)
-		{
-			if (request->name == NULL)
-			{
-				/*
-				 * Got a PTR response with no name, something strange is
-				 * happening. Try another DNS server.
-				 */
-				ns_failure_count[ns]++;
-				resend_query(request);
-				return 1;
-			}
-
-			/*
-			 * Lookup the 'authoritative' name that we were given for the
-			 * ip#.
-			 */
-			if (GET_SS_FAMILY(&request->addr) == AF_INET6)
-				gethost_byname_type_fqdn(request->name, request->query, T_AAAA);
-			else
-				gethost_byname_type_fqdn(request->name, request->query, T_A);
-			rem_request(request);
-		}
-		else
+		if (request->type == T_PTR && request->name == NULL)
 		{
 			/*
-			 * got a name and address response, client resolved
+			 * Got a PTR response with no name, something strange is
+			 * happening. Try another DNS server.
 			 */
-			reply = make_dnsreply(request);
-			(*request->query->callback) (request->query->ptr, reply);
-			rb_free(reply);
-			rem_request(request);
+			ns_failure_count[ns]++;
+			resend_query(request);
+			return 1;
 		}
 
+		res_cache_add(request, false);
+		answer_request(request);
+
 		ns_failure_count[ns] /= 4;
 	}
 	else
@@ -863,6 +1111,65 @@ static int res_read_single_reply(rb_fde_t *F, void *data)
 	return 1;
 }
 
+/*
+ * answer_request - a request has its answer, pass it on
+ */
+static void
+answer_request(struct reslist *request)
+{
+	struct DNSReply *reply;
+
+	if (request->type == T_PTR)
+	{
+		/*
+		 * Lookup the 'authoritative' name that we were given for the
+		 * ip#.
+		 */
+		if (GET_SS_FAMILY(&request->addr) == AF_INET6)
+			gethost_byname_type_fqdn(request->name, request->query, T_AAAA);
+		else
+			gethost_byname_type_fqdn(request->name, request->query, T_A);
+	}
+	else
+	{
+		/*
+		 * got a name and address response, client resolved
+		 */
+		reply = make_dnsreply(request);
+		(*request->query->callback) (request->query->ptr, reply);
+		rb_free(reply);
+	}
+
+	rem_request(request);
+}
+
+/*
+ * res_cached_reply - call back the requests answered from the cache
+ */
+static void
+res_cached_reply(rb_fde_t *F, void *data)
+{
+	char buf[64];
+
+	while (rb_read(F, buf, sizeof(buf)) > 0)
+		;
+
+	while (cached_list.head != NULL)
+	{
+		struct reslist *request = cached_list.head->data;
+
+		if (request->negative)
+		{
+			(*request->query->callback) (request->query->ptr, NULL);
+			rem_request(request);
+		}
+		else
+			answer_request(request);
+	}
+
+	rb_setselect(F, RB_SELECT_READ, res_cached_reply, NULL);
+}
+
 static void
 res_readreply(rb_fde_t *F, void *data)
 {
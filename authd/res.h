@@ -25,8 +25,19 @@ struct DNSQuery
   void (*callback)(void* vptr, struct DNSReply *reply); /* callback to call */
 };
 
+struct res_cache_stats
+{
+  unsigned int entries;
+  unsigned int max;
+  unsigned long hits;
+  unsigned long negative_hits;
+  unsigned long misses;
+  unsigned long evictions;
+};
+
 extern struct rb_sockaddr_storage irc_nsaddr_list[];
 extern int irc_nscount;
+extern struct res_cache_stats res_cache_stats;
 
 extern void init_resolver(void);
 extern void restart_resolver(void);
@@ -0,0 +1,240 @@
+/* authd/verdict.c - cache of recent accept/reject decisions
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice is present in all copies.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* A client that reconnects soon after being accepted or rejected gets the
+ * same answer again without any provider being run.
+ *
+ * Accepts are kept for the exact address, as they carry its hostname.
+ * Rejects are kept for the address's prefix (by default the /64 for IPv6),
+ * so a bot hopping around its own network does not get a fresh scan each
+ * time.  The most specific entry wins.
+ *
+ * Only verdicts every provider finished on are kept: a client accepted
+ * because a DNSBL or its hostname lookup timed out, or because it went
+ * away, is not.  The proxy scan ending at its timeout is a clean finish,
+ * as that is how it reports finding nothing.  The ircd flushes the cache on rehash.
+ */
+
+#include "authd.h"
+#include "provider.h"
+#include "notice.h"
+#include "verdict.h"
+
+#define VERDICT_MAX	65536
+
+struct verdict
+{
+	rb_dlink_node node;
+	rb_patricia_node_t *pnode;
+	time_t expires;
+	bool accept;
+	char letter;			/* provider that rejected */
+	char ip[HOSTIPLEN + 1];		/* address the hostname belongs to */
+	char hostname[HOSTLEN + 1];
+	char *data;
+	char *reason;
+};
+
+static rb_patricia_tree_t *verdict_tree;
+static rb_dlink_list verdict_list;
+
+static time_t accept_duration = 60;
+static time_t reject_duration = 300;
+static int ipv4_bitlen = 32;
+static int ipv6_bitlen = 64;
+
+static void
+verdict_free(struct verdict *v)
+{
+	rb_dlinkDelete(&v->node, &verdict_list);
+	rb_patricia_remove(verdict_tree, v->pnode);
+	rb_free(v->data);
+	rb_free(v->reason);
+	rb_free(v);
+}
+
+static void
+expire_verdicts(void *unused)
+{
+	rb_dlink_node *ptr, *nptr;
+
+	RB_DLINK_FOREACH_SAFE(ptr, nptr, verdict_list.head)
+	{
+		struct verdict *v = ptr->data;
+
+		if(v->expires <= rb_current_time())
+			verdict_free(v);
+	}
+}
+
+void
+flush_verdicts(const char letter)
+{
+	while(verdict_list.head != NULL)
+		verdict_free(verdict_list.head->data);
+}
+
+static struct verdict *
+verdict_add(struct auth_client *auth, bool accept)
+{
+	struct sockaddr *addr = (struct sockaddr *)&auth->c_addr;
+	rb_patricia_node_t *pnode;
+	struct verdict *v;
+	int bitlen;
+
+	if(GET_SS_FAMILY(&auth->c_addr) == AF_INET)
+		bitlen = accept ? 32 : ipv4_bitlen;
+	else if(GET_SS_FAMILY(&auth->c_addr) == AF_INET6)
+		bitlen = accept ? 128 : ipv6_bitlen;
+	else
+		return NULL;
+
+	if((accept ? accept_duration : reject_duration) == 0)
+		return NULL;
+
+	if(rb_dlink_list_length(&verdict_list) >= VERDICT_MAX)
+		return NULL;
+
+	if((pnode = make_and_lookup_ip(verdict_tree, addr, bitlen)) == NULL)
+		return NULL;
+
+	if((v = pnode->data) != NULL)
+	{
+		rb_free(v->data);
+		rb_free(v->reason);
+		v->data = v->reason = NULL;
+	}
+	else
+	{
+		v = rb_malloc(sizeof(struct verdict));
+		v->pnode = pnode;
+		pnode->data = v;
+		rb_dlinkAdd(v, &v->node, &verdict_list);
+	}
+
+	v->accept = accept;
+	v->expires = rb_current_time() + (accept ? accept_duration : reject_duration);
+	rb_strlcpy(v->ip, auth->c_ip, sizeof(v->ip));
+	rb_strlcpy(v->hostname, auth->hostname, sizeof(v->hostname));
+	return v;
+}
+
+void
+verdict_accept(struct auth_client *auth)
+{
+	rb_dlink_node *ptr;
+
+	if(auth->providers_cancelled)
+		return;
+
+	RB_DLINK_FOREACH(ptr, auth_providers.head)
+	{
+		struct auth_provider *provider = ptr->data;
+
+		if(is_provider_inconclusive(auth, provider->id))
+			return;
+	}
+
+	(void)verdict_add(auth, true);
+}
+
+void
+verdict_reject(struct auth_client *auth, char letter, const char *data, const char *reason)
+{
+	struct verdict *v = verdict_add(auth, false);
+
+	if(v == NULL)
+		return;
+
+	v->letter = letter;
+	v->data = rb_strdup(data == NULL ? "*" : data);
+	v->reason = rb_strdup(reason);
+}
+
+/* Answer a new client from the cache; returns false if it must be checked */
+bool
+verdict_replay(struct auth_client *auth)
+{
+	rb_patricia_node_t *pnode;
+	struct verdict *v;
+	const char *hostname;
+
+	if(verdict_tree == NULL ||
+		(pnode = rb_match_ip(verdict_tree, (struct sockaddr *)&auth->c_addr)) == NULL)
+		return false;
+
+	v = pnode->data;
+	if(v->expires <= rb_current_time())
+	{
+		verdict_free(v);
+		return false;
+	}
+
+	/* a reject may be for someone else in the prefix */
+	hostname = strcmp(v->ip, auth->c_ip) == 0 ? v->hostname : "*";
+
+	if(v->accept)
+	{
+		if(strcmp(hostname, "*") != 0)
+			notice_client(auth->cid, "*** Found your hostname: %s (cached)", hostname);
+		rb_helper_write(authd_helper, "A %x * %s", auth->cid, hostname);
+	}
+	else
+		rb_helper_write(authd_helper, "R %x %c * %s %s :%s",
+			auth->cid, v->letter, hostname, v->data, v->reason);
+
+	return true;
+}
+
+static void
+set_verdict_cache(const char *key, int parc, const char **parv)
+{
+	int accept = atoi(parv[0]), reject = atoi(parv[1]);
+	int v4 = atoi(parv[2]), v6 = atoi(parv[3]);
+
+	if(accept < 0 || reject < 0 || v4 < 0 || v4 > 32 || v6 < 0 || v6 > 128)
+	{
+		warn_opers(L_CRIT, "BUG: verdict_cache: bad parameters %s %s %s %s",
+			parv[0], parv[1], parv[2], parv[3]);
+		return;
+	}
+
+	accept_duration = accept;
+	reject_duration = reject;
+	ipv4_bitlen = v4;
+	ipv6_bitlen = v6;
+}
+
+static struct auth_opts_handler verdict_options[] =
+{
+	{ "verdict_cache", 4, set_verdict_cache },
+	{ NULL, 0, NULL },
+};
+
+void
+init_verdicts(void)
+{
+	struct auth_opts_handler *handler;
+
+	verdict_tree = rb_new_patricia(PATRICIA_BITS);
+	rb_event_addish("expire_verdicts", expire_verdicts, NULL, 30);
+
+	for(handler = verdict_options; handler->option != NULL; handler++)
+		rb_dictionary_add(authd_option_handlers, handler->option, handler);
+}
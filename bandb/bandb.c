@@ -37,6 +37,8 @@
 #define MAXPARA 10
 
 #define COMMIT_INTERVAL 3 /* seconds */
+#define COMMIT_MAX_ROWS 10000	/* commit a burst this often */
+#define LIST_FLUSH_ROWS 1000	/* pass bans on to ircd this often */
 
 typedef enum
 {
@@ -58,14 +60,48 @@ static const char *bandb_table[LAST_BANDB_TYPE] = {
 
 static rb_helper *bandb_helper;
 static int in_transaction;
+static int transaction_rows;
+static struct ev_entry *commit_ev;
+
+/* prepared once, used for every request */
+static struct rsdb_stmt *insert_stmt[LAST_BANDB_TYPE];
+static struct rsdb_stmt *delete_stmt[LAST_BANDB_TYPE];
+static struct rsdb_stmt *select_stmt[LAST_BANDB_TYPE];
 
 static void check_schema(void);
+static void prepare_statements(void);
+static void finalize_statements(void);
 
 static void
 bandb_commit(void *unused)
 {
 	rsdb_transaction(RSDB_TRANS_END);
 	in_transaction = 0;
+	commit_ev = NULL;
+}
+
+/* writes are grouped into a transaction, committed every few seconds
+ * or every COMMIT_MAX_ROWS rows, whichever comes first
+ */
+static void
+bandb_write_begin(void)
+{
+	if(in_transaction && transaction_rows >= COMMIT_MAX_ROWS)
+	{
+		rb_event_delete(commit_ev);
+		bandb_commit(NULL);
+	}
+
+	if(!in_transaction)
+	{
+		rsdb_transaction(RSDB_TRANS_START);
+		in_transaction = 1;
+		transaction_rows = 0;
+		commit_ev = rb_event_addonce("bandb_commit", bandb_commit, NULL,
+				COMMIT_INTERVAL);
+	}
+
+	transaction_rows++;
 }
 
 static void
@@ -97,17 +133,10 @@ parse_ban(bandb_type type, char *parv[], int parc)
 	perm = parv[para++];
 	reason = parv[para++];
 
-	if(!in_transaction)
-	{
-		rsdb_transaction(RSDB_TRANS_START);
-		in_transaction = 1;
-		rb_event_addonce("bandb_commit", bandb_commit, NULL,
-				COMMIT_INTERVAL);
-	}
+	bandb_write_begin();
 
-	rsdb_exec(NULL,
-		  "INSERT INTO %s (mask1, mask2, oper, time, perm, reason) VALUES('%Q', '%Q', '%Q', %s, %s, '%Q')",
-		  bandb_table[type], mask1, mask2 ? mask2 : "", oper, curtime, perm, reason);
+	const char *params[] = { mask1, mask2 ? mask2 : "", oper, curtime, perm, reason };
+	rsdb_stmt_exec(insert_stmt[type], NULL, NULL, 6, params);
 }
 
 static void
@@ -129,49 +158,43 @@ parse_unban(bandb_type type, char *parv[], int parc)
 	if(type == BANDB_KLINE)
 		mask2 = parv[2];
 
-	if(!in_transaction)
-	{
-		rsdb_transaction(RSDB_TRANS_START);
-		in_transaction = 1;
-		rb_event_addonce("bandb_commit", bandb_commit, NULL,
-				COMMIT_INTERVAL);
-	}
+	bandb_write_begin();
 
-	rsdb_exec(NULL, "DELETE FROM %s WHERE mask1='%Q' AND mask2='%Q'",
-		  bandb_table[type], mask1, mask2 ? mask2 : "");
+	const char *params[] = { mask1, mask2 ? mask2 : "" };
+	rsdb_stmt_exec(delete_stmt[type], NULL, NULL, 2, params);
+}
+
+static void
+list_ban_row(void *data, int colc, const char **colv)
+{
+	static unsigned int rows;
+	bandb_type type = *(bandb_type *)data;
+
+	if(colc < 4)
+		return;
+
+	if(type == BANDB_KLINE)
+		rb_helper_write_queue(bandb_helper, "%c %s %s %s :%s",
+				bandb_letter[type], colv[0], colv[1], colv[2], colv[3]);
+	else
+		rb_helper_write_queue(bandb_helper, "%c %s %s :%s",
+				bandb_letter[type], colv[0], colv[2], colv[3]);
+
+	/* let ircd get started while we read the rest */
+	if(++rows % LIST_FLUSH_ROWS == 0)
+		rb_helper_write_flush(bandb_helper);
 }
 
 static void
 list_bans(void)
 {
-	static char buf[512];
-	struct rsdb_table table;
-	int i, j;
+	bandb_type i;
 
 	/* schedule a clear of anything already pending */
 	rb_helper_write_queue(bandb_helper, "C");
 
 	for(i = 0; i < LAST_BANDB_TYPE; i++)
-	{
-		rsdb_exec_fetch(&table, "SELECT mask1,mask2,oper,reason FROM %s WHERE 1",
-				bandb_table[i]);
-
-		for(j = 0; j < table.row_count; j++)
-		{
-			if(i == BANDB_KLINE)
-				snprintf(buf, sizeof(buf), "%c %s %s %s :%s",
-					    bandb_letter[i], table.row[j][0],
-					    table.row[j][1], table.row[j][2], table.row[j][3]);
-			else
-				snprintf(buf, sizeof(buf), "%c %s %s :%s",
-					    bandb_letter[i], table.row[j][0],
-					    table.row[j][2], table.row[j][3]);
-
-			rb_helper_write_queue(bandb_helper, "%s", buf);
-		}
-
-		rsdb_exec_fetch_end(&table);
-	}
+		rsdb_stmt_exec(select_stmt[i], list_ban_row, &i, 0, NULL);
 
 	rb_helper_write(bandb_helper, "F");
 }
@@ -244,6 +267,10 @@ error_cb(rb_helper *helper)
 {
 	if(in_transaction)
 		rsdb_transaction(RSDB_TRANS_END);
+
+	/* a clean close checkpoints the WAL and removes it */
+	finalize_statements();
+	rsdb_shutdown();
 	exit(1);
 }
 
@@ -309,6 +336,7 @@ main(int argc, char *argv[])
 	}
 	rsdb_init(db_error_cb);
 	check_schema();
+	prepare_statements();
 	rb_helper_loop(bandb_helper, 0);
 
 	return 0;
@@ -334,3 +362,36 @@ check_schema(void)
 				  bandb_table[i]);
 	}
 }
+
+static void
+prepare_statements(void)
+{
+	int i;
+
+	for(i = 0; i < LAST_BANDB_TYPE; i++)
+	{
+		insert_stmt[i] = rsdb_prepare("INSERT INTO %s (mask1, mask2, oper, time, perm, reason) VALUES(?, ?, ?, ?, ?, ?)",
+				bandb_table[i]);
+		delete_stmt[i] = rsdb_prepare("DELETE FROM %s WHERE mask1=? AND mask2=?",
+				bandb_table[i]);
+		select_stmt[i] = rsdb_prepare("SELECT mask1,mask2,oper,reason FROM %s WHERE 1",
+				bandb_table[i]);
+	}
+}
+
+static void
+finalize_statements(void)
+{
+	int i;
+
+	for(i = 0; i < LAST_BANDB_TYPE; i++)
+	{
+		if(insert_stmt[i] == NULL)
+			continue;
+
+		rsdb_finalize(insert_stmt[i]);
+		rsdb_finalize(delete_stmt[i]);
+		rsdb_finalize(select_stmt[i]);
+		insert_stmt[i] = delete_stmt[i] = select_stmt[i] = NULL;
+	}
+}
@@ -6,6 +6,9 @@ typedef void rsdb_error_cb(const char *);
 
 typedef int (*rsdb_callback) (int, const char **);
 
+/* called for each row a prepared statement returns */
+typedef void rsdb_row_cb(void *data, int colc, const char **colv);
+
 typedef enum rsdb_transtype
 {
 	RSDB_TRANS_START,
@@ -13,6 +16,8 @@ typedef enum rsdb_transtype
 }
 rsdb_transtype;
 
+struct rsdb_stmt;
+
 struct rsdb_table
 {
 	char ***row;
@@ -22,6 +27,7 @@ struct rsdb_table
 };
 
 int rsdb_init(rsdb_error_cb *);
+void rsdb_shutdown(void);
 
 const char *rsdb_quote(const char *src);
 
@@ -31,6 +37,12 @@ void rsdb_exec_fetch(struct rsdb_table *data, const char *format, ...);
 void rsdb_exec_fetch_end(struct rsdb_table *data);
 
 void rsdb_transaction(rsdb_transtype type);
+
+/* format is expanded once, with ? standing for each parameter */
+struct rsdb_stmt *rsdb_prepare(const char *format, ...);
+void rsdb_stmt_exec(struct rsdb_stmt *stmt, rsdb_row_cb *cb, void *data, int parc, const char **parv);
+void rsdb_finalize(struct rsdb_stmt *stmt);
+
 /* rsdb_snprintf.c */
 
 int rs_vsnprintf(char *dest, const size_t bytes, const char *format, va_list args);
@@ -33,8 +33,15 @@
 
 #include <sqlite3.h>
 
+#define RSDB_MAXCOLS 16
+
 struct sqlite3 *rb_bandb;
 
+struct rsdb_stmt
+{
+	sqlite3_stmt *stmt;
+};
+
 rsdb_error_cb *error_cb;
 
 static void
@@ -82,9 +89,21 @@ rsdb_init(rsdb_error_cb * ecb)
 		mlog(errbuf);
 		return -1;
 	}
+
+	/* readers no longer wait on writers, and commits are one fsync */
+	rsdb_exec(NULL, "PRAGMA journal_mode=WAL");
+	rsdb_exec(NULL, "PRAGMA synchronous=NORMAL");
 	return 0;
 }
 
+/* every statement must have been finalized, or the close fails */
+void
+rsdb_shutdown(void)
+{
+	sqlite3_close(rb_bandb);
+	rb_bandb = NULL;
+}
+
 const char *
 rsdb_quote(const char *src)
 {
@@ -254,3 +273,88 @@ rsdb_transaction(rsdb_transtype type)
 	else if(type == RSDB_TRANS_END)
 		rsdb_exec(NULL, "COMMIT TRANSACTION");
 }
+
+struct rsdb_stmt *
+rsdb_prepare(const char *format, ...)
+{
+	static char buf[BUFSIZE * 4];
+	struct rsdb_stmt *stmt;
+	va_list args;
+	unsigned int i;
+
+	va_start(args, format);
+	i = rs_vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+
+	if(i >= sizeof(buf))
+	{
+		mlog("fatal error: length problem with compiling sql");
+	}
+
+	stmt = rb_malloc(sizeof(struct rsdb_stmt));
+	if(sqlite3_prepare_v2(rb_bandb, buf, -1, &stmt->stmt, NULL) != SQLITE_OK)
+	{
+		mlog("fatal error: problem with db file: %s", sqlite3_errmsg(rb_bandb));
+	}
+
+	return stmt;
+}
+
+/*
+ * rsdb_stmt_exec: runs a prepared statement with parv bound to its
+ * parameters, handing each row to cb as it is read rather than gathering
+ * the whole result first.
+ */
+void
+rsdb_stmt_exec(struct rsdb_stmt *stmt, rsdb_row_cb *cb, void *data, int parc, const char **parv)
+{
+	const char *colv[RSDB_MAXCOLS];
+	int colc, retval, i, j = 0;
+	bool rows = false;
+
+	for(i = 0; i < parc; i++)
+		sqlite3_bind_text(stmt->stmt, i + 1, parv[i], -1, SQLITE_STATIC);
+
+	while((retval = sqlite3_step(stmt->stmt)) != SQLITE_DONE)
+	{
+		if(retval == SQLITE_ROW)
+		{
+			rows = true;
+			if(cb == NULL)
+				continue;
+
+			colc = sqlite3_column_count(stmt->stmt);
+			if(colc > RSDB_MAXCOLS)
+				colc = RSDB_MAXCOLS;
+
+			for(i = 0; i < colc; i++)
+			{
+				colv[i] = (const char *)sqlite3_column_text(stmt->stmt, i);
+				if(colv[i] == NULL)
+					colv[i] = "";
+			}
+
+			cb(data, colc, colv);
+		}
+		else if(retval == SQLITE_BUSY && !rows && j++ < 5)
+		{
+			rb_sleep(0, 500000);
+			sqlite3_reset(stmt->stmt);
+		}
+		else
+		{
+			mlog("fatal error: problem with db file: %s", sqlite3_errmsg(rb_bandb));
+			break;
+		}
+	}
+
+	sqlite3_reset(stmt->stmt);
+	sqlite3_clear_bindings(stmt->stmt);
+}
+
+void
+rsdb_finalize(struct rsdb_stmt *stmt)
+{
+	sqlite3_finalize(stmt->stmt);
+	rb_free(stmt);
+}
@@ -220,6 +220,7 @@ check_new_user(void *vdata)
 	if (source_p->umodes & user_modes['x'])
 	{
 		rb_strlcpy(source_p->host, source_p->localClient->mangledhost, sizeof(source_p->host));
+		invalidate_client_prefix(source_p);
 		if (irccmp(source_p->host, source_p->orighost))
 			SetDynSpoof(source_p);
 	}
@@ -53,6 +53,19 @@ struct OPMListener
 	uint16_t port;		/* Listener port */
 };
 
+struct OPMStats
+{
+	unsigned long inflight;	/* connections open */
+	unsigned long max_scans;
+	unsigned long running;	/* groups with connections left to make */
+	unsigned long waiting;	/* groups not started */
+	unsigned long groups;
+	unsigned long started;	/* connections made */
+	unsigned long joined;	/* clients covered by another's scan */
+	unsigned long found;
+	time_t updated;
+};
+
 enum
 {
 	LISTEN_IPV4,
@@ -65,9 +78,11 @@ extern rb_helper *authd_helper;
 extern rb_dictionary *dnsbl_stats;
 extern rb_dlink_list opm_list;
 extern struct OPMListener opm_listeners[LISTEN_LAST];
+extern struct OPMStats opm_stats;
 
 void init_authd(void);
 void configure_authd(void);
+void configure_authd_cache(void);
 void restart_authd(void);
 void rehash_authd(void);
 void check_authd(void);
@@ -89,5 +104,6 @@ void create_opm_proxy_scanner(const char *type, uint16_t port);
 void delete_opm_proxy_scanner_all(void);
 void delete_opm_listener_all(void);
 void opm_check_enable(bool enabled);
+void set_opm_scan_limits(int max_scans, int ipv4_prefix, int ipv6_prefix);
 
 #endif
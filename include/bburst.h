@@ -0,0 +1,47 @@
+/*
+ *  ircd-ratbox: A slightly useful ircd.
+ *  bburst.h: Binary burst records between servers.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ */
+
+#ifndef INCLUDED_bburst_h
+#define INCLUDED_bburst_h
+
+struct Client;
+struct Channel;
+
+#define BBURST_FRAME	'\001'	/* first byte of a line of records */
+#define BBURST_LINELEN	500	/* longest escaped line after that byte */
+
+/* records waiting to go out as one line */
+struct bburst_frame
+{
+	unsigned char buf[BBURST_LINELEN];
+	size_t len;
+	size_t esclen;		/* len once escaped */
+};
+
+/* these return false if it has to be sent as text instead */
+extern bool bburst_user(struct Client *client_p, struct bburst_frame *frame,
+		struct Client *target_p, const char *umodes);
+extern bool bburst_sjoin(struct Client *client_p, struct bburst_frame *frame,
+		struct Channel *chptr, const char *modes);
+extern void bburst_flush(struct Client *client_p, struct bburst_frame *frame);
+
+extern void bburst_parse(struct Client *client_p, const char *line);
+
+#endif /* INCLUDED_bburst_h */
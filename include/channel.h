@@ -48,6 +48,23 @@ struct Mode
 };
 
 /* channel structure */
+/* one slot of a channel's packed member array */
+struct ChannelMember
+{
+	struct Client *client_p;
+	struct membership *msptr;
+};
+
+struct MemberArray
+{
+	struct ChannelMember *v;
+	unsigned int count;
+	unsigned int size;
+};
+
+#define MEMBERS_FOREACH(cm, arr) \
+	for ((cm) = (arr)->v; (cm) != NULL && (cm) < (arr)->v + (arr)->count; (cm)++)
+
 struct Channel
 {
 	rb_dlink_node node;
@@ -61,6 +78,13 @@ struct Channel
 	rb_dlink_list members;	/* channel members */
 	rb_dlink_list locmembers;	/* local channel members */
 
+	/* the same members packed for fan-out, in no particular order */
+	struct MemberArray memberv;
+	struct MemberArray locmemberv;
+	/* client -> membership, open addressed, only for big channels */
+	struct membership **member_index;
+	unsigned int member_index_size;
+
 	rb_dlink_list invites;
 	rb_dlink_list banlist;
 	rb_dlink_list exceptlist;
@@ -82,6 +106,9 @@ struct Channel
 	time_t last_checked_ts;
 	unsigned int last_checked_type;
 	int last_checked_result;
+
+	/* compiled forms of banlist, exceptlist, invexlist and quietlist */
+	struct BanIndex *ban_index[4];
 };
 
 struct membership
@@ -95,6 +122,9 @@ struct membership
 	unsigned int flags;
 
 	time_t bants;
+
+	unsigned int memberidx;		/* slot in chptr->memberv */
+	unsigned int locmemberidx;	/* slot in chptr->locmemberv */
 };
 
 #define BANLEN 195
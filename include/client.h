@@ -61,8 +61,10 @@ struct Server;
 struct LocalUser;
 struct PreClient;
 struct ListClient;
+struct burst_state;
 struct scache_entry;
 struct ws_ctl;
+struct ClientIndexEntry;
 
 typedef int SSL_OPEN_CB(struct Client *, int status);
 
@@ -80,6 +82,10 @@ struct User
 	struct PrivilegeSet *privset;
 
 	char suser[NICKLEN+1];
+
+	char *prefix;	/* ":nick!user@host ", see get_client_prefix() */
+
+	struct ClientIndexEntry *who_index;	/* in the IP and host indexes for WHO */
 };
 
 struct Server
@@ -180,6 +186,7 @@ struct LocalUser
 	/* Send and receive linebuf queues .. */
 	buf_head_t buf_sendq;
 	buf_head_t buf_recvq;
+	rb_dlink_node flush_node;	/* node on the deferred flush list */
 
 	/*
 	 * we want to use unsigned int here so the sizes have a better chance of
@@ -241,6 +248,11 @@ struct LocalUser
 	 *   -- adrian
 	 */
 	int sent_parsed;	/* how many messages we've parsed in this second */
+	time_t flood_lastcredit;	/* when sent_parsed was last decayed */
+	rb_dlink_node flood_node;	/* on the flood throttled list */
+
+	/* our entry in the local client IP and host indexes (hash.c) */
+	struct ClientIndexEntry *ban_index;
 	time_t last_knock;	/* time of last knock */
 	uint32_t random_ping;
 
@@ -258,6 +270,7 @@ struct LocalUser
 	unsigned int join_who_credits;
 
 	struct ListClient *safelist_data;
+	struct burst_state *burst;	/* set while a server burst is streamed out */
 
 	char *mangledhost; /* non-NULL if host mangling module loaded and
 			      applicable to this client */
@@ -428,6 +441,8 @@ struct ListClient
 #define LFLAGS_SECURE		0x00000010	/* for marking SSL clients as secure before registration */
 /* LFLAGS_FAKE: client may not have the usually expected machinery plugged in; don't assert on it. For tests only. */
 #define LFLAGS_FAKE		0x00000020
+#define LFLAGS_FLUSHPENDING	0x00000040	/* on the deferred sendq flush list */
+#define LFLAGS_FLOODWAIT	0x00000080	/* has lines held back by flood control */
 
 /* umodes, settable flags */
 /* lots of this moved to snomask -- jilles */
@@ -499,6 +514,13 @@ struct ListClient
 #define SetFlush(x)		((x)->localClient->localflags |= LFLAGS_FLUSH)
 #define ClearFlush(x)		((x)->localClient->localflags &= ~LFLAGS_FLUSH)
 
+#define IsFlushPending(x)	((x)->localClient->localflags & LFLAGS_FLUSHPENDING)
+#define SetFlushPending(x)	((x)->localClient->localflags |= LFLAGS_FLUSHPENDING)
+#define ClearFlushPending(x)	((x)->localClient->localflags &= ~LFLAGS_FLUSHPENDING)
+#define IsFloodWait(x)		((x)->localClient->localflags & LFLAGS_FLOODWAIT)
+#define SetFloodWait(x)		((x)->localClient->localflags |= LFLAGS_FLOODWAIT)
+#define ClearFloodWait(x)	((x)->localClient->localflags &= ~LFLAGS_FLOODWAIT)
+
 #define IsSCTP(x)		((x)->localClient->localflags & LFLAGS_SCTP)
 #define SetSCTP(x)		((x)->localClient->localflags |= LFLAGS_SCTP)
 #define ClearSCTP(x)		((x)->localClient->localflags &= ~LFLAGS_SCTP)
@@ -606,6 +628,8 @@ extern int show_ip_whowas(struct Whowas *whowas, struct Client *source_p);
 
 extern void free_user(struct User *, struct Client *);
 extern struct User *make_user(struct Client *);
+extern const char *get_client_prefix(struct Client *);
+extern void invalidate_client_prefix(struct Client *);
 extern struct Server *make_server(struct Client *);
 extern void close_connection(struct Client *);
 extern void init_uid(void);
@@ -78,6 +78,9 @@ extern const char *ircd_paths[IRCD_PATH_COUNT];
 #define MAX_TARGETS_DEFAULT		4		/* default for max_targets */
 #define DNSBL_TIMEOUT_DEFAULT		10
 #define OPM_TIMEOUT_DEFAULT		10
+#define OPM_MAX_SCANS_DEFAULT		256		/* connections open at once */
+#define OPM_IPV4_BITLEN_DEFAULT		24		/* clients scanned as one */
+#define OPM_IPV6_BITLEN_DEFAULT		64
 #define RDNS_TIMEOUT_DEFAULT		5
 #define MIN_JOIN_LEAVE_TIME		60
 #define MAX_JOIN_LEAVE_COUNT		25
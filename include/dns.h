@@ -31,10 +31,24 @@
 
 extern rb_dlink_list nameservers;
 
+struct DNSCacheStats
+{
+	unsigned long entries;
+	unsigned long max;
+	unsigned long hits;
+	unsigned long negative_hits;
+	unsigned long misses;
+	unsigned long evictions;
+	time_t updated;
+};
+
+extern struct DNSCacheStats dns_cache_stats;
+
 typedef void (*DNSCB)(const char *res, int status, int aftype, void *data);
 typedef void (*DNSLISTCB)(int resc, const char *resv[], int status, void *data);
 
 uint32_t lookup_hostname(const char *hostname, int aftype, DNSCB callback, void *data);
+uint32_t get_authd_stat(char letter, DNSLISTCB callback, void *data);
 
 void dns_results_callback(const char *callid, const char *status, const char *aftype, const char *results);
 void dns_stats_results_callback(const char *callid, const char *status, int resc, const char *resv[]);
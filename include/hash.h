@@ -31,6 +31,7 @@
 extern rb_dictionary *nd_dict;
 extern rb_radixtree *resv_tree;
 extern rb_radixtree *channel_tree;
+extern rb_radixtree *client_name_tree;
 
 /* Magic value for FNV hash functions */
 #define FNV1_32_INIT 0x811c9dc5UL
@@ -95,6 +96,18 @@ extern void del_from_resv_hash(const char *name, const struct ConfItem *aconf);
 extern struct ConfItem *hash_find_resv(const char *name);
 extern void clear_resv_hash(void);
 
+extern void add_to_local_index(struct Client *client_p);
+extern void del_from_local_index(struct Client *client_p);
+extern void find_local_by_ip(struct sockaddr *addr, int bits, rb_dlink_list *found);
+extern bool find_local_by_hostmask(const char *mask, rb_dlink_list *found);
+
+extern void add_to_global_index(struct Client *client_p);
+extern void del_from_global_index(struct Client *client_p);
+extern void rehash_global_index(void);
+extern bool find_global_by_ip(struct sockaddr *addr, int bits, rb_dlink_list *found);
+extern bool find_global_by_hostmask(const char *mask, rb_dlink_list *found);
+extern const char *host_mask_tail(const char *mask);
+
 void add_to_cli_connid_hash(struct Client *client_p, uint32_t id);
 void del_from_cli_connid_hash(uint32_t id);
 struct Client *find_cli_connid_hash(uint32_t connid);
@@ -5,10 +5,16 @@
 #ifndef INCLUDED_HOOK_H
 #define INCLUDED_HOOK_H
 
+typedef void (*hookfn) (void *data);
+
 typedef struct
 {
 	char *name;
 	rb_dlink_list hooks;
+	hookfn *fns;		/* hooks, in the order they run */
+	int nfns;
+	unsigned long calls;
+	uint64_t nsec;		/* spent in the hooks */
 } hook;
 
 enum hook_priority
@@ -29,7 +35,8 @@ enum whois_idle_approval
 	WHOIS_IDLE_AUSPEX = 2
 };
 
-typedef void (*hookfn) (void *data);
+extern hook *hooks;
+extern int max_hooks;
 
 extern int h_iosend_id;
 extern int h_iorecv_id;
@@ -61,7 +68,28 @@ int register_hook(const char *name);
 void add_hook(const char *name, hookfn fn);
 void add_hook_prio(const char *name, hookfn fn, enum hook_priority priority);
 void remove_hook(const char *name, const hookfn fn);
-void call_hook(int id, void *arg);
+void dispatch_hook(int id, void *arg);
+
+/* hook_has_subscribers()
+ *   True if anything is hooked on the event, for callers that would
+ *   rather not build the hook data for nothing.
+ */
+static inline bool
+hook_has_subscribers(int id)
+{
+	return hooks[id].nfns > 0;
+}
+
+/* call_hook()
+ *   Calls the functions hooked on an event.  An event with nothing
+ *   hooked on it costs a test.
+ */
+static inline void
+call_hook(int id, void *arg)
+{
+	if(hooks[id].nfns > 0)
+		dispatch_hook(id, arg);
+}
 
 typedef struct
 {
@@ -91,6 +119,18 @@ typedef struct
 	struct Client *target;
 } hook_data_client;
 
+/* for burst_finished; starts out the same as hook_data_client */
+typedef struct
+{
+	struct Client *client;
+	struct Client *target;	/* always NULL */
+	unsigned int users;
+	unsigned int channels;
+	unsigned long bytes;
+	unsigned long elapsed_ms;	/* from the link being established */
+	unsigned long busy_ms;		/* spent putting the burst together */
+} hook_data_burst;
+
 typedef struct
 {
 	struct Client *client;
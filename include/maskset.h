@@ -0,0 +1,36 @@
+/*
+ *  ircd-ratbox: A slightly useful ircd.
+ *  maskset.h: Sets of match_esc() masks looked up together.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ */
+
+#ifndef INCLUDED_maskset_h
+#define INCLUDED_maskset_h
+
+struct maskset;
+
+extern struct maskset *maskset_create(void);
+extern void maskset_destroy(struct maskset *set);
+
+/* data identifies the mask for maskset_del() and is what finds return */
+extern void maskset_add(struct maskset *set, const char *mask, void *data);
+extern void maskset_del(struct maskset *set, void *data);
+
+/* the most recently added mask that match_esc()es name, or NULL */
+extern void *maskset_find(struct maskset *set, const char *name);
+
+#endif /* INCLUDED_maskset_h */
@@ -51,8 +51,12 @@ struct MsgBuf_str_data {
 
 #define MSGBUF_CACHE_SIZE 32
 
+/* Entries are keyed by the set of tags a client's caps select rather
+ * than by the caps themselves, so every cap mask that produces the same
+ * line shares one entry.
+ */
 struct MsgBuf_cache_entry {
-	unsigned int caps;
+	unsigned int tagset;
 	buf_head_t linebuf;
 	struct MsgBuf_cache_entry *next;
 };
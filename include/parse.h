@@ -32,6 +32,7 @@ struct Client;
 struct MsgBuf;
 
 extern void parse(struct Client *, char *, char *);
+extern void parse_split(struct Client *, struct Client *, int, const char *parv[]);
 extern void handle_encap(struct MsgBuf *, struct Client *, struct Client *,
 		         const char *, int, const char *parv[]);
 extern void clear_hash_parse(void);
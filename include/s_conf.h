@@ -169,6 +169,7 @@ struct config_file_entry
 	char *fname_killlog;
 	char *fname_klinelog;
 	char *fname_ioerrorlog;
+	int log_fsync;		/* 1 << ilogfile for each log to fsync() */
 
 	int disable_fake_channels;
 	int failed_oper_notice;
@@ -214,6 +215,10 @@ struct config_file_entry
 	int reject_ban_time;
 	int reject_after_count;
 	int reject_duration;
+	int auth_cache_accept_duration;
+	int auth_cache_reject_duration;
+	int auth_cache_ipv4_bitlen;
+	int auth_cache_ipv6_bitlen;
 	int throttle_count;
 	int throttle_duration;
 	int target_change;
@@ -237,6 +242,8 @@ struct config_file_entry
 	int hide_opers_in_whois;
 	int hide_opers;
 
+	int who_indexes;
+
 	char *drain_reason;
 	char *sasl_only_client_message;
 	char *sctp_forbidden_client_message;
@@ -288,8 +295,17 @@ struct server_info
 	char *ssl_cert;
 	char *ssl_dh_params;
 	char *ssl_cipher_list;
+	int ssl_ktls;
+	int ssl_session_tickets;
+	int ssl_session_cache;
 	int ssld_count;
+	char *ssld_cpus;
 	int wsockd_count;
+	int ws_deflate;
+	int ws_deflate_window_bits;
+	int ws_deflate_context_takeover;
+	int ws_deflate_memory;
+	int ws_deflate_cpu;
 };
 
 struct admin_info
@@ -54,6 +54,10 @@ extern rb_dlink_list tgchange_list;
 
 extern struct _rb_patricia_tree_t *tgchange_tree;
 
+struct maskset;
+extern struct maskset *xline_maskset;
+extern struct maskset *resv_maskset;
+
 extern void init_s_newconf(void);
 extern void clear_s_newconf(void);
 extern void clear_s_newconf_bans(void);
@@ -93,6 +93,7 @@ extern unsigned int CAP_EOPMOD;			/* supports EOPMOD (ext +z + ext topic) */
 extern unsigned int CAP_BAN;			/* supports propagated bans */
 extern unsigned int CAP_MLOCK;			/* supports MLOCK messages */
 extern unsigned int CAP_EBMASK;			/* supports sending BMASK set by/at metadata */
+extern unsigned int CAP_BBURST;			/* supports binary burst records */
 
 /* XXX: added for backwards compatibility. --nenolod */
 #define CAP_MASK	(capability_index_mask(serv_capindex) & ~(CAP_TS6 | CAP_CAP))
@@ -138,4 +139,14 @@ extern int server_estab(struct Client *client_p);
 
 extern int serv_connect(struct server_conf *, struct Client *);
 
+/* streaming burst towards a newly linked server, see s_serv.c */
+extern void burst_start(struct Client *client_p);
+extern void burst_continue(struct Client *client_p);
+extern bool burst_defer(struct Client *client_p, buf_head_t *linebuf);
+extern unsigned int burst_deferred_len(struct Client *client_p);
+extern void burst_cancel(struct Client *client_p);
+extern void burst_forget_client(struct Client *target_p);
+extern void burst_new_client(struct Client *target_p);
+extern void burst_forget_channel(struct Channel *chptr);
+
 #endif /* INCLUDED_s_serv_h */
@@ -64,6 +64,8 @@ struct ServerStatistics
 	unsigned int is_sbad;	/* failed sasl authentications */
 	unsigned int is_tgch;	/* messages blocked due to target change */
 	unsigned int is_rl;     /* commands blocked due to ratelimit */
+	unsigned long long int is_sqw;	/* sendq writes that wrote data */
+	unsigned long long int is_sql;	/* lines completed by those writes */
 };
 
 extern struct ServerStatistics ServerStats;
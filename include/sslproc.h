@@ -40,7 +40,20 @@ void start_zlib_session(void *data);
 void ssld_update_config(void);
 void ssld_decrement_clicount(ssl_ctl_t *ctl);
 int get_ssld_count(void);
-void ssld_foreach_info(void (*func)(void *data, pid_t pid, int cli_count, enum ssld_status status, const char *version), void *data);
+struct ssld_info
+{
+	pid_t pid;
+	int cli_count;
+	enum ssld_status status;
+	const char *version;
+	int handshakes;		/* in progress */
+	uint32_t rate;		/* bytes per second */
+	uint32_t completed;	/* accepted handshakes completed */
+	uint32_t resumed;	/* ... of which resumed a session */
+};
+
+void ssld_foreach_info(void (*func)(void *data, const struct ssld_info *info), void *data);
+void ssld_assign_cpus(void);
 
 #endif
 
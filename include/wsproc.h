@@ -37,6 +37,7 @@ int start_wsockd(int count);
 ws_ctl_t *start_wsockd_accept(rb_fde_t *wsF, rb_fde_t *plainF, uint32_t id);
 void wsockd_decrement_clicount(ws_ctl_t *ctl);
 int get_wsockd_count(void);
+void wsockd_update_config(void);
 
 #endif
 
@@ -71,6 +71,10 @@ rb_dictionary *dnsbl_stats = NULL;
 
 rb_dlink_list opm_list;
 struct OPMListener opm_listeners[LISTEN_LAST];
+static int opm_max_scans = OPM_MAX_SCANS_DEFAULT;
+static int opm_ipv4_prefix = OPM_IPV4_BITLEN_DEFAULT;
+static int opm_ipv6_prefix = OPM_IPV6_BITLEN_DEFAULT;
+struct OPMStats opm_stats;
 
 static struct authd_cb authd_cmd_tab[256] =
 {
@@ -252,7 +256,9 @@ cmd_stats_results(int parc, char **parv)
 	/* Select by type */
 	switch(*parv[2])
 	{
+	case 'C':
 	case 'D':
+	case 'O':
 		/* parv[0] conveys status */
 		if(parc < 4)
 		{
@@ -302,6 +308,31 @@ parse_authd_reply(rb_helper * helper)
 	}
 }
 
+static void
+opm_stats_callback(int resc, const char *resv[], int status, void *data)
+{
+	if(status != 0 || resc < 8)
+		return;
+
+	opm_stats.inflight = strtoul(resv[0], NULL, 10);
+	opm_stats.max_scans = strtoul(resv[1], NULL, 10);
+	opm_stats.running = strtoul(resv[2], NULL, 10);
+	opm_stats.waiting = strtoul(resv[3], NULL, 10);
+	opm_stats.groups = strtoul(resv[4], NULL, 10);
+	opm_stats.started = strtoul(resv[5], NULL, 10);
+	opm_stats.joined = strtoul(resv[6], NULL, 10);
+	opm_stats.found = strtoul(resv[7], NULL, 10);
+	opm_stats.updated = rb_current_time();
+}
+
+/* authd's scan queue, kept fresh for STATS A */
+static void
+refresh_opm_stats(void *unused)
+{
+	if(authd_helper != NULL && rb_dlink_list_length(&opm_list) > 0)
+		(void)get_authd_stat('O', opm_stats_callback, NULL);
+}
+
 void
 init_authd(void)
 {
@@ -310,6 +341,8 @@ init_authd(void)
 		ierror("Unable to start authd helper: %s", strerror(errno));
 		exit(0);
 	}
+
+	rb_event_addish("refresh_opm_stats", refresh_opm_stats, NULL, 10);
 }
 
 void
@@ -318,6 +351,7 @@ configure_authd(void)
 	/* Timeouts */
 	set_authd_timeout("rdns_timeout", ConfigFileEntry.connect_timeout);
 	set_authd_timeout("rbl_timeout", ConfigFileEntry.connect_timeout);
+	configure_authd_cache();
 
 	/* Configure OPM */
 	if(rb_dlink_list_length(&opm_list) > 0 &&
@@ -341,6 +375,9 @@ configure_authd(void)
 				scanner->type, scanner->port);
 		}
 
+		rb_helper_write(authd_helper, "O opm_scan_limits %d %d %d",
+			opm_max_scans, opm_ipv4_prefix, opm_ipv6_prefix);
+
 		opm_check_enable(true);
 	}
 	else
@@ -359,6 +396,20 @@ configure_authd(void)
 	}
 }
 
+/* How long authd may reuse an accept or reject for the same address */
+void
+configure_authd_cache(void)
+{
+	if(authd_helper == NULL)
+		return;
+
+	rb_helper_write(authd_helper, "O verdict_cache %d %d %d %d",
+		ConfigFileEntry.auth_cache_accept_duration,
+		ConfigFileEntry.auth_cache_reject_duration,
+		ConfigFileEntry.auth_cache_ipv4_bitlen,
+		ConfigFileEntry.auth_cache_ipv6_bitlen);
+}
+
 static void
 authd_free_client(struct Client *client_p)
 {
@@ -701,6 +752,17 @@ delete_opm_listener_all(void)
 	rb_helper_write(authd_helper, "O opm_listener_del_all");
 }
 
+/* How many connections authd may have open, and how wide a scan reaches */
+void
+set_opm_scan_limits(int max_scans, int ipv4_prefix, int ipv6_prefix)
+{
+	opm_max_scans = max_scans;
+	opm_ipv4_prefix = ipv4_prefix;
+	opm_ipv6_prefix = ipv6_prefix;
+	rb_helper_write(authd_helper, "O opm_scan_limits %d %d %d",
+		max_scans, ipv4_prefix, ipv6_prefix);
+}
+
 /* Disable all OPM scans */
 void
 opm_check_enable(bool enabled)
@@ -40,6 +40,7 @@
 #include "hostmask.h"
 #include "hash.h"
 #include "s_newconf.h"
+#include "maskset.h"
 #include "reject.h"
 #include "send.h"
 #include "ircd.h"
@@ -352,7 +353,10 @@ bandb_handle_finish(void)
 
 		case CONF_XLINE:
 			if(bandb_check_xline(aconf))
+			{
 				rb_dlinkAddAlloc(aconf, &xline_conf_list);
+				maskset_add(xline_maskset, aconf->host, aconf);
+			}
 			else
 				free_conf(aconf);
 
@@ -368,7 +372,10 @@ bandb_handle_finish(void)
 
 		case CONF_RESV_NICK:
 			if(bandb_check_resv_nick(aconf))
+			{
 				rb_dlinkAddAlloc(aconf, &resv_conf_list);
+				maskset_add(resv_maskset, aconf->host, aconf);
+			}
 			else
 				free_conf(aconf);
 
@@ -0,0 +1,606 @@
+/*
+ *  ircd-ratbox: A slightly useful ircd.
+ *  bburst.c: Binary burst records between servers.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ */
+
+/*
+ * Between servers that both offer BBURST, users and channels are burst
+ * as records rather than EUID and SJOIN lines.  A line of records is
+ * BBURST_FRAME followed by records, each a type byte, a length and that
+ * many bytes.  Numbers are 7 bits a byte, low bits first; strings are a
+ * length then the bytes.  NUL, CR, LF and BBURST_ESCAPE are escaped, so
+ * the line goes over the link like any other and text lines can come
+ * between them freely.  Nothing is compressed; the saving is only in the
+ * encoding.
+ *
+ * The receiving end hands each record to the EUID or SJOIN handler as
+ * if the line had been parsed, so the TS rules are the same either way.
+ */
+
+#include "stdinc.h"
+#include "bburst.h"
+#include "client.h"
+#include "channel.h"
+#include "hash.h"
+#include "ircd.h"
+#include "match.h"
+#include "msgbuf.h"
+#include "parse.h"
+#include "s_serv.h"
+#include "s_stats.h"
+#include "send.h"
+
+#define BBURST_ESCAPE	0x10
+
+#define REC_EUID	'U'
+#define REC_SJOIN	'J'
+
+/* room for the type and length of a record */
+#define REC_HEADER	8
+
+#define CHFL_BBURST_OP		0x01
+#define CHFL_BBURST_VOICE	0x02
+
+struct writer
+{
+	unsigned char *buf;
+	size_t len;
+	size_t esclen;
+	size_t max;		/* of esclen */
+	bool full;
+};
+
+struct reader
+{
+	const unsigned char *p;
+	const unsigned char *end;
+	char *arena;		/* strings are copied out to here */
+	size_t arenalen;
+	bool bad;
+};
+
+static inline bool
+needs_escape(unsigned char c)
+{
+	return c == '\0' || c == '\r' || c == '\n' || c == BBURST_ESCAPE;
+}
+
+static void
+writer_init(struct writer *w, unsigned char *buf, size_t max)
+{
+	w->buf = buf;
+	w->len = w->esclen = 0;
+	w->max = max;
+	w->full = false;
+}
+
+static void
+put_byte(struct writer *w, unsigned char c)
+{
+	size_t cost = needs_escape(c) ? 2 : 1;
+
+	if(w->esclen + cost > w->max)
+	{
+		w->full = true;
+		return;
+	}
+	w->buf[w->len++] = c;
+	w->esclen += cost;
+}
+
+static void
+put_uint(struct writer *w, unsigned long v)
+{
+	while(v >= 0x80)
+	{
+		put_byte(w, (v & 0x7f) | 0x80);
+		v >>= 7;
+	}
+	put_byte(w, v);
+}
+
+static void
+put_data(struct writer *w, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	put_uint(w, len);
+	while(len-- > 0 && !w->full)
+		put_byte(w, *p++);
+}
+
+static void
+put_str(struct writer *w, const char *s)
+{
+	put_data(w, s, strlen(s));
+}
+
+/* an address goes as its bytes, unless that would not give back the
+ * same text at the other end */
+static void
+put_ip(struct writer *w, const char *ip)
+{
+	unsigned char addr[16];
+	char check[HOSTIPLEN + 1];
+
+	if(rb_inet_pton(AF_INET, ip, addr) == 1 &&
+	   rb_inet_ntop(AF_INET, addr, check, sizeof(check)) != NULL && !strcmp(ip, check))
+	{
+		put_byte(w, 4);
+		put_data(w, addr, 4);
+	}
+#ifdef RB_IPV6
+	else if(rb_inet_pton(AF_INET6, ip, addr) == 1 &&
+		rb_inet_ntop(AF_INET6, addr, check, sizeof(check)) != NULL && !strcmp(ip, check))
+	{
+		put_byte(w, 6);
+		put_data(w, addr, 16);
+	}
+#endif
+	else
+	{
+		put_byte(w, 0);
+		put_str(w, ip);
+	}
+}
+
+/* put_record()
+ *
+ * inputs	- link, frame, record type, record contents
+ * outputs	- false if the record can never fit in a line
+ * side effects - the record is added to the frame, which is sent first
+ *		  if there is no room left in it
+ */
+static bool
+put_record(struct Client *client_p, struct bburst_frame *frame, unsigned char type, struct writer *payload)
+{
+	unsigned char buf[BBURST_LINELEN];
+	struct writer w;
+
+	if(payload->full)
+		return false;
+
+	writer_init(&w, buf, sizeof(buf));
+	put_byte(&w, type);
+	put_data(&w, payload->buf, payload->len);
+	if(w.full)
+		return false;
+
+	if(frame->esclen + w.esclen > BBURST_LINELEN)
+		bburst_flush(client_p, frame);
+
+	memcpy(frame->buf + frame->len, w.buf, w.len);
+	frame->len += w.len;
+	frame->esclen += w.esclen;
+	return true;
+}
+
+/* bburst_user()
+ *
+ * inputs	- link being burst to, its frame, user, user's umodes
+ * outputs	- false if the user has to be sent as EUID instead
+ * side effects - the user's EUID record is added to the frame
+ */
+bool
+bburst_user(struct Client *client_p, struct bburst_frame *frame, struct Client *target_p, const char *umodes)
+{
+	unsigned char buf[BBURST_LINELEN];
+	struct writer w;
+	size_t sidlen = strlen(target_p->servptr->id);
+
+	/* the sid is sent once, not again as the start of the uid */
+	if(strncmp(target_p->id, target_p->servptr->id, sidlen))
+		return false;
+
+	writer_init(&w, buf, BBURST_LINELEN - REC_HEADER);
+	put_str(&w, target_p->servptr->id);
+	put_str(&w, target_p->name);
+	put_uint(&w, target_p->hopcount + 1);
+	put_uint(&w, target_p->tsinfo);
+	put_str(&w, umodes);
+	put_str(&w, target_p->username);
+	put_str(&w, target_p->host);
+	put_ip(&w, IsIPSpoof(target_p) ? "0" : target_p->sockhost);
+	put_str(&w, target_p->id + sidlen);
+	put_str(&w, IsDynSpoof(target_p) ? target_p->orighost : "");
+	put_str(&w, EmptyString(target_p->user->suser) ? "" : target_p->user->suser);
+	put_str(&w, target_p->info);
+
+	return put_record(client_p, frame, REC_EUID, &w);
+}
+
+/* bburst_sjoin()
+ *
+ * inputs	- link being burst to, its frame, channel, channel's modes
+ * outputs	- false if the channel has to be sent as SJOIN instead
+ * side effects - SJOIN records for the channel are added to the frame,
+ *		  as many as its members need
+ */
+bool
+bburst_sjoin(struct Client *client_p, struct bburst_frame *frame, struct Channel *chptr, const char *modes)
+{
+	unsigned char buf[BBURST_LINELEN];
+	struct writer w;
+	struct membership *msptr;
+	rb_dlink_node *ptr;
+	size_t headlen, headesc;
+	size_t len, esclen;
+
+	writer_init(&w, buf, BBURST_LINELEN - REC_HEADER);
+	put_uint(&w, chptr->channelts);
+	put_str(&w, chptr->chname);
+	put_str(&w, modes);
+	if(w.full)
+		return false;
+
+	headlen = w.len;
+	headesc = w.esclen;
+
+	RB_DLINK_FOREACH(ptr, chptr->members.head)
+	{
+		msptr = ptr->data;
+
+		/* it told us about these itself */
+		if(msptr->client_p->from == client_p)
+			continue;
+
+		len = w.len;
+		esclen = w.esclen;
+
+		put_byte(&w, (is_chanop(msptr) ? CHFL_BBURST_OP : 0) |
+				(is_voiced(msptr) ? CHFL_BBURST_VOICE : 0));
+		put_str(&w, use_id(msptr->client_p));
+
+		if(w.full)
+		{
+			/* send what fits, then start again with this one */
+			w.len = len;
+			w.esclen = esclen;
+			w.full = false;
+			put_record(client_p, frame, REC_SJOIN, &w);
+
+			w.len = headlen;
+			w.esclen = headesc;
+			put_byte(&w, (is_chanop(msptr) ? CHFL_BBURST_OP : 0) |
+					(is_voiced(msptr) ? CHFL_BBURST_VOICE : 0));
+			put_str(&w, use_id(msptr->client_p));
+		}
+	}
+
+	put_record(client_p, frame, REC_SJOIN, &w);
+	return true;
+}
+
+/* bburst_flush()
+ *
+ * inputs	- link, its frame
+ * outputs	-
+ * side effects - whatever records are in the frame are sent as a line
+ */
+void
+bburst_flush(struct Client *client_p, struct bburst_frame *frame)
+{
+	char line[BBURST_LINELEN + 2];
+	char *t = line;
+	size_t i;
+
+	if(frame->len == 0)
+		return;
+
+	*t++ = BBURST_FRAME;
+	for(i = 0; i < frame->len; i++)
+	{
+		if(needs_escape(frame->buf[i]))
+		{
+			*t++ = BBURST_ESCAPE;
+			*t++ = frame->buf[i] ^ 0x40;
+		}
+		else
+			*t++ = frame->buf[i];
+	}
+	*t = '\0';
+
+	/* empty before sending, anything sent meanwhile must not flush it */
+	frame->len = frame->esclen = 0;
+
+	sendto_one(client_p, "%s", line);
+}
+
+static unsigned char
+get_byte(struct reader *r)
+{
+	if(r->p >= r->end)
+	{
+		r->bad = true;
+		return 0;
+	}
+	return *r->p++;
+}
+
+static unsigned long
+get_uint(struct reader *r)
+{
+	unsigned long v = 0;
+	unsigned int shift = 0;
+	unsigned char c;
+
+	do
+	{
+		c = get_byte(r);
+		if(shift >= sizeof(v) * 8 - 7)
+			r->bad = true;
+		if(r->bad)
+			return 0;
+		v |= (unsigned long) (c & 0x7f) << shift;
+		shift += 7;
+	}
+	while(c & 0x80);
+
+	return v;
+}
+
+static const unsigned char *
+get_data(struct reader *r, size_t *len)
+{
+	const unsigned char *data;
+
+	*len = get_uint(r);
+	if(r->bad || *len > (size_t) (r->end - r->p))
+	{
+		r->bad = true;
+		return NULL;
+	}
+	data = r->p;
+	r->p += *len;
+	return data;
+}
+
+/* copies a string out to the arena; only the last parameter of a line
+ * may have spaces in it, and nothing may have line breaks */
+static const char *
+arena_copy(struct reader *r, const void *data, size_t len, bool spaces)
+{
+	char *s;
+
+	if(r->bad || len + 1 > r->arenalen || memchr(data, '\0', len) != NULL ||
+	   memchr(data, '\r', len) != NULL || memchr(data, '\n', len) != NULL ||
+	   (!spaces && memchr(data, ' ', len) != NULL))
+	{
+		r->bad = true;
+		return "";
+	}
+
+	s = r->arena;
+	memcpy(s, data, len);
+	s[len] = '\0';
+	r->arena += len + 1;
+	r->arenalen -= len + 1;
+	return s;
+}
+
+static const char *
+get_str(struct reader *r, bool spaces)
+{
+	const unsigned char *data;
+	size_t len;
+
+	data = get_data(r, &len);
+	return arena_copy(r, data, len, spaces);
+}
+
+static const char *
+get_uint_str(struct reader *r)
+{
+	char buf[32];
+	unsigned long v = get_uint(r);
+
+	snprintf(buf, sizeof(buf), "%lu", v);
+	return arena_copy(r, buf, strlen(buf), false);
+}
+
+static const char *
+get_ip(struct reader *r)
+{
+	char buf[HOSTIPLEN + 1];
+	const unsigned char *data;
+	size_t len;
+	int family = get_byte(r);
+
+	if(family == 0)
+		return get_str(r, false);
+
+	data = get_data(r, &len);
+	if(r->bad || !((family == 4 && len == 4) || (family == 6 && len == 16)) ||
+	   rb_inet_ntop(family == 4 ? AF_INET : AF_INET6, data, buf, sizeof(buf)) == NULL)
+	{
+		r->bad = true;
+		return "";
+	}
+	return arena_copy(r, buf, strlen(buf), false);
+}
+
+static bool
+parse_euid(struct Client *client_p, struct reader *r)
+{
+	const char *parv[12];
+	const char *sid, *uid;
+	struct Client *source_p;
+	char idbuf[IDLEN * 2];
+
+	sid = get_str(r, false);
+	parv[0] = "EUID";
+	parv[1] = get_str(r, false);
+	parv[2] = get_uint_str(r);
+	parv[3] = get_uint_str(r);
+	parv[4] = get_str(r, false);
+	parv[5] = get_str(r, false);
+	parv[6] = get_str(r, false);
+	parv[7] = get_ip(r);
+	uid = get_str(r, false);
+	parv[9] = get_str(r, false);
+	parv[10] = get_str(r, false);
+	parv[11] = get_str(r, true);
+
+	if(r->bad || r->p != r->end)
+		return false;
+
+	snprintf(idbuf, sizeof(idbuf), "%s%s", sid, uid);
+	parv[8] = idbuf;
+	if(EmptyString(parv[9]))
+		parv[9] = "*";
+	if(EmptyString(parv[10]))
+		parv[10] = "*";
+
+	/* as parse() does for a line from the wrong direction */
+	source_p = find_id(sid);
+	if(source_p == NULL || !IsServer(source_p) || source_p->from != client_p)
+	{
+		ServerStats.is_wrdi++;
+		return true;
+	}
+
+	parse_split(client_p, source_p, 12, parv);
+	return true;
+}
+
+static bool
+parse_sjoin(struct Client *client_p, struct reader *r)
+{
+	const char *parv[MAXPARA];
+	char modes[BUFSIZE];
+	char members[BUFSIZE];
+	char *p, *t, *save;
+	int parc = 0;
+	int flags;
+	const char *id;
+
+	parv[parc++] = "SJOIN";
+	parv[parc++] = get_uint_str(r);
+	parv[parc++] = get_str(r, false);
+	rb_strlcpy(modes, get_str(r, true), sizeof(modes));
+
+	/* the modes and their arguments are separate parameters */
+	for(p = rb_strtok_r(modes, " ", &save); p != NULL; p = rb_strtok_r(NULL, " ", &save))
+	{
+		if(parc >= MAXPARA - 1)
+			return false;
+		parv[parc++] = p;
+	}
+
+	t = members;
+	*t = '\0';
+	while(!r->bad && r->p < r->end)
+	{
+		flags = get_byte(r);
+		id = get_str(r, false);
+
+		if((size_t) (t - members) + strlen(id) + 4 > sizeof(members))
+			return false;
+
+		if(t != members)
+			*t++ = ' ';
+		if(flags & CHFL_BBURST_OP)
+			*t++ = '@';
+		if(flags & CHFL_BBURST_VOICE)
+			*t++ = '+';
+		t += sprintf(t, "%s", id);
+	}
+
+	if(r->bad || parc < 4)
+		return false;
+
+	parv[parc++] = members;
+	parse_split(client_p, client_p, parc, parv);
+	return true;
+}
+
+/* bburst_parse()
+ *
+ * inputs	- server link, line of records after BBURST_FRAME
+ * outputs	-
+ * side effects - each record is handled like the line it stands for;
+ *		  the link is dropped if the line is malformed
+ */
+void
+bburst_parse(struct Client *client_p, const char *line)
+{
+	unsigned char buf[BUFSIZE];
+	char arena[BUFSIZE * 2];
+	struct reader r, rec;
+	const unsigned char *data;
+	const char *s;
+	size_t len = 0;
+	unsigned char type;
+	bool ok;
+
+	for(s = line; *s != '\0'; s++)
+	{
+		if(len == sizeof(buf))
+			goto bad;
+
+		if(*s == BBURST_ESCAPE)
+		{
+			if(*++s == '\0')
+				goto bad;
+			buf[len++] = *s ^ 0x40;
+		}
+		else
+			buf[len++] = *s;
+	}
+
+	r.p = buf;
+	r.end = buf + len;
+	r.bad = false;
+
+	while(r.p < r.end && !IsAnyDead(client_p))
+	{
+		type = get_byte(&r);
+		data = get_data(&r, &len);
+		if(r.bad)
+			goto bad;
+
+		rec.p = data;
+		rec.end = data + len;
+		rec.arena = arena;
+		rec.arenalen = sizeof(arena);
+		rec.bad = false;
+
+		switch(type)
+		{
+		case REC_EUID:
+			ok = parse_euid(client_p, &rec);
+			break;
+		case REC_SJOIN:
+			ok = parse_sjoin(client_p, &rec);
+			break;
+		default:
+			/* from something newer, skip it */
+			ok = true;
+			break;
+		}
+
+		if(!ok)
+			goto bad;
+	}
+	return;
+
+bad:
+	sendto_realops_snomask(SNO_GENERAL, L_ALL,
+			"Malformed binary burst from %s", client_p->name);
+	exit_client(client_p, client_p, &me, "Malformed binary burst");
+}
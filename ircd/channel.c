@@ -48,6 +48,7 @@ static rb_bh *topic_heap;
 static rb_bh *member_heap;
 
 static void free_topic(struct Channel *chptr);
+static void free_ban_index(struct BanIndex *idx);
 
 static int h_can_join;
 static int h_can_send;
@@ -87,6 +88,13 @@ allocate_channel(const char *chname)
 void
 free_channel(struct Channel *chptr)
 {
+	for(size_t i = 0; i < ARRAY_SIZE(chptr->ban_index); i++)
+		free_ban_index(chptr->ban_index[i]);
+
+	rb_free(chptr->memberv.v);
+	rb_free(chptr->locmemberv.v);
+	rb_free(chptr->member_index);
+
 	rb_free(chptr->chname);
 	rb_free(chptr->mode_lock);
 	rb_bh_free(channel_heap, chptr);
@@ -147,6 +155,197 @@ send_channel_join(struct Channel *chptr, struct Client *client_p)
  * output	- membership of client in channel, else NULL
  * side effects	-
  */
+/*
+ * Packed member arrays.
+ *
+ * chptr->memberv and chptr->locmemberv hold the same memberships as the
+ * members and locmembers lists, as a flat array the send functions can
+ * walk without chasing list nodes.  Removal moves the last slot into the
+ * hole, so each membership remembers its slot.  Channels with at least
+ * MEMBER_INDEX_MIN members also get an open addressed client ->
+ * membership table so find_channel_membership() does not have to walk
+ * either side.
+ */
+#define MEMBER_ARRAY_MIN	8
+#define MEMBER_INDEX_MIN	64
+
+static unsigned int
+member_array_add(struct MemberArray *arr, struct membership *msptr)
+{
+	if(arr->count == arr->size)
+	{
+		arr->size = arr->size ? arr->size * 2 : MEMBER_ARRAY_MIN;
+		arr->v = rb_realloc(arr->v, arr->size * sizeof(struct ChannelMember));
+	}
+
+	arr->v[arr->count].client_p = msptr->client_p;
+	arr->v[arr->count].msptr = msptr;
+	return arr->count++;
+}
+
+/* removes slot idx, returns the membership moved into it, if any */
+static struct membership *
+member_array_del(struct MemberArray *arr, unsigned int idx)
+{
+	struct membership *moved = NULL;
+
+	s_assert(idx < arr->count);
+
+	if(--arr->count == 0)
+	{
+		rb_free(arr->v);
+		arr->v = NULL;
+		arr->size = 0;
+		return NULL;
+	}
+
+	if(idx != arr->count)
+	{
+		arr->v[idx] = arr->v[arr->count];
+		moved = arr->v[idx].msptr;
+	}
+
+	if(arr->count * 4 <= arr->size && arr->size > MEMBER_ARRAY_MIN)
+	{
+		arr->size /= 2;
+		arr->v = rb_realloc(arr->v, arr->size * sizeof(struct ChannelMember));
+	}
+
+	return moved;
+}
+
+static inline unsigned int
+member_hash(const struct Client *client_p, unsigned int size)
+{
+	uint32_t h = (uint32_t)((uintptr_t)client_p >> 4) * 2654435761U;
+
+	return (h ^ (h >> 16)) & (size - 1);
+}
+
+static void
+member_index_insert(struct Channel *chptr, struct membership *msptr)
+{
+	unsigned int i = member_hash(msptr->client_p, chptr->member_index_size);
+
+	while(chptr->member_index[i] != NULL)
+		i = (i + 1) & (chptr->member_index_size - 1);
+
+	chptr->member_index[i] = msptr;
+}
+
+static void
+member_index_remove(struct Channel *chptr, struct membership *msptr)
+{
+	unsigned int mask = chptr->member_index_size - 1;
+	unsigned int i, j, k;
+
+	i = member_hash(msptr->client_p, chptr->member_index_size);
+	while(chptr->member_index[i] != msptr)
+	{
+		if(chptr->member_index[i] == NULL)
+		{
+			s_assert(0);
+			return;
+		}
+		i = (i + 1) & mask;
+	}
+
+	/* shift later entries of the probe run back over the hole */
+	for(j = (i + 1) & mask; chptr->member_index[j] != NULL; j = (j + 1) & mask)
+	{
+		k = member_hash(chptr->member_index[j]->client_p, chptr->member_index_size);
+		if(((j - k) & mask) >= ((j - i) & mask))
+		{
+			chptr->member_index[i] = chptr->member_index[j];
+			i = j;
+		}
+	}
+	chptr->member_index[i] = NULL;
+}
+
+static void
+member_index_rebuild(struct Channel *chptr)
+{
+	struct ChannelMember *cm;
+	unsigned int size;
+
+	rb_free(chptr->member_index);
+	chptr->member_index = NULL;
+	chptr->member_index_size = 0;
+
+	if(chptr->memberv.count < MEMBER_INDEX_MIN / 2)
+		return;
+
+	/* keep the table at most half full */
+	for(size = MEMBER_INDEX_MIN * 2; size < chptr->memberv.count * 4; size *= 2)
+		;
+
+	chptr->member_index = rb_malloc(size * sizeof(struct membership *));
+	chptr->member_index_size = size;
+
+	MEMBERS_FOREACH(cm, &chptr->memberv)
+		member_index_insert(chptr, cm->msptr);
+}
+
+static struct membership *
+find_member_index(struct Channel *chptr, struct Client *client_p)
+{
+	unsigned int i = member_hash(client_p, chptr->member_index_size);
+	struct membership *msptr;
+
+	while((msptr = chptr->member_index[i]) != NULL)
+	{
+		if(msptr->client_p == client_p)
+			return msptr;
+		i = (i + 1) & (chptr->member_index_size - 1);
+	}
+
+	return NULL;
+}
+
+static void
+link_member(struct Channel *chptr, struct membership *msptr)
+{
+	msptr->memberidx = member_array_add(&chptr->memberv, msptr);
+
+	if(MyClient(msptr->client_p))
+		msptr->locmemberidx = member_array_add(&chptr->locmemberv, msptr);
+
+	if(chptr->member_index != NULL)
+	{
+		if(chptr->memberv.count * 2 > chptr->member_index_size)
+			member_index_rebuild(chptr);
+		else
+			member_index_insert(chptr, msptr);
+	}
+	else if(chptr->memberv.count >= MEMBER_INDEX_MIN)
+		member_index_rebuild(chptr);
+}
+
+static void
+unlink_member(struct Channel *chptr, struct membership *msptr)
+{
+	struct membership *moved;
+
+	if((moved = member_array_del(&chptr->memberv, msptr->memberidx)) != NULL)
+		moved->memberidx = msptr->memberidx;
+
+	if(msptr->client_p->servptr == &me)
+	{
+		if((moved = member_array_del(&chptr->locmemberv, msptr->locmemberidx)) != NULL)
+			moved->locmemberidx = msptr->locmemberidx;
+	}
+
+	if(chptr->member_index != NULL)
+	{
+		if(chptr->memberv.count < MEMBER_INDEX_MIN / 2 ||
+				chptr->memberv.count * 8 < chptr->member_index_size)
+			member_index_rebuild(chptr);
+		else
+			member_index_remove(chptr, msptr);
+	}
+}
+
 struct membership *
 find_channel_membership(struct Channel *chptr, struct Client *client_p)
 {
@@ -156,17 +355,20 @@ find_channel_membership(struct Channel *chptr, struct Client *client_p)
 	if(!IsClient(client_p))
 		return NULL;
 
+	if(chptr->member_index != NULL)
+		return find_member_index(chptr, client_p);
+
 	/* Pick the most efficient list to use to be nice to things like
 	 * CHANSERV which could be in a large number of channels
 	 */
-	if(rb_dlink_list_length(&chptr->members) < rb_dlink_list_length(&client_p->user->channel))
+	if(chptr->memberv.count < rb_dlink_list_length(&client_p->user->channel))
 	{
-		RB_DLINK_FOREACH(ptr, chptr->members.head)
-		{
-			msptr = ptr->data;
+		struct ChannelMember *cm;
 
-			if(msptr->client_p == client_p)
-				return msptr;
+		MEMBERS_FOREACH(cm, &chptr->memberv)
+		{
+			if(cm->client_p == client_p)
+				return cm->msptr;
 		}
 	}
 	else
@@ -248,6 +450,8 @@ add_user_to_channel(struct Channel *chptr, struct Client *client_p, int flags)
 
 	if(MyClient(client_p))
 		rb_dlinkAdd(msptr, &msptr->locchannode, &chptr->locmembers);
+
+	link_member(chptr, msptr);
 }
 
 /* remove_user_from_channel()
@@ -270,6 +474,7 @@ remove_user_from_channel(struct membership *msptr)
 
 	rb_dlinkDelete(&msptr->usernode, &client_p->user->channel);
 	rb_dlinkDelete(&msptr->channode, &chptr->members);
+	unlink_member(chptr, msptr);
 
 	if(client_p->servptr == &me)
 		rb_dlinkDelete(&msptr->locchannode, &chptr->locmembers);
@@ -305,6 +510,7 @@ remove_user_from_channels(struct Client *client_p)
 		chptr = msptr->chptr;
 
 		rb_dlinkDelete(&msptr->channode, &chptr->members);
+		unlink_member(chptr, msptr);
 
 		if(client_p->servptr == &me)
 			rb_dlinkDelete(&msptr->locchannode, &chptr->locmembers);
@@ -413,6 +619,7 @@ destroy_channel(struct Channel *chptr)
 	/* Free the topic */
 	free_topic(chptr);
 
+	burst_forget_channel(chptr);
 	rb_dlinkDelete(&chptr->node, &global_channel_list);
 	del_from_channel_hash(chptr->chname, chptr);
 	free_channel(chptr);
@@ -545,6 +752,294 @@ del_invite(struct Channel *chptr, struct Client *who)
 	rb_dlinkFindDestroy(chptr, &who->user->invited);
 }
 
+/*
+ * Ban list index
+ *
+ * Long ban lists are compiled into an index so that checking a client
+ * does not mean running match() against every mask.  Masks whose host
+ * part has no wildcards are kept sorted by host part and found with a
+ * binary search, those which are also valid CIDR masks go in a patricia
+ * tree as well, and anything else (wildcard hosts, extbans) is left on
+ * a residual list.  Every candidate is still confirmed with
+ * matches_mask(), so the index only decides what is worth trying.
+ *
+ * An index is rebuilt the first time it is used after chptr->bants
+ * changes, which happens whenever one of the lists is modified.
+ */
+#define BAN_INDEX_MIN	8	/* shorter lists are just walked */
+
+struct BanIndexEntry
+{
+	struct Ban *ban;
+	const char *host;			/* host part of the mask */
+	struct BanIndexEntry *cidr_next;	/* more masks for the same network */
+};
+
+struct BanIndex
+{
+	time_t bants;				/* chptr->bants when built */
+	struct BanIndexEntry *entries;		/* in list order */
+	struct BanIndexEntry **hosts;		/* literal host parts, sorted */
+	struct BanIndexEntry **residual;	/* in list order */
+	int numhosts;
+	int numresidual;
+	rb_patricia_tree_t *cidr;
+};
+
+static void
+free_ban_index(struct BanIndex *idx)
+{
+	if(idx == NULL)
+		return;
+
+	if(idx->cidr != NULL)
+		rb_destroy_patricia(idx->cidr, NULL);
+	rb_free(idx->entries);
+	rb_free(idx->hosts);
+	rb_free(idx->residual);
+	rb_free(idx);
+}
+
+static int
+ban_index_hostcmp(const void *a, const void *b)
+{
+	const struct BanIndexEntry *ea = *(struct BanIndexEntry * const *)a;
+	const struct BanIndexEntry *eb = *(struct BanIndexEntry * const *)b;
+	int res = irccmp(ea->host, eb->host);
+
+	/* keep list order within a host, for the benefit of forwards */
+	if(res == 0)
+		res = (ea > eb) - (ea < eb);
+	return res;
+}
+
+/* ban_index_cidr()
+ *
+ * input	- host part of a mask, buffer for the address
+ * output	- prefix length if the host part is a CIDR mask that
+ *		  match_cidr() would accept, else 0
+ * side effects -
+ */
+static int
+ban_index_cidr(const char *host, struct rb_sockaddr_storage *addr)
+{
+	char ip[HOSTIPLEN + 1];
+	const char *len;
+	int bitlen;
+
+	if((len = strrchr(host, '/')) == NULL || (size_t)(len - host) >= sizeof(ip))
+		return 0;
+
+	rb_strlcpy(ip, host, len - host + 1);
+	bitlen = atoi(len + 1);
+	if(bitlen <= 0)
+		return 0;
+
+	if(strchr(ip, ':') != NULL)
+	{
+		if(bitlen > 128 || rb_inet_pton_sock(ip, addr) <= 0 || GET_SS_FAMILY(addr) != AF_INET6)
+			return 0;
+	}
+	else if(bitlen > 32 || rb_inet_pton_sock(ip, addr) <= 0 || GET_SS_FAMILY(addr) != AF_INET)
+		return 0;
+
+	return bitlen;
+}
+
+static struct BanIndex *
+build_ban_index(struct Channel *chptr, rb_dlink_list *list)
+{
+	struct BanIndex *idx = rb_malloc(sizeof(struct BanIndex));
+	struct BanIndexEntry *entry;
+	struct rb_sockaddr_storage addr;
+	rb_patricia_node_t *pnode;
+	rb_dlink_node *ptr;
+	const char *at;
+	int bitlen;
+
+	idx->bants = chptr->bants;
+	idx->entries = rb_malloc(sizeof(struct BanIndexEntry) * rb_dlink_list_length(list));
+	idx->hosts = rb_malloc(sizeof(struct BanIndexEntry *) * rb_dlink_list_length(list));
+	idx->residual = rb_malloc(sizeof(struct BanIndexEntry *) * rb_dlink_list_length(list));
+
+	entry = idx->entries;
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		entry->ban = ptr->data;
+		at = strchr(entry->ban->banstr, '@');
+
+		/* extbans, and masks that can only be matched the slow way */
+		if(*entry->ban->banstr == '$' || at == NULL || strchr(at + 1, '@') != NULL ||
+				strpbrk(at + 1, "*?") != NULL)
+		{
+			idx->residual[idx->numresidual++] = entry++;
+			continue;
+		}
+
+		entry->host = at + 1;
+		idx->hosts[idx->numhosts++] = entry;
+
+		if((bitlen = ban_index_cidr(entry->host, &addr)) > 0)
+		{
+			if(idx->cidr == NULL)
+				idx->cidr = rb_new_patricia(PATRICIA_BITS);
+			pnode = make_and_lookup_ip(idx->cidr, (struct sockaddr *)&addr, bitlen);
+			entry->cidr_next = pnode->data;
+			pnode->data = entry;
+		}
+		entry++;
+	}
+
+	qsort(idx->hosts, idx->numhosts, sizeof(struct BanIndexEntry *), ban_index_hostcmp);
+	return idx;
+}
+
+/* ban_index_try()
+ *
+ * input	- entry to try, best entry found so far, client buffers
+ * output	- the entry which comes first in the list of those that match
+ * side effects -
+ */
+static inline struct BanIndexEntry *
+ban_index_try(struct BanIndexEntry *entry, struct BanIndexEntry *best,
+		const struct matchset *ms)
+{
+	if(best != NULL && entry >= best)
+		return best;
+	if(matches_mask(ms, entry->ban->banstr))
+		return entry;
+	return best;
+}
+
+static struct BanIndexEntry *
+ban_index_hosts(struct BanIndex *idx, const char *str, struct BanIndexEntry *best,
+		const struct matchset *ms)
+{
+	const char *host = strrchr(str, '@');
+	int lo = 0, hi = idx->numhosts;
+
+	if(host == NULL)
+		return best;
+	host++;
+
+	/* find the first entry for this host */
+	while(lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+
+		if(irccmp(idx->hosts[mid]->host, host) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for(; lo < idx->numhosts && !irccmp(idx->hosts[lo]->host, host); lo++)
+		best = ban_index_try(idx->hosts[lo], best, ms);
+
+	return best;
+}
+
+static struct BanIndexEntry *
+ban_index_cidrs(struct BanIndex *idx, const char *str, struct BanIndexEntry *best,
+		const struct matchset *ms)
+{
+	struct rb_sockaddr_storage addr;
+	rb_patricia_node_t *pnode;
+	struct BanIndexEntry *entry;
+	const char *ip = strrchr(str, '@');
+
+	if(ip == NULL || rb_inet_pton_sock(ip + 1, &addr) <= 0)
+		return best;
+
+	/* every network containing the address is on the path from
+	 * the most specific one back up to the root
+	 */
+	for(pnode = rb_match_ip(idx->cidr, (struct sockaddr *)&addr); pnode != NULL;
+			pnode = pnode->parent)
+	{
+		for(entry = pnode->data; entry != NULL; entry = entry->cidr_next)
+			best = ban_index_try(entry, best, ms);
+	}
+
+	return best;
+}
+
+/* find_ban()
+ *
+ * input	- channel, ban list, client and its prebuilt buffers,
+ *		  mode type to check extbans as
+ * output	- the first ban in the list that matches the client, or NULL
+ * side effects - the list's index may be (re)built
+ */
+static struct Ban *
+find_ban(struct Channel *chptr, rb_dlink_list *list, struct Client *who,
+		const struct matchset *ms, long mode_type)
+{
+	struct BanIndex **idxp;
+	struct BanIndex *idx;
+	struct BanIndexEntry *best = NULL;
+	struct Ban *actualBan;
+	rb_dlink_node *ptr;
+	int i;
+
+	if(list == &chptr->banlist)
+		idxp = &chptr->ban_index[0];
+	else if(list == &chptr->exceptlist)
+		idxp = &chptr->ban_index[1];
+	else if(list == &chptr->invexlist)
+		idxp = &chptr->ban_index[2];
+	else
+		idxp = &chptr->ban_index[3];
+
+	if(rb_dlink_list_length(list) < BAN_INDEX_MIN)
+	{
+		RB_DLINK_FOREACH(ptr, list->head)
+		{
+			actualBan = ptr->data;
+			if(matches_mask(ms, actualBan->banstr) ||
+					match_extban(actualBan->banstr, who, chptr, mode_type))
+				return actualBan;
+		}
+		return NULL;
+	}
+
+	if(*idxp == NULL || (*idxp)->bants != chptr->bants)
+	{
+		free_ban_index(*idxp);
+		*idxp = build_ban_index(chptr, list);
+	}
+	idx = *idxp;
+
+	for(i = 0; i < ARRAY_SIZE(ms->host) && ms->host[i][0] != '\0'; i++)
+		best = ban_index_hosts(idx, ms->host[i], best, ms);
+
+	for(i = 0; i < ARRAY_SIZE(ms->ip) && ms->ip[i][0] != '\0'; i++)
+	{
+		best = ban_index_hosts(idx, ms->ip[i], best, ms);
+		if(idx->cidr != NULL)
+			best = ban_index_cidrs(idx, ms->ip[i], best, ms);
+	}
+
+	/* the residual list is in list order, so the first hit is all
+	 * that can matter
+	 */
+	for(i = 0; i < idx->numresidual; i++)
+	{
+		struct BanIndexEntry *entry = idx->residual[i];
+
+		if(best != NULL && entry > best)
+			break;
+		if(matches_mask(ms, entry->ban->banstr) ||
+				match_extban(entry->ban->banstr, who, chptr, mode_type))
+		{
+			best = entry;
+			break;
+		}
+	}
+
+	return best != NULL ? best->ban : NULL;
+}
+
 /* is_banned_list()
  *
  * input	- channel to check bans for, ban list (banlist or quietlist),
@@ -572,35 +1067,23 @@ is_banned_list(struct Channel *chptr, rb_dlink_list *list,
 		ms = &ms_;
 	}
 
-	RB_DLINK_FOREACH(ptr, list->head)
-	{
-		actualBan = ptr->data;
-		if (matches_mask(ms, actualBan->banstr))
-			break;
-		if (match_extban(actualBan->banstr, who, chptr, CHFL_BAN))
-			break;
-		actualBan = NULL;
-	}
+	actualBan = find_ban(chptr, list, who, ms, CHFL_BAN);
 
 	if (actualBan != NULL)
 	{
-		RB_DLINK_FOREACH(ptr, chptr->exceptlist.head)
-		{
-			actualExcept = ptr->data;
+		actualExcept = find_ban(chptr, &chptr->exceptlist, who, ms, CHFL_EXCEPTION);
 
-			/* theyre exempted.. */
-			if (matches_mask(ms, actualExcept->banstr) ||
-					match_extban(actualExcept->banstr, who, chptr, CHFL_EXCEPTION))
+		/* theyre exempted.. */
+		if (actualExcept != NULL)
+		{
+			/* cache the fact theyre not banned */
+			if(msptr != NULL)
 			{
-				/* cache the fact theyre not banned */
-				if(msptr != NULL)
-				{
-					msptr->bants = chptr->bants;
-					msptr->flags &= ~CHFL_BANNED;
-				}
-
-				return CHFL_EXCEPTION;
+				msptr->bants = chptr->bants;
+				msptr->flags &= ~CHFL_BANNED;
 			}
+
+			return CHFL_EXCEPTION;
 		}
 	}
 
@@ -705,14 +1188,8 @@ can_join(struct Client *source_p, struct Channel *chptr, const char *key, const
 		}
 		if(invite == NULL)
 		{
-			RB_DLINK_FOREACH(ptr, chptr->invexlist.head)
-			{
-				invex = ptr->data;
-				if (matches_mask(&ms, invex->banstr) ||
-						match_extban(invex->banstr, source_p, chptr, CHFL_INVEX))
-					break;
-			}
-			if(ptr == NULL)
+			invex = find_ban(chptr, &chptr->invexlist, source_p, &ms, CHFL_INVEX);
+			if(invex == NULL)
 				moduledata.approved = ERR_INVITEONLYCHAN;
 		}
 	}
@@ -277,9 +277,8 @@ add_id(struct Client *source_p, struct Channel *chptr, const char *banid, const
 
 	rb_dlinkAdd(actualBan, &actualBan->node, list);
 
-	/* invalidate the can_send() cache */
-	if(mode_type == CHFL_BAN || mode_type == CHFL_QUIET || mode_type == CHFL_EXCEPTION)
-		chptr->bants++;
+	/* invalidate the can_send() cache and the list's index */
+	chptr->bants++;
 
 	return actualBan;
 }
@@ -307,9 +306,8 @@ del_id(struct Channel *chptr, const char *banid, rb_dlink_list * list, long mode
 		{
 			rb_dlinkDelete(&banptr->node, list);
 
-			/* invalidate the can_send() cache */
-			if(mode_type == CHFL_BAN || mode_type == CHFL_QUIET || mode_type == CHFL_EXCEPTION)
-				chptr->bants++;
+			/* invalidate the can_send() cache and the list's index */
+			chptr->bants++;
 
 			return banptr;
 		}
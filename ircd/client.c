@@ -57,7 +57,9 @@
 #define DEBUG_EXITED_CLIENTS
 
 static void check_pings_list(rb_dlink_list * list);
+static void check_pings_client(struct Client *client_p);
 static void check_unknowns_list(rb_dlink_list * list);
+static void check_unknowns_client(struct Client *client_p);
 static void free_exited_clients(void *unused);
 static void exit_aborted_clients(void *unused);
 
@@ -108,6 +110,7 @@ init_client(void)
 	/*
 	 * start off the check ping event ..  -- adrian
 	 * Every 30 seconds is plenty -- db
+	 * ... for each client, but spread over those 30 seconds
 	 */
 	client_heap = rb_bh_create(sizeof(struct Client), CLIENT_HEAP_SIZE, "client_heap");
 	lclient_heap = rb_bh_create(sizeof(struct LocalUser), LCLIENT_HEAP_SIZE, "lclient_heap");
@@ -115,7 +118,7 @@ init_client(void)
 	user_heap = rb_bh_create(sizeof(struct User), USER_HEAP_SIZE, "user_heap");
 	away_heap = rb_bh_create(AWAYLEN, AWAY_HEAP_SIZE, "away_heap");
 
-	rb_event_addish("check_pings", check_pings, NULL, 30);
+	rb_event_add("check_pings", check_pings, NULL, 1);
 	rb_event_addish("free_exited_clients", &free_exited_clients, NULL, 4);
 	rb_event_addish("exit_aborted_clients", exit_aborted_clients, NULL, 1);
 	rb_event_add("flood_recalc", flood_recalc, NULL, 1);
@@ -272,6 +275,9 @@ free_local_client(struct Client *client_p)
 	if(client_p->localClient == NULL)
 		return;
 
+	flood_cancel_wait(client_p);
+	burst_cancel(client_p);
+
 	/*
 	 * clean up extra sockets from P-lines which have been discarded.
 	 */
@@ -351,14 +357,57 @@ free_client(struct Client *client_p)
  *     -- adrian
  */
 
+/* spread each sweep over this many calls of check_pings() */
+#define CHECK_PINGS_SLICES	30
+
+static unsigned int check_pings_slice;
+
 static void
 check_pings(void *notused)
 {
+	check_pings_slice = (check_pings_slice + 1) % CHECK_PINGS_SLICES;
+
 	check_pings_list(&lclient_list);
 	check_pings_list(&serv_list);
 	check_unknowns_list(&unknown_list);
 }
 
+/*
+ * check_list_slice()
+ *
+ * inputs	- pointer to list to check, per client check
+ * output	- NONE
+ * side effects	- the oldest slice of the list is checked and moved to
+ *		  the front, so every client is seen once per
+ *		  CHECK_PINGS_SLICES calls without walking the whole list
+ *		  each second
+ */
+static void
+check_list_slice(rb_dlink_list * list, void (*check)(struct Client *))
+{
+	struct Client *client_p;
+	rb_dlink_node *ptr;
+	unsigned long len = rb_dlink_list_length(list);
+	unsigned long count;
+
+	/* this slice's share of the list, the shares add up to the whole
+	 * list over CHECK_PINGS_SLICES calls even when it is short
+	 */
+	count = len * (check_pings_slice + 1) / CHECK_PINGS_SLICES -
+		len * check_pings_slice / CHECK_PINGS_SLICES;
+
+	/* new clients are added at the head, so the tail is the one
+	 * that has waited longest
+	 */
+	while(count-- > 0 && (ptr = list->tail) != NULL)
+	{
+		client_p = ptr->data;
+		rb_dlinkDelete(ptr, list);
+		rb_dlinkAdd(client_p, ptr, list);
+		check(client_p);
+	}
+}
+
 /*
  * Check_pings_list()
  *
@@ -368,82 +417,79 @@ check_pings(void *notused)
  */
 static void
 check_pings_list(rb_dlink_list * list)
+{
+	check_list_slice(list, check_pings_client);
+}
+
+static void
+check_pings_client(struct Client *client_p)
 {
 	char scratch[32];	/* way too generous but... */
-	struct Client *client_p;	/* current local client_p being examined */
 	int ping = 0;		/* ping time value from client */
-	rb_dlink_node *ptr, *next_ptr;
-
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, list->head)
-	{
-		client_p = ptr->data;
 
-		if(!MyConnect(client_p) || IsDead(client_p))
-			continue;
+	if(!MyConnect(client_p) || IsDead(client_p))
+		return;
 
-		ping = get_client_ping(client_p);
+	ping = get_client_ping(client_p);
 
-		if(ping < (rb_current_time() - client_p->localClient->lasttime))
+	if(ping < (rb_current_time() - client_p->localClient->lasttime))
+	{
+		/*
+		 * If the client/server hasnt talked to us in 2*ping seconds
+		 * and it has a ping time, then close its connection.
+		 */
+		if(((rb_current_time() - client_p->localClient->lasttime) >= (2 * ping)
+		    && (client_p->flags & FLAGS_PINGSENT)))
 		{
-			/*
-			 * If the client/server hasnt talked to us in 2*ping seconds
-			 * and it has a ping time, then close its connection.
-			 */
-			if(((rb_current_time() - client_p->localClient->lasttime) >= (2 * ping)
-			    && (client_p->flags & FLAGS_PINGSENT)))
-			{
-				if(IsServer(client_p))
-				{
-					sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-							     "No response from %s, closing link",
-							     client_p->name);
-					ilog(L_SERVER,
-					     "No response from %s, closing link",
-					     log_client_name(client_p, HIDE_IP));
-				}
-				(void) snprintf(scratch, sizeof(scratch),
-						  "Ping timeout: %d seconds",
-						  (int) (rb_current_time() - client_p->localClient->lasttime));
-
-				exit_client(client_p, client_p, &me, scratch);
-				continue;
-			}
-			else if((client_p->flags & FLAGS_PINGSENT) == 0)
+			if(IsServer(client_p))
 			{
-				/*
-				 * if we havent PINGed the connection and we havent
-				 * heard from it in a while, PING it to make sure
-				 * it is still alive.
-				 */
-				client_p->flags |= FLAGS_PINGSENT;
-				/* not nice but does the job */
-				client_p->localClient->lasttime = rb_current_time() - ping;
-				sendto_one(client_p, "PING :%s", me.name);
-			}
-			else if (ConfigFileEntry.ping_warn_time > 0 && (IsServer(client_p) || IsHandshake(client_p)) &&
-					(rb_current_time() - client_p->localClient->lasttime) >= (ping + ConfigFileEntry.ping_warn_time))
-			{
-				/*
-				 * if we haven't heard from a server in a while,
-				 * warn opers that something could be wrong...
-				 *
-				 * we'll do this about every 30 seconds until
-				 * the server either becomes responsive or
-				 * pings out. whichever comes first.
-				 */
-				client_p->flags |= FLAGS_PINGWARN;
 				sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-					     "Warning: No response from %s for %ld seconds",
-					     client_p->name,
-					     (rb_current_time() - client_p->localClient->lasttime - ping));
+						     "No response from %s, closing link",
+						     client_p->name);
 				ilog(L_SERVER,
-					     "Warning: No response from %s for %ld seconds",
-					     log_client_name(client_p, HIDE_IP),
-					     (rb_current_time() - client_p->localClient->lasttime - ping));
+				     "No response from %s, closing link",
+				     log_client_name(client_p, HIDE_IP));
 			}
-		}
-		/* ping_timeout: */
+			(void) snprintf(scratch, sizeof(scratch),
+					  "Ping timeout: %d seconds",
+					  (int) (rb_current_time() - client_p->localClient->lasttime));
 
+			exit_client(client_p, client_p, &me, scratch);
+			return;
+		}
+		else if((client_p->flags & FLAGS_PINGSENT) == 0)
+		{
+			/*
+			 * if we havent PINGed the connection and we havent
+			 * heard from it in a while, PING it to make sure
+			 * it is still alive.
+			 */
+			client_p->flags |= FLAGS_PINGSENT;
+			/* not nice but does the job */
+			client_p->localClient->lasttime = rb_current_time() - ping;
+			sendto_one(client_p, "PING :%s", me.name);
+		}
+		else if (ConfigFileEntry.ping_warn_time > 0 && (IsServer(client_p) || IsHandshake(client_p)) &&
+				(rb_current_time() - client_p->localClient->lasttime) >= (ping + ConfigFileEntry.ping_warn_time))
+		{
+			/*
+			 * if we haven't heard from a server in a while,
+			 * warn opers that something could be wrong...
+			 *
+			 * we'll do this about every 30 seconds until
+			 * the server either becomes responsive or
+			 * pings out. whichever comes first.
+			 */
+			client_p->flags |= FLAGS_PINGWARN;
+			sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
+				     "Warning: No response from %s for %ld seconds",
+				     client_p->name,
+				     (rb_current_time() - client_p->localClient->lasttime - ping));
+			ilog(L_SERVER,
+				     "Warning: No response from %s for %ld seconds",
+				     log_client_name(client_p, HIDE_IP),
+				     (rb_current_time() - client_p->localClient->lasttime - ping));
+		}
 	}
 }
 
@@ -457,40 +503,39 @@ check_pings_list(rb_dlink_list * list)
 static void
 check_unknowns_list(rb_dlink_list * list)
 {
-	rb_dlink_node *ptr, *next_ptr;
-	struct Client *client_p;
-	int timeout;
+	check_list_slice(list, check_unknowns_client);
+}
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, list->head)
-	{
-		client_p = ptr->data;
+static void
+check_unknowns_client(struct Client *client_p)
+{
+	int timeout;
 
-		if(IsDead(client_p) || IsClosing(client_p))
-			continue;
+	if(IsDead(client_p) || IsClosing(client_p))
+		return;
 
-		/* Still querying with authd */
-		if(client_p->preClient != NULL && client_p->preClient->auth.cid != 0)
-			continue;
+	/* Still querying with authd */
+	if(client_p->preClient != NULL && client_p->preClient->auth.cid != 0)
+		return;
 
-		/*
-		 * Check UNKNOWN connections - if they have been in this state
-		 * for > 30s, close them.
-		 */
+	/*
+	 * Check UNKNOWN connections - if they have been in this state
+	 * for > 30s, close them.
+	 */
 
-		timeout = IsAnyServer(client_p) ? ConfigFileEntry.connect_timeout : 30;
-		if((rb_current_time() - client_p->localClient->firsttime) > timeout)
+	timeout = IsAnyServer(client_p) ? ConfigFileEntry.connect_timeout : 30;
+	if((rb_current_time() - client_p->localClient->firsttime) > timeout)
+	{
+		if(IsAnyServer(client_p))
 		{
-			if(IsAnyServer(client_p))
-			{
-				sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-						     "No response from %s, closing link",
-						     client_p->name);
-				ilog(L_SERVER,
-				     "No response from %s, closing link",
-				     log_client_name(client_p, HIDE_IP));
-			}
-			exit_client(client_p, client_p, &me, "Connection timed out");
+			sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
+					     "No response from %s, closing link",
+					     client_p->name);
+			ilog(L_SERVER,
+			     "No response from %s, closing link",
+			     log_client_name(client_p, HIDE_IP));
 		}
+		exit_client(client_p, client_p, &me, "Connection timed out");
 	}
 }
 
@@ -524,6 +569,92 @@ notify_banned_client(struct Client *client_p, struct ConfItem *aconf, int ban)
 			 ConfigFileEntry.kline_reason);
 }
 
+/* check_kline_client()
+ *
+ * inputs	- client to check
+ * outputs	- 1 if the client was exited, else 0
+ * side effects - client is exited if it matches a kline
+ */
+static int
+check_kline_client(struct Client *client_p)
+{
+	struct ConfItem *aconf;
+
+	if((aconf = find_kline(client_p)) == NULL)
+		return 0;
+
+	if(IsExemptKline(client_p))
+	{
+		sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
+				     "KLINE over-ruled for %s, client is kline_exempt [%s@%s]",
+				     get_client_name(client_p, HIDE_IP),
+				     aconf->user, aconf->host);
+		return 0;
+	}
+
+	sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
+			     "Disconnecting K-Lined user %s (%s@%s)",
+			     get_client_name(client_p, HIDE_IP), aconf->user, aconf->host);
+
+	notify_banned_client(client_p, aconf, K_LINED);
+	return 1;
+}
+
+/* check_dline_client()
+ *
+ * inputs	- client to check, whether to notify opers
+ * outputs	- 1 if the client was exited, else 0
+ * side effects - client is exited if it matches a dline
+ */
+static int
+check_dline_client(struct Client *client_p, int notify)
+{
+	struct ConfItem *aconf;
+
+	aconf = find_dline((struct sockaddr *)&client_p->localClient->ip, GET_SS_FAMILY(&client_p->localClient->ip));
+	if(aconf == NULL || aconf->status & CONF_EXEMPTDLINE)
+		return 0;
+
+	if(notify)
+		sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
+				     "Disconnecting D-Lined user %s (%s)",
+				     get_client_name(client_p, HIDE_IP), aconf->host);
+
+	notify_banned_client(client_p, aconf, D_LINED);
+	return 1;
+}
+
+/* check_xline_client()
+ *
+ * inputs	- client to check
+ * outputs	- 1 if the client was exited, else 0
+ * side effects - client is exited if it matches an xline
+ */
+static int
+check_xline_client(struct Client *client_p)
+{
+	struct ConfItem *aconf;
+
+	if((aconf = find_xline(client_p->info, 1)) == NULL)
+		return 0;
+
+	if(IsExemptKline(client_p))
+	{
+		sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
+				     "XLINE over-ruled for %s, client is kline_exempt [%s]",
+				     get_client_name(client_p, HIDE_IP),
+				     aconf->host);
+		return 0;
+	}
+
+	sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
+				"Disconnecting X-Lined user %s (%s)",
+				get_client_name(client_p, HIDE_IP), aconf->host);
+
+	(void) exit_client(client_p, client_p, &me, "Bad user info");
+	return 1;
+}
+
 /*
  * check_banned_lines
  * inputs	- NONE
@@ -534,9 +665,35 @@ notify_banned_client(struct Client *client_p, struct ConfItem *aconf, int ban)
 void
 check_banned_lines(void)
 {
-	check_dlines();
-	check_klines();
-	check_xlines();
+	struct Client *client_p;
+	rb_dlink_node *ptr;
+	rb_dlink_node *next_ptr;
+
+	/* one pass over the clients, rather than one for each type */
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, lclient_list.head)
+	{
+		client_p = ptr->data;
+
+		if(IsMe(client_p))
+			continue;
+
+		if(check_dline_client(client_p, 1))
+			continue;
+
+		if(!IsPerson(client_p))
+			continue;
+
+		if(check_kline_client(client_p))
+			continue;
+
+		check_xline_client(client_p);
+	}
+
+	/* dlines need to be checked against unknowns too */
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, unknown_list.head)
+	{
+		check_dline_client(ptr->data, 0);
+	}
 }
 
 /* check_klines
@@ -549,7 +706,6 @@ void
 check_klines(void)
 {
 	struct Client *client_p;
-	struct ConfItem *aconf;
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
 
@@ -560,24 +716,7 @@ check_klines(void)
 		if(IsMe(client_p) || !IsPerson(client_p))
 			continue;
 
-		if((aconf = find_kline(client_p)) != NULL)
-		{
-			if(IsExemptKline(client_p))
-			{
-				sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-						     "KLINE over-ruled for %s, client is kline_exempt [%s@%s]",
-						     get_client_name(client_p, HIDE_IP),
-						     aconf->user, aconf->host);
-				continue;
-			}
-
-			sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-					     "Disconnecting K-Lined user %s (%s@%s)",
-					     get_client_name(client_p, HIDE_IP), aconf->user, aconf->host);
-
-			notify_banned_client(client_p, aconf, K_LINED);
-			continue;
-		}
+		check_kline_client(client_p);
 	}
 }
 
@@ -588,12 +727,15 @@ check_klines(void)
  *
  * inputs       - pointer to kline to check
  * outputs      -
- * side effects - all clients will be checked against given kline
+ * side effects - all clients the kline could apply to will be checked
+ *		  against it, found through the local client indexes
  */
 void
 check_one_kline(struct ConfItem *kline)
 {
 	struct Client *client_p;
+	rb_dlink_list candidates = { NULL, NULL, 0 };
+	rb_dlink_list *list = &candidates;
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
 	int masktype;
@@ -603,13 +745,24 @@ check_one_kline(struct ConfItem *kline)
 
 	masktype = parse_netmask(kline->host, (struct sockaddr_storage *)&sockaddr, &bits);
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, lclient_list.head)
+	switch (masktype) {
+	case HM_IPV4:
+	case HM_IPV6:
+		find_local_by_ip((struct sockaddr *)&sockaddr, bits, &candidates);
+		break;
+	case HM_HOST:
+		if(!find_local_by_hostmask(kline->host, &candidates))
+			list = &lclient_list;
+		break;
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, list->head)
 	{
 		int matched = 0;
 
 		client_p = ptr->data;
 
-		if(IsMe(client_p) || !IsPerson(client_p))
+		if(IsMe(client_p) || !IsPerson(client_p) || IsAnyDead(client_p))
 			continue;
 
 		if(!match(kline->user, client_p->username))
@@ -660,6 +813,11 @@ check_one_kline(struct ConfItem *kline)
 
 		notify_banned_client(client_p, kline, K_LINED);
 	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, candidates.head)
+	{
+		rb_free_rb_dlink_node(ptr);
+	}
 }
 
 
@@ -672,44 +830,21 @@ check_one_kline(struct ConfItem *kline)
 void
 check_dlines(void)
 {
-	struct Client *client_p;
-	struct ConfItem *aconf;
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
 
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, lclient_list.head)
 	{
-		client_p = ptr->data;
-
-		if(IsMe(client_p))
+		if(IsMe((struct Client *)ptr->data))
 			continue;
 
-		if((aconf = find_dline((struct sockaddr *)&client_p->localClient->ip, GET_SS_FAMILY(&client_p->localClient->ip))) != NULL)
-		{
-			if(aconf->status & CONF_EXEMPTDLINE)
-				continue;
-
-			sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-					     "Disconnecting D-Lined user %s (%s)",
-					     get_client_name(client_p, HIDE_IP), aconf->host);
-
-			notify_banned_client(client_p, aconf, D_LINED);
-			continue;
-		}
+		check_dline_client(ptr->data, 1);
 	}
 
 	/* dlines need to be checked against unknowns too */
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, unknown_list.head)
 	{
-		client_p = ptr->data;
-
-		if((aconf = find_dline((struct sockaddr *)&client_p->localClient->ip, GET_SS_FAMILY(&client_p->localClient->ip))) != NULL)
-		{
-			if(aconf->status & CONF_EXEMPTDLINE)
-				continue;
-
-			notify_banned_client(client_p, aconf, D_LINED);
-		}
+		check_dline_client(ptr->data, 0);
 	}
 }
 
@@ -723,7 +858,6 @@ void
 check_xlines(void)
 {
 	struct Client *client_p;
-	struct ConfItem *aconf;
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
 
@@ -734,24 +868,7 @@ check_xlines(void)
 		if(IsMe(client_p) || !IsPerson(client_p))
 			continue;
 
-		if((aconf = find_xline(client_p->info, 1)) != NULL)
-		{
-			if(IsExemptKline(client_p))
-			{
-				sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-						     "XLINE over-ruled for %s, client is kline_exempt [%s]",
-						     get_client_name(client_p, HIDE_IP),
-						     aconf->host);
-				continue;
-			}
-
-			sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-						"Disconnecting X-Lined user %s (%s)",
-						get_client_name(client_p, HIDE_IP), aconf->host);
-
-			(void) exit_client(client_p, client_p, &me, "Bad user info");
-			continue;
-		}
+		check_xline_client(client_p);
 	}
 }
 
@@ -824,6 +941,7 @@ resv_nick_fnc(const char *mask, const char *reason, int temp_time)
 			del_from_client_hash(client_p->name, client_p);
 			rb_strlcpy(client_p->name, nick, sizeof(client_p->name));
 			add_to_client_hash(nick, client_p);
+			invalidate_client_prefix(client_p);
 
 			monitor_signon(client_p);
 
@@ -919,6 +1037,7 @@ remove_client_from_list(struct Client *client_p)
 	if(client_p->node.prev == NULL && client_p->node.next == NULL)
 		return;
 
+	burst_forget_client(client_p);
 	rb_dlinkDelete(&client_p->node, &global_client_list);
 
 	update_client_exit_stats(client_p);
@@ -1374,6 +1493,7 @@ exit_generic_client(struct Client *client_p, struct Client *source_p, struct Cli
 		del_from_id_hash(source_p->id, source_p);
 
 	del_from_hostname_hash(source_p->orighost, source_p);
+	del_from_global_index(source_p);
 	del_from_client_hash(source_p->name, source_p);
 	remove_client_from_list(source_p);
 }
@@ -1607,6 +1727,7 @@ exit_local_client(struct Client *client_p, struct Client *source_p, struct Clien
 
 	s_assert(IsPerson(source_p));
 	rb_dlinkDelete(&source_p->localClient->tnode, &lclient_list);
+	del_from_local_index(source_p);
 	rb_dlinkDelete(&source_p->lnode, &me.serv->users);
 
 	if(IsOper(source_p))
@@ -1894,6 +2015,50 @@ make_user(struct Client *client_p)
 	return user;
 }
 
+/*
+ * get_client_prefix
+ *
+ * inputs	- pointer to a person
+ * output	- ":nick!user@host " for use as a message prefix
+ * side effects - the prefix is built once and kept until
+ *		  invalidate_client_prefix() is called
+ */
+const char *
+get_client_prefix(struct Client *client_p)
+{
+	char buf[1 + NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 2];
+	struct User *user = client_p->user;
+
+	s_assert(user != NULL);
+
+	if(user->prefix == NULL)
+	{
+		snprintf(buf, sizeof buf, ":%s!%s@%s ",
+			 client_p->name, client_p->username, client_p->host);
+		user->prefix = rb_strdup(buf);
+	}
+
+	return user->prefix;
+}
+
+/*
+ * invalidate_client_prefix
+ *
+ * inputs	- pointer to client
+ * output	- none
+ * side effects - the cached prefix is dropped; must be called whenever
+ *		  the nick, username or host of a person changes
+ */
+void
+invalidate_client_prefix(struct Client *client_p)
+{
+	if(client_p->user == NULL)
+		return;
+
+	rb_free(client_p->user->prefix);
+	client_p->user->prefix = NULL;
+}
+
 /*
  * make_server
  *
@@ -1934,6 +2099,7 @@ free_user(struct User *user, struct Client *client_p)
 		if(user->away)
 			rb_free((char *) user->away);
 		rb_free(user->opername);
+		rb_free(user->prefix);
 		if (user->privset)
 			privilegeset_unref(user->privset);
 		/*
@@ -2101,6 +2267,7 @@ close_connection(struct Client *client_p)
 		client_p->localClient->F = NULL;
 	}
 
+	send_cancel_flush(client_p);
 	rb_linebuf_donebuf(&client_p->localClient->buf_sendq);
 	rb_linebuf_donebuf(&client_p->localClient->buf_recvq);
 	detach_conf(client_p);
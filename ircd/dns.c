@@ -44,7 +44,7 @@
 #define DNS_REVERSE_IPV6	((char)'S')
 
 static void submit_dns(uint32_t uid, char type, const char *addr);
-static void submit_dns_stat(uint32_t uid);
+static void submit_dns_stat(uint32_t uid, char letter);
 
 struct dnsreq
 {
@@ -63,6 +63,7 @@ static rb_dictionary *query_dict;
 static rb_dictionary *stat_dict;
 
 rb_dlink_list nameservers;
+struct DNSCacheStats dns_cache_stats;
 
 static uint32_t query_id = 0;
 static uint32_t stat_id = 0;
@@ -129,8 +130,8 @@ lookup_hostname(const char *hostname, int aftype, DNSCB callback, void *data)
 	return (rid);
 }
 
-static uint32_t
-get_nameservers(DNSLISTCB callback, void *data)
+uint32_t
+get_authd_stat(char letter, DNSLISTCB callback, void *data)
 {
 	struct dnsstatreq *req = rb_malloc(sizeof(struct dnsstatreq));
 	uint32_t qid = assign_id(&stat_id);
@@ -142,10 +143,16 @@ get_nameservers(DNSLISTCB callback, void *data)
 	req->callback = callback;
 	req->data = data;
 
-	submit_dns_stat(qid);
+	submit_dns_stat(qid, letter);
 	return (qid);
 }
 
+static uint32_t
+get_nameservers(DNSLISTCB callback, void *data)
+{
+	return get_authd_stat('D', callback, data);
+}
+
 
 void
 dns_results_callback(const char *callid, const char *status, const char *type, const char *results)
@@ -252,6 +259,28 @@ stats_results_callback(int resc, const char *resv[], int status, void *data)
 	}
 }
 
+static void
+cache_stats_callback(int resc, const char *resv[], int status, void *data)
+{
+	if(status != 0 || resc < 6)
+		return;
+
+	dns_cache_stats.entries = strtoul(resv[0], NULL, 10);
+	dns_cache_stats.max = strtoul(resv[1], NULL, 10);
+	dns_cache_stats.hits = strtoul(resv[2], NULL, 10);
+	dns_cache_stats.negative_hits = strtoul(resv[3], NULL, 10);
+	dns_cache_stats.misses = strtoul(resv[4], NULL, 10);
+	dns_cache_stats.evictions = strtoul(resv[5], NULL, 10);
+	dns_cache_stats.updated = rb_current_time();
+}
+
+/* authd's cache counters, kept fresh for STATS A */
+static void
+refresh_cache_stats(void *unused)
+{
+	if(authd_helper != NULL)
+		(void)get_authd_stat('C', cache_stats_callback, NULL);
+}
 
 void
 init_dns(void)
@@ -259,6 +288,7 @@ init_dns(void)
 	query_dict = rb_dictionary_create("dns queries", rb_uint32cmp);
 	stat_dict = rb_dictionary_create("dns stat queries", rb_uint32cmp);
 	(void)get_nameservers(stats_results_callback, NULL);
+	rb_event_addish("refresh_dns_cache_stats", refresh_cache_stats, NULL, 60);
 }
 
 void
@@ -282,12 +312,12 @@ submit_dns(uint32_t nid, char type, const char *addr)
 }
 
 static void
-submit_dns_stat(uint32_t nid)
+submit_dns_stat(uint32_t nid, char letter)
 {
 	if(authd_helper == NULL)
 	{
 		handle_dns_stat_failure(nid);
 		return;
 	}
-	rb_helper_write(authd_helper, "S %x D", nid);
+	rb_helper_write(authd_helper, "S %x %c", nid, letter);
 }
@@ -47,6 +47,35 @@ rb_radixtree *channel_tree = NULL;
 rb_radixtree *resv_tree = NULL;
 rb_radixtree *hostname_tree = NULL;
 
+/* users by IP address and by every dot separated suffix of their
+ * hosts: local users so bans can find the clients they apply to, and
+ * everyone for WHO when general::who_indexes is set
+ */
+struct ClientIndex
+{
+	rb_patricia_tree_t *ip_tree;
+	rb_radixtree *host_tree;
+};
+
+struct IndexHostRef
+{
+	rb_dlink_node node;
+	const char *key;	/* points into the entry's copy of the hosts */
+	rb_dlink_list *list;
+};
+
+struct ClientIndexEntry
+{
+	rb_patricia_node_t *ip[2];	/* the address, and the v4 one it maps */
+	rb_dlink_node ip_node[2];
+	struct IndexHostRef *host;
+	int host_count;
+};
+
+static struct ClientIndex local_index;
+static struct ClientIndex global_index;
+static bool global_index_kept = false;
+
 /*
  * look in whowas.c for the missing ...[WW_MAX]; entry
  */
@@ -66,6 +95,11 @@ init_hash(void)
 	resv_tree = rb_radixtree_create("resv", irccasecanon);
 
 	hostname_tree = rb_radixtree_create("hostname", irccasecanon);
+
+	local_index.ip_tree = rb_new_patricia(PATRICIA_BITS);
+	local_index.host_tree = rb_radixtree_create("local host suffix", irccasecanon);
+	global_index.ip_tree = rb_new_patricia(PATRICIA_BITS);
+	global_index.host_tree = rb_radixtree_create("host suffix", irccasecanon);
 }
 
 uint32_t
@@ -182,6 +216,444 @@ add_to_hostname_hash(const char *hostname, struct Client *client_p)
 	rb_dlinkAddAlloc(client_p, list);
 }
 
+/* host_suffixes()
+ *
+ * input	- host, array to fill, size of array
+ * output	- number of suffixes found
+ * side effects - the host itself and everything following each '.' in it
+ */
+static int
+host_suffixes(const char *host, const char **suffixes, int max)
+{
+	int count = 0;
+
+	while(!EmptyString(host) && count < max)
+	{
+		suffixes[count++] = host;
+		if((host = strchr(host, '.')) != NULL)
+			host++;
+	}
+
+	return count;
+}
+
+static void
+index_add_ip(struct ClientIndex *index, struct ClientIndexEntry *entry,
+	     struct Client *client_p, int slot, struct sockaddr *addr, int bits)
+{
+	rb_patricia_node_t *pnode;
+
+	if((pnode = make_and_lookup_ip(index->ip_tree, addr, bits)) == NULL)
+		return;
+
+	if(pnode->data == NULL)
+		pnode->data = rb_malloc(sizeof(rb_dlink_list));
+
+	rb_dlinkAdd(client_p, &entry->ip_node[slot], pnode->data);
+	entry->ip[slot] = pnode;
+}
+
+/* index_add()
+ *
+ * input	- index, client, address (may be NULL), two hosts (may be NULL)
+ * output	- the client's entry, to be given back to index_del()
+ * side effects - the client is listed under its address and under every
+ *		  suffix of the hosts.  The hosts are copied, so the client's
+ *		  own may change as long as it is taken out of the index first.
+ */
+static struct ClientIndexEntry *
+index_add(struct ClientIndex *index, struct Client *client_p,
+	  struct sockaddr *addr, const char *host1, const char *host2)
+{
+	struct ClientIndexEntry *entry;
+	const char *suffixes[2 * (HOSTLEN + 1)];
+	struct sockaddr_in ip4;
+	rb_dlink_list *list;
+	char *keys;
+	size_t len1, len2;
+	int count, i, j;
+
+	len1 = EmptyString(host1) ? 0 : strlen(host1) + 1;
+	len2 = EmptyString(host2) || (len1 && !irccmp(host1, host2)) ? 0 : strlen(host2) + 1;
+
+	count = len1 ? host_suffixes(host1, suffixes, HOSTLEN + 1) : 0;
+	if(len2)
+		count += host_suffixes(host2, suffixes + count, HOSTLEN + 1);
+
+	/* the entry, its host references and the copied hosts, in one go */
+	entry = rb_malloc(sizeof(struct ClientIndexEntry) +
+			sizeof(struct IndexHostRef) * count + len1 + len2);
+	entry->host = (struct IndexHostRef *)(entry + 1);
+	keys = (char *)(entry->host + count);
+
+	if(len1)
+		memcpy(keys, host1, len1);
+	if(len2)
+		memcpy(keys + len1, host2, len2);
+
+	if(addr != NULL && addr->sa_family == AF_INET6)
+	{
+		index_add_ip(index, entry, client_p, 0, addr, 128);
+
+		/* v4 masks apply to v4-mapped addresses too */
+		if(rb_ipv4_from_ipv6((const struct sockaddr_in6 *)addr, &ip4))
+			index_add_ip(index, entry, client_p, 1, (struct sockaddr *)&ip4, 32);
+	}
+	else if(addr != NULL && addr->sa_family == AF_INET)
+		index_add_ip(index, entry, client_p, 0, addr, 32);
+
+	/* the same suffixes again, within the copies */
+	count = len1 ? host_suffixes(keys, suffixes, HOSTLEN + 1) : 0;
+	if(len2)
+		count += host_suffixes(keys + len1, suffixes + count, HOSTLEN + 1);
+
+	for(i = 0; i < count; i++)
+	{
+		/* the two hosts may share a suffix, only list the client once */
+		for(j = 0; j < entry->host_count; j++)
+			if(!irccmp(entry->host[j].key, suffixes[i]))
+				break;
+		if(j < entry->host_count)
+			continue;
+
+		if((list = rb_radixtree_retrieve(index->host_tree, suffixes[i])) == NULL)
+		{
+			list = rb_malloc(sizeof(rb_dlink_list));
+			rb_radixtree_add(index->host_tree, suffixes[i], list);
+		}
+
+		j = entry->host_count++;
+		entry->host[j].key = suffixes[i];
+		entry->host[j].list = list;
+		rb_dlinkAdd(client_p, &entry->host[j].node, list);
+	}
+
+	return entry;
+}
+
+/* index_del()
+ *
+ * input	- index, client's entry from index_add()
+ * output	-
+ * side effects - the client is taken out of the index and the entry freed
+ */
+static void
+index_del(struct ClientIndex *index, struct ClientIndexEntry *entry)
+{
+	struct IndexHostRef *ref;
+	rb_patricia_node_t *pnode;
+	int i;
+
+	for(i = 0; i < 2; i++)
+	{
+		if((pnode = entry->ip[i]) == NULL)
+			continue;
+
+		rb_dlinkDelete(&entry->ip_node[i], pnode->data);
+		if(rb_dlink_list_length((rb_dlink_list *)pnode->data) == 0)
+		{
+			rb_free(pnode->data);
+			pnode->data = NULL;
+			rb_patricia_remove(index->ip_tree, pnode);
+		}
+	}
+
+	for(i = 0; i < entry->host_count; i++)
+	{
+		ref = &entry->host[i];
+
+		rb_dlinkDelete(&ref->node, ref->list);
+		if(rb_dlink_list_length(ref->list) == 0)
+		{
+			rb_radixtree_delete(index->host_tree, ref->key);
+			rb_free(ref->list);
+		}
+	}
+
+	rb_free(entry);
+}
+
+/* index_ip_within()
+ *
+ * input	- index node, family and address of a network, prefix length
+ * output	- true if the node's address is within the network
+ */
+static bool
+index_ip_within(rb_patricia_node_t *node, int family, const unsigned char *ip, int bits)
+{
+	const unsigned char *nip = (const unsigned char *)&node->prefix->add;
+	int bytes = bits / 8, rest = bits % 8;
+
+	if(node->prefix->family != family || memcmp(nip, ip, bytes) != 0)
+		return false;
+
+	return rest == 0 || ((nip[bytes] ^ ip[bytes]) & (0xff << (8 - rest))) == 0;
+}
+
+/* index_find_by_ip()
+ *
+ * input	- index, network address and prefix length, list to fill
+ * output	-
+ * side effects - clients whose address is within the network are
+ *		  added to the list
+ */
+static void
+index_find_by_ip(struct ClientIndex *index, const struct sockaddr *addr, int bits,
+		 rb_dlink_list *found)
+{
+	rb_patricia_node_t *pnode = index->ip_tree->head;
+	rb_patricia_node_t *xnode;
+	const unsigned char *ip;
+	rb_dlink_node *ptr;
+
+	if(addr->sa_family == AF_INET6)
+		ip = (const unsigned char *)&((const struct sockaddr_in6 *)addr)->sin6_addr;
+	else
+		ip = (const unsigned char *)&((const struct sockaddr_in *)addr)->sin_addr;
+
+	/* descend to the first node which tests a bit beyond the
+	 * prefix, every address within the network is below it
+	 */
+	while(pnode != NULL && pnode->bit < (unsigned int)bits)
+	{
+		if(ip[pnode->bit >> 3] & (0x80 >> (pnode->bit & 0x07)))
+			pnode = pnode->r;
+		else
+			pnode = pnode->l;
+	}
+
+	if(pnode == NULL)
+		return;
+
+	RB_PATRICIA_WALK(pnode, xnode)
+	{
+		/* the walk starts where the address first differs, which
+		 * may be outside the network altogether
+		 */
+		if(xnode->data != NULL && index_ip_within(xnode, addr->sa_family, ip, bits))
+		{
+			RB_DLINK_FOREACH(ptr, ((rb_dlink_list *)xnode->data)->head)
+				rb_dlinkAddAlloc(ptr->data, found);
+		}
+	}
+	RB_PATRICIA_WALK_END;
+}
+
+/* host_mask_tail()
+ *
+ * input	- host mask
+ * output	- the whole labels ending the mask after its last wildcard,
+ *		  or NULL if there are none
+ */
+const char *
+host_mask_tail(const char *mask)
+{
+	const char *tail = mask;
+	const char *p;
+
+	/* whatever follows the last wildcard has to end the host */
+	for(p = mask; *p != '\0'; p++)
+		if(*p == '*' || *p == '?')
+			tail = p + 1;
+
+	/* only whole labels can be looked up, so unless the mask has no
+	 * wildcards at all skip whatever may be the end of a label
+	 */
+	if(tail != mask)
+	{
+		if(*tail != '.' && (tail = strchr(tail, '.')) == NULL)
+			return NULL;
+		tail++;
+	}
+
+	if(EmptyString(tail))
+		return NULL;
+
+	return tail;
+}
+
+/* index_find_by_hostmask()
+ *
+ * input	- index, host mask, list to fill
+ * output	- false if the mask is too wild to use the index
+ * side effects - clients whose hosts may match the mask are added to
+ *		  the list, callers must still check each one
+ */
+static bool
+index_find_by_hostmask(struct ClientIndex *index, const char *mask, rb_dlink_list *found)
+{
+	const char *tail = host_mask_tail(mask);
+	rb_dlink_list *list;
+	rb_dlink_node *ptr;
+
+	if(tail == NULL)
+		return false;
+
+	if((list = rb_radixtree_retrieve(index->host_tree, tail)) != NULL)
+	{
+		RB_DLINK_FOREACH(ptr, list->head)
+			rb_dlinkAddAlloc(ptr->data, found);
+	}
+
+	return true;
+}
+
+/* add_to_local_index()
+ *
+ * adds a local user to the IP and host suffix indexes
+ */
+void
+add_to_local_index(struct Client *client_p)
+{
+	struct LocalUser *lclient_p = client_p->localClient;
+
+	s_assert(lclient_p->ban_index == NULL);
+
+	lclient_p->ban_index = index_add(&local_index, client_p,
+			(struct sockaddr *)&lclient_p->ip, client_p->orighost, client_p->sockhost);
+}
+
+/* del_from_local_index()
+ *
+ * removes a local user from the IP and host suffix indexes
+ */
+void
+del_from_local_index(struct Client *client_p)
+{
+	struct LocalUser *lclient_p = client_p->localClient;
+
+	if(lclient_p->ban_index == NULL)
+		return;
+
+	index_del(&local_index, lclient_p->ban_index);
+	lclient_p->ban_index = NULL;
+}
+
+/* find_local_by_ip()
+ *
+ * input	- network address and prefix length, list to fill
+ * output	-
+ * side effects - local users whose address is within the network are
+ *		  added to the list
+ */
+void
+find_local_by_ip(struct sockaddr *addr, int bits, rb_dlink_list *found)
+{
+	index_find_by_ip(&local_index, addr, bits, found);
+}
+
+/* find_local_by_hostmask()
+ *
+ * input	- host mask, list to fill
+ * output	- false if the mask is too wild to use the index
+ * side effects - local users whose host or IP text may match the mask
+ *		  are added to the list, callers must still check each one
+ */
+bool
+find_local_by_hostmask(const char *mask, rb_dlink_list *found)
+{
+	return index_find_by_hostmask(&local_index, mask, found);
+}
+
+/* add_to_global_index()
+ *
+ * adds a user to the network wide IP and host suffix indexes, if
+ * general::who_indexes has them kept
+ */
+void
+add_to_global_index(struct Client *client_p)
+{
+	struct rb_sockaddr_storage addr;
+	struct sockaddr *addrp = NULL;
+
+	if(!global_index_kept || client_p->user == NULL)
+		return;
+
+	s_assert(client_p->user->who_index == NULL);
+
+	/* remote users with no known address have "0" */
+	if(rb_inet_pton_sock(client_p->sockhost, &addr) > 0)
+		addrp = (struct sockaddr *)&addr;
+
+	client_p->user->who_index = index_add(&global_index, client_p,
+			addrp, client_p->host, client_p->orighost);
+}
+
+/* del_from_global_index()
+ *
+ * removes a user from the network wide IP and host suffix indexes
+ */
+void
+del_from_global_index(struct Client *client_p)
+{
+	if(client_p->user == NULL || client_p->user->who_index == NULL)
+		return;
+
+	index_del(&global_index, client_p->user->who_index);
+	client_p->user->who_index = NULL;
+}
+
+/* rehash_global_index()
+ *
+ * builds or drops the network wide indexes to follow general::who_indexes
+ */
+void
+rehash_global_index(void)
+{
+	rb_dlink_node *ptr;
+
+	if(global_index_kept == (bool)ConfigFileEntry.who_indexes)
+		return;
+
+	global_index_kept = ConfigFileEntry.who_indexes;
+
+	RB_DLINK_FOREACH(ptr, global_client_list.head)
+	{
+		struct Client *client_p = ptr->data;
+
+		if(!IsPerson(client_p))
+			continue;
+
+		if(global_index_kept)
+			add_to_global_index(client_p);
+		else
+			del_from_global_index(client_p);
+	}
+}
+
+/* find_global_by_ip()
+ *
+ * input	- network address and prefix length, list to fill
+ * output	- false if the indexes are not kept
+ * side effects - users whose address is within the network are added
+ *		  to the list
+ */
+bool
+find_global_by_ip(struct sockaddr *addr, int bits, rb_dlink_list *found)
+{
+	if(!global_index_kept)
+		return false;
+
+	index_find_by_ip(&global_index, addr, bits, found);
+	return true;
+}
+
+/* find_global_by_hostmask()
+ *
+ * input	- host mask, list to fill
+ * output	- false if the indexes are not kept or the mask is too wild
+ * side effects - users whose host or original host may match the mask
+ *		  are added to the list, callers must still check each one
+ */
+bool
+find_global_by_hostmask(const char *mask, rb_dlink_list *found)
+{
+	if(!global_index_kept)
+		return false;
+
+	return index_find_by_hostmask(&global_index, mask, found);
+}
+
 /* add_to_resv_hash()
  *
  * adds a resv channel entry to the resv hash table
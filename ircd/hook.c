@@ -178,6 +178,32 @@ register_hook(const char *name)
 	return i;
 }
 
+/* build_hook()
+ *   Copies an event's hooks into the array call_hook() runs, in priority
+ *   order.
+ */
+static void
+build_hook(hook *h)
+{
+	rb_dlink_node *ptr;
+	int i = 0;
+
+	rb_free(h->fns);
+	h->fns = NULL;
+	h->nfns = 0;
+
+	if(rb_dlink_list_length(&h->hooks) == 0)
+		return;
+
+	h->fns = rb_malloc(sizeof(hookfn) * rb_dlink_list_length(&h->hooks));
+	RB_DLINK_FOREACH(ptr, h->hooks.head)
+	{
+		struct hook_entry *entry = ptr->data;
+		h->fns[i++] = entry->fn;
+	}
+	h->nfns = i;
+}
+
 /* add_hook()
  *   Adds a hook to an event in the hook table, creating event first if
  *   needed.
@@ -208,11 +234,13 @@ add_hook_prio(const char *name, hookfn fn, enum hook_priority priority)
 		if (entry->priority <= o->priority)
 		{
 			rb_dlinkAddBefore(ptr, entry, &entry->node, &hooks[i].hooks);
+			build_hook(&hooks[i]);
 			return;
 		}
 	}
 
 	rb_dlinkAddTail(entry, &entry->node, &hooks[i].hooks);
+	build_hook(&hooks[i]);
 }
 
 /* remove_hook()
@@ -233,26 +261,37 @@ remove_hook(const char *name, const hookfn fn)
 		if (entry->fn == fn)
 		{
 			rb_dlinkDelete(ptr, &hooks[i].hooks);
+			rb_free(entry);
+			build_hook(&hooks[i]);
 			return;
 		}
 	}
 }
 
-/* call_hook()
- *   Calls functions from a given event in the hook table.
+/* dispatch_hook()
+ *   Calls functions from a given event in the hook table.  call_hook()
+ *   only gets here if there are any.
  */
 void
-call_hook(int id, void *arg)
+dispatch_hook(int id, void *arg)
 {
-	rb_dlink_node *ptr;
+	hook *h;
+	struct timespec start, end;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-	/* The ID we were passed is the position in the hook table of this
-	 * hook
+	/* a hook may add or remove hooks, even register new events and move
+	 * the table, so look everything up again each time round
 	 */
-	RB_DLINK_FOREACH(ptr, hooks[id].hooks.head)
-	{
-		struct hook_entry *entry = ptr->data;
-		entry->fn(arg);
-	}
+	for(i = 0; i < hooks[id].nfns; i++)
+		hooks[id].fns[i](arg);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	h = &hooks[id];
+	h->calls++;
+	h->nsec += (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000 +
+		end.tv_nsec - start.tv_nsec;
 }
 
@@ -180,6 +180,9 @@ ircd_shutdown(const char *reason)
 	}
 
 	ilog(L_MAIN, "Server Terminating. %s", reason);
+
+	/* we exit before the io loop would have written these */
+	send_flush_pending(NULL);
 	close_logfiles();
 
 	unlink(pidFileName);
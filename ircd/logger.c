@@ -40,6 +40,51 @@
 #include "client.h"
 #include "s_serv.h"
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <poll.h>
+#endif
+
+/*
+ * ilog() does not write to the log files itself.  It formats the line
+ * into log_ring, and a writer thread takes lines off the other end and
+ * writes them out in batches, every LOG_FLUSH_INTERVAL or sooner once
+ * LOG_FLUSH_SIZE bytes are waiting.  ilog() never waits for the writer:
+ * if the ring is full the line is dropped and counted, and the writer
+ * notes how many were lost in that log when it next gets to it.
+ *
+ * There is one producer, the main thread, so the ring needs no lock on
+ * that side.  Whoever holds log_lock may take lines off it; that is the
+ * writer, or the main thread while opening and closing the files.  Built
+ * without threads, or if the thread cannot be started, ilog() writes the
+ * ring out before it returns, as it always used to.
+ *
+ * Logs listed in logging::fsync are fsync()ed after each batch.
+ */
+
+#define LOG_RING_SIZE		(1024 * 1024)	/* a power of two */
+#define LOG_FLUSH_SIZE		(64 * 1024)
+#define LOG_FLUSH_INTERVAL	1000		/* milliseconds */
+
+struct log_record
+{
+	uint16_t dest;
+	uint16_t len;
+};
+
+static unsigned char log_ring[LOG_RING_SIZE];
+static size_t log_head;		/* only ilog() moves this */
+static size_t log_tail;		/* only the holder of log_lock moves this */
+static unsigned long log_lost[LAST_LOGFILE];
+static int log_threaded;
+static int log_kicked;
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t log_thread;
+static int log_wake[2] = { -1, -1 };
+#endif
+
 static FILE *log_main;
 static FILE *log_user;
 static FILE *log_fuser;
@@ -54,6 +99,7 @@ struct log_struct
 {
 	char **name;
 	FILE **logfile;
+	bool fsync;
 };
 
 static struct log_struct log_table[LAST_LOGFILE] =
@@ -69,6 +115,243 @@ static struct log_struct log_table[LAST_LOGFILE] =
 	{ &ConfigFileEntry.fname_ioerrorlog,	&log_ioerror	}
 };
 
+static void
+log_lock_take(void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&log_lock);
+#endif
+}
+
+static void
+log_lock_release(void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&log_lock);
+#endif
+}
+
+static void
+ring_put(size_t pos, const void *data, size_t len)
+{
+	size_t off = pos & (LOG_RING_SIZE - 1);
+	size_t first = MIN(len, LOG_RING_SIZE - off);
+
+	memcpy(log_ring + off, data, first);
+	memcpy(log_ring, (const unsigned char *)data + first, len - first);
+}
+
+static void
+ring_get(size_t pos, void *data, size_t len)
+{
+	size_t off = pos & (LOG_RING_SIZE - 1);
+	size_t first = MIN(len, LOG_RING_SIZE - off);
+
+	memcpy(data, log_ring + off, first);
+	memcpy((unsigned char *)data + first, log_ring, len - first);
+}
+
+/* smalldate() for the writer, which cannot share its buffer */
+static void
+log_date(char *buf, size_t len)
+{
+	time_t now = time(NULL);
+	struct tm lt;
+
+	localtime_r(&now, &lt);
+	snprintf(buf, len, "%d/%d/%d %02d.%02d",
+		    lt.tm_year + 1900, lt.tm_mon + 1,
+		    lt.tm_mday, lt.tm_hour, lt.tm_min);
+}
+
+static bool
+log_write(ilogfile dest, const char *data, size_t len)
+{
+	FILE *logfile = *log_table[dest].logfile;
+
+	if(logfile == NULL)
+		return false;
+
+	if(fwrite(data, 1, len, logfile) != len)
+	{
+		fclose(logfile);
+		__atomic_store_n(log_table[dest].logfile, NULL, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	return true;
+}
+
+/* log_drain()
+ *
+ * inputs	-
+ * outputs	-
+ * side effects	- writes out everything on the ring; caller holds log_lock
+ */
+static void
+log_drain(void)
+{
+	struct log_record rec;
+	char line[MAX_DATE_STRING + 1 + BUFSIZE + 1];
+	char date[MAX_DATE_STRING];
+	size_t head = __atomic_load_n(&log_head, __ATOMIC_ACQUIRE);
+	size_t tail = log_tail;
+	unsigned long lost;
+	bool dirty[LAST_LOGFILE] = { false };
+	FILE *logfile;
+	int i;
+
+	while(tail != head)
+	{
+		ring_get(tail, &rec, sizeof(rec));
+		ring_get(tail + sizeof(rec), line, rec.len);
+		tail += sizeof(rec) + rec.len;
+		__atomic_store_n(&log_tail, tail, __ATOMIC_RELEASE);
+
+		if(log_write(rec.dest, line, rec.len))
+			dirty[rec.dest] = true;
+	}
+
+	for(i = 0; i < LAST_LOGFILE; i++)
+	{
+		if((lost = __atomic_exchange_n(&log_lost[i], 0, __ATOMIC_RELAXED)) != 0)
+		{
+			log_date(date, sizeof(date));
+			snprintf(line, sizeof(line), "%s %lu lines lost, log buffer full\n",
+					date, lost);
+			if(log_write(i, line, strlen(line)))
+				dirty[i] = true;
+		}
+
+		if(!dirty[i] || (logfile = *log_table[i].logfile) == NULL)
+			continue;
+
+		if(fflush(logfile) != 0)
+		{
+			fclose(logfile);
+			__atomic_store_n(log_table[i].logfile, NULL, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		if(log_table[i].fsync)
+			fsync(fileno(logfile));
+	}
+}
+
+#ifdef HAVE_PTHREAD
+static void *
+log_writer(void *unused)
+{
+	struct pollfd pfd;
+	char junk[64];
+
+	pfd.fd = log_wake[0];
+	pfd.events = POLLIN;
+
+	for(;;)
+	{
+		if(poll(&pfd, 1, LOG_FLUSH_INTERVAL) < 0 && errno != EINTR)
+			break;
+		/* the restart code closes every fd on its way out */
+		if(pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+			break;
+
+		while(read(log_wake[0], junk, sizeof(junk)) > 0)
+			;
+		__atomic_store_n(&log_kicked, 0, __ATOMIC_RELAXED);
+
+		pthread_mutex_lock(&log_lock);
+		log_drain();
+		pthread_mutex_unlock(&log_lock);
+	}
+
+	__atomic_store_n(&log_threaded, 0, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/* whatever is still on the ring when we exit */
+static void
+log_atexit(void)
+{
+	pthread_mutex_lock(&log_lock);
+	log_drain();
+	pthread_mutex_unlock(&log_lock);
+}
+
+static void
+start_log_writer(void)
+{
+	sigset_t all, old;
+	int i;
+
+	if(log_threaded || pipe(log_wake) < 0)
+		return;
+
+	for(i = 0; i < 2; i++)
+	{
+		fcntl(log_wake[i], F_SETFL, O_NONBLOCK);
+		fcntl(log_wake[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	/* signals are for the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	if(pthread_create(&log_thread, NULL, log_writer, NULL) == 0)
+	{
+		pthread_detach(log_thread);
+		log_threaded = 1;
+		atexit(log_atexit);
+	}
+	else
+	{
+		close(log_wake[0]);
+		close(log_wake[1]);
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+#endif
+
+static void
+log_append(ilogfile dest, const char *data, size_t len)
+{
+	struct log_record rec;
+	size_t head = log_head;
+	size_t used = head - __atomic_load_n(&log_tail, __ATOMIC_ACQUIRE);
+
+	if(LOG_RING_SIZE - used < sizeof(rec) + len)
+	{
+		__atomic_add_fetch(&log_lost[dest], 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	rec.dest = dest;
+	rec.len = len;
+	ring_put(head, &rec, sizeof(rec));
+	ring_put(head + sizeof(rec), data, len);
+	__atomic_store_n(&log_head, head + sizeof(rec) + len, __ATOMIC_RELEASE);
+
+	if(!__atomic_load_n(&log_threaded, __ATOMIC_ACQUIRE))
+	{
+		log_lock_take();
+		log_drain();
+		log_lock_release();
+		return;
+	}
+
+#ifdef HAVE_PTHREAD
+	if(used + sizeof(rec) + len >= LOG_FLUSH_SIZE &&
+			!__atomic_exchange_n(&log_kicked, 1, __ATOMIC_RELAXED))
+	{
+		if(write(log_wake[1], "", 1) < 0)
+		{
+			/* the pipe is full, so the writer is awake anyway */
+		}
+	}
+#endif
+}
+
 static void
 verify_logfile_access(const char *filename)
 {
@@ -119,6 +402,10 @@ init_main_logfile(void)
 	{
 		log_main = fopen(logFileName, "a");
 	}
+
+#ifdef HAVE_PTHREAD
+	start_log_writer();
+#endif
 }
 
 void
@@ -128,18 +415,26 @@ open_logfiles(void)
 
 	close_logfiles();
 
+	/* before taking the lock, as the warnings it sends may be logged */
+	for(i = 1; i < LAST_LOGFILE; i++)
+		if(!EmptyString(*log_table[i].name))
+			verify_logfile_access(*log_table[i].name);
+
+	log_lock_take();
+
 	log_main = fopen(logFileName, "a");
+	log_table[0].fsync = ConfigFileEntry.log_fsync & (1 << L_MAIN);
 
 	/* log_main is handled above, so just do the rest */
 	for(i = 1; i < LAST_LOGFILE; i++)
 	{
 		/* reopen those with paths */
 		if(!EmptyString(*log_table[i].name))
-		{
-			verify_logfile_access(*log_table[i].name);
 			*log_table[i].logfile = fopen(*log_table[i].name, "a");
-		}
+		log_table[i].fsync = ConfigFileEntry.log_fsync & (1 << i);
 	}
+
+	log_lock_release();
 }
 
 void
@@ -147,8 +442,15 @@ close_logfiles(void)
 {
 	int i;
 
+	/* lines already logged go to the files they were meant for */
+	log_lock_take();
+	log_drain();
+
 	if(log_main != NULL)
+	{
 		fclose(log_main);
+		log_main = NULL;
+	}
 
 	/* log_main is handled above, so just do the rest */
 	for(i = 1; i < LAST_LOGFILE; i++)
@@ -159,34 +461,44 @@ close_logfiles(void)
 			*log_table[i].logfile = NULL;
 		}
 	}
+
+	log_lock_release();
 }
 
+/* ilog() must only be called from the main thread. */
 void
 ilog(ilogfile dest, const char *format, ...)
 {
-	FILE *logfile = *log_table[dest].logfile;
-	char buf[BUFSIZE];
-	char buf2[MAX_DATE_STRING + 1 + BUFSIZE + 1];
+	static time_t datetime;
+	static char date[MAX_DATE_STRING + 1];
+	static size_t datelen;
+	char buf[MAX_DATE_STRING + 1 + BUFSIZE + 1];
 	va_list args;
+	int len;
 
-	if(logfile == NULL)
+	if(__atomic_load_n(log_table[dest].logfile, __ATOMIC_RELAXED) == NULL)
 		return;
 
+	if(datetime != rb_current_time() || datelen == 0)
+	{
+		datetime = rb_current_time();
+		datelen = snprintf(date, sizeof(date), "%s ", smalldate(datetime));
+	}
+	memcpy(buf, date, datelen);
+
 	va_start(args, format);
-	vsnprintf(buf, sizeof(buf), format, args);
+	len = vsnprintf(buf + datelen, BUFSIZE, format, args);
 	va_end(args);
 
-	snprintf(buf2, sizeof(buf2), "%s %s\n",
-			smalldate(rb_current_time()), buf);
-
-	if(fputs(buf2, logfile) < 0)
-	{
-		fclose(logfile);
-		*log_table[dest].logfile = NULL;
+	if(len < 0)
 		return;
-	}
+	if(len >= BUFSIZE)
+		len = BUFSIZE - 1;
+
+	len += datelen;
+	buf[len++] = '\n';
 
-	fflush(logfile);
+	log_append(dest, buf, len);
 }
 
 static void
@@ -0,0 +1,515 @@
+/*
+ *  ircd-ratbox: A slightly useful ircd.
+ *  maskset.c: Sets of match_esc() masks looked up together.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ */
+
+/*
+ * Every mask that has any literal text in it is filed under its longest
+ * run of literal characters (its anchor), and the anchors are compiled
+ * into one Aho-Corasick automaton.  A lookup walks the name through the
+ * automaton once, and only masks whose anchor turns up in the name are
+ * tried with match_esc().  An anchor that has to sit at a fixed distance
+ * from the start or end of the name (a literal prefix or suffix, give or
+ * take some ?s) is checked for position before that, as is the shortest
+ * name the mask could match.  Masks with no literal text at all, such as
+ * "*" or "?*?", are simply tried on every lookup.
+ *
+ * Masks added since the automaton was built are tried one by one, and
+ * deleted ones stay in it marked dead, until there are enough of either
+ * to be worth building it again.  That happens on the next lookup, so
+ * loading a few thousand bans only builds it once.
+ *
+ * match_esc() always has the final say, so what matches is exactly what
+ * the linear scan over the list would have matched.
+ */
+
+#include "stdinc.h"
+#include "maskset.h"
+#include "match.h"
+#include "rb_dictionary.h"
+#include "s_assert.h"
+
+#define MS_PENDING_MAX	32	/* masks tried one by one before a rebuild */
+
+enum ms_kind
+{
+	MS_FLOAT,		/* anchor anywhere in the name */
+	MS_START,		/* anchor offset chars from the start */
+	MS_END,			/* anchor offset chars from the end */
+};
+
+struct ms_entry
+{
+	char *mask;
+	unsigned char *anchor;	/* folded */
+	void *data;		/* NULL once deleted */
+	unsigned long serial;	/* higher is more recent */
+	unsigned long seen;	/* lookup that last tried this */
+	size_t minlen;		/* shortest name that could match */
+	bool exact;		/* no '*', so names are exactly minlen */
+	enum ms_kind kind;
+	size_t offset;
+	size_t anchorlen;	/* 0 if there is nothing to anchor on */
+	bool compiled;
+	struct ms_entry *next_out;
+	rb_dlink_node node;
+};
+
+struct ms_node
+{
+	unsigned char *keys;	/* sorted */
+	unsigned int *next;
+	unsigned int nchild;
+	unsigned int fail;
+	unsigned int dict;	/* next node down the fail chain with output */
+	struct ms_entry *out;
+};
+
+struct maskset
+{
+	rb_dictionary *entries;	/* data -> entry */
+	rb_dlink_list compiled;	/* in the automaton, dead ones included */
+	rb_dlink_list pending;	/* added since it was built */
+	rb_dlink_list residual;	/* nothing to anchor on */
+	unsigned long dead;
+	unsigned long serial;
+	unsigned long lookups;
+
+	struct ms_node *nodes;
+	unsigned int nnodes;
+	unsigned int maxnodes;
+};
+
+static int
+ms_ptrcmp(const void *a, const void *b)
+{
+	uintptr_t x = (uintptr_t)a, y = (uintptr_t)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* ms_analyse()
+ *
+ * inputs	- entry, buffer of at least strlen(mask) + 1
+ * outputs	- anchor for the mask, folded, written to buf
+ * side effects	- fills in the kind, position and length of the anchor
+ *
+ * Tokens are as match_esc() sees them: '*', one of "?@#" for a single
+ * character of a class, or a literal, which may be escaped ("\s" is a
+ * space).  The longest run of literals is the anchor.  It is fixed to
+ * the start if no '*' comes before it and to the end if none comes after.
+ *
+ * match_esc() lets "\*" followed by nothing but '?' match trailing junk,
+ * so masks with "\*" in them are never fixed to the end or exact.
+ */
+static void
+ms_analyse(struct ms_entry *e, unsigned char *buf)
+{
+	const unsigned char *m = (const unsigned char *)e->mask;
+	size_t tokens = 0, firststar = 0, laststar = 0;
+	size_t run = 0, runstart = 0, best = 0, beststart = 0;
+	bool stars = false, escstar = false, literal;
+	unsigned char c;
+
+	e->kind = MS_FLOAT;
+	e->offset = 0;
+
+	for(;; m++)
+	{
+		c = *m;
+		literal = false;
+
+		if(c == '\\' && m[1] != '\0')
+		{
+			c = *++m;
+			if(c == '*')
+				escstar = true;
+			else if(c == 's')
+				c = ' ';
+			literal = true;
+		}
+		else if(c == '\\')
+			c = '\0';
+		else if(c != '\0' && c != '*' && c != '?' && c != '@' && c != '#')
+			literal = true;
+
+		if(literal)
+		{
+			if(run++ == 0)
+				runstart = tokens;
+			buf[tokens++] = irctolower(c);
+			continue;
+		}
+
+		/* a run has ended; the first of the longest wins */
+		if(run > best)
+		{
+			best = run;
+			beststart = runstart;
+		}
+		run = 0;
+
+		if(c == '\0')
+			break;
+
+		if(c == '*')
+		{
+			if(!stars)
+				firststar = tokens;
+			stars = true;
+			laststar = tokens;
+		}
+		else
+			buf[tokens++] = '\0';
+	}
+
+	e->minlen = tokens;
+	e->exact = !stars && !escstar;
+	e->anchorlen = best;
+
+	if(best == 0)
+		return;
+
+	if(!stars || firststar > beststart)
+	{
+		e->kind = MS_START;
+		e->offset = beststart;
+	}
+	else if(laststar <= beststart && !escstar)
+	{
+		e->kind = MS_END;
+		e->offset = tokens - beststart - best;
+	}
+
+	memmove(buf, buf + beststart, best);
+	buf[best] = '\0';
+}
+
+static unsigned int
+ms_child(struct ms_node *node, unsigned char c)
+{
+	unsigned int lo = 0, hi = node->nchild, mid;
+
+	while(lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if(node->keys[mid] == c)
+			return node->next[mid];
+		if(node->keys[mid] < c)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return 0;
+}
+
+static unsigned int
+ms_new_node(struct maskset *set)
+{
+	if(set->nnodes == set->maxnodes)
+	{
+		set->maxnodes = set->maxnodes ? set->maxnodes * 2 : 64;
+		set->nodes = rb_realloc(set->nodes, set->maxnodes * sizeof(struct ms_node));
+	}
+	memset(&set->nodes[set->nnodes], 0, sizeof(struct ms_node));
+	return set->nnodes++;
+}
+
+static void
+ms_insert(struct maskset *set, struct ms_entry *e, const unsigned char *anchor)
+{
+	struct ms_node *node;
+	unsigned int cur = 0, next, i;
+
+	for(; *anchor != '\0'; anchor++)
+	{
+		next = ms_child(&set->nodes[cur], *anchor);
+		if(next == 0)
+		{
+			next = ms_new_node(set);
+			node = &set->nodes[cur];
+			node->keys = rb_realloc(node->keys, node->nchild + 1);
+			node->next = rb_realloc(node->next, (node->nchild + 1) * sizeof(unsigned int));
+			for(i = node->nchild; i > 0 && node->keys[i - 1] > *anchor; i--)
+			{
+				node->keys[i] = node->keys[i - 1];
+				node->next[i] = node->next[i - 1];
+			}
+			node->keys[i] = *anchor;
+			node->next[i] = next;
+			node->nchild++;
+		}
+		cur = next;
+	}
+
+	e->next_out = set->nodes[cur].out;
+	set->nodes[cur].out = e;
+}
+
+static void
+ms_free_nodes(struct maskset *set)
+{
+	unsigned int i;
+
+	for(i = 0; i < set->nnodes; i++)
+	{
+		rb_free(set->nodes[i].keys);
+		rb_free(set->nodes[i].next);
+	}
+	rb_free(set->nodes);
+	set->nodes = NULL;
+	set->nnodes = set->maxnodes = 0;
+}
+
+static void
+ms_free_entry(struct ms_entry *e)
+{
+	rb_free(e->mask);
+	rb_free(e->anchor);
+	rb_free(e);
+}
+
+/* ms_build()
+ *
+ * Builds the automaton again from the live compiled and pending masks,
+ * freeing dead ones.  Fail links are set breadth first, so a node's fail
+ * link is always to a shallower node that is already done.
+ */
+static void
+ms_build(struct maskset *set)
+{
+	struct ms_entry *e;
+	struct ms_node *node;
+	rb_dlink_node *ptr, *next_ptr;
+	unsigned int *queue;
+	unsigned int head = 0, tail = 0, u, v, f, i;
+	unsigned char c;
+
+	ms_free_nodes(set);
+	ms_new_node(set);
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, set->pending.head)
+	{
+		rb_dlinkDelete(ptr, &set->pending);
+		rb_dlinkAddTail(ptr->data, ptr, &set->compiled);
+		((struct ms_entry *)ptr->data)->compiled = true;
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, set->compiled.head)
+	{
+		e = ptr->data;
+		if(e->data == NULL)
+		{
+			rb_dlinkDelete(ptr, &set->compiled);
+			ms_free_entry(e);
+			continue;
+		}
+
+		ms_insert(set, e, e->anchor);
+	}
+	set->dead = 0;
+
+	queue = rb_malloc(set->nnodes * sizeof(unsigned int));
+	queue[tail++] = 0;
+
+	while(head < tail)
+	{
+		u = queue[head++];
+
+		for(i = 0; i < set->nodes[u].nchild; i++)
+		{
+			v = set->nodes[u].next[i];
+			node = &set->nodes[v];
+
+			f = 0;
+			if(u != 0)
+			{
+				c = set->nodes[u].keys[i];
+				for(f = set->nodes[u].fail; f != 0; f = set->nodes[f].fail)
+					if(ms_child(&set->nodes[f], c) != 0)
+						break;
+				f = ms_child(&set->nodes[f], c);
+			}
+			node->fail = f;
+			node->dict = set->nodes[f].out != NULL ? f : set->nodes[f].dict;
+			queue[tail++] = v;
+		}
+	}
+	rb_free(queue);
+}
+
+struct maskset *
+maskset_create(void)
+{
+	struct maskset *set = rb_malloc(sizeof(struct maskset));
+
+	set->entries = rb_dictionary_create("maskset", ms_ptrcmp);
+	ms_new_node(set);
+	return set;
+}
+
+static void
+ms_free_list(rb_dlink_list *list)
+{
+	rb_dlink_node *ptr, *next_ptr;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, list->head)
+	{
+		rb_dlinkDelete(ptr, list);
+		ms_free_entry(ptr->data);
+	}
+}
+
+void
+maskset_destroy(struct maskset *set)
+{
+	rb_dictionary_destroy(set->entries, NULL, NULL);
+	ms_free_list(&set->compiled);
+	ms_free_list(&set->pending);
+	ms_free_list(&set->residual);
+	ms_free_nodes(set);
+	rb_free(set);
+}
+
+void
+maskset_add(struct maskset *set, const char *mask, void *data)
+{
+	struct ms_entry *e;
+
+	s_assert(data != NULL);
+	if(data == NULL || rb_dictionary_find(set->entries, data) != NULL)
+		return;
+
+	e = rb_malloc(sizeof(struct ms_entry));
+	e->mask = rb_strdup(mask);
+	e->anchor = rb_malloc(strlen(mask) + 1);
+	e->data = data;
+	e->serial = ++set->serial;
+	ms_analyse(e, e->anchor);
+
+	rb_dlinkAdd(e, &e->node, e->anchorlen > 0 ? &set->pending : &set->residual);
+	rb_dictionary_add(set->entries, data, e);
+}
+
+void
+maskset_del(struct maskset *set, void *data)
+{
+	struct ms_entry *e = rb_dictionary_delete(set->entries, data);
+
+	if(e == NULL)
+		return;
+
+	if(e->anchorlen == 0)
+	{
+		rb_dlinkDelete(&e->node, &set->residual);
+		ms_free_entry(e);
+	}
+	else if(!e->compiled)
+	{
+		rb_dlinkDelete(&e->node, &set->pending);
+		ms_free_entry(e);
+	}
+	else
+	{
+		/* the automaton still points at it */
+		e->data = NULL;
+		set->dead++;
+	}
+}
+
+/* ms_try()
+ *
+ * inputs	- entry whose anchor ends at name[end - 1], best so far
+ * outputs	- the better of the two
+ */
+static struct ms_entry *
+ms_try(struct maskset *set, struct ms_entry *e, const char *name,
+		size_t len, size_t end, struct ms_entry *best)
+{
+	if(e->data == NULL || e->seen == set->lookups)
+		return best;
+	if(best != NULL && e->serial < best->serial)
+		return best;
+	if(len < e->minlen || (e->exact && len != e->minlen))
+		return best;
+
+	switch(e->kind)
+	{
+	case MS_START:
+		if(end - e->anchorlen != e->offset)
+			return best;
+		break;
+	case MS_END:
+		if(len - end != e->offset)
+			return best;
+		break;
+	case MS_FLOAT:
+		break;
+	}
+
+	e->seen = set->lookups;
+	return match_esc(e->mask, name) ? e : best;
+}
+
+void *
+maskset_find(struct maskset *set, const char *name)
+{
+	struct ms_entry *e, *best = NULL;
+	struct ms_node *nodes;
+	rb_dlink_node *ptr;
+	unsigned int state = 0, o, next;
+	size_t len = strlen(name), i;
+
+	if(rb_dlink_list_length(&set->pending) > MS_PENDING_MAX ||
+			set->dead > rb_dlink_list_length(&set->compiled) / 4 + MS_PENDING_MAX)
+		ms_build(set);
+
+	set->lookups++;
+	nodes = set->nodes;
+
+	for(i = 0; i < len; i++)
+	{
+		unsigned char c = irctolower(name[i]);
+
+		while((next = ms_child(&nodes[state], c)) == 0 && state != 0)
+			state = nodes[state].fail;
+		state = next;
+
+		for(o = nodes[state].out != NULL ? state : nodes[state].dict; o != 0; o = nodes[o].dict)
+			for(e = nodes[o].out; e != NULL; e = e->next_out)
+				best = ms_try(set, e, name, len, i + 1, best);
+	}
+
+	RB_DLINK_FOREACH(ptr, set->pending.head)
+	{
+		e = ptr->data;
+		if(best == NULL || e->serial > best->serial)
+			if(match_esc(e->mask, name))
+				best = e;
+	}
+
+	RB_DLINK_FOREACH(ptr, set->residual.head)
+	{
+		e = ptr->data;
+		if(best == NULL || e->serial > best->serial)
+			if(match_esc(e->mask, name))
+				best = e;
+	}
+
+	return best != NULL ? best->data : NULL;
+}
@@ -234,7 +234,7 @@ msgbuf_unparse_tags(char *buf, size_t buflen, const struct MsgBuf *msgbuf, unsig
 
 		if (output + len > end)
 			break;
-		strcat(output, msgbuf->tags[i].key);
+		memcpy(output, msgbuf->tags[i].key, len);
 		output += len;
 
 		if (msgbuf->tags[i].value != NULL) {
@@ -375,7 +375,7 @@ msgbuf_cache_init(struct MsgBuf_cache *cache, const struct MsgBuf *msgbuf, const
 	}
 
 	for (int i = 0; i < MSGBUF_CACHE_SIZE; i++) {
-		cache->entry[i].caps = 0;
+		cache->entry[i].tagset = 0;
 		cache->entry[i].next = NULL;
 	}
 
@@ -400,12 +400,19 @@ msgbuf_cache_get(struct MsgBuf_cache *cache, unsigned int caps)
 	struct MsgBuf_cache_entry *prev = NULL;
 	struct MsgBuf_cache_entry *result = NULL;
 	struct MsgBuf_cache_entry *tail = NULL;
+	unsigned int tagset = 0;
 	int n = 0;
 
 	caps &= cache->overall_capmask;
 
+	/* tags are limited to MAXPARA, so one bit per tag fits */
+	for (size_t i = 0; i < cache->msgbuf->n_tags; i++) {
+		if (cache->msgbuf->tags[i].capmask & caps)
+			tagset |= 1U << i;
+	}
+
 	while (entry != NULL) {
-		if (entry->caps == caps) {
+		if (entry->tagset == tagset) {
 			/* Cache hit */
 			result = entry;
 			break;
@@ -439,7 +446,7 @@ msgbuf_cache_get(struct MsgBuf_cache *cache, unsigned int caps)
 			{ .format = cache->message, .length = DATALEN + 1, .next = NULL }
 		};
 
-		result->caps = caps;
+		result->tagset = tagset;
 		rb_linebuf_newbuf(&result->linebuf);
 		rb_linebuf_put(&result->linebuf, &strings[0]);
 	}
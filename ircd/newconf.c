@@ -67,6 +67,9 @@ static char *yy_opm_address_ipv6 = NULL;
 static uint16_t yy_opm_port_ipv4 = 0;
 static uint16_t yy_opm_port_ipv6 = 0;
 static int yy_opm_timeout = 0;
+static int yy_opm_max_scans = OPM_MAX_SCANS_DEFAULT;
+static int yy_opm_ipv4_prefix = OPM_IPV4_BITLEN_DEFAULT;
+static int yy_opm_ipv6_prefix = OPM_IPV6_BITLEN_DEFAULT;
 static rb_dlink_list yy_opm_scanner_list;
 
 static char *yy_privset_extends = NULL;
@@ -336,6 +339,19 @@ static struct mode_table auth_table[] = {
 	{NULL, 0}
 };
 
+static struct mode_table log_table[] = {
+	{"main",	1 << L_MAIN	},
+	{"userlog",	1 << L_USER	},
+	{"fuserlog",	1 << L_FUSER	},
+	{"operlog",	1 << L_OPERED	},
+	{"foperlog",	1 << L_FOPER	},
+	{"serverlog",	1 << L_SERVER	},
+	{"killlog",	1 << L_KILL	},
+	{"klinelog",	1 << L_KLINE	},
+	{"ioerrorlog",	1 << L_IOERROR	},
+	{NULL, 0}
+};
+
 static struct mode_table connect_table[] = {
 	{ "autoconn",	SERVER_AUTOCONN		},
 	{ "compressed",	0			},
@@ -1553,6 +1569,13 @@ conf_set_general_oper_umodes(void *data)
 	set_modes_from_table(&ConfigFileEntry.oper_umodes, "umode", umode_table, data);
 }
 
+static void
+conf_set_log_fsync(void *data)
+{
+	ConfigFileEntry.log_fsync = 0;
+	set_modes_from_table(&ConfigFileEntry.log_fsync, "log", log_table, data);
+}
+
 static void
 conf_set_general_certfp_method(void *data)
 {
@@ -1968,6 +1991,9 @@ conf_begin_opm(struct TopConf *tc)
 {
 	yy_opm_address_ipv4 = yy_opm_address_ipv6 = NULL;
 	yy_opm_port_ipv4 = yy_opm_port_ipv6 = yy_opm_timeout = 0;
+	yy_opm_max_scans = OPM_MAX_SCANS_DEFAULT;
+	yy_opm_ipv4_prefix = OPM_IPV4_BITLEN_DEFAULT;
+	yy_opm_ipv6_prefix = OPM_IPV6_BITLEN_DEFAULT;
 	delete_opm_proxy_scanner_all();
 	delete_opm_listener_all();
 	return 0;
@@ -2024,6 +2050,9 @@ conf_end_opm(struct TopConf *tc)
 	else if(yy_opm_timeout <= 0 || yy_opm_timeout >= 60)
 		conf_report_error("opm::timeout value is invalid -- ignoring");
 
+	if(!fail)
+		set_opm_scan_limits(yy_opm_max_scans, yy_opm_ipv4_prefix, yy_opm_ipv6_prefix);
+
 end:
 	RB_DLINK_FOREACH_SAFE(ptr, nptr, yy_opm_scanner_list.head)
 	{
@@ -2058,6 +2087,48 @@ conf_set_opm_timeout(void *data)
 	yy_opm_timeout = timeout;
 }
 
+static void
+conf_set_opm_max_scans(void *data)
+{
+	int max_scans = *((int *)data);
+
+	if(max_scans < 0)
+	{
+		conf_report_error("opm::max_scans value %d is bogus, ignoring", max_scans);
+		return;
+	}
+
+	yy_opm_max_scans = max_scans;
+}
+
+static void
+conf_set_opm_ipv4_prefix(void *data)
+{
+	int prefix = *((int *)data);
+
+	if(prefix < 1 || prefix > 32)
+	{
+		conf_report_error("opm::ipv4_prefix value %d is bogus, ignoring", prefix);
+		return;
+	}
+
+	yy_opm_ipv4_prefix = prefix;
+}
+
+static void
+conf_set_opm_ipv6_prefix(void *data)
+{
+	int prefix = *((int *)data);
+
+	if(prefix < 1 || prefix > 128)
+	{
+		conf_report_error("opm::ipv6_prefix value %d is bogus, ignoring", prefix);
+		return;
+	}
+
+	yy_opm_ipv6_prefix = prefix;
+}
+
 static void
 conf_set_opm_listen_address_both(void *data, bool ipv6)
 {
@@ -2467,7 +2538,17 @@ static struct ConfEntry conf_serverinfo_table[] =
 	{ "ssl_cert",           CF_QSTRING, NULL, 0, &ServerInfo.ssl_cert },
 	{ "ssl_dh_params",      CF_QSTRING, NULL, 0, &ServerInfo.ssl_dh_params },
 	{ "ssl_cipher_list",	CF_QSTRING, NULL, 0, &ServerInfo.ssl_cipher_list },
+	{ "ssl_ktls",		CF_YESNO,   NULL, 0, &ServerInfo.ssl_ktls },
+	{ "ssl_session_tickets",CF_YESNO,   NULL, 0, &ServerInfo.ssl_session_tickets },
+	{ "ssl_session_cache",	CF_INT,     NULL, 0, &ServerInfo.ssl_session_cache },
 	{ "ssld_count",		CF_INT,	    NULL, 0, &ServerInfo.ssld_count },
+	{ "ssld_cpus",		CF_QSTRING, NULL, 0, &ServerInfo.ssld_cpus },
+
+	{ "ws_deflate",		CF_YESNO,   NULL, 0, &ServerInfo.ws_deflate },
+	{ "ws_deflate_window_bits", CF_INT, NULL, 0, &ServerInfo.ws_deflate_window_bits },
+	{ "ws_deflate_context_takeover", CF_YESNO, NULL, 0, &ServerInfo.ws_deflate_context_takeover },
+	{ "ws_deflate_memory",	CF_INT,     NULL, 0, &ServerInfo.ws_deflate_memory },
+	{ "ws_deflate_cpu",	CF_INT,     NULL, 0, &ServerInfo.ws_deflate_cpu },
 
 	{ "default_max_clients",CF_INT,     NULL, 0, &ServerInfo.default_max_clients },
 
@@ -2494,6 +2575,7 @@ static struct ConfEntry conf_log_table[] =
 	{ "fname_killlog", 	CF_QSTRING, NULL, PATH_MAX, &ConfigFileEntry.fname_killlog	},
 	{ "fname_klinelog", 	CF_QSTRING, NULL, PATH_MAX, &ConfigFileEntry.fname_klinelog	},
 	{ "fname_ioerrorlog", 	CF_QSTRING, NULL, PATH_MAX, &ConfigFileEntry.fname_ioerrorlog },
+	{ "fsync",		CF_STRING | CF_FLIST, conf_set_log_fsync, 0, NULL },
 	{ "\0",			0,	    NULL, 0,          NULL }
 };
 
@@ -2589,6 +2671,10 @@ static struct ConfEntry conf_general_table[] =
 	{ "hidden_caps", CF_QSTRING | CF_FLIST, conf_set_general_hidden_caps, 0, NULL },
 
 	{ "anti_nick_flood",	CF_YESNO, NULL, 0, &ConfigFileEntry.anti_nick_flood	},
+	{ "auth_cache_accept_duration",	CF_TIME,  NULL, 0, &ConfigFileEntry.auth_cache_accept_duration	},
+	{ "auth_cache_reject_duration",	CF_TIME,  NULL, 0, &ConfigFileEntry.auth_cache_reject_duration	},
+	{ "auth_cache_ipv4_bitlen",	CF_INT,   NULL, 0, &ConfigFileEntry.auth_cache_ipv4_bitlen	},
+	{ "auth_cache_ipv6_bitlen",	CF_INT,   NULL, 0, &ConfigFileEntry.auth_cache_ipv6_bitlen	},
 	{ "caller_id_wait",	CF_TIME,  NULL, 0, &ConfigFileEntry.caller_id_wait	},
 	{ "client_exit",	CF_YESNO, NULL, 0, &ConfigFileEntry.client_exit		},
 	{ "post_registration_delay", CF_TIME, NULL, 0, &ConfigFileEntry.post_registration_delay	},
@@ -2632,6 +2718,7 @@ static struct ConfEntry conf_general_table[] =
 	{ "away_interval",		CF_INT,   NULL, 0, &ConfigFileEntry.away_interval		},
 	{ "hide_opers_in_whois",	CF_YESNO, NULL, 0, &ConfigFileEntry.hide_opers_in_whois		},
 	{ "hide_opers",		CF_YESNO, NULL, 0, &ConfigFileEntry.hide_opers		},
+	{ "who_indexes",	CF_YESNO, NULL, 0, &ConfigFileEntry.who_indexes		},
 	{ "certfp_method",	CF_STRING, conf_set_general_certfp_method, 0, NULL },
 	{ "drain_reason",	CF_QSTRING, NULL, BUFSIZE, &ConfigFileEntry.drain_reason	},
 	{ "sasl_only_client_message",	CF_QSTRING, NULL, BUFSIZE, &ConfigFileEntry.sasl_only_client_message	},
@@ -2735,6 +2822,9 @@ newconf_init()
 
 	add_top_conf("opm", conf_begin_opm, conf_end_opm, NULL);
 	add_conf_item("opm", "timeout", CF_INT, conf_set_opm_timeout);
+	add_conf_item("opm", "max_scans", CF_INT, conf_set_opm_max_scans);
+	add_conf_item("opm", "ipv4_prefix", CF_INT, conf_set_opm_ipv4_prefix);
+	add_conf_item("opm", "ipv6_prefix", CF_INT, conf_set_opm_ipv6_prefix);
 	add_conf_item("opm", "listen_ipv4", CF_QSTRING, conf_set_opm_listen_address_ipv4);
 	add_conf_item("opm", "listen_ipv6", CF_QSTRING, conf_set_opm_listen_address_ipv6);
 	add_conf_item("opm", "port_v4", CF_INT, conf_set_opm_listen_port_ipv4);
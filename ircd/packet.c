@@ -37,6 +37,64 @@
 static char readBuf[READBUF_SIZE];
 static void client_dopacket(struct Client *client_p, char *buffer, size_t length);
 
+/* clients with complete lines held back by flood control */
+static rb_dlink_list flood_wait_list;
+
+/*
+ * flood_credit - give a client back the flood allowance it has earned
+ * since we last looked at it.  This used to be done for every client
+ * once a second by flood_recalc(), it is now worked out from the
+ * elapsed time whenever the client's queue is parsed.
+ */
+static void
+flood_credit(struct Client *client_p)
+{
+	struct LocalUser *lclient_p = client_p->localClient;
+	long long credit;
+	time_t elapsed;
+
+	elapsed = rb_current_time() - lclient_p->flood_lastcredit;
+	if(elapsed <= 0)
+		return;
+	lclient_p->flood_lastcredit = rb_current_time();
+
+	if(IsUnknown(client_p))
+		credit = elapsed;
+	else if(IsFloodDone(client_p))
+		credit = (long long)elapsed * ConfigFileEntry.client_flood_message_num;
+	else
+		credit = lclient_p->sent_parsed;
+
+	if(credit >= lclient_p->sent_parsed)
+		lclient_p->sent_parsed = 0;
+	else
+		lclient_p->sent_parsed -= credit;
+}
+
+static void
+flood_wait(struct Client *client_p)
+{
+	if(IsFloodWait(client_p))
+		return;
+
+	SetFloodWait(client_p);
+	rb_dlinkAddTail(client_p, &client_p->localClient->flood_node, &flood_wait_list);
+}
+
+/*
+ * flood_cancel_wait - take a client off the flood throttled list,
+ * must be done before its LocalUser goes away.
+ */
+void
+flood_cancel_wait(struct Client *client_p)
+{
+	if(!IsFloodWait(client_p))
+		return;
+
+	ClearFloodWait(client_p);
+	rb_dlinkDelete(&client_p->localClient->flood_node, &flood_wait_list);
+}
+
 /*
  * parse_client_queued - parse client queued messages
  */
@@ -45,17 +103,23 @@ parse_client_queued(struct Client *client_p)
 {
 	int dolen;
 	int allow_read;
+	int throttled = 0;
 
 	if(IsAnyDead(client_p))
 		return;
 
+	flood_credit(client_p);
+
 	if(IsUnknown(client_p))
 	{
 		allow_read = ConfigFileEntry.client_flood_burst_max;
 		for (;;)
 		{
 			if(client_p->localClient->sent_parsed >= allow_read)
+			{
+				throttled = 1;
 				break;
+			}
 
 			dolen = rb_linebuf_get(&client_p->localClient->
 					    buf_recvq, readBuf, READBUF_SIZE,
@@ -130,15 +194,25 @@ parse_client_queued(struct Client *client_p)
 			 * Therefore a client will be penalised more if they keep flooding,
 			 * as sent_parsed will always hover around the allow_read limit
 			 * and no 'bursts' will be permitted.
+			 *
+			 * The decay is applied lazily by flood_credit(), and only
+			 * clients that were held back here are revisited by
+			 * flood_recalc().
 			 */
 			if(client_p->localClient->sent_parsed >= allow_read)
+			{
+				throttled = 1;
 				break;
+			}
 
 			/* post_registration_delay hack. Don't process any messages from a new client for $n seconds,
 			 * to allow network bots to do their thing before channels can be joined.
 			 */
 			if (rb_current_time() < client_p->localClient->firsttime + ConfigFileEntry.post_registration_delay)
+			{
+				throttled = 1;
 				break;
+			}
 
 			dolen = rb_linebuf_get(&client_p->localClient->
 					    buf_recvq, readBuf, READBUF_SIZE,
@@ -161,6 +235,10 @@ parse_client_queued(struct Client *client_p)
 			client_p->localClient->sent_parsed = allow_read +
 				ConfigFileEntry.client_flood_message_time - 1;
 	}
+
+	/* come back for the rest once some allowance has been earned */
+	if(throttled && rb_linebuf_len(&client_p->localClient->buf_recvq) > 0)
+		flood_wait(client_p);
 }
 
 /* flood_endgrace()
@@ -181,54 +259,114 @@ flood_endgrace(struct Client *client_p)
 /*
  * flood_recalc
  *
- * recalculate the number of allowed flood lines. this should be called
- * once a second on any given client. We then attempt to flush some data.
+ * give clients held back by flood control another go at their queued
+ * lines. this is called once a second, and only looks at clients
+ * which actually had lines left over.
  */
 void
 flood_recalc(void *unused)
 {
-	rb_dlink_node *ptr, *next;
 	struct Client *client_p;
+	unsigned long count;
 
-	RB_DLINK_FOREACH_SAFE(ptr, next, lclient_list.head)
+	/* anything put back on the list while we run goes on the end,
+	 * so only handle what was there when we started
+	 */
+	for(count = rb_dlink_list_length(&flood_wait_list);
+	    count > 0 && flood_wait_list.head != NULL; count--)
 	{
-		client_p = ptr->data;
+		client_p = flood_wait_list.head->data;
+		flood_cancel_wait(client_p);
+		parse_client_queued(client_p);
+	}
+}
 
-		if(rb_unlikely(IsMe(client_p)))
-			continue;
+/*
+ * client_read_data - note that the client is alive and queue what it sent
+ * returns 0 if the client has gone
+ */
+static int
+client_read_data(struct Client *client_p, char *buf, int length)
+{
+	int binary = 0;
 
-		if(rb_unlikely(client_p->localClient == NULL))
-			continue;
+	if(client_p->localClient->lasttime < rb_current_time())
+		client_p->localClient->lasttime = rb_current_time();
+	client_p->flags &= ~FLAGS_PINGSENT;
 
-		if(IsFloodDone(client_p))
-			client_p->localClient->sent_parsed -= ConfigFileEntry.client_flood_message_num;
-		else
-			client_p->localClient->sent_parsed = 0;
+	if (client_p->flags & FLAGS_PINGWARN)
+	{
+		/*
+		 * if we warned about this server being unresponsive
+		 * before, let's let everyone know there's no need
+		 * to panic
+		 */
+		client_p->flags &= ~FLAGS_PINGWARN;
+		sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
+			"Received response from previously unresponsive link %s",
+			client_p->name);
+		ilog(L_SERVER,
+			"Received response from previously unresponsive link %s",
+			log_client_name(client_p, HIDE_IP));
+	}
 
-		if(client_p->localClient->sent_parsed < 0)
-			client_p->localClient->sent_parsed = 0;
 
-		parse_client_queued(client_p);
+	/*
+	 * Before we even think of parsing what we just read, stick
+	 * it on the end of the receive queue and do it when its
+	 * turn comes around.
+	 */
+	if(IsHandshake(client_p) || IsUnknown(client_p))
+		binary = 1;
 
-		if(rb_unlikely(IsAnyDead(client_p)))
-			continue;
+	(void) rb_linebuf_parse(&client_p->localClient->buf_recvq, buf, length, binary);
 
-	}
+	if(IsAnyDead(client_p))
+		return 0;
+
+	/* Attempt to parse what we have */
+	parse_client_queued(client_p);
 
-	RB_DLINK_FOREACH_SAFE(ptr, next, unknown_list.head)
+	if(IsAnyDead(client_p))
+		return 0;
+
+	/* Check to make sure we're not flooding */
+	if(!IsAnyServer(client_p) && !IsOperGeneral(client_p) &&
+	   (rb_linebuf_alloclen(&client_p->localClient->buf_recvq) > ConfigFileEntry.client_flood_max_lines))
 	{
-		client_p = ptr->data;
+		exit_client(client_p, client_p, client_p, "Excess Flood");
+		return 0;
+	}
 
-		if(client_p->localClient == NULL)
-			continue;
+	return 1;
+}
 
-		client_p->localClient->sent_parsed--;
+/*
+ * read_packet_stream - completion for reads the network loop does itself
+ */
+static void
+read_packet_stream(rb_fde_t * F, char *buf, int length, void *data)
+{
+	struct Client *client_p = data;
 
-		if(client_p->localClient->sent_parsed < 0)
-			client_p->localClient->sent_parsed = 0;
+	if(IsAnyDead(client_p))
+	{
+		rb_read_stream(F, NULL, NULL);
+		return;
+	}
 
-		parse_client_queued(client_p);
+	if(length <= 0)
+	{
+		error_exit_client(client_p, length);
+		return;
 	}
+
+	if(!client_read_data(client_p, buf, length))
+		return;
+
+	/* STARTTLS moved the client onto an ssld socketpair */
+	if(client_p->localClient->F != F)
+		read_packet(client_p->localClient->F, client_p);
 }
 
 /*
@@ -239,13 +377,16 @@ read_packet(rb_fde_t * F, void *data)
 {
 	struct Client *client_p = data;
 	int length;
-	int binary = 0;
+
+	if(IsAnyDead(client_p))
+		return;
+
+	/* where the poller can, it does the reads from here on */
+	if(rb_read_stream(client_p->localClient->F, read_packet_stream, client_p) == 0)
+		return;
 
 	while(1)
 	{
-		if(IsAnyDead(client_p))
-			return;
-
 		/*
 		 * Read some data. We *used to* do anti-flood protection here, but
 		 * I personally think it makes the code too hairy to make sane.
@@ -268,53 +409,8 @@ read_packet(rb_fde_t * F, void *data)
 			return;
 		}
 
-		if(client_p->localClient->lasttime < rb_current_time())
-			client_p->localClient->lasttime = rb_current_time();
-		client_p->flags &= ~FLAGS_PINGSENT;
-
-		if (client_p->flags & FLAGS_PINGWARN)
-		{
-			/*
-			 * if we warned about this server being unresponsive
-			 * before, let's let everyone know there's no need
-			 * to panic
-			 */
-			client_p->flags &= ~FLAGS_PINGWARN;
-			sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-				"Received response from previously unresponsive link %s",
-				client_p->name);
-			ilog(L_SERVER,
-				"Received response from previously unresponsive link %s",
-				log_client_name(client_p, HIDE_IP));
-		}
-
-
-		/*
-		 * Before we even think of parsing what we just read, stick
-		 * it on the end of the receive queue and do it when its
-		 * turn comes around.
-		 */
-		if(IsHandshake(client_p) || IsUnknown(client_p))
-			binary = 1;
-
-		(void) rb_linebuf_parse(&client_p->localClient->buf_recvq, readBuf, length, binary);
-
-		if(IsAnyDead(client_p))
-			return;
-
-		/* Attempt to parse what we have */
-		parse_client_queued(client_p);
-
-		if(IsAnyDead(client_p))
-			return;
-
-		/* Check to make sure we're not flooding */
-		if(!IsAnyServer(client_p) && !IsOperGeneral(client_p) &&
-		   (rb_linebuf_alloclen(&client_p->localClient->buf_recvq) > ConfigFileEntry.client_flood_max_lines))
-		{
-			exit_client(client_p, client_p, client_p, "Excess Flood");
+		if(!client_read_data(client_p, readBuf, length))
 			return;
-		}
 
 		/* bail if short read, but not for SCTP as it returns data in packets */
 		if (length < READBUF_SIZE && !(rb_get_type(client_p->localClient->F) & RB_FD_SCTP)) {
@@ -40,6 +40,7 @@
 #include "s_serv.h"
 #include "packet.h"
 #include "s_assert.h"
+#include "bburst.h"
 
 rb_dictionary *cmd_dict = NULL;
 rb_dictionary *alias_dict = NULL;
@@ -96,6 +97,12 @@ parse(struct Client *client_p, char *pbuffer, char *bufend)
 	if(*end == '\r')
 		*end = '\0';
 
+	if(*pbuffer == BBURST_FRAME && IsServer(client_p) && IsCapable(client_p, CAP_BBURST))
+	{
+		bburst_parse(client_p, pbuffer + 1);
+		return;
+	}
+
 	res = msgbuf_parse(&msgbuf, pbuffer);
 	if (res)
 	{
@@ -241,6 +248,36 @@ handle_command(struct Message *mptr, struct MsgBuf *msgbuf_p, struct Client *cli
 	return (1);
 }
 
+/* parse_split()
+ *
+ * inputs	- server link, source, command and parameters already split up
+ * outputs	-
+ * side effects - the command is handled as if parse() had been given it
+ */
+void
+parse_split(struct Client *client_p, struct Client *from, int parc, const char *parv[])
+{
+	struct Message *mptr;
+	struct MsgBuf msgbuf;
+	int i;
+
+	if(parc < 1 || parc > MAXPARA)
+		return;
+
+	mptr = rb_dictionary_retrieve(cmd_dict, parv[0]);
+	if(mptr == NULL || mptr->cmd == NULL)
+		return;
+
+	msgbuf_init(&msgbuf);
+	msgbuf.origin = use_id(from);
+	msgbuf.cmd = parv[0];
+	msgbuf.n_para = parc;
+	for(i = 0; i < parc; i++)
+		msgbuf.para[i] = parv[i];
+
+	handle_command(mptr, &msgbuf, client_p, from);
+}
+
 void
 handle_encap(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p,
 	     const char *command, int parc, const char *parv[])
@@ -58,6 +58,10 @@ server_reboot(void)
 
 	ilog(L_MAIN, "Restarting server...");
 
+	/* we exec before the io loop would have written anything queued */
+	send_flush_pending(NULL);
+	close_logfiles();
+
 	/*
 	 * XXX we used to call flush_connections() here. But since this routine
 	 * doesn't exist anymore, we won't be flushing. This is ok, since
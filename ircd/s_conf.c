@@ -27,6 +27,7 @@
 #include "s_conf.h"
 #include "s_user.h"
 #include "s_newconf.h"
+#include "maskset.h"
 #include "newconf.h"
 #include "s_serv.h"
 #include "s_stats.h"
@@ -732,6 +733,7 @@ set_default_conf(void)
 	ConfigFileEntry.fname_killlog = NULL;
 	ConfigFileEntry.fname_klinelog = NULL;
 	ConfigFileEntry.fname_ioerrorlog = NULL;
+	ConfigFileEntry.log_fsync = 0;
 	ConfigFileEntry.hide_error_messages = 1;
 	ConfigFileEntry.max_targets = MAX_TARGETS_DEFAULT;
 	ConfigFileEntry.max_ratelimit_tokens = 30;
@@ -774,6 +776,10 @@ set_default_conf(void)
         ConfigFileEntry.reject_after_count = 5;
 	ConfigFileEntry.reject_ban_time = 300;
 	ConfigFileEntry.reject_duration = 120;
+	ConfigFileEntry.auth_cache_accept_duration = 60;
+	ConfigFileEntry.auth_cache_reject_duration = 300;
+	ConfigFileEntry.auth_cache_ipv4_bitlen = 32;
+	ConfigFileEntry.auth_cache_ipv6_bitlen = 64;
 	ConfigFileEntry.throttle_count = 4;
 	ConfigFileEntry.throttle_duration = 60;
 
@@ -789,6 +795,7 @@ set_default_conf(void)
 	ConfigFileEntry.certfp_method = RB_SSL_CERTFP_METH_CERT_SHA1;
 	ConfigFileEntry.hide_opers_in_whois = 0;
 	ConfigFileEntry.hide_opers = 0;
+	ConfigFileEntry.who_indexes = 1;
 
 	if (!alias_dict)
 		alias_dict = rb_dictionary_create("alias", (DCF)rb_strcasecmp);
@@ -812,6 +819,7 @@ read_conf(void)
 	validate_conf();	/* Check to make sure some values are still okay. */
 	/* Some global values are also loaded here. */
 	check_class();		/* Make sure classes are valid */
+	rehash_global_index();
 	construct_cflags_strings();
 }
 
@@ -848,12 +856,20 @@ validate_conf(void)
 		/* start up additional ssld if needed */
 		start_ssldaemon(start);
 	}
+	ssld_assign_cpus();
 
 	if(ServerInfo.wsockd_count > get_wsockd_count())
 	{
 		int start = ServerInfo.wsockd_count - get_wsockd_count();
 		start_wsockd(start);
 	}
+	wsockd_update_config();
+
+	if(ConfigFileEntry.auth_cache_ipv4_bitlen < 0 || ConfigFileEntry.auth_cache_ipv4_bitlen > 32)
+		ConfigFileEntry.auth_cache_ipv4_bitlen = 32;
+	if(ConfigFileEntry.auth_cache_ipv6_bitlen < 0 || ConfigFileEntry.auth_cache_ipv6_bitlen > 128)
+		ConfigFileEntry.auth_cache_ipv6_bitlen = 64;
+	configure_authd_cache();
 
 	/* General conf */
 	if (ConfigFileEntry.default_operstring == NULL)
@@ -1097,9 +1113,11 @@ deactivate_conf(struct ConfItem *aconf, time_t now)
 			break;
 		case CONF_XLINE:
 			rb_dlinkFindDestroy(aconf, &xline_conf_list);
+			maskset_del(xline_maskset, aconf);
 			break;
 		case CONF_RESV_NICK:
 			rb_dlinkFindDestroy(aconf, &resv_conf_list);
+			maskset_del(resv_maskset, aconf);
 			break;
 		case CONF_RESV_CHANNEL:
 			del_from_resv_hash(aconf->host, aconf);
@@ -1468,6 +1486,17 @@ clear_out_old_conf(void)
 	ServerInfo.network_name = NULL;
 
 	ServerInfo.ssld_count = 1;
+	ServerInfo.ssl_ktls = 0;
+	ServerInfo.ssl_session_tickets = 1;
+	ServerInfo.ssl_session_cache = 0;
+	rb_free(ServerInfo.ssld_cpus);
+	ServerInfo.ssld_cpus = NULL;
+
+	ServerInfo.ws_deflate = 0;
+	ServerInfo.ws_deflate_window_bits = 15;
+	ServerInfo.ws_deflate_context_takeover = 1;
+	ServerInfo.ws_deflate_memory = 64 * 1024 * 1024;
+	ServerInfo.ws_deflate_cpu = 250;
 
 	/* clean out AdminInfo */
 	rb_free(AdminInfo.name);
@@ -51,6 +51,7 @@
 #include "s_assert.h"
 #include "logger.h"
 #include "dns.h"
+#include "maskset.h"
 
 rb_dlink_list oper_conf_list;
 rb_dlink_list server_conf_list;
@@ -61,6 +62,10 @@ rb_dlink_list tgchange_list;
 
 rb_patricia_tree_t *tgchange_tree;
 
+/* the masks on xline_conf_list and resv_conf_list, for matching */
+struct maskset *xline_maskset;
+struct maskset *resv_maskset;
+
 static rb_bh *nd_heap = NULL;
 
 static void expire_temp_rxlines(void *unused);
@@ -73,6 +78,8 @@ void
 init_s_newconf(void)
 {
 	tgchange_tree = rb_new_patricia(PATRICIA_BITS);
+	xline_maskset = maskset_create();
+	resv_maskset = maskset_create();
 	nd_heap = rb_bh_create(sizeof(struct nd_entry), ND_HEAP_SIZE, "nd_heap");
 	expire_nd_entries_ev = rb_event_addish("expire_nd_entries", expire_nd_entries, NULL, 30);
 	expire_temp_rxlines_ev = rb_event_addish("expire_temp_rxlines", expire_temp_rxlines, NULL, 60);
@@ -118,6 +125,7 @@ clear_s_newconf_bans(void)
 		if(aconf->hold)
 			continue;
 
+		maskset_del(xline_maskset, aconf);
 		free_conf(aconf);
 		rb_dlinkDestroy(ptr, &xline_conf_list);
 	}
@@ -130,6 +138,7 @@ clear_s_newconf_bans(void)
 		if(aconf->hold)
 			continue;
 
+		maskset_del(resv_maskset, aconf);
 		free_conf(aconf);
 		rb_dlinkDestroy(ptr, &resv_conf_list);
 	}
@@ -506,21 +515,12 @@ struct ConfItem *
 find_xline(const char *gecos, int counter)
 {
 	struct ConfItem *aconf;
-	rb_dlink_node *ptr;
 
-	RB_DLINK_FOREACH(ptr, xline_conf_list.head)
-	{
-		aconf = ptr->data;
+	aconf = maskset_find(xline_maskset, gecos);
+	if(aconf != NULL && counter)
+		aconf->port++;
 
-		if(match_esc(aconf->host, gecos))
-		{
-			if(counter)
-				aconf->port++;
-			return aconf;
-		}
-	}
-
-	return NULL;
+	return aconf;
 }
 
 struct ConfItem *
@@ -544,20 +544,12 @@ struct ConfItem *
 find_nick_resv(const char *name)
 {
 	struct ConfItem *aconf;
-	rb_dlink_node *ptr;
-
-	RB_DLINK_FOREACH(ptr, resv_conf_list.head)
-	{
-		aconf = ptr->data;
 
-		if(match_esc(aconf->host, name))
-		{
-			aconf->port++;
-			return aconf;
-		}
-	}
+	aconf = maskset_find(resv_maskset, name);
+	if(aconf != NULL)
+		aconf->port++;
 
-	return NULL;
+	return aconf;
 }
 
 struct ConfItem *
@@ -746,6 +738,7 @@ expire_temp_rxlines(void *unused)
 				sendto_realops_snomask(SNO_GENERAL, L_ALL,
 						"Temporary RESV for [%s] expired",
 						aconf->host);
+			maskset_del(resv_maskset, aconf);
 			free_conf(aconf);
 			rb_dlinkDestroy(ptr, &resv_conf_list);
 		}
@@ -763,6 +756,7 @@ expire_temp_rxlines(void *unused)
 				sendto_realops_snomask(SNO_GENERAL, L_ALL,
 						"Temporary X-line for [%s] expired",
 						aconf->host);
+			maskset_del(xline_maskset, aconf);
 			free_conf(aconf);
 			rb_dlinkDestroy(ptr, &xline_conf_list);
 		}
@@ -52,6 +52,7 @@
 #include "sslproc.h"
 #include "capability.h"
 #include "s_assert.h"
+#include "bburst.h"
 
 int MaxConnectionCount = 1;
 int MaxClientCount = 1;
@@ -88,6 +89,7 @@ unsigned int CAP_EOPMOD;
 unsigned int CAP_BAN;
 unsigned int CAP_MLOCK;
 unsigned int CAP_EBMASK;
+unsigned int CAP_BBURST;
 unsigned int CAP_FDF;
 
 unsigned int CLICAP_MULTI_PREFIX;
@@ -131,6 +133,7 @@ init_builtin_capabs(void)
 	CAP_BAN = capability_put(serv_capindex, "BAN", NULL);
 	CAP_MLOCK = capability_put(serv_capindex, "MLOCK", NULL);
 	CAP_EBMASK = capability_put(serv_capindex, "EBMASK", NULL);
+	CAP_BBURST = capability_put(serv_capindex, "BBURST", NULL);
 	/* TODO: Remove me in next major version */
 	CAP_FDF = capability_put(serv_capindex, "FDF", NULL);
 
@@ -544,179 +547,502 @@ burst_modes_TS6(struct Client *client_p, struct Channel *chptr,
 }
 
 /*
- * burst_TS6
+ * The burst to a new server is not put out in one go.  A cursor walks
+ * the clients and then the channels that existed when the link came up,
+ * and more is only put together while the link's sendq is short, so a
+ * big network neither stalls the io loop nor balloons the sendq.
  *
- * inputs	- client (server) to send nick towards
- * 		- client to send nick for
- * output	- NONE
- * side effects	- NICK message is sent towards given client_p
+ * Anything else sent to the link meanwhile is held back and follows the
+ * burst, so the other side never hears about a client or channel before
+ * it has been burst.  Clients and channels that come along later are
+ * left to that held back traffic.
+ */
+#define BURST_SENDQ		65536	/* put together this much at a time */
+#define BURST_REPORT_INTERVAL	10	/* seconds between progress notices */
+
+struct burst_state
+{
+	struct Client *client_p;
+	rb_dlink_node *next_client;	/* on global_client_list */
+	rb_dlink_node *last_client;	/* the last one there at the start */
+	rb_dlink_node *next_channel;	/* on global_channel_list */
+	buf_head_t deferred;		/* everything else sent meanwhile */
+	bool generating;
+	bool binary;			/* users and channels go as records */
+	struct bburst_frame frame;
+
+	unsigned int users;
+	unsigned int channels;
+	unsigned long bytes;
+	struct timeval started;
+	unsigned long busy_us;
+	time_t next_report;
+
+	rb_dlink_node node;
+};
+
+static rb_dlink_list burst_list;
+
+static unsigned long
+tv_diff_us(const struct timeval *from, const struct timeval *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000UL + to->tv_usec - from->tv_usec;
+}
+
+/* burst_client()
+ *
+ * input	- burst, client to introduce
+ * output	-
+ * side effects - the client and its state are sent to the new server
  */
 static void
-burst_TS6(struct Client *client_p)
+burst_client(struct burst_state *b, struct Client *target_p)
 {
+	struct Client *client_p = b->client_p;
+	hook_data_client hclientinfo;
 	char ubuf[BUFSIZE];
-	struct Client *target_p;
-	struct Channel *chptr;
+
+	if(!IsPerson(target_p) || target_p->from == client_p)
+		return;
+
+	if(MyClient(target_p->from) && target_p->localClient->att_sconf != NULL && ServerConfNoExport(target_p->localClient->att_sconf))
+		return;
+
+	send_umode(NULL, target_p, 0, ubuf);
+	if(!*ubuf)
+	{
+		ubuf[0] = '+';
+		ubuf[1] = '\0';
+	}
+
+	if(b->binary && bburst_user(client_p, &b->frame, target_p, ubuf))
+		;
+	else if(IsCapable(client_p, CAP_EUID))
+		sendto_one(client_p, ":%s EUID %s %d %ld %s %s %s %s %s %s %s :%s",
+			   target_p->servptr->id, target_p->name,
+			   target_p->hopcount + 1,
+			   (long) target_p->tsinfo, ubuf,
+			   target_p->username, target_p->host,
+			   IsIPSpoof(target_p) ? "0" : target_p->sockhost,
+			   target_p->id,
+			   IsDynSpoof(target_p) ? target_p->orighost : "*",
+			   EmptyString(target_p->user->suser) ? "*" : target_p->user->suser,
+			   target_p->info);
+	else
+		sendto_one(client_p, ":%s UID %s %d %ld %s %s %s %s %s :%s",
+			   target_p->servptr->id, target_p->name,
+			   target_p->hopcount + 1,
+			   (long) target_p->tsinfo, ubuf,
+			   target_p->username, target_p->host,
+			   IsIPSpoof(target_p) ? "0" : target_p->sockhost,
+			   target_p->id, target_p->info);
+
+	if(!EmptyString(target_p->certfp))
+		sendto_one(client_p, ":%s ENCAP * CERTFP :%s",
+				use_id(target_p), target_p->certfp);
+
+	if(!IsCapable(client_p, CAP_EUID))
+	{
+		if(IsDynSpoof(target_p))
+			sendto_one(client_p, ":%s ENCAP * REALHOST %s",
+					use_id(target_p), target_p->orighost);
+		if(!EmptyString(target_p->user->suser))
+			sendto_one(client_p, ":%s ENCAP * LOGIN %s",
+					use_id(target_p), target_p->user->suser);
+	}
+
+	if(!EmptyString(target_p->user->away))
+		sendto_one(client_p, ":%s AWAY :%s",
+			   use_id(target_p),
+			   target_p->user->away);
+
+	if (IsOper(target_p) && target_p->user && target_p->user->opername)
+	{
+		if (target_p->user->privset)
+			sendto_one(client_p, ":%s OPER %s %s",
+					use_id(target_p),
+					target_p->user->opername,
+					target_p->user->privset->name);
+		else
+			sendto_one(client_p, ":%s OPER %s",
+					use_id(target_p),
+					target_p->user->opername);
+	}
+
+	hclientinfo.client = client_p;
+	hclientinfo.target = target_p;
+	call_hook(h_burst_client, &hclientinfo);
+
+	b->users++;
+}
+
+/* burst_sjoin()
+ *
+ * input	- server being burst to, channel
+ * output	-
+ * side effects - the channel and its members are sent as SJOIN lines
+ */
+static void
+burst_sjoin(struct Client *client_p, struct Channel *chptr)
+{
 	struct membership *msptr;
-	hook_data_client hclientinfo;
-	hook_data_channel hchaninfo;
-	rb_dlink_node *ptr;
 	rb_dlink_node *uptr;
+	const char *prefix, *id;
+	size_t plen, idlen;
 	char *t;
-	int tlen, mlen;
-	int cur_len = 0;
+	int mlen;
+
+	mlen = sprintf(buf, ":%s SJOIN %ld %s %s :", me.id,
+			(long) chptr->channelts, chptr->chname,
+			channel_modes(chptr, client_p));
 
-	hclientinfo.client = hchaninfo.client = client_p;
+	t = buf + mlen;
 
-	RB_DLINK_FOREACH(ptr, global_client_list.head)
+	RB_DLINK_FOREACH(uptr, chptr->members.head)
 	{
-		target_p = ptr->data;
+		msptr = uptr->data;
 
-		if(!IsPerson(target_p))
+		/* it told us about these itself */
+		if(msptr->client_p->from == client_p)
 			continue;
 
-		if(MyClient(target_p->from) && target_p->localClient->att_sconf != NULL && ServerConfNoExport(target_p->localClient->att_sconf))
-			continue;
+		prefix = find_channel_status(msptr, 1);
+		id = use_id(msptr->client_p);
+		plen = strlen(prefix);
+		idlen = strlen(id);
 
-		send_umode(NULL, target_p, 0, ubuf);
-		if(!*ubuf)
+		if((t - buf) + plen + idlen + 1 >= BUFSIZE - 3)
 		{
-			ubuf[0] = '+';
-			ubuf[1] = '\0';
+			*(t-1) = '\0';
+			sendto_one(client_p, "%s", buf);
+			t = buf + mlen;
 		}
 
-		if(IsCapable(client_p, CAP_EUID))
-			sendto_one(client_p, ":%s EUID %s %d %ld %s %s %s %s %s %s %s :%s",
-				   target_p->servptr->id, target_p->name,
-				   target_p->hopcount + 1,
-				   (long) target_p->tsinfo, ubuf,
-				   target_p->username, target_p->host,
-				   IsIPSpoof(target_p) ? "0" : target_p->sockhost,
-				   target_p->id,
-				   IsDynSpoof(target_p) ? target_p->orighost : "*",
-				   EmptyString(target_p->user->suser) ? "*" : target_p->user->suser,
-				   target_p->info);
-		else
-			sendto_one(client_p, ":%s UID %s %d %ld %s %s %s %s %s :%s",
-				   target_p->servptr->id, target_p->name,
-				   target_p->hopcount + 1,
-				   (long) target_p->tsinfo, ubuf,
-				   target_p->username, target_p->host,
-				   IsIPSpoof(target_p) ? "0" : target_p->sockhost,
-				   target_p->id, target_p->info);
+		memcpy(t, prefix, plen);
+		t += plen;
+		memcpy(t, id, idlen);
+		t += idlen;
+		*t++ = ' ';
+	}
 
-		if(!EmptyString(target_p->certfp))
-			sendto_one(client_p, ":%s ENCAP * CERTFP :%s",
-					use_id(target_p), target_p->certfp);
+	/* remove trailing space */
+	if(t > buf + mlen)
+		t--;
+	*t = '\0';
+	sendto_one(client_p, "%s", buf);
+}
 
-		if(!IsCapable(client_p, CAP_EUID))
-		{
-			if(IsDynSpoof(target_p))
-				sendto_one(client_p, ":%s ENCAP * REALHOST %s",
-						use_id(target_p), target_p->orighost);
-			if(!EmptyString(target_p->user->suser))
-				sendto_one(client_p, ":%s ENCAP * LOGIN %s",
-						use_id(target_p), target_p->user->suser);
-		}
+/* burst_channel()
+ *
+ * input	- burst, channel to send
+ * output	-
+ * side effects - the channel, its members and its lists are sent to
+ *		  the new server
+ */
+static void
+burst_channel(struct burst_state *b, struct Channel *chptr)
+{
+	struct Client *client_p = b->client_p;
+	hook_data_channel hchaninfo;
+
+	if(*chptr->chname != '#')
+		return;
+
+	if(!b->binary || !bburst_sjoin(client_p, &b->frame, chptr, channel_modes(chptr, client_p)))
+		burst_sjoin(client_p, chptr);
+
+	if(rb_dlink_list_length(&chptr->banlist) > 0)
+		burst_modes_TS6(client_p, chptr, &chptr->banlist, 'b');
+
+	if(IsCapable(client_p, CAP_EX) &&
+	   rb_dlink_list_length(&chptr->exceptlist) > 0)
+		burst_modes_TS6(client_p, chptr, &chptr->exceptlist, 'e');
+
+	if(IsCapable(client_p, CAP_IE) &&
+	   rb_dlink_list_length(&chptr->invexlist) > 0)
+		burst_modes_TS6(client_p, chptr, &chptr->invexlist, 'I');
+
+	if(rb_dlink_list_length(&chptr->quietlist) > 0)
+		burst_modes_TS6(client_p, chptr, &chptr->quietlist, 'q');
+
+	if(IsCapable(client_p, CAP_TB) && chptr->topic != NULL)
+		sendto_one(client_p, ":%s TB %s %ld %s :%s",
+			   me.id, chptr->chname, (long) chptr->topic_time,
+			   chptr->topic_info,
+			   chptr->topic);
+
+	if(IsCapable(client_p, CAP_MLOCK))
+		sendto_one(client_p, ":%s MLOCK %ld %s :%s",
+			   me.id, (long) chptr->channelts, chptr->chname,
+			   EmptyString(chptr->mode_lock) ? "" : chptr->mode_lock);
 
-		if(!EmptyString(target_p->user->away))
-			sendto_one(client_p, ":%s AWAY :%s",
-				   use_id(target_p),
-				   target_p->user->away);
+	hchaninfo.client = client_p;
+	hchaninfo.chptr = chptr;
+	call_hook(h_burst_channel, &hchaninfo);
+
+	b->channels++;
+}
+
+static void
+burst_free(struct burst_state *b)
+{
+	b->client_p->localClient->burst = NULL;
+	rb_linebuf_donebuf(&b->deferred);
+	rb_dlinkDelete(&b->node, &burst_list);
+	rb_free(b);
+}
+
+/* burst_finish()
+ *
+ * input	- burst that has been put out in full
+ * output	-
+ * side effects - end of burst PING and whatever was held back are
+ *		  queued, opers and modules are told
+ */
+static void
+burst_finish(struct burst_state *b)
+{
+	struct Client *client_p = b->client_p;
+	hook_data_burst hdata;
+	struct timeval now;
+	unsigned long elapsed_us;
+
+	/* from here on, sends go straight to the sendq */
+	client_p->localClient->burst = NULL;
+
+	/* Always send a PING after connect burst is done */
+	sendto_one(client_p, "PING :%s", get_id(&me, client_p));
+
+	rb_linebuf_attach(&client_p->localClient->buf_sendq, &b->deferred);
+
+	rb_gettimeofday(&now, NULL);
+	elapsed_us = tv_diff_us(&b->started, &now);
+
+	sendto_realops_snomask(SNO_GENERAL, L_ALL,
+			"Burst to %s complete: %u users, %u channels, %lu KB%s in %lu.%03lu seconds (%lu.%03lu busy)",
+			client_p->name, b->users, b->channels, b->bytes / 1024,
+			b->binary ? " (binary)" : "",
+			elapsed_us / 1000000, (elapsed_us / 1000) % 1000,
+			b->busy_us / 1000000, (b->busy_us / 1000) % 1000);
+
+	hdata.client = client_p;
+	hdata.target = NULL;
+	hdata.users = b->users;
+	hdata.channels = b->channels;
+	hdata.bytes = b->bytes;
+	hdata.elapsed_ms = elapsed_us / 1000;
+	hdata.busy_ms = b->busy_us / 1000;
+	call_hook(h_burst_finished, &hdata);
+
+	burst_free(b);
+}
 
-		if (IsOper(target_p) && target_p->user && target_p->user->opername)
+/* burst_start()
+ *
+ * input	- server that has just been linked
+ * output	-
+ * side effects - the burst towards it is begun
+ */
+void
+burst_start(struct Client *client_p)
+{
+	struct burst_state *b;
+
+	s_assert(MyConnect(client_p) && client_p->localClient->burst == NULL);
+
+	b = rb_malloc(sizeof(struct burst_state));
+	b->client_p = client_p;
+	b->next_client = global_client_list.head;
+	b->last_client = global_client_list.tail;
+	b->next_channel = global_channel_list.head;
+	rb_linebuf_newbuf(&b->deferred);
+	b->binary = IsCapable(client_p, CAP_BBURST) && IsCapable(client_p, CAP_EUID);
+	rb_gettimeofday(&b->started, NULL);
+	b->next_report = rb_current_time() + BURST_REPORT_INTERVAL;
+
+	client_p->localClient->burst = b;
+	rb_dlinkAdd(b, &b->node, &burst_list);
+
+	burst_continue(client_p);
+}
+
+/* burst_continue()
+ *
+ * input	- server being burst to
+ * output	-
+ * side effects - the sendq is topped up with more of the burst, if it
+ *		  has drained far enough
+ */
+void
+burst_continue(struct Client *client_p)
+{
+	struct burst_state *b = client_p->localClient->burst;
+	buf_head_t *sendq = &client_p->localClient->buf_sendq;
+	struct timeval start, end;
+	rb_dlink_node *node;
+	int startlen;
+
+	if(b == NULL || b->generating || rb_linebuf_len(sendq) >= BURST_SENDQ / 2)
+		return;
+
+	rb_gettimeofday(&start, NULL);
+	startlen = rb_linebuf_len(sendq);
+	b->generating = true;
+
+	while(rb_linebuf_len(sendq) < BURST_SENDQ && !IsAnyDead(client_p))
+	{
+		if(b->next_client != NULL)
 		{
-			if (target_p->user->privset)
-				sendto_one(client_p, ":%s OPER %s %s",
-						use_id(target_p),
-						target_p->user->opername,
-						target_p->user->privset->name);
-			else
-				sendto_one(client_p, ":%s OPER %s",
-						use_id(target_p),
-						target_p->user->opername);
+			node = b->next_client;
+			b->next_client = node == b->last_client ? NULL : node->next;
+			burst_client(b, node->data);
 		}
+		else if(b->next_channel != NULL)
+		{
+			node = b->next_channel;
+			b->next_channel = node->next;
+			burst_channel(b, node->data);
+		}
+		else
+			break;
+	}
+
+	bburst_flush(client_p, &b->frame);
+	b->generating = false;
+	b->bytes += rb_linebuf_len(sendq) - startlen;
+
+	rb_gettimeofday(&end, NULL);
+	b->busy_us += tv_diff_us(&start, &end);
 
-		hclientinfo.target = target_p;
-		call_hook(h_burst_client, &hclientinfo);
+	if(IsAnyDead(client_p))
+		return;
+
+	if(b->next_client == NULL && b->next_channel == NULL)
+	{
+		burst_finish(b);
+		return;
 	}
 
-	RB_DLINK_FOREACH(ptr, global_channel_list.head)
+	if(rb_current_time() >= b->next_report)
 	{
-		chptr = ptr->data;
+		sendto_realops_snomask(SNO_GENERAL, L_ALL,
+				"Burst to %s in progress: %u users, %u channels, %lu KB so far",
+				client_p->name, b->users, b->channels, b->bytes / 1024);
+		b->next_report = rb_current_time() + BURST_REPORT_INTERVAL;
+	}
+}
 
-		if(*chptr->chname != '#')
-			continue;
+/* burst_defer()
+ *
+ * input	- server, linebuf being sent to it
+ * output	- true if the linebuf was held back behind the burst
+ * side effects -
+ */
+bool
+burst_defer(struct Client *client_p, buf_head_t *linebuf)
+{
+	struct burst_state *b = client_p->localClient->burst;
 
-		cur_len = mlen = sprintf(buf, ":%s SJOIN %ld %s %s :", me.id,
-				(long) chptr->channelts, chptr->chname,
-				channel_modes(chptr, client_p));
+	if(b == NULL)
+		return false;
 
-		t = buf + mlen;
+	if(b->generating)
+	{
+		/* records made so far go first, the text may be about them */
+		bburst_flush(client_p, &b->frame);
+		return false;
+	}
 
-		RB_DLINK_FOREACH(uptr, chptr->members.head)
-		{
-			msptr = uptr->data;
+	rb_linebuf_attach(&b->deferred, linebuf);
+	return true;
+}
 
-			tlen = strlen(use_id(msptr->client_p)) + 1;
-			if(is_chanop(msptr))
-				tlen++;
-			if(is_voiced(msptr))
-				tlen++;
+unsigned int
+burst_deferred_len(struct Client *client_p)
+{
+	struct burst_state *b = client_p->localClient->burst;
 
-			if(cur_len + tlen >= BUFSIZE - 3)
-			{
-				*(t-1) = '\0';
-				sendto_one(client_p, "%s", buf);
-				cur_len = mlen;
-				t = buf + mlen;
-			}
+	return b != NULL ? rb_linebuf_len(&b->deferred) : 0;
+}
+
+/* burst_cancel()
+ *
+ * input	- server going away
+ * output	-
+ * side effects - any burst to it is dropped
+ */
+void
+burst_cancel(struct Client *client_p)
+{
+	if(client_p->localClient->burst != NULL)
+		burst_free(client_p->localClient->burst);
+}
 
-			sprintf(t, "%s%s ", find_channel_status(msptr, 1),
-				   use_id(msptr->client_p));
+/* burst_forget_client()
+ *
+ * input	- client leaving global_client_list
+ * output	-
+ * side effects - no burst cursor is left pointing at it
+ */
+void
+burst_forget_client(struct Client *target_p)
+{
+	struct burst_state *b;
+	rb_dlink_node *ptr;
 
-			cur_len += tlen;
-			t += tlen;
-		}
+	RB_DLINK_FOREACH(ptr, burst_list.head)
+	{
+		b = ptr->data;
 
-		if (rb_dlink_list_length(&chptr->members) > 0)
+		if(b->last_client == &target_p->node)
 		{
-			/* remove trailing space */
-			*(t-1) = '\0';
+			if(b->next_client == b->last_client)
+				b->next_client = NULL;
+			b->last_client = b->last_client->prev;
 		}
-		sendto_one(client_p, "%s", buf);
-
-		if(rb_dlink_list_length(&chptr->banlist) > 0)
-			burst_modes_TS6(client_p, chptr, &chptr->banlist, 'b');
-
-		if(IsCapable(client_p, CAP_EX) &&
-		   rb_dlink_list_length(&chptr->exceptlist) > 0)
-			burst_modes_TS6(client_p, chptr, &chptr->exceptlist, 'e');
+		else if(b->next_client == &target_p->node)
+			b->next_client = b->next_client->next;
+	}
+}
 
-		if(IsCapable(client_p, CAP_IE) &&
-		   rb_dlink_list_length(&chptr->invexlist) > 0)
-			burst_modes_TS6(client_p, chptr, &chptr->invexlist, 'I');
+/* burst_new_client()
+ *
+ * input	- local client that has just registered
+ * output	-
+ * side effects - it is moved to the end of global_client_list, past
+ *		  every burst cursor, so a burst under way hears of it
+ *		  only from introduce_client()
+ */
+void
+burst_new_client(struct Client *target_p)
+{
+	if(rb_dlink_list_length(&burst_list) == 0)
+		return;
 
-		if(rb_dlink_list_length(&chptr->quietlist) > 0)
-			burst_modes_TS6(client_p, chptr, &chptr->quietlist, 'q');
+	burst_forget_client(target_p);
+	rb_dlinkDelete(&target_p->node, &global_client_list);
+	rb_dlinkAddTail(target_p, &target_p->node, &global_client_list);
+}
 
-		if(IsCapable(client_p, CAP_TB) && chptr->topic != NULL)
-			sendto_one(client_p, ":%s TB %s %ld %s :%s",
-				   me.id, chptr->chname, (long) chptr->topic_time,
-				   chptr->topic_info,
-				   chptr->topic);
+/* burst_forget_channel()
+ *
+ * input	- channel leaving global_channel_list
+ * output	-
+ * side effects - no burst cursor is left pointing at it
+ */
+void
+burst_forget_channel(struct Channel *chptr)
+{
+	struct burst_state *b;
+	rb_dlink_node *ptr;
 
-		if(IsCapable(client_p, CAP_MLOCK))
-			sendto_one(client_p, ":%s MLOCK %ld %s :%s",
-				   me.id, (long) chptr->channelts, chptr->chname,
-				   EmptyString(chptr->mode_lock) ? "" : chptr->mode_lock);
+	RB_DLINK_FOREACH(ptr, burst_list.head)
+	{
+		b = ptr->data;
 
-		hchaninfo.chptr = chptr;
-		call_hook(h_burst_channel, &hchaninfo);
+		if(b->next_channel == &chptr->node)
+			b->next_channel = b->next_channel->next;
 	}
-
-	hclientinfo.target = NULL;
-	call_hook(h_burst_finished, &hclientinfo);
 }
 
 /*
@@ -948,10 +1274,7 @@ server_estab(struct Client *client_p)
 	if(IsCapable(client_p, CAP_BAN))
 		burst_ban(client_p);
 
-	burst_TS6(client_p);
-
-	/* Always send a PING after connect burst is done */
-	sendto_one(client_p, "PING :%s", get_id(&me, client_p));
+	burst_start(client_p);
 
 	free_pre_client(client_p);
 
@@ -659,6 +659,7 @@ register_local_user(struct Client *client_p, struct Client *source_p)
 			source_p->info);
 
 	add_to_hostname_hash(source_p->orighost, source_p);
+	add_to_global_index(source_p);
 
 	/* Allocate a UID if it was not previously allocated.
 	 * If this already occured, it was probably during SASL auth...
@@ -677,7 +678,9 @@ register_local_user(struct Client *client_p, struct Client *source_p)
 
 	s_assert(!IsClient(source_p));
 	rb_dlinkMoveNode(&source_p->localClient->tnode, &unknown_list, &lclient_list);
+	add_to_local_index(source_p);
 	SetClient(source_p);
+	burst_new_client(source_p);
 
 	source_p->servptr = &me;
 	rb_dlinkAdd(source_p, &source_p->lnode, &source_p->servptr->serv->users);
@@ -1669,7 +1672,12 @@ change_nick_user_host(struct Client *target_p,	const char *nick, const char *use
 	if (user != target_p->username)
 		rb_strlcpy(target_p->username, user, sizeof target_p->username);
 
-	rb_strlcpy(target_p->host, host, sizeof target_p->host);
+	if (strcmp(target_p->host, host))
+	{
+		del_from_global_index(target_p);
+		rb_strlcpy(target_p->host, host, sizeof target_p->host);
+		add_to_global_index(target_p);
+	}
 
 	if (changed)
 		whowas_add_history(target_p, 1);
@@ -1677,6 +1685,7 @@ change_nick_user_host(struct Client *target_p,	const char *nick, const char *use
 	del_from_client_hash(target_p->name, target_p);
 	rb_strlcpy(target_p->name, nick, NICKLEN);
 	add_to_client_hash(target_p->name, target_p);
+	invalidate_client_prefix(target_p);
 
 	if(changed)
 	{
@@ -34,6 +34,7 @@
 #include "s_serv.h"
 #include "s_conf.h"
 #include "s_newconf.h"
+#include "s_stats.h"
 #include "logger.h"
 #include "hook.h"
 #include "monitor.h"
@@ -45,6 +46,10 @@
 #define CLIENT_CAPS_ONLY(x)	((IsClient((x)) && (x)->localClient) ? (x)->localClient->caps : 0)
 
 static void send_queued_write(rb_fde_t *F, void *data);
+static void send_queued_defer(struct Client *to);
+
+/* local clients with unflushed sendqs, written out once per io loop pass */
+static rb_dlink_list flush_pending_list;
 
 unsigned long current_serial = 0L;
 
@@ -59,6 +64,8 @@ struct Client *remote_rehash_oper_p;
 static int
 _send_linebuf(struct Client *to, buf_head_t *linebuf)
 {
+	unsigned int sendqlen;
+
 	if(IsMe(to))
 	{
 		sendto_realops_snomask(SNO_GENERAL, L_ALL, "Trying to send message to myself!");
@@ -68,7 +75,10 @@ _send_linebuf(struct Client *to, buf_head_t *linebuf)
 	if(!MyConnect(to) || IsIOError(to))
 		return 0;
 
-	if(rb_linebuf_len(&to->localClient->buf_sendq) > get_sendq(to))
+	/* what is held back behind a burst counts too */
+	sendqlen = rb_linebuf_len(&to->localClient->buf_sendq) + burst_deferred_len(to);
+
+	if(sendqlen > get_sendq(to))
 	{
 		dead_link(to, 1);
 
@@ -76,19 +86,15 @@ _send_linebuf(struct Client *to, buf_head_t *linebuf)
 		{
 			sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
 					     "Max SendQ limit exceeded for %s: %u > %lu",
-					     to->name,
-					     rb_linebuf_len(&to->localClient->buf_sendq),
-					     get_sendq(to));
+					     to->name, sendqlen, get_sendq(to));
 
 			ilog(L_SERVER, "Max SendQ limit exceeded for %s: %u > %lu",
-			     log_client_name(to, SHOW_IP),
-			     rb_linebuf_len(&to->localClient->buf_sendq),
-			     get_sendq(to));
+			     log_client_name(to, SHOW_IP), sendqlen, get_sendq(to));
 		}
 
 		return -1;
 	}
-	else
+	else if(!burst_defer(to, linebuf))
 	{
 		/* just attach the linebuf to the sendq instead of
 		 * generating a new one
@@ -104,10 +110,69 @@ _send_linebuf(struct Client *to, buf_head_t *linebuf)
 	to->localClient->sendM += 1;
 	me.localClient->sendM += 1;
 	if(rb_linebuf_len(&to->localClient->buf_sendq) > 0)
-		send_queued(to);
+		send_queued_defer(to);
 	return 0;
 }
 
+/* send_flush_pending()
+ *
+ * inputs	- none
+ * outputs	-
+ * side effects - every client on the deferred flush list has its sendq
+ *		  written out, so lines queued during one io loop pass
+ *		  share as few writev() calls as possible.  Also called
+ *		  directly by anything about to exit or exec.
+ */
+void
+send_flush_pending(void *unused)
+{
+	struct Client *to;
+
+	/* sends made while draining land on this list too, so keep
+	 * going until it is really empty */
+	while(flush_pending_list.head != NULL)
+	{
+		to = flush_pending_list.head->data;
+		send_queued(to);
+	}
+}
+
+/* send_queued_defer()
+ *
+ * inputs	- client to flush
+ * outputs	-
+ * side effects - client is put on the deferred flush list
+ */
+static void
+send_queued_defer(struct Client *to)
+{
+	/* already queued, or waiting for the socket to become writable */
+	if(IsFlushPending(to) || IsFlush(to))
+		return;
+
+	if(flush_pending_list.head == NULL)
+		rb_defer(send_flush_pending, NULL);
+
+	SetFlushPending(to);
+	rb_dlinkAddTail(to, &to->localClient->flush_node, &flush_pending_list);
+}
+
+/* send_cancel_flush()
+ *
+ * inputs	- client whose connection is going away
+ * outputs	-
+ * side effects - client is removed from the deferred flush list
+ */
+void
+send_cancel_flush(struct Client *to)
+{
+	if(!IsFlushPending(to))
+		return;
+
+	ClearFlushPending(to);
+	rb_dlinkDelete(&to->localClient->flush_node, &flush_pending_list);
+}
+
 /* send_linebuf_remote()
  *
  * inputs	- client to attach to, sender, linebuf
@@ -124,6 +189,69 @@ send_linebuf_remote(struct Client *to, struct Client *from, buf_head_t *linebuf)
 	_send_linebuf(to, linebuf);
 }
 
+static void send_queued_write(rb_fde_t *F, void *data);
+
+/* send_queued_count()
+ *
+ * inputs	- client written to, bytes and whole lines written
+ * outputs	- none
+ * side effects - send counters are updated
+ */
+static void
+send_queued_count(struct Client *to, int retlen, int lines)
+{
+	ServerStats.is_sqw++;
+	ServerStats.is_sql += lines;
+
+	to->localClient->sendB += retlen;
+	me.localClient->sendB += retlen;
+	if(to->localClient->sendB > 1023)
+	{
+		to->localClient->sendK += (to->localClient->sendB >> 10);
+		to->localClient->sendB &= 0x03ff;	/* 2^10 = 1024, 3ff = 1023 */
+	}
+	else if(me.localClient->sendB > 1023)
+	{
+		me.localClient->sendK += (me.localClient->sendB >> 10);
+		me.localClient->sendB &= 0x03ff;
+	}
+}
+
+/* send_queued_done()
+ *
+ * inputs	- fd (NULL if it has since been closed), result of the
+ *		  write, lines written, client
+ * outputs	- none
+ * side effects - an asynchronous sendq write has finished, carry on
+ *		  with whatever is left
+ */
+static void
+send_queued_done(rb_fde_t *F, int retlen, int lines, void *data)
+{
+	struct Client *to = data;
+
+	ClearFlush(to);
+
+	if(retlen > 0)
+		send_queued_count(to, retlen, lines);
+	else if(F == NULL)
+		;	/* handed over to ssld, carry on with the new fd */
+	else if(retlen < 0 && rb_ignore_errno(errno))
+	{
+		/* the socket is full, wait until it drains */
+		SetFlush(to);
+		rb_setselect(F, RB_SELECT_WRITE, send_queued_write, to);
+		return;
+	}
+	else
+	{
+		dead_link(to, 0);
+		return;
+	}
+
+	send_queued(to);
+}
+
 /* send_queued_write()
  *
  * inputs	- fd to have queue sent, client we're sending to
@@ -134,8 +262,13 @@ void
 send_queued(struct Client *to)
 {
 	int retlen;
+	int numlines;
 
 	rb_fde_t *F = to->localClient->F;
+
+	/* whatever is queued is being written now */
+	send_cancel_flush(to);
+
 	if (!F)
 		return;
 
@@ -149,24 +282,26 @@ send_queued(struct Client *to)
 
 	if(rb_linebuf_len(&to->localClient->buf_sendq))
 	{
+		/* where the poller can, the write goes out with the next
+		 * pass of the loop and send_queued_done() picks up from there */
+		if(rb_linebuf_flush_async(F, &to->localClient->buf_sendq, send_queued_done, to))
+		{
+			SetFlush(to);
+			if(to->localClient->burst != NULL)
+				burst_continue(to);
+			return;
+		}
+
+		numlines = rb_linebuf_numlines(&to->localClient->buf_sendq);
+
 		while ((retlen =
 			rb_linebuf_flush(F, &to->localClient->buf_sendq)) > 0)
 		{
 			/* We have some data written .. update counters */
 			ClearFlush(to);
-
-			to->localClient->sendB += retlen;
-			me.localClient->sendB += retlen;
-			if(to->localClient->sendB > 1023)
-			{
-				to->localClient->sendK += (to->localClient->sendB >> 10);
-				to->localClient->sendB &= 0x03ff;	/* 2^10 = 1024, 3ff = 1023 */
-			}
-			else if(me.localClient->sendB > 1023)
-			{
-				me.localClient->sendK += (me.localClient->sendB >> 10);
-				me.localClient->sendB &= 0x03ff;
-			}
+			send_queued_count(to, retlen,
+				numlines - rb_linebuf_numlines(&to->localClient->buf_sendq));
+			numlines = rb_linebuf_numlines(&to->localClient->buf_sendq);
 		}
 
 		if(retlen == 0 || (retlen < 0 && !rb_ignore_errno(errno)))
@@ -176,6 +311,15 @@ send_queued(struct Client *to)
 		}
 	}
 
+	/* a burst being streamed out tops the sendq back up as it drains;
+	 * whatever it adds is written on the next pass, so a fast link
+	 * does not keep us here until the whole burst is out */
+	if(to->localClient->burst != NULL)
+	{
+		SetFlush(to);
+		burst_continue(to);
+	}
+
 	if(rb_linebuf_len(&to->localClient->buf_sendq))
 	{
 		SetFlush(to);
@@ -487,6 +631,27 @@ sendto_server(struct Client *one, struct Channel *chptr, unsigned long caps,
 	rb_linebuf_donebuf(&linebuf);
 }
 
+/* msgbuf_cache_init_source()
+ *
+ * inputs	- cache, tags, message, source of the message
+ * outputs	- none
+ * side effects - cache is initialised with the message prefixed by the
+ *		  source, using the source's cached prefix when it is a person
+ */
+static void
+msgbuf_cache_init_source(struct MsgBuf_cache *cache, const struct MsgBuf *msgbuf,
+		const rb_strf_t *message, struct Client *source_p)
+{
+	if(IsPerson(source_p))
+	{
+		rb_strf_t prefix = { .format = get_client_prefix(source_p), .format_args = NULL, .next = message };
+
+		msgbuf_cache_init(cache, msgbuf, &prefix);
+	}
+	else
+		msgbuf_cache_initf(cache, msgbuf, message, ":%s ", source_p->name);
+}
+
 /* sendto_channel_flags()
  *
  * inputs	- server not to send to, flags needed, source, channel, va_args
@@ -502,8 +667,7 @@ sendto_channel_flags(struct Client *one, int type, struct Client *source_p,
 	buf_head_t rb_linebuf_remote;
 	struct Client *target_p;
 	struct membership *msptr;
-	rb_dlink_node *ptr;
-	rb_dlink_node *next_ptr;
+	struct ChannelMember *cm;
 	struct MsgBuf msgbuf;
 	struct MsgBuf_cache msgbuf_cache;
 	rb_strf_t strings = { .format = buf, .format_args = NULL, .next = NULL };
@@ -519,14 +683,12 @@ sendto_channel_flags(struct Client *one, int type, struct Client *source_p,
 	va_end(args);
 
 	linebuf_put_msgf(&rb_linebuf_remote, NULL, ":%s %s", use_id(source_p), buf);
-	msgbuf_cache_initf(&msgbuf_cache, &msgbuf, &strings,
-		IsPerson(source_p) ? ":%1$s!%2$s@%3$s " : ":%1$s ",
-		source_p->name, source_p->username, source_p->host);
+	msgbuf_cache_init_source(&msgbuf_cache, &msgbuf, &strings, source_p);
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, chptr->members.head)
+	MEMBERS_FOREACH(cm, &chptr->memberv)
 	{
-		msptr = ptr->data;
-		target_p = msptr->client_p;
+		msptr = cm->msptr;
+		target_p = cm->client_p;
 
 		if(!MyClient(source_p) && (IsIOError(target_p->from) || target_p->from == one))
 			continue;
@@ -587,8 +749,7 @@ sendto_channel_opmod(struct Client *one, struct Client *source_p,
 	buf_head_t rb_linebuf_new;
 	struct Client *target_p;
 	struct membership *msptr;
-	rb_dlink_node *ptr;
-	rb_dlink_node *next_ptr;
+	struct ChannelMember *cm;
 	struct MsgBuf msgbuf;
 	struct MsgBuf_cache msgbuf_cache;
 	rb_strf_t strings = { .format = text, .format_args = NULL, .next = NULL };
@@ -606,9 +767,8 @@ sendto_channel_opmod(struct Client *one, struct Client *source_p,
 			       source_p->name, command, chptr->chname);
 	} else {
 		msgbuf_cache_initf(&msgbuf_cache, &msgbuf, &strings,
-			       ":%s!%s@%s %s @%s :",
-			       source_p->name, source_p->username,
-			       source_p->host, command, chptr->chname);
+			       "%s%s @%s :",
+			       get_client_prefix(source_p), command, chptr->chname);
 	}
 
 	if (chptr->mode.mode & MODE_MODERATED) {
@@ -624,10 +784,10 @@ sendto_channel_opmod(struct Client *one, struct Client *source_p,
 	linebuf_put_msgf(&rb_linebuf_new, &strings,
 		       ":%s %s =%s :",
 		       use_id(source_p), command, chptr->chname);
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, chptr->members.head)
+	MEMBERS_FOREACH(cm, &chptr->memberv)
 	{
-		msptr = ptr->data;
-		target_p = msptr->client_p;
+		msptr = cm->msptr;
+		target_p = cm->client_p;
 
 		if(!MyClient(source_p) && (IsIOError(target_p->from) || target_p->from == one))
 			continue;
@@ -686,8 +846,7 @@ _sendto_channel_local(struct Client *source_p, int type, const char *priv, struc
 {
 	struct membership *msptr;
 	struct Client *target_p;
-	rb_dlink_node *ptr;
-	rb_dlink_node *next_ptr;
+	struct ChannelMember *cm;
 	struct MsgBuf msgbuf;
 	struct MsgBuf_cache msgbuf_cache;
 	rb_strf_t strings = { .format = pattern, .format_args = args, .next = NULL };
@@ -696,10 +855,10 @@ _sendto_channel_local(struct Client *source_p, int type, const char *priv, struc
 
 	msgbuf_cache_init(&msgbuf_cache, &msgbuf, &strings);
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, chptr->locmembers.head)
+	MEMBERS_FOREACH(cm, &chptr->locmemberv)
 	{
-		msptr = ptr->data;
-		target_p = msptr->client_p;
+		msptr = cm->msptr;
+		target_p = cm->client_p;
 
 		if (IsIOError(target_p))
 			continue;
@@ -757,8 +916,7 @@ _sendto_channel_local_with_capability_butone(struct Client *source_p, const stru
 {
 	struct membership *msptr;
 	struct Client *target_p;
-	rb_dlink_node *ptr;
-	rb_dlink_node *next_ptr;
+	struct ChannelMember *cm;
 	struct MsgBuf msgbuf;
 	struct MsgBuf_cache msgbuf_cache;
 	rb_strf_t strings = { .format = pattern, .format_args = args, .next = NULL };
@@ -766,10 +924,10 @@ _sendto_channel_local_with_capability_butone(struct Client *source_p, const stru
 	build_msgbuf_tags(&msgbuf, source_p);
 	msgbuf_cache_init(&msgbuf_cache, &msgbuf, &strings);
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, chptr->locmembers.head)
+	MEMBERS_FOREACH(cm, &chptr->locmemberv)
 	{
-		msptr = ptr->data;
-		target_p = msptr->client_p;
+		msptr = cm->msptr;
+		target_p = cm->client_p;
 
 		if (target_p == one)
 			continue;
@@ -837,8 +995,7 @@ sendto_channel_local_butone(struct Client *one, int type, struct Channel *chptr,
 	struct membership *msptr;
 	struct Client *target_p;
 	struct MsgBuf msgbuf;
-	rb_dlink_node *ptr;
-	rb_dlink_node *next_ptr;
+	struct ChannelMember *cm;
 	struct MsgBuf_cache msgbuf_cache;
 	rb_strf_t strings = { .format = pattern, .format_args = &args, .next = NULL };
 
@@ -848,10 +1005,10 @@ sendto_channel_local_butone(struct Client *one, int type, struct Channel *chptr,
 	msgbuf_cache_init(&msgbuf_cache, &msgbuf, &strings);
 	va_end(args);
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, chptr->locmembers.head)
+	MEMBERS_FOREACH(cm, &chptr->locmemberv)
 	{
-		msptr = ptr->data;
-		target_p = msptr->client_p;
+		msptr = cm->msptr;
+		target_p = cm->client_p;
 
 		if(target_p == one)
 			continue;
@@ -887,11 +1044,9 @@ sendto_common_channels_local(struct Client *user, int cap, int negcap, const cha
 	va_list args;
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
-	rb_dlink_node *uptr;
-	rb_dlink_node *next_uptr;
 	struct Channel *chptr;
 	struct Client *target_p;
-	struct membership *msptr;
+	struct ChannelMember *cm;
 	struct membership *mscptr;
 	struct MsgBuf msgbuf;
 	struct MsgBuf_cache msgbuf_cache;
@@ -910,10 +1065,9 @@ sendto_common_channels_local(struct Client *user, int cap, int negcap, const cha
 		mscptr = ptr->data;
 		chptr = mscptr->chptr;
 
-		RB_DLINK_FOREACH_SAFE(uptr, next_uptr, chptr->locmembers.head)
+		MEMBERS_FOREACH(cm, &chptr->locmemberv)
 		{
-			msptr = uptr->data;
-			target_p = msptr->client_p;
+			target_p = cm->client_p;
 
 			if(IsIOError(target_p) ||
 			   target_p->serial == current_serial ||
@@ -954,11 +1108,9 @@ sendto_common_channels_local_butone(struct Client *user, int cap, int negcap, co
 	va_list args;
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
-	rb_dlink_node *uptr;
-	rb_dlink_node *next_uptr;
 	struct Channel *chptr;
 	struct Client *target_p;
-	struct membership *msptr;
+	struct ChannelMember *cm;
 	struct membership *mscptr;
 	struct MsgBuf msgbuf;
 	struct MsgBuf_cache msgbuf_cache;
@@ -979,10 +1131,9 @@ sendto_common_channels_local_butone(struct Client *user, int cap, int negcap, co
 		mscptr = ptr->data;
 		chptr = mscptr->chptr;
 
-		RB_DLINK_FOREACH_SAFE(uptr, next_uptr, chptr->locmembers.head)
+		MEMBERS_FOREACH(cm, &chptr->locmemberv)
 		{
-			msptr = uptr->data;
-			target_p = msptr->client_p;
+			target_p = cm->client_p;
 
 			if(IsIOError(target_p) ||
 			   target_p->serial == current_serial ||
@@ -1026,9 +1177,7 @@ sendto_match_butone(const struct Client *one, struct Client *source_p,
 	vsnprintf(buf, sizeof(buf), pattern, args);
 	va_end(args);
 
-	msgbuf_cache_initf(&msgbuf_cache, &msgbuf, &strings,
-		IsServer(source_p) ? ":%s " : ":%s!%s@%s ",
-		source_p->name, source_p->username, source_p->host);
+	msgbuf_cache_init_source(&msgbuf_cache, &msgbuf, &strings, source_p);
 
 	linebuf_put_msgf(&rb_linebuf_remote, &strings, ":%s ", use_id(source_p));
 
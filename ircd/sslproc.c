@@ -42,7 +42,7 @@ static char tmpbuf[READBUF_SIZE];
 static char nul = '\0';
 
 #define MAXPASSFD 4
-#define READSIZE 1024
+#define READSIZE 4096	/* fits a shared TLS session, see ssl_share_session() */
 typedef struct _ssl_ctl_buf
 {
 	rb_dlink_node node;
@@ -57,6 +57,12 @@ struct _ssl_ctl
 {
 	rb_dlink_node node;
 	int cli_count;
+	int handshakes;		/* in progress, as of the last 'L' report */
+	int assigned;		/* connections handed over since that report */
+	uint32_t rate;		/* bytes per second, from the last 'L' report */
+	uint32_t completed;	/* accepted handshakes completed ... */
+	uint32_t resumed;	/* ... and how many resumed a session */
+	int cpu;		/* cpu it is pinned to, or -1 */
 	rb_fde_t *F;
 	rb_fde_t *P;
 	pid_t pid;
@@ -70,10 +76,28 @@ struct _ssl_ctl
 static void ssld_update_config_one(ssl_ctl_t *ctl);
 static void send_new_ssl_certs_one(ssl_ctl_t * ctl);
 static void send_certfp_method(ssl_ctl_t *ctl);
+static void send_ticket_keys_one(ssl_ctl_t *ctl);
+static void rotate_ticket_keys(void);
+static void ssl_cmd_write_queue(ssl_ctl_t * ctl, rb_fde_t ** F, int count, const void *buf, size_t buflen);
 
 
 static rb_dlink_list ssl_daemons;
 
+/*
+ * which_ssld() weighs each handshake in progress like this many
+ * established connections, and adds one for every SSLD_RATE_UNIT bytes
+ * per second the ssld is moving
+ */
+#define SSLD_HANDSHAKE_WEIGHT	50
+#define SSLD_RATE_UNIT		16384
+
+#define SSLD_MAX_CPUS		256
+
+/* session ticket keys, newest first, replaced every SSLD_TICKET_ROTATE */
+#define SSLD_TICKET_ROTATE	3600
+static uint8_t ticket_keys[RB_SSL_TICKET_KEYS_MAX * RB_SSL_TICKET_KEY_LEN];
+static int ticket_key_count;
+
 static inline uint32_t
 buf_to_uint32(char *buf)
 {
@@ -100,6 +124,7 @@ allocate_ssl_daemon(rb_fde_t * F, rb_fde_t * P, int pid)
 	ctl->F = F;
 	ctl->P = P;
 	ctl->pid = pid;
+	ctl->cpu = -1;
 	ssld_count++;
 	rb_dlinkAdd(ctl, &ctl->node, &ssl_daemons);
 	return ctl;
@@ -336,6 +361,7 @@ start_ssldaemon(int count)
 		ssl_do_pipe(P2, ctl);
 
 	}
+	ssld_assign_cpus();
 	ilog(L_MAIN, "ssld helper started");
 	sendto_realops_snomask(SNO_GENERAL, L_NETWIDE, "ssld helper started");
 	return started;
@@ -491,6 +517,29 @@ ssl_process_certfp(ssl_ctl_t * ctl, ssl_ctl_buf_t * ctl_buf)
 	client_p->certfp = certfp_string;
 }
 
+/*
+ * ssl_share_session: one ssld cached a new session; copy it to the others
+ * so the client can resume it through any of them
+ */
+static void
+ssl_share_session(ssl_ctl_t *from, ssl_ctl_buf_t *ctl_buf)
+{
+	rb_dlink_node *ptr;
+
+	if(ServerInfo.ssl_session_cache <= 0)
+		return;
+
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+	{
+		ssl_ctl_t *ctl = ptr->data;
+
+		if(ctl == from || ctl->dead || ctl->shutdown)
+			continue;
+
+		ssl_cmd_write_queue(ctl, NULL, 0, ctl_buf->buf, ctl_buf->buflen);
+	}
+}
+
 static void
 ssl_process_cmd_recv(ssl_ctl_t * ctl)
 {
@@ -523,6 +572,18 @@ ssl_process_cmd_recv(ssl_ctl_t * ctl)
 		case 'F':
 			ssl_process_certfp(ctl, ctl_buf);
 			break;
+		case 'L':
+			if(ctl_buf->buflen != 17)
+				break;
+			ctl->handshakes = buf_to_uint32(&ctl_buf->buf[1]);
+			ctl->rate = buf_to_uint32(&ctl_buf->buf[5]);
+			ctl->completed = buf_to_uint32(&ctl_buf->buf[9]);
+			ctl->resumed = buf_to_uint32(&ctl_buf->buf[13]);
+			ctl->assigned = 0;
+			break;
+		case 'R':
+			ssl_share_session(ctl, ctl_buf);
+			break;
 		case 'I':
 			ircd_ssl_ok = false;
 			ilog(L_MAIN, "%s", cannot_setup_ssl);
@@ -590,10 +651,26 @@ ssl_read_ctl(rb_fde_t * F, void *data)
 	rb_setselect(ctl->F, RB_SELECT_READ, ssl_read_ctl, ctl);
 }
 
+static unsigned long
+ssld_load(ssl_ctl_t *ctl)
+{
+	return ctl->cli_count
+		+ (unsigned long)(ctl->handshakes + ctl->assigned) * SSLD_HANDSHAKE_WEIGHT
+		+ ctl->rate / SSLD_RATE_UNIT;
+}
+
+/*
+ * which_ssld: picks the ssld with the lowest load.  Handshakes cost far
+ * more cpu than established connections, so an ssld busy negotiating a
+ * burst of new clients is avoided even when it has fewer connections.
+ * Connections handed over since its last report are assumed to still be
+ * handshaking.
+ */
 static ssl_ctl_t *
 which_ssld(void)
 {
 	ssl_ctl_t *ctl, *lowest = NULL;
+	unsigned long load, lowest_load = 0;
 	rb_dlink_node *ptr;
 
 	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
@@ -603,13 +680,12 @@ which_ssld(void)
 			continue;
 		if(ctl->shutdown)
 			continue;
-		if(lowest == NULL)
+		load = ssld_load(ctl);
+		if(lowest == NULL || load < lowest_load)
 		{
 			lowest = ctl;
-			continue;
+			lowest_load = load;
 		}
-		if(ctl->cli_count < lowest->cli_count)
-			lowest = ctl;
 	}
 	return (lowest);
 }
@@ -679,7 +755,7 @@ ssl_cmd_write_queue(ssl_ctl_t * ctl, rb_fde_t ** F, int count, const void *buf,
 static void
 send_new_ssl_certs_one(ssl_ctl_t * ctl)
 {
-	size_t len = 5;
+	size_t len = 7;
 
 	if(ServerInfo.ssl_cert)
 		len += strlen(ServerInfo.ssl_cert);
@@ -706,13 +782,15 @@ send_new_ssl_certs_one(ssl_ctl_t * ctl)
 		return;
 	}
 
-	int ret = snprintf(tmpbuf, sizeof(tmpbuf), "K%c%s%c%s%c%s%c%s%c", nul,
+	int ret = snprintf(tmpbuf, sizeof(tmpbuf), "K%c%s%c%s%c%s%c%s%c%s%c%d%c", nul,
 	                   ServerInfo.ssl_cert, nul,
 	                   ServerInfo.ssl_private_key != NULL ? ServerInfo.ssl_private_key : "", nul,
 	                   ServerInfo.ssl_dh_params != NULL ? ServerInfo.ssl_dh_params : "", nul,
-	                   ServerInfo.ssl_cipher_list != NULL ? ServerInfo.ssl_cipher_list : "", nul);
+	                   ServerInfo.ssl_cipher_list != NULL ? ServerInfo.ssl_cipher_list : "", nul,
+	                   ServerInfo.ssl_ktls ? "1" : "0", nul,
+	                   ServerInfo.ssl_session_cache > 0 ? ServerInfo.ssl_session_cache : 0, nul);
 
-	if(ret > 5)
+	if(ret > 7)
 		ssl_cmd_write_queue(ctl, NULL, 0, tmpbuf, (size_t) ret);
 }
 
@@ -726,11 +804,67 @@ send_certfp_method(ssl_ctl_t *ctl)
 	ssl_cmd_write_queue(ctl, NULL, 0, buf, sizeof(buf));
 }
 
+/*
+ * send_ticket_keys_one: the newest key issues tickets; the one before it
+ * is still accepted so tickets survive a rotation.  An empty list turns
+ * tickets off.
+ */
+static void
+send_ticket_keys_one(ssl_ctl_t *ctl)
+{
+	char buf[1 + sizeof(ticket_keys)];
+	int count;
+
+	/* the first ssld can start before init_ssld() */
+	if(ticket_key_count == 0)
+		rotate_ticket_keys();
+
+	count = ServerInfo.ssl_session_tickets ? ticket_key_count : 0;
+
+	buf[0] = 'T';
+	memcpy(&buf[1], ticket_keys, count * RB_SSL_TICKET_KEY_LEN);
+	ssl_cmd_write_queue(ctl, NULL, 0, buf, 1 + count * RB_SSL_TICKET_KEY_LEN);
+}
+
+static void
+rotate_ticket_keys(void)
+{
+	memmove(&ticket_keys[RB_SSL_TICKET_KEY_LEN], ticket_keys,
+		sizeof(ticket_keys) - RB_SSL_TICKET_KEY_LEN);
+	if(!rb_get_random(ticket_keys, RB_SSL_TICKET_KEY_LEN))
+	{
+		/* never hand out predictable keys */
+		ticket_key_count = 0;
+		return;
+	}
+	if(ticket_key_count < RB_SSL_TICKET_KEYS_MAX)
+		ticket_key_count++;
+}
+
+static void
+rotate_ticket_keys_event(void *unused)
+{
+	rb_dlink_node *ptr;
+
+	rotate_ticket_keys();
+
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+	{
+		ssl_ctl_t *ctl = ptr->data;
+
+		if (ctl->dead || ctl->shutdown)
+			continue;
+
+		send_ticket_keys_one(ctl);
+	}
+}
+
 static void
 ssld_update_config_one(ssl_ctl_t *ctl)
 {
 	send_certfp_method(ctl);
 	send_new_ssl_certs_one(ctl);
+	send_ticket_keys_one(ctl);
 }
 
 void
@@ -764,6 +898,7 @@ start_ssld_accept(rb_fde_t * sslF, rb_fde_t * plainF, uint32_t id)
 	if(!ctl)
 		return NULL;
 	ctl->cli_count++;
+	ctl->assigned++;
 	ssl_cmd_write_queue(ctl, F, 2, buf, sizeof(buf));
 	return ctl;
 }
@@ -784,6 +919,7 @@ start_ssld_connect(rb_fde_t * sslF, rb_fde_t * plainF, uint32_t id)
 	if(!ctl)
 		return NULL;
 	ctl->cli_count++;
+	ctl->assigned++;
 	ssl_cmd_write_queue(ctl, F, 2, buf, sizeof(buf));
 	return ctl;
 }
@@ -828,17 +964,98 @@ get_ssld_count(void)
 }
 
 void
-ssld_foreach_info(void (*func)(void *data, pid_t pid, int cli_count, enum ssld_status status, const char *version), void *data)
+ssld_foreach_info(void (*func)(void *data, const struct ssld_info *info), void *data)
 {
 	rb_dlink_node *ptr, *next;
 	ssl_ctl_t *ctl;
+	struct ssld_info info;
 	RB_DLINK_FOREACH_SAFE(ptr, next, ssl_daemons.head)
 	{
 		ctl = ptr->data;
-		func(data, ctl->pid, ctl->cli_count,
-			ctl->dead ? SSLD_DEAD :
-				(ctl->shutdown ? SSLD_SHUTDOWN : SSLD_ACTIVE),
-			ctl->version);
+		info.pid = ctl->pid;
+		info.cli_count = ctl->cli_count;
+		info.status = ctl->dead ? SSLD_DEAD :
+				(ctl->shutdown ? SSLD_SHUTDOWN : SSLD_ACTIVE);
+		info.version = ctl->version;
+		info.handshakes = ctl->handshakes + ctl->assigned;
+		info.rate = ctl->rate;
+		info.completed = ctl->completed;
+		info.resumed = ctl->resumed;
+		func(data, &info);
+	}
+}
+
+/*
+ * parse_cpu_list: reads a list such as "0-3,6" into cpus, returning how
+ * many were found.  Anything malformed ends the list.
+ */
+static int
+parse_cpu_list(const char *list, int *cpus, int max)
+{
+	const char *p = list;
+	int count = 0;
+	char *end;
+
+	while(*p != '\0' && count < max)
+	{
+		long lo, hi;
+
+		lo = hi = strtol(p, &end, 10);
+		if(end == p || lo < 0)
+			break;
+		p = end;
+		if(*p == '-')
+		{
+			p++;
+			hi = strtol(p, &end, 10);
+			if(end == p || hi < lo)
+				break;
+			p = end;
+		}
+		for(; lo <= hi && count < max; lo++)
+			cpus[count++] = lo;
+		if(*p != ',')
+			break;
+		p++;
+	}
+	return count;
+}
+
+static void
+send_cpu(ssl_ctl_t *ctl, int cpu)
+{
+	char buf[5];
+
+	if(ctl->cpu == cpu)
+		return;
+	ctl->cpu = cpu;
+	buf[0] = 'P';
+	uint32_to_buf(&buf[1], cpu < 0 ? UINT32_MAX : (uint32_t)cpu);
+	ssl_cmd_write_queue(ctl, NULL, 0, buf, sizeof(buf));
+}
+
+/*
+ * ssld_assign_cpus: spreads the running sslds over serverinfo::ssld_cpus,
+ * one cpu each in turn, and unpins them when that is unset
+ */
+void
+ssld_assign_cpus(void)
+{
+	int cpus[SSLD_MAX_CPUS];
+	int count = 0, i = 0;
+	rb_dlink_node *ptr;
+
+	if(!EmptyString(ServerInfo.ssld_cpus))
+		count = parse_cpu_list(ServerInfo.ssld_cpus, cpus, SSLD_MAX_CPUS);
+
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+	{
+		ssl_ctl_t *ctl = ptr->data;
+
+		if(ctl->dead || ctl->shutdown)
+			continue;
+
+		send_cpu(ctl, count > 0 ? cpus[i++ % count] : -1);
 	}
 }
 
@@ -846,4 +1063,5 @@ void
 init_ssld(void)
 {
 	rb_event_addish("cleanup_dead_ssld", cleanup_dead_ssl, NULL, 60);
+	rb_event_add("rotate_ticket_keys", rotate_ticket_keys_event, NULL, SSLD_TICKET_ROTATE);
 }
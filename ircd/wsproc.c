@@ -35,6 +35,7 @@
 #include "packet.h"
 
 static void ws_read_ctl(rb_fde_t * F, void *data);
+static void wsockd_update_config_one(ws_ctl_t *ctl);
 static int wsockd_count;
 
 #define MAXPASSFD 4
@@ -272,6 +273,7 @@ start_wsockd(int count)
 		rb_close(F2);
 		rb_close(P1);
 		ctl = allocate_ws_daemon(F1, P2, pid);
+		wsockd_update_config_one(ctl);
 		ws_read_ctl(ctl->F, ctl);
 		ws_do_pipe(P2, ctl);
 
@@ -458,6 +460,40 @@ ws_cmd_write_queue(ws_ctl_t * ctl, rb_fde_t ** F, int count, const void *buf, si
 	ws_write_ctl(ctl->F, ctl);
 }
 
+/*
+ * wsockd_update_config_one: sends the permessage-deflate settings, see
+ * set_deflate() in wsockd
+ */
+static void
+wsockd_update_config_one(ws_ctl_t *ctl)
+{
+	char buf[21];
+
+	buf[0] = 'D';
+	uint32_to_buf(&buf[1], ServerInfo.ws_deflate);
+	uint32_to_buf(&buf[5], ServerInfo.ws_deflate_window_bits);
+	uint32_to_buf(&buf[9], ServerInfo.ws_deflate_context_takeover);
+	uint32_to_buf(&buf[13], ServerInfo.ws_deflate_memory > 0 ? ServerInfo.ws_deflate_memory : 0);
+	uint32_to_buf(&buf[17], ServerInfo.ws_deflate_cpu > 0 ? ServerInfo.ws_deflate_cpu : 0);
+	ws_cmd_write_queue(ctl, NULL, 0, buf, sizeof(buf));
+}
+
+void
+wsockd_update_config(void)
+{
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, wsock_daemons.head)
+	{
+		ws_ctl_t *ctl = ptr->data;
+
+		if (ctl->dead || ctl->shutdown)
+			continue;
+
+		wsockd_update_config_one(ctl);
+	}
+}
+
 ws_ctl_t *
 start_wsockd_accept(rb_fde_t * sslF, rb_fde_t * plainF, uint32_t id)
 {
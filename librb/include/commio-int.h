@@ -154,6 +154,7 @@ int rb_io_sched_event(struct ev_entry *ev, int when);
 void rb_io_unsched_event(struct ev_entry *ev);
 int rb_io_supports_event(void);
 void rb_io_init_event(void);
+void rb_run_deferred(void);
 
 /* epoll versions */
 void rb_setselect_epoll(rb_fde_t *F, unsigned int type, PF * handler, void *client_data);
@@ -167,6 +168,16 @@ void rb_epoll_unsched_event(struct ev_entry *event);
 int rb_epoll_supports_event(void);
 
 
+/* io_uring versions */
+void rb_setselect_iouring(rb_fde_t *F, unsigned int type, PF * handler, void *client_data);
+int rb_init_netio_iouring(void);
+int rb_select_iouring(long);
+int rb_setup_fd_iouring(rb_fde_t *F);
+int rb_read_stream_iouring(rb_fde_t *F, RSCB *cb, void *data);
+int rb_writev_async_iouring(rb_fde_t *F, struct rb_iovec *vec, int count, WVCB *cb, void *data);
+void rb_close_iouring(rb_fde_t *F);
+
+
 /* poll versions */
 void rb_setselect_poll(rb_fde_t *F, unsigned int type, PF * handler, void *client_data);
 int rb_init_netio_poll(void);
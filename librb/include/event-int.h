@@ -22,9 +22,44 @@
  *
  */
 
+/*
+ * Binary min-heap of deadlines.  Entries are embedded in the structure
+ * being scheduled and remember their slot, so they can be removed from
+ * the middle of the heap without searching for them.
+ */
+struct rb_heap_entry
+{
+	int64_t key;		/* deadline in milliseconds */
+	int index;		/* slot in the heap, -1 if not queued */
+};
+
+struct rb_heap
+{
+	struct rb_heap_entry **items;
+	int len;
+	int size;
+};
+
+void rb_heap_insert(struct rb_heap *heap, struct rb_heap_entry *entry);
+void rb_heap_delete(struct rb_heap *heap, struct rb_heap_entry *entry);
+
+static inline struct rb_heap_entry *
+rb_heap_min(struct rb_heap *heap)
+{
+	return heap->len > 0 ? heap->items[0] : NULL;
+}
+
+static inline int64_t
+rb_current_time_ms(void)
+{
+	const struct timeval *tv = rb_current_time_tv();
+	return (int64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
+
 struct ev_entry
 {
 	rb_dlink_node node;
+	struct rb_heap_entry hnode;
 	EVH *func;
 	void *arg;
 	char *name;
@@ -47,6 +47,10 @@ typedef void DUMPCB(int, const char *desc, void *);
 typedef void ACCB(rb_fde_t *, int status, struct sockaddr *addr, rb_socklen_t len, void *);
 /* callback for pre-accept callback */
 typedef int ACPRE(rb_fde_t *, struct sockaddr *addr, rb_socklen_t len, void *);
+/* callback for stream reads: data and its length, 0 at EOF, -1 on error */
+typedef void RSCB(rb_fde_t *, char *buf, int len, void *);
+/* callback for completed writes: bytes written, or -1 with errno set */
+typedef void WVCB(rb_fde_t *, ssize_t, void *);
 
 enum
 {
@@ -141,6 +145,8 @@ ssize_t rb_write(rb_fde_t *, const void *buf, int count);
 ssize_t rb_writev(rb_fde_t *, struct rb_iovec *vector, int count);
 
 ssize_t rb_read(rb_fde_t *, void *buf, int count);
+int rb_read_stream(rb_fde_t *, RSCB *cb, void *data);
+int rb_writev_async(rb_fde_t *, struct rb_iovec *vector, int count, WVCB *cb, void *data);
 int rb_pipe(rb_fde_t **, rb_fde_t **, const char *desc);
 
 int rb_setup_ssl_server(const char *cert, const char *keyfile, const char *dhfile, const char *cipher_list);
@@ -193,6 +199,24 @@ rb_fde_t *rb_recv_fd(rb_fde_t *);
 
 const char *rb_ssl_get_cipher(rb_fde_t *F);
 
+/* directions of an established session offloaded to kernel TLS */
+#define RB_SSL_KTLS_SEND	0x1
+#define RB_SSL_KTLS_RECV	0x2
+
+void rb_ssl_set_ktls(int enable);
+int rb_ssl_ktls(rb_fde_t *F);
+
+/* session ticket key: 16 bytes name, 32 bytes HMAC key, 32 bytes AES key */
+#define RB_SSL_TICKET_KEY_LEN	80
+#define RB_SSL_TICKET_KEYS_MAX	2
+
+typedef void RB_SSL_SESSION_CB(const uint8_t *data, size_t len);
+
+int rb_ssl_set_ticket_keys(const uint8_t *keys, int count);
+void rb_ssl_set_session_cache(int size, RB_SSL_SESSION_CB *cb);
+int rb_ssl_add_session(const uint8_t *data, size_t len);
+int rb_ssl_session_reused(rb_fde_t *F);
+
 int rb_ipv4_from_ipv6(const struct sockaddr_in6 *restrict ip6, struct sockaddr_in *restrict ip4);
 
 #endif /* INCLUDED_commio_h */
@@ -37,6 +37,10 @@
 
 struct _buf_line;
 struct _buf_head;
+struct _linebuf_write;
+
+/* callback for rb_linebuf_flush_async(): bytes and whole lines written */
+typedef void LBFCB(rb_fde_t *, int retval, int lines, void *);
 
 /* IRCv3 tags (512 bytes) + RFC1459 message (510 bytes) */
 #define LINEBUF_TAGSLEN         512     /* IRCv3 message tags */
@@ -44,22 +48,39 @@ struct _buf_head;
 #define LINEBUF_SIZE            (512 + 510)
 #define CRLF_LEN                2
 
+/*
+ * Lines are immutable once terminated and shared between every queue
+ * they have been attached to, so a line only needs as much storage as
+ * it actually holds.  Lines built by rb_linebuf_put() are carved from
+ * the smallest size class that fits; lines being filled by
+ * rb_linebuf_parse() always use the full LINEBUF_SIZE class.
+ */
+#define LINEBUF_LINE_CLASSES    4
+
 typedef struct _buf_line
 {
-	char buf[LINEBUF_SIZE + CRLF_LEN + 1];
 	uint8_t terminated;	/* Whether we've terminated the buffer */
 	uint8_t raw;		/* Whether this linebuf may hold 8-bit data */
+	uint8_t size_class;	/* which line heap this came from */
 	int len;		/* How much data we've got */
-	int refcount;		/* how many linked lists are we in? */
+	int refcount;		/* how many queues are we in? */
+	char buf[];		/* line data, sized by size_class */
 } buf_line_t;
 
+/*
+ * A queue of line pointers kept in a power-of-two ring, so attaching
+ * a shared line to a queue is a single pointer store.
+ */
 typedef struct _buf_head
 {
-	rb_dlink_list list;	/* the actual dlink list */
+	buf_line_t **lines;	/* ring of line pointers */
+	int first;		/* ring slot of the oldest line */
+	int ringsize;		/* number of slots in the ring */
 	int len;		/* length of all the data */
 	int alloclen;		/* Actual allocated data length */
 	int writeofs;		/* offset in the first line for the write */
 	int numlines;		/* number of lines */
+	struct _linebuf_write *writing;	/* async write in flight, if any */
 } buf_head_t;
 
 /* they should be functions, but .. */
@@ -76,6 +97,7 @@ void rb_linebuf_put(buf_head_t *, const rb_strf_t *);
 void rb_linebuf_attach(buf_head_t *, buf_head_t *);
 void rb_count_rb_linebuf_memory(size_t *, size_t *);
 int rb_linebuf_flush(rb_fde_t *F, buf_head_t *);
+int rb_linebuf_flush_async(rb_fde_t *F, buf_head_t *, LBFCB *, void *);
 
 
 #endif
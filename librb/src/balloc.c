@@ -57,18 +57,48 @@
 #include <librb_config.h>
 #include <rb_lib.h>
 
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#if !defined(MAP_ANON) && defined(MAP_ANONYMOUS)
+#define MAP_ANON MAP_ANONYMOUS
+#endif
+#endif
+
 static void _rb_bh_fail(const char *reason, const char *file, int line) __attribute__((noreturn));
 
 static uintptr_t offset_pad;
+static size_t page_size;
+
+/*
+ * A block is one page aligned run of elements.  Each element is
+ * preceded by offset_pad bytes holding a pointer back to its block, so
+ * rb_bh_free() can find the block without searching.  Free elements
+ * are chained through their first bytes, which is why elements may not
+ * be smaller than an rb_dlink_node.
+ */
+struct rb_heap_block
+{
+	rb_dlink_node node;		/* on the heap's block_list */
+	rb_dlink_node free_node;	/* on the heap's free_list, if not full */
+	rb_bh *heap;
+	void *elems;
+	size_t alloc_size;
+	unsigned long elem_count;
+	unsigned long free_count;
+	void *free_elems;		/* chain of free elements */
+};
 
 /* information for the root node of the heap */
 struct rb_bh
 {
 	rb_dlink_node hlist;
 	size_t elemSize;	/* Size of each element to be stored */
+	size_t stride;		/* elemSize plus the block pointer, aligned */
 	unsigned long elemsPerBlock;	/* Number of elements per block */
-	rb_dlink_list block_list;
-	rb_dlink_list free_list;
+	unsigned long totalElems;	/* Number of elements over all blocks */
+	unsigned long freeElems;	/* Number of free elements over all blocks */
+	rb_dlink_list block_list;	/* every block */
+	rb_dlink_list free_list;	/* blocks with free elements */
 	char *desc;
 };
 
@@ -106,6 +136,84 @@ rb_init_bh(void)
 		offset_pad &= ~(__alignof__(long long) - 1);
 	}
 #endif
+
+#ifdef HAVE_MMAP
+	page_size = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+	if(page_size == 0)
+		page_size = 4096;
+}
+
+/*
+ * static void *get_block(size_t size)
+ *
+ * Input: Size of block to allocate
+ * Output: Pointer to new block, page aligned when mmap() is available
+ * Side Effects: None
+ */
+static void *
+get_block(size_t size)
+{
+	void *ptr;
+#ifdef HAVE_MMAP
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if(ptr == MAP_FAILED)
+		ptr = NULL;
+#else
+	ptr = malloc(size);
+#endif
+	if(ptr == NULL)
+		rb_outofmemory();
+	return ptr;
+}
+
+static void
+free_block(void *ptr, size_t size)
+{
+#ifdef HAVE_MMAP
+	munmap(ptr, size);
+#else
+	free(ptr);
+#endif
+}
+
+/*
+ * static void newblock(rb_bh *bh)
+ *
+ * Input: Heap to grow
+ * Output: None
+ * Side Effects: A block of at least elemsPerBlock elements is added
+ *		 to the heap, rounded up to a whole number of pages
+ */
+static void
+newblock(rb_bh *bh)
+{
+	struct rb_heap_block *b;
+	unsigned long i, count;
+	char *offset;
+
+	b = rb_malloc(sizeof(struct rb_heap_block));
+	b->heap = bh;
+	b->alloc_size = bh->elemsPerBlock * bh->stride;
+	b->alloc_size = (b->alloc_size + page_size - 1) & ~(page_size - 1);
+	b->elems = get_block(b->alloc_size);
+
+	/* use whatever the page rounding left over as well */
+	count = b->alloc_size / bh->stride;
+	offset = b->elems;
+	for(i = 0; i < count; i++)
+	{
+		*(struct rb_heap_block **)offset = b;
+		*(void **)(offset + offset_pad) = b->free_elems;
+		b->free_elems = offset + offset_pad;
+		offset += bh->stride;
+	}
+	b->elem_count = b->free_count = count;
+	bh->totalElems += count;
+	bh->freeElems += count;
+
+	rb_dlinkAdd(b, &b->node, &bh->block_list);
+	rb_dlinkAdd(b, &b->free_node, &bh->free_list);
 }
 
 /* ************************************************************************ */
@@ -142,6 +250,7 @@ rb_bh_create(size_t elemsize, int elemsperblock, const char *desc)
 	/* Allocate our new rb_bh */
 	bh = rb_malloc(sizeof(rb_bh));
 	bh->elemSize = elemsize;
+	bh->stride = (offset_pad + elemsize + offset_pad - 1) & ~(offset_pad - 1);
 	bh->elemsPerBlock = elemsperblock;
 	if(desc != NULL)
 		bh->desc = rb_strdup(desc);
@@ -169,13 +278,29 @@ rb_bh_create(size_t elemsize, int elemsperblock, const char *desc)
 void *
 rb_bh_alloc(rb_bh *bh)
 {
+	struct rb_heap_block *b;
+	void *ptr;
+
 	lrb_assert(bh != NULL);
 	if(rb_unlikely(bh == NULL))
 	{
 		rb_bh_fail("Cannot allocate if bh == NULL");
 	}
 
-	return (rb_malloc(bh->elemSize));
+	if(bh->free_list.head == NULL)
+		newblock(bh);
+
+	b = bh->free_list.head->data;
+	ptr = b->free_elems;
+	b->free_elems = *(void **)ptr;
+
+	if(--b->free_count == 0)
+		rb_dlinkDelete(&b->free_node, &bh->free_list);
+	bh->freeElems--;
+
+	/* callers expect zeroed memory, as from rb_malloc() */
+	memset(ptr, 0, bh->elemSize);
+	return (ptr);
 }
 
 
@@ -191,8 +316,10 @@ rb_bh_alloc(rb_bh *bh)
 /*    0 if successful, 1 if element not contained within rb_bh.           */
 /* ************************************************************************ */
 int
-rb_bh_free(const rb_bh *bh, void *ptr)
+rb_bh_free(rb_bh *bh, void *ptr)
 {
+	struct rb_heap_block *b;
+
 	lrb_assert(bh != NULL);
 	lrb_assert(ptr != NULL);
 
@@ -208,20 +335,83 @@ rb_bh_free(const rb_bh *bh, void *ptr)
 		return (1);
 	}
 
-	rb_free(ptr);
+	b = *(struct rb_heap_block **)((uintptr_t)ptr - offset_pad);
+	if(rb_unlikely(b == NULL || b->heap != bh))
+	{
+		rb_lib_log("balloc.c:rb_bhFree() ptr not from heap %s", bh->desc ? bh->desc : "");
+		return (1);
+	}
+
+	*(void **)ptr = b->free_elems;
+	b->free_elems = ptr;
+	if(b->free_count++ == 0)
+		rb_dlinkAdd(b, &b->free_node, &bh->free_list);
+	bh->freeElems++;
+
+	/* hand a block that is entirely free back to the system, as long
+	 * as there is another block's worth of free space to fall back on
+	 */
+	if(b->free_count == b->elem_count && bh->freeElems - b->free_count >= bh->elemsPerBlock)
+	{
+		bh->totalElems -= b->elem_count;
+		bh->freeElems -= b->elem_count;
+		rb_dlinkDelete(&b->free_node, &bh->free_list);
+		rb_dlinkDelete(&b->node, &bh->block_list);
+		free_block(b->elems, b->alloc_size);
+		rb_free(b);
+	}
 	return (0);
 }
 
 
+/*
+ * void rb_bh_usage(rb_bh *bh, size_t *bused, size_t *bfree, size_t *bmemusage, const char **desc)
+ *
+ * Inputs: heap, places to store the number of elements in use, the number
+ *	   free, the bytes in use and the heap's description; any may be NULL
+ * Outputs: None
+ */
 void
-rb_bh_usage(rb_bh *bh __attribute__((unused)), size_t *bused, size_t *bfree, size_t *bmemusage, const char **desc)
+rb_bh_usage(rb_bh *bh, size_t *bused, size_t *bfree, size_t *bmemusage, const char **desc)
 {
 	if(bused != NULL)
-		*bused = 0;
+		*bused = bh->totalElems - bh->freeElems;
 	if(bfree != NULL)
-		*bfree = 0;
+		*bfree = bh->freeElems;
 	if(bmemusage != NULL)
-		*bmemusage = 0;
+		*bmemusage = (bh->totalElems - bh->freeElems) * bh->elemSize;
 	if(desc != NULL)
-		*desc = "no blockheap";
+		*desc = bh->desc;
+}
+
+/*
+ * void rb_bh_usage_all(rb_bh_usage_cb *cb, void *data)
+ *
+ * Inputs: callback, private data for the callback
+ * Outputs: None
+ * Side Effects: cb is called for every heap with its usage and the
+ *		 memory held from the system for it
+ */
+void
+rb_bh_usage_all(rb_bh_usage_cb *cb, void *data)
+{
+	rb_dlink_node *ptr, *bptr;
+	rb_bh *bh;
+	size_t used, freem, memusage, heapalloc;
+	const char *desc;
+
+	if(cb == NULL)
+		return;
+
+	RB_DLINK_FOREACH(ptr, heap_lists->head)
+	{
+		bh = ptr->data;
+		rb_bh_usage(bh, &used, &freem, &memusage, &desc);
+
+		heapalloc = 0;
+		RB_DLINK_FOREACH(bptr, bh->block_list.head)
+			heapalloc += ((struct rb_heap_block *)bptr->data)->alloc_size;
+
+		cb(used, freem, memusage, heapalloc, desc != NULL ? desc : "(unnamed_heap)", data);
+	}
 }
@@ -39,8 +39,7 @@
 struct timeout_data
 {
 	rb_fde_t *F;
-	rb_dlink_node node;
-	time_t timeout;
+	struct rb_heap_entry hnode;
 	PF *timeout_handler;
 	void *timeout_data;
 };
@@ -48,7 +47,8 @@ struct timeout_data
 rb_dlink_list *rb_fd_table;
 static rb_bh *fd_heap;
 
-static rb_dlink_list timeout_list;
+/* pending fd timeouts, soonest first */
+static struct rb_heap timeout_heap;
 static rb_dlink_list closed_list;
 
 struct defer
@@ -61,6 +61,11 @@ static rb_dlink_list defer_list;
 
 static struct ev_entry *rb_timeout_ev;
 
+/* completion-based I/O, only set by pollers that can do it */
+static int (*read_stream_handler) (rb_fde_t *, RSCB *, void *);
+static int (*writev_async_handler) (rb_fde_t *, struct rb_iovec *, int, WVCB *, void *);
+static void (*close_handler) (rb_fde_t *);
+
 
 static const char *rb_err_str[] = { "Comm OK", "Error during bind()",
 	"Error during DNS lookup", "connect timeout",
@@ -281,10 +286,10 @@ rb_settimeout(rb_fde_t *F, time_t timeout, PF * callback, void *cbdata)
 	{
 		if(td == NULL)
 			return;
-		rb_dlinkDelete(&td->node, &timeout_list);
+		rb_heap_delete(&timeout_heap, &td->hnode);
 		rb_free(td);
 		F->timeout = NULL;
-		if(rb_dlink_list_length(&timeout_list) == 0)
+		if(timeout_heap.len == 0)
 		{
 			rb_event_delete(rb_timeout_ev);
 			rb_timeout_ev = NULL;
@@ -293,16 +298,21 @@ rb_settimeout(rb_fde_t *F, time_t timeout, PF * callback, void *cbdata)
 	}
 
 	if(F->timeout == NULL)
+	{
 		td = F->timeout = rb_malloc(sizeof(struct timeout_data));
+		td->hnode.index = -1;
+	}
+	else
+		rb_heap_delete(&timeout_heap, &td->hnode);
 
 	td->F = F;
-	td->timeout = rb_current_time() + timeout;
+	td->hnode.key = ((int64_t)rb_current_time() + timeout) * 1000;
 	td->timeout_handler = callback;
 	td->timeout_data = cbdata;
-	rb_dlinkAdd(td, &td->node, &timeout_list);
+	rb_heap_insert(&timeout_heap, &td->hnode);
 	if(rb_timeout_ev == NULL)
 	{
-		rb_timeout_ev = rb_event_add("rb_checktimeouts", rb_checktimeouts, NULL, 5);
+		rb_timeout_ev = rb_event_add("rb_checktimeouts", rb_checktimeouts, NULL, 1);
 	}
 }
 
@@ -316,28 +326,30 @@ rb_settimeout(rb_fde_t *F, time_t timeout, PF * callback, void *cbdata)
 void
 rb_checktimeouts(void *notused __attribute__((unused)))
 {
-	rb_dlink_node *ptr, *next;
+	struct rb_heap_entry *entry;
 	struct timeout_data *td;
 	rb_fde_t *F;
 	PF *hdl;
 	void *data;
+	int64_t now = (int64_t)rb_current_time() * 1000;
 
-	RB_DLINK_FOREACH_SAFE(ptr, next, timeout_list.head)
+	/* only the expired entries are looked at, the rest stay queued */
+	while((entry = rb_heap_min(&timeout_heap)) != NULL && entry->key < now)
 	{
-		td = ptr->data;
+		td = (struct timeout_data *)((char *)entry - offsetof(struct timeout_data, hnode));
 		F = td->F;
-		if(F == NULL || !IsFDOpen(F))
-			continue;
+		hdl = td->timeout_handler;
+		data = td->timeout_data;
+		rb_heap_delete(&timeout_heap, entry);
+		F->timeout = NULL;
+		rb_free(td);
+		hdl(F, data);
+	}
 
-		if(td->timeout < rb_current_time())
-		{
-			hdl = td->timeout_handler;
-			data = td->timeout_data;
-			rb_dlinkDelete(&td->node, &timeout_list);
-			F->timeout = NULL;
-			rb_free(td);
-			hdl(F, data);
-		}
+	if(timeout_heap.len == 0 && rb_timeout_ev != NULL)
+	{
+		rb_event_delete(rb_timeout_ev);
+		rb_timeout_ev = NULL;
 	}
 }
 
@@ -1096,6 +1108,8 @@ rb_close(rb_fde_t *F)
 	}
 
 	rb_setselect(F, RB_SELECT_WRITE | RB_SELECT_READ, NULL, NULL);
+	if(close_handler != NULL)
+		close_handler(F);
 	rb_settimeout(F, 0, NULL, NULL);
 	rb_free(F->accept);
 	rb_free(F->connect);
@@ -1295,6 +1309,54 @@ rb_writev(rb_fde_t *F, struct rb_iovec * vector, int count)
 
 }
 
+/*
+ * rb_read_stream
+ *
+ * Have whatever arrives on the socket F handed to cb as the network
+ * loop completes it, rather than waiting for readiness and reading.
+ * The buffer is only valid during the callback.  A NULL cb stops the
+ * stream.  Returns -1 if the poller or F cannot do this, in which case
+ * the caller should stay with rb_setselect() and rb_read().
+ */
+int
+rb_read_stream(rb_fde_t *F, RSCB *cb, void *data)
+{
+	if(F == NULL)
+	{
+		errno = EBADF;
+		return -1;
+	}
+	if(read_stream_handler == NULL || !(F->type & RB_FD_SOCKET) || (F->type & RB_FD_SSL))
+	{
+		errno = ENOSYS;
+		return -1;
+	}
+	return read_stream_handler(F, cb, data);
+}
+
+/*
+ * rb_writev_async
+ *
+ * Queue a writev on F to go out with the next pass of the network loop,
+ * calling cb with the result.  The data must stay put until then.  As
+ * with rb_read_stream(), -1 means use rb_writev() instead.
+ */
+int
+rb_writev_async(rb_fde_t *F, struct rb_iovec *vector, int count, WVCB *cb, void *data)
+{
+	if(F == NULL)
+	{
+		errno = EBADF;
+		return -1;
+	}
+	if(writev_async_handler == NULL || !(F->type & RB_FD_SOCKET) || (F->type & RB_FD_SSL))
+	{
+		errno = ENOSYS;
+		return -1;
+	}
+	return writev_async_handler(F, vector, count, cb, data);
+}
+
 /*
  * From: Thomas Helvey <tomh@inxpress.net>
  */
@@ -1825,6 +1887,27 @@ try_epoll(void)
 	return -1;
 }
 
+static int
+try_iouring(void)
+{
+	if(!rb_init_netio_iouring())
+	{
+		setselect_handler = rb_setselect_iouring;
+		select_handler = rb_select_iouring;
+		setup_fd_handler = rb_setup_fd_iouring;
+		io_sched_event = NULL;
+		io_unsched_event = NULL;
+		io_init_event = NULL;
+		io_supports_event = rb_unsupported_event;
+		read_stream_handler = rb_read_stream_iouring;
+		writev_async_handler = rb_writev_async_iouring;
+		close_handler = rb_close_iouring;
+		rb_strlcpy(iotype, "iouring", sizeof(iotype));
+		return 0;
+	}
+	return -1;
+}
+
 static int
 try_ports(void)
 {
@@ -1931,6 +2014,12 @@ rb_io_init_event(void)
 	rb_event_io_register_all();
 }
 
+const char *
+rb_get_iotype(void)
+{
+	return iotype;
+}
+
 void
 rb_init_netio(void)
 {
@@ -1945,6 +2034,12 @@ rb_init_netio(void)
 			if(!try_epoll())
 				return;
 		}
+		else if(!strcmp("iouring", ioenv))
+		{
+			/* falls back to the usual order below if unsupported */
+			if(!try_iouring())
+				return;
+		}
 		else if(!strcmp("kqueue", ioenv))
 		{
 			if(!try_kqueue())
@@ -2005,10 +2100,14 @@ rb_defer(void (*fn)(void *), void *data)
 	rb_dlinkAdd(defer, &defer->node, &defer_list);
 }
 
-int
-rb_select(unsigned long timeout)
+/*
+ * rb_run_deferred
+ *
+ * Run everything queued by rb_defer() since the last pass
+ */
+void
+rb_run_deferred(void)
 {
-	int ret = select_handler(timeout);
 	rb_dlink_node *ptr, *next;
 	RB_DLINK_FOREACH_SAFE(ptr, next, defer_list.head)
 	{
@@ -2017,6 +2116,13 @@ rb_select(unsigned long timeout)
 		rb_dlinkDelete(ptr, &defer_list);
 		rb_free(defer);
 	}
+}
+
+int
+rb_select(unsigned long timeout)
+{
+	int ret = select_handler(timeout);
+	rb_run_deferred();
 	rb_close_pending_fds();
 	return ret;
 }
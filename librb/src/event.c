@@ -50,7 +50,116 @@
 static char last_event_ran[EV_NAME_LEN];
 static rb_dlink_list event_list;
 
-static time_t event_time_min = -1;
+/* events waiting to run, soonest first; only used when the io
+ * backend cannot schedule events itself */
+static struct rb_heap event_heap;
+
+#define ev_of(entry) ((struct ev_entry *)((char *)(entry) - offsetof(struct ev_entry, hnode)))
+
+static inline void
+rb_heap_set(struct rb_heap *heap, int i, struct rb_heap_entry *entry)
+{
+	heap->items[i] = entry;
+	entry->index = i;
+}
+
+static void
+rb_heap_sift_up(struct rb_heap *heap, int i)
+{
+	struct rb_heap_entry *entry = heap->items[i];
+
+	while(i > 0)
+	{
+		int parent = (i - 1) / 2;
+
+		if(heap->items[parent]->key <= entry->key)
+			break;
+		rb_heap_set(heap, i, heap->items[parent]);
+		i = parent;
+	}
+	rb_heap_set(heap, i, entry);
+}
+
+static void
+rb_heap_sift_down(struct rb_heap *heap, int i)
+{
+	struct rb_heap_entry *entry = heap->items[i];
+
+	for(;;)
+	{
+		int child = 2 * i + 1;
+
+		if(child >= heap->len)
+			break;
+		if(child + 1 < heap->len && heap->items[child + 1]->key < heap->items[child]->key)
+			child++;
+		if(entry->key <= heap->items[child]->key)
+			break;
+		rb_heap_set(heap, i, heap->items[child]);
+		i = child;
+	}
+	rb_heap_set(heap, i, entry);
+}
+
+void
+rb_heap_insert(struct rb_heap *heap, struct rb_heap_entry *entry)
+{
+	lrb_assert(entry->index == -1);
+
+	if(heap->len == heap->size)
+	{
+		heap->size = heap->size ? heap->size * 2 : 64;
+		heap->items = rb_realloc(heap->items, sizeof(struct rb_heap_entry *) * heap->size);
+	}
+
+	heap->items[heap->len] = entry;
+	entry->index = heap->len++;
+	rb_heap_sift_up(heap, entry->index);
+}
+
+void
+rb_heap_delete(struct rb_heap *heap, struct rb_heap_entry *entry)
+{
+	int i = entry->index;
+
+	if(i < 0)
+		return;
+
+	entry->index = -1;
+	heap->len--;
+	if(i == heap->len)
+		return;
+
+	/* move the last entry into the hole and restore the heap order */
+	rb_heap_set(heap, i, heap->items[heap->len]);
+	if(i > 0 && heap->items[(i - 1) / 2]->key > heap->items[i]->key)
+		rb_heap_sift_up(heap, i);
+	else
+		rb_heap_sift_down(heap, i);
+}
+
+static void
+rb_event_free(struct ev_entry *ev)
+{
+	rb_dlinkDelete(&ev->node, &event_list);
+	rb_free(ev->name);
+	rb_free(ev);
+}
+
+/*
+ * rb_event_schedule
+ *
+ * (Re)queue an event to run after the given number of seconds
+ */
+static void
+rb_event_schedule(struct ev_entry *ev, time_t delay)
+{
+	ev->when = rb_current_time() + delay;
+	ev->hnode.key = rb_current_time_ms() + (int64_t)delay * 1000;
+
+	if(!rb_io_supports_event())
+		rb_heap_insert(&event_heap, &ev->hnode);
+}
 
 static
 struct ev_entry *
@@ -61,15 +170,13 @@ rb_event_add_common(const char *name, EVH * func, void *arg, time_t when, time_t
 	ev->func = func;
 	ev->name = rb_strndup(name, EV_NAME_LEN);
 	ev->arg = arg;
-	ev->when = rb_current_time() + when;
 	ev->next = when;
 	ev->frequency = frequency;
 	ev->dead = 0;
-
-	if((ev->when < event_time_min) || (event_time_min == -1))
-		event_time_min = ev->when;
+	ev->hnode.index = -1;
 
 	rb_dlinkAdd(ev, &ev->node, &event_list);
+	rb_event_schedule(ev, when);
 	rb_io_sched_event(ev, when);
 	return ev;
 }
@@ -123,6 +230,13 @@ rb_event_delete(struct ev_entry *ev)
 	ev->dead = 1;
 
 	rb_io_unsched_event(ev);
+
+	/* queued in our heap, so nothing else refers to it */
+	if(ev->hnode.index >= 0)
+	{
+		rb_heap_delete(&event_heap, &ev->hnode);
+		rb_event_free(ev);
+	}
 }
 
 static time_t
@@ -168,8 +282,6 @@ rb_run_one_event(struct ev_entry *ev)
 		return;
 	}
 	ev->when = rb_current_time() + rb_event_frequency(ev->frequency);
-	if((ev->when < event_time_min) || (event_time_min == -1))
-		event_time_min = ev->when;
 }
 
 /*
@@ -182,47 +294,28 @@ rb_run_one_event(struct ev_entry *ev)
 void
 rb_event_run(void)
 {
-	rb_dlink_node *ptr, *next;
+	struct rb_heap_entry *entry;
 	struct ev_entry *ev;
+	int64_t now;
 
 	if(rb_io_supports_event())
 		return;
 
-	event_time_min = -1;
-	RB_DLINK_FOREACH_SAFE(ptr, next, event_list.head)
+	now = rb_current_time_ms();
+
+	while((entry = rb_heap_min(&event_heap)) != NULL && entry->key <= now)
 	{
-		ev = ptr->data;
-		if (ev->dead)
-		{
-			rb_dlinkDelete(&ev->node, &event_list);
-			rb_free(ev->name);
-			rb_free(ev);
-			continue;
-		}
-		if(ev->when <= rb_current_time())
-		{
-			rb_strlcpy(last_event_ran, ev->name, sizeof(last_event_ran));
-			ev->func(ev->arg);
-
-			/* event is scheduled more than once */
-			if(ev->frequency)
-			{
-				ev->when = rb_current_time() + rb_event_frequency(ev->frequency);
-				if((ev->when < event_time_min) || (event_time_min == -1))
-					event_time_min = ev->when;
-			}
-			else
-			{
-				rb_dlinkDelete(&ev->node, &event_list);
-				rb_free(ev->name);
-				rb_free(ev);
-			}
-		}
+		ev = ev_of(entry);
+		rb_heap_delete(&event_heap, entry);
+
+		rb_strlcpy(last_event_ran, ev->name, sizeof(last_event_ran));
+		ev->func(ev->arg);
+
+		/* event is scheduled more than once, and did not delete itself */
+		if(ev->frequency && !ev->dead)
+			rb_event_schedule(ev, rb_event_frequency(ev->frequency));
 		else
-		{
-			if((ev->when < event_time_min) || (event_time_min == -1))
-				event_time_min = ev->when;
-		}
+			rb_event_free(ev);
 	}
 }
 
@@ -271,6 +364,8 @@ rb_dump_events(void (*func) (char *, void *), void *ptr)
 	RB_DLINK_FOREACH(dptr, event_list.head)
 	{
 		ev = dptr->data;
+		if(ev->dead)
+			continue;
 		snprintf(buf, sizeof buf, "%-28s %-4lld seconds (frequency=%d)", ev->name,
 			    (long long)(ev->when - rb_current_time()), (int)ev->frequency);
 		func(buf, ptr);
@@ -295,11 +390,38 @@ rb_set_back_events(time_t by)
 			ev->when -= by;
 		else
 			ev->when = 0;
+
+		/* shifting every deadline alike keeps the heap ordered */
+		ev->hnode.key -= (int64_t)by * 1000;
 	}
 }
 
 time_t
 rb_event_next(void)
 {
-	return event_time_min;
+	struct rb_heap_entry *entry = rb_heap_min(&event_heap);
+
+	if(entry == NULL)
+		return -1;
+	return ev_of(entry)->when;
+}
+
+/*
+ * long rb_event_next_delay(void)
+ *
+ * Input: None
+ * Output: milliseconds until the next event is due, 0 if one is
+ *	   overdue, or -1 if there is nothing to wait for
+ */
+long
+rb_event_next_delay(void)
+{
+	struct rb_heap_entry *entry = rb_heap_min(&event_heap);
+	int64_t delay;
+
+	if(entry == NULL)
+		return -1;
+
+	delay = entry->key - rb_current_time_ms();
+	return delay > 0 ? (long)delay : 0;
 }
@@ -0,0 +1,1023 @@
+/*
+ *  ircd-ratbox: A slightly useful ircd.
+ *  iouring.c: Linux io_uring network routines.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ *
+ */
+
+/*
+ * About the io_uring backend
+ *
+ * For rb_setselect() readiness callbacks this backend arms one-shot
+ * IORING_OP_POLL_ADD requests.  What it buys over epoll is batching:
+ * rb_setselect_iouring() only records the wanted interest, and every
+ * interest change made during a loop pass (including the re-arms after
+ * callbacks run) is submitted together with the wait for completions
+ * in a single io_uring_enter() call, instead of one epoll_ctl() per
+ * change.
+ *
+ * Each fd slot carries a generation number that is folded into the
+ * request user_data, so completions for polls that were since removed,
+ * or for an fd number that has been closed and reused, are discarded.
+ *
+ * Where the kernel has multishot IORING_OP_RECV and provided buffer
+ * rings (Linux 6.0), sockets can also be read and written through the
+ * ring itself, see rb_read_stream() and rb_writev_async().  A stream
+ * keeps one multishot recv armed that fills buffers from a ring
+ * registered at startup, and hands each completion's buffer straight
+ * to the callback before giving it back to the ring.  Writes are
+ * IORING_OP_WRITEV requests.  Both are queued like the poll changes and
+ * go to the kernel with the next wait, so a loop pass costs one system
+ * call however many sockets it reads and writes.  Without those
+ * features both calls fail and callers stay with readiness and
+ * ordinary reads and writes.
+ *
+ * It is only used when asked for with LIBRB_USE_IOTYPE=iouring; if the
+ * kernel lacks io_uring, or lacks IORING_FEAT_EXT_ARG for timed waits,
+ * initialisation fails and commio carries on with the next poller.
+ */
+
+#include <librb_config.h>
+#include <rb_lib.h>
+#include <commio-int.h>
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_SYS_SYSCALL_H)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <poll.h>
+#endif
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_SYS_SYSCALL_H) && defined(__NR_io_uring_setup) && defined(IORING_FEAT_EXT_ARG)
+#define USING_IOURING
+
+#define IOURING_ENTRIES		4096
+
+/* headers new enough for multishot receives also have buffer rings */
+#ifdef IORING_RECV_MULTISHOT
+#define USING_IOURING_STREAMS
+#endif
+
+/* provided buffers for stream reads, one group shared by every socket */
+#define IOURING_BUF_GROUP	0
+#define IOURING_BUF_COUNT	256	/* a power of two */
+#define IOURING_BUF_SIZE	16384
+
+/*
+ * user_data is the kind of request in the top two bits, and for polls
+ * and reads a generation and the fd below that.  Writes carry the
+ * address of their iouring_write instead.
+ */
+#define IOURING_TAG_SHIFT	62
+#define IOURING_TAG_MASK	(3ULL << IOURING_TAG_SHIFT)
+#define IOURING_GEN_MASK	0x3fffffffU
+
+enum
+{
+	IOURING_TAG_NONE,	/* poll removes and cancels */
+	IOURING_TAG_POLL,
+	IOURING_TAG_RECV,
+	IOURING_TAG_WRITE
+};
+
+/* a write handed to the kernel, see rb_writev_async_iouring() */
+struct iouring_write
+{
+	rb_fde_t *F;		/* NULL once the fd has been closed */
+	WVCB *callback;
+	void *data;
+	struct iovec vec[];	/* read by the kernel at submission */
+};
+
+/* interest we have asked the kernel about, per fd */
+struct iouring_fd
+{
+	uint32_t gen;		/* bumped every time a poll is armed */
+	int armed;		/* poll mask currently armed, 0 if none */
+	uint8_t dirty;		/* on the dirty list awaiting submission */
+
+	/* completion reads, see rb_read_stream_iouring() */
+	uint8_t stream_armed;	/* a multishot recv is outstanding */
+	uint32_t stream_gen;	/* bumped every time a stream stops */
+	RSCB *stream_cb;
+	void *stream_data;
+
+	struct iouring_write *write;	/* in flight, if any */
+};
+
+struct iouring_info
+{
+	int ring_fd;
+
+	/* submission ring */
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned int sq_entries;
+	unsigned int to_submit;
+
+	/* completion ring */
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	size_t sq_ring_sz;
+	void *cq_ring;
+	size_t cq_ring_sz;
+	size_t sqes_sz;
+
+	struct iouring_fd *fds;
+	int *dirty;
+	int fds_size;
+	int num_dirty;
+
+	/* provided buffer ring for stream reads, NULL without them */
+	struct io_uring_buf_ring *buf_ring;
+	char *bufs;
+	uint16_t buf_tail;
+};
+
+static struct iouring_info *ur_info;
+
+static inline uint64_t
+iouring_user_data(int tag, int fd, uint32_t gen)
+{
+	return ((uint64_t)tag << IOURING_TAG_SHIFT) | ((uint64_t)(gen & IOURING_GEN_MASK) << 32) | (uint32_t)fd;
+}
+
+static int
+iouring_enter(unsigned int to_submit, unsigned int min_complete, unsigned int flags, void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, ur_info->ring_fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+/*
+ * iouring_get_sqe
+ *
+ * Return a free submission entry, pushing what we have queued to the
+ * kernel first if the ring has filled up.
+ */
+static struct io_uring_sqe *
+iouring_get_sqe(void)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head, tail, idx;
+
+	tail = *ur_info->sq_tail;
+	head = __atomic_load_n(ur_info->sq_head, __ATOMIC_ACQUIRE);
+
+	if(tail - head >= ur_info->sq_entries)
+	{
+		if(iouring_enter(ur_info->to_submit, 0, 0, NULL, 0) >= 0)
+			ur_info->to_submit = 0;
+		head = __atomic_load_n(ur_info->sq_head, __ATOMIC_ACQUIRE);
+		if(tail - head >= ur_info->sq_entries)
+			return NULL;
+	}
+
+	idx = tail & *ur_info->sq_mask;
+	sqe = &ur_info->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	ur_info->sq_array[idx] = idx;
+	__atomic_store_n(ur_info->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ur_info->to_submit++;
+	return sqe;
+}
+
+static void
+iouring_grow_fds(int fd)
+{
+	int old_size = ur_info->fds_size;
+
+	if(rb_likely(fd < old_size))
+		return;
+
+	while(ur_info->fds_size <= fd)
+		ur_info->fds_size += 1024;
+
+	ur_info->fds = rb_realloc(ur_info->fds, sizeof(struct iouring_fd) * ur_info->fds_size);
+	memset(&ur_info->fds[old_size], 0, sizeof(struct iouring_fd) * (ur_info->fds_size - old_size));
+	ur_info->dirty = rb_realloc(ur_info->dirty, sizeof(int) * ur_info->fds_size);
+}
+
+static void
+iouring_mark_dirty(int fd)
+{
+	iouring_grow_fds(fd);
+
+	if(ur_info->fds[fd].dirty)
+		return;
+
+	ur_info->fds[fd].dirty = 1;
+	ur_info->dirty[ur_info->num_dirty++] = fd;
+}
+
+/*
+ * iouring_flush_dirty
+ *
+ * Queue poll removes and adds for every fd whose interest changed
+ * since the last pass.  Nothing is handed to the kernel here, that
+ * happens along with the wait in rb_select_iouring().
+ */
+static void
+iouring_flush_dirty(void)
+{
+	struct io_uring_sqe *sqe;
+	struct iouring_fd *ufd;
+	rb_fde_t *F;
+	int i, fd, wanted;
+
+	for(i = 0; i < ur_info->num_dirty; i++)
+	{
+		fd = ur_info->dirty[i];
+		ufd = &ur_info->fds[fd];
+		ufd->dirty = 0;
+
+		F = rb_find_fd(fd);
+		if(F == NULL || !IsFDOpen(F))
+			F = NULL;
+
+#ifdef USING_IOURING_STREAMS
+		if(F != NULL && ufd->stream_cb != NULL && !ufd->stream_armed)
+		{
+			if((sqe = iouring_get_sqe()) == NULL)
+				goto full;
+			sqe->opcode = IORING_OP_RECV;
+			sqe->fd = fd;
+			sqe->ioprio = IORING_RECV_MULTISHOT;
+			sqe->flags = IOSQE_BUFFER_SELECT;
+			sqe->buf_group = IOURING_BUF_GROUP;
+			sqe->user_data = iouring_user_data(IOURING_TAG_RECV, fd, ufd->stream_gen);
+			ufd->stream_armed = 1;
+		}
+#endif
+
+		wanted = F != NULL ? F->pflags : 0;
+
+		if(wanted == ufd->armed)
+			continue;
+
+		if(ufd->armed != 0)
+		{
+			if((sqe = iouring_get_sqe()) == NULL)
+				goto full;
+			sqe->opcode = IORING_OP_POLL_REMOVE;
+			sqe->fd = -1;
+			sqe->addr = iouring_user_data(IOURING_TAG_POLL, fd, ufd->gen);
+			sqe->user_data = 0;
+			ufd->armed = 0;
+		}
+
+		if(wanted != 0)
+		{
+			if((sqe = iouring_get_sqe()) == NULL)
+				goto full;
+			ufd->gen = (ufd->gen + 1) & IOURING_GEN_MASK;
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = fd;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			sqe->poll32_events = ((uint32_t)wanted << 16) | ((uint32_t)wanted >> 16);
+#else
+			sqe->poll32_events = wanted;
+#endif
+			sqe->user_data = iouring_user_data(IOURING_TAG_POLL, fd, ufd->gen);
+			ufd->armed = wanted;
+		}
+	}
+	ur_info->num_dirty = 0;
+	return;
+
+full:
+	/* the kernel would not take anything more, retry the rest next pass */
+	rb_lib_log("iouring_flush_dirty(): submission queue full");
+	memmove(ur_info->dirty, &ur_info->dirty[i], sizeof(int) * (ur_info->num_dirty - i));
+	ur_info->num_dirty -= i;
+	for(i = 0; i < ur_info->num_dirty; i++)
+		ur_info->fds[ur_info->dirty[i]].dirty = 1;
+}
+
+/*
+ * iouring_cancel
+ *
+ * Queue a cancel for the request carrying the given user_data.  Its
+ * last completion still arrives, and is told apart by the generation
+ * or by the write having been disowned.
+ */
+static void
+iouring_cancel(uint64_t user_data)
+{
+	struct io_uring_sqe *sqe;
+
+	if((sqe = iouring_get_sqe()) == NULL)
+	{
+		rb_lib_log("iouring_cancel(): submission queue full");
+		return;
+	}
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = user_data;
+	sqe->user_data = 0;
+}
+
+#ifdef USING_IOURING_STREAMS
+/*
+ * iouring_buf_recycle
+ *
+ * Give a provided buffer back to the kernel.  The new tail is only
+ * published by iouring_buf_publish(), once per pass.
+ */
+static void
+iouring_buf_recycle(unsigned int bid)
+{
+	struct io_uring_buf *buf;
+
+	buf = &ur_info->buf_ring->bufs[ur_info->buf_tail & (IOURING_BUF_COUNT - 1)];
+	buf->addr = (uint64_t)(uintptr_t)(ur_info->bufs + (size_t)bid * IOURING_BUF_SIZE);
+	buf->len = IOURING_BUF_SIZE;
+	buf->bid = bid;
+	ur_info->buf_tail++;
+}
+
+static void
+iouring_buf_publish(void)
+{
+	__atomic_store_n(&ur_info->buf_ring->tail, ur_info->buf_tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * iouring_probe_streams
+ *
+ * Check the kernel really delivers multishot receives into our buffer
+ * ring, by streaming one byte over a socketpair.  Kernels that do not
+ * know the flag fail the request, or complete it without F_MORE.
+ */
+static int
+iouring_probe_streams(void)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned int head, tail;
+	int sv[2], ok = 0, first = 1, done = 0;
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		return 0;
+
+	if((sqe = iouring_get_sqe()) == NULL)
+	{
+		close(sv[0]);
+		close(sv[1]);
+		return 0;
+	}
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = sv[0];
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = IOURING_BUF_GROUP;
+	sqe->user_data = 0;
+
+	if(write(sv[1], "x", 1) != 1)
+		rb_lib_log("iouring_probe_streams(): write failed");
+
+	memset(&arg, 0, sizeof(arg));
+	ts.tv_sec = 1;
+	ts.tv_nsec = 0;
+	arg.ts = (uint64_t)(uintptr_t)&ts;
+
+	while(!done)
+	{
+		if(iouring_enter(ur_info->to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+				 &arg, sizeof(arg)) >= 0)
+			ur_info->to_submit = 0;
+		else if(errno != EINTR)
+			break;
+
+		head = *ur_info->cq_head;
+		tail = __atomic_load_n(ur_info->cq_tail, __ATOMIC_ACQUIRE);
+		for(; head != tail; head++)
+		{
+			cqe = &ur_info->cqes[head & *ur_info->cq_mask];
+			if(cqe->flags & IORING_CQE_F_BUFFER)
+				iouring_buf_recycle(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+			if(first)
+			{
+				first = 0;
+				ok = cqe->res == 1 && (cqe->flags & IORING_CQE_F_MORE);
+				/* end the stream with an EOF */
+				close(sv[1]);
+				sv[1] = -1;
+			}
+			if(!(cqe->flags & IORING_CQE_F_MORE))
+				done = 1;
+		}
+		__atomic_store_n(ur_info->cq_head, head, __ATOMIC_RELEASE);
+		iouring_buf_publish();
+	}
+
+	close(sv[0]);
+	if(sv[1] >= 0)
+		close(sv[1]);
+	return ok && done;
+}
+
+/*
+ * iouring_init_streams
+ *
+ * Register the provided buffer ring stream reads come from.  Failure
+ * only means rb_read_stream() and rb_writev_async() are unavailable.
+ */
+static void
+iouring_init_streams(void)
+{
+	struct io_uring_buf_reg reg;
+	size_t ring_sz = sizeof(struct io_uring_buf) * IOURING_BUF_COUNT;
+	unsigned int i;
+
+	ur_info->buf_ring = mmap(NULL, ring_sz, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(ur_info->buf_ring == MAP_FAILED)
+	{
+		ur_info->buf_ring = NULL;
+		return;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)ur_info->buf_ring;
+	reg.ring_entries = IOURING_BUF_COUNT;
+	reg.bgid = IOURING_BUF_GROUP;
+	if(syscall(__NR_io_uring_register, ur_info->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+	{
+		munmap(ur_info->buf_ring, ring_sz);
+		ur_info->buf_ring = NULL;
+		return;
+	}
+
+	ur_info->bufs = rb_malloc((size_t)IOURING_BUF_COUNT * IOURING_BUF_SIZE);
+	ur_info->buf_tail = 0;
+	for(i = 0; i < IOURING_BUF_COUNT; i++)
+		iouring_buf_recycle(i);
+	iouring_buf_publish();
+
+	if(!iouring_probe_streams())
+	{
+		syscall(__NR_io_uring_register, ur_info->ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+		munmap(ur_info->buf_ring, ring_sz);
+		rb_free(ur_info->bufs);
+		ur_info->bufs = NULL;
+		ur_info->buf_ring = NULL;
+	}
+}
+#endif
+
+/*
+ * rb_init_netio
+ *
+ * This is a needed exported function which will be called to initialise
+ * the network loop code.
+ */
+int
+rb_init_netio_iouring(void)
+{
+	struct io_uring_params p;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = IOURING_ENTRIES * 4;
+
+	fd = (int)syscall(__NR_io_uring_setup, IOURING_ENTRIES, &p);
+	if(fd < 0)
+		return -1;
+
+	/* we need timed waits and a completion queue that never drops */
+	if(!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP))
+	{
+		close(fd);
+		return -1;
+	}
+
+	ur_info = rb_malloc(sizeof(struct iouring_info));
+	ur_info->ring_fd = fd;
+
+	ur_info->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ur_info->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(ur_info->cq_ring_sz > ur_info->sq_ring_sz)
+			ur_info->sq_ring_sz = ur_info->cq_ring_sz;
+		ur_info->cq_ring_sz = ur_info->sq_ring_sz;
+	}
+
+	ur_info->sq_ring = mmap(NULL, ur_info->sq_ring_sz, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if(ur_info->sq_ring == MAP_FAILED)
+		goto fail;
+
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+		ur_info->cq_ring = ur_info->sq_ring;
+	else
+	{
+		ur_info->cq_ring = mmap(NULL, ur_info->cq_ring_sz, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if(ur_info->cq_ring == MAP_FAILED)
+		{
+			munmap(ur_info->sq_ring, ur_info->sq_ring_sz);
+			goto fail;
+		}
+	}
+
+	ur_info->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	ur_info->sqes = mmap(NULL, ur_info->sqes_sz, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if(ur_info->sqes == MAP_FAILED)
+	{
+		if(ur_info->cq_ring != ur_info->sq_ring)
+			munmap(ur_info->cq_ring, ur_info->cq_ring_sz);
+		munmap(ur_info->sq_ring, ur_info->sq_ring_sz);
+		goto fail;
+	}
+
+	ur_info->sq_head = (unsigned int *)((char *)ur_info->sq_ring + p.sq_off.head);
+	ur_info->sq_tail = (unsigned int *)((char *)ur_info->sq_ring + p.sq_off.tail);
+	ur_info->sq_mask = (unsigned int *)((char *)ur_info->sq_ring + p.sq_off.ring_mask);
+	ur_info->sq_array = (unsigned int *)((char *)ur_info->sq_ring + p.sq_off.array);
+	ur_info->sq_entries = p.sq_entries;
+
+	ur_info->cq_head = (unsigned int *)((char *)ur_info->cq_ring + p.cq_off.head);
+	ur_info->cq_tail = (unsigned int *)((char *)ur_info->cq_ring + p.cq_off.tail);
+	ur_info->cq_mask = (unsigned int *)((char *)ur_info->cq_ring + p.cq_off.ring_mask);
+	ur_info->cqes = (struct io_uring_cqe *)((char *)ur_info->cq_ring + p.cq_off.cqes);
+
+	ur_info->fds_size = 0;
+	iouring_grow_fds(getdtablesize());
+
+#ifdef USING_IOURING_STREAMS
+	iouring_init_streams();
+#endif
+
+	rb_open(fd, RB_FD_UNKNOWN, "io_uring file descriptor");
+	return 0;
+
+fail:
+	close(fd);
+	rb_free(ur_info);
+	ur_info = NULL;
+	return -1;
+}
+
+int
+rb_setup_fd_iouring(rb_fde_t *F __attribute__((unused)))
+{
+	return 0;
+}
+
+/*
+ * rb_setselect
+ *
+ * This is a needed exported function which will be called to register
+ * and deregister interest in a pending IO state for a given FD.
+ */
+void
+rb_setselect_iouring(rb_fde_t *F, unsigned int type, PF * handler, void *client_data)
+{
+	lrb_assert(IsFDOpen(F));
+
+	if(type & RB_SELECT_READ)
+	{
+		if(handler != NULL)
+			F->pflags |= POLLIN;
+		else
+			F->pflags &= ~POLLIN;
+		F->read_handler = handler;
+		F->read_data = client_data;
+	}
+
+	if(type & RB_SELECT_WRITE)
+	{
+		if(handler != NULL)
+			F->pflags |= POLLOUT;
+		else
+			F->pflags &= ~POLLOUT;
+		F->write_handler = handler;
+		F->write_data = client_data;
+	}
+
+	iouring_grow_fds(F->fd);
+	if(F->pflags != ur_info->fds[F->fd].armed)
+		iouring_mark_dirty(F->fd);
+}
+
+/*
+ * rb_read_stream_iouring
+ *
+ * Start, or with a NULL callback stop, delivering what arrives on F to
+ * the callback as it completes.  Anything still in flight when a stream
+ * is stopped is thrown away.
+ */
+int
+rb_read_stream_iouring(rb_fde_t *F, RSCB *cb, void *data)
+{
+	struct iouring_fd *ufd;
+
+	if(ur_info->buf_ring == NULL)
+	{
+		errno = ENOSYS;
+		return -1;
+	}
+
+	iouring_grow_fds(F->fd);
+	ufd = &ur_info->fds[F->fd];
+
+	if(cb == NULL)
+	{
+		if(ufd->stream_armed)
+			iouring_cancel(iouring_user_data(IOURING_TAG_RECV, F->fd, ufd->stream_gen));
+		ufd->stream_armed = 0;
+		ufd->stream_gen = (ufd->stream_gen + 1) & IOURING_GEN_MASK;
+		ufd->stream_cb = NULL;
+		ufd->stream_data = NULL;
+		return 0;
+	}
+
+	ufd->stream_cb = cb;
+	ufd->stream_data = data;
+	if(!ufd->stream_armed)
+		iouring_mark_dirty(F->fd);
+	return 0;
+}
+
+/*
+ * rb_writev_async_iouring
+ *
+ * Queue a write of the given vector, submitted with the next pass.  The
+ * vector is copied, but the data it points at must stay put until the
+ * callback runs.  Only one write per fd may be in flight.
+ */
+int
+rb_writev_async_iouring(rb_fde_t *F, struct rb_iovec *vec, int count, WVCB *cb, void *data)
+{
+	struct io_uring_sqe *sqe;
+	struct iouring_write *req;
+	struct iouring_fd *ufd;
+
+	if(ur_info->buf_ring == NULL)
+	{
+		errno = ENOSYS;
+		return -1;
+	}
+
+	iouring_grow_fds(F->fd);
+	ufd = &ur_info->fds[F->fd];
+
+	if(ufd->write != NULL)
+	{
+		errno = EBUSY;
+		return -1;
+	}
+
+	if((sqe = iouring_get_sqe()) == NULL)
+	{
+		errno = EAGAIN;
+		return -1;
+	}
+
+	req = rb_malloc(sizeof(struct iouring_write) + sizeof(struct iovec) * count);
+	req->F = F;
+	req->callback = cb;
+	req->data = data;
+	memcpy(req->vec, vec, sizeof(struct iovec) * count);
+
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = F->fd;
+	sqe->addr = (uint64_t)(uintptr_t)req->vec;
+	sqe->len = count;
+	sqe->off = (uint64_t)-1;
+	sqe->user_data = ((uint64_t)IOURING_TAG_WRITE << IOURING_TAG_SHIFT) | (uint64_t)(uintptr_t)req;
+
+	ufd->write = req;
+	return 0;
+}
+
+/*
+ * rb_close_iouring
+ *
+ * Called as F is closed.  Reads and writes in flight are cancelled and
+ * disowned, and everything queued that names the fd is submitted now,
+ * before the number can be closed and reused.
+ */
+void
+rb_close_iouring(rb_fde_t *F)
+{
+	struct iouring_fd *ufd;
+
+	if(F->fd < 0 || F->fd >= ur_info->fds_size)
+		return;
+
+	ufd = &ur_info->fds[F->fd];
+
+	if(ufd->stream_cb != NULL || ufd->stream_armed)
+		rb_read_stream_iouring(F, NULL, NULL);
+
+	if(ufd->write != NULL)
+	{
+		iouring_cancel(((uint64_t)IOURING_TAG_WRITE << IOURING_TAG_SHIFT) | (uint64_t)(uintptr_t)ufd->write);
+		ufd->write->F = NULL;
+		ufd->write = NULL;
+	}
+
+	if(ur_info->to_submit > 0 && iouring_enter(ur_info->to_submit, 0, 0, NULL, 0) >= 0)
+		ur_info->to_submit = 0;
+}
+
+#ifdef USING_IOURING_STREAMS
+/*
+ * iouring_stream_complete
+ *
+ * Hand one multishot receive completion to the stream's callback, and
+ * work out whether the stream has to be armed again.
+ */
+static void
+iouring_stream_complete(struct io_uring_cqe *cqe, int fd, uint32_t gen)
+{
+	struct iouring_fd *ufd = &ur_info->fds[fd];
+	unsigned int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	int has_buf = cqe->flags & IORING_CQE_F_BUFFER;
+	int res = cqe->res;
+	rb_fde_t *F;
+	RSCB *cb;
+
+	/* a stream that has since been stopped */
+	if(gen != ufd->stream_gen || !ufd->stream_armed)
+	{
+		if(has_buf)
+			iouring_buf_recycle(bid);
+		return;
+	}
+
+	if(!(cqe->flags & IORING_CQE_F_MORE))
+		ufd->stream_armed = 0;
+
+	F = rb_find_fd(fd);
+	cb = ufd->stream_cb;
+
+	if(res > 0 && has_buf)
+		cb(F, ur_info->bufs + (size_t)bid * IOURING_BUF_SIZE, res, ufd->stream_data);
+	else if(res == 0)
+		cb(F, NULL, 0, ufd->stream_data);
+	else if(res == -ENOBUFS || rb_ignore_errno(-res))
+		;	/* armed again below */
+	else
+	{
+		errno = -res;
+		cb(F, NULL, -1, ufd->stream_data);
+	}
+
+	if(has_buf)
+		iouring_buf_recycle(bid);
+
+	/* the callback may have stopped the stream, closed the fd, or
+	 * opened others and so moved the fd table */
+	ufd = &ur_info->fds[fd];
+	if(gen != ufd->stream_gen)
+		return;
+
+	/* EOF and errors end the stream */
+	if(res == 0 || (res < 0 && res != -ENOBUFS && !rb_ignore_errno(-res)))
+	{
+		ufd->stream_cb = NULL;
+		ufd->stream_data = NULL;
+		return;
+	}
+
+	if(!ufd->stream_armed)
+		iouring_mark_dirty(fd);
+}
+#endif
+
+static void
+iouring_write_complete(struct io_uring_cqe *cqe)
+{
+	struct iouring_write *req = (struct iouring_write *)(uintptr_t)(cqe->user_data & ~IOURING_TAG_MASK);
+	ssize_t ret = cqe->res;
+
+	if(req->F != NULL)
+		ur_info->fds[req->F->fd].write = NULL;
+
+	if(ret < 0)
+	{
+		errno = -ret;
+		ret = -1;
+	}
+
+	req->callback(req->F, ret, req->data);
+	rb_free(req);
+}
+
+/*
+ * rb_select
+ *
+ * Submit the interest changes queued since the last call, wait for
+ * completions and call the handlers of the fds that became ready.
+ */
+int
+rb_select_iouring(long delay)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	struct io_uring_cqe *cqe;
+	struct iouring_fd *ufd;
+	unsigned int head, tail;
+	int num, o_errno, fd, revents, tag;
+	uint32_t gen;
+	void *data;
+	PF *hdl;
+	rb_fde_t *F;
+
+	iouring_flush_dirty();
+
+	memset(&arg, 0, sizeof(arg));
+	if(delay >= 0)
+	{
+		ts.tv_sec = delay / 1000;
+		ts.tv_nsec = (delay % 1000) * 1000000;
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+	}
+
+	num = iouring_enter(ur_info->to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+			    &arg, sizeof(arg));
+
+	/* save errno as rb_set_time() will likely clobber it */
+	o_errno = errno;
+	rb_set_time();
+	errno = o_errno;
+
+	if(num >= 0)
+		ur_info->to_submit = 0;
+	else if(o_errno != ETIME && !rb_ignore_errno(o_errno))
+		return RB_ERROR;
+
+	head = *ur_info->cq_head;
+	tail = __atomic_load_n(ur_info->cq_tail, __ATOMIC_ACQUIRE);
+
+	for(; head != tail; head++)
+	{
+		cqe = &ur_info->cqes[head & *ur_info->cq_mask];
+		tag = (int)(cqe->user_data >> IOURING_TAG_SHIFT);
+
+		if(tag == IOURING_TAG_WRITE)
+		{
+			iouring_write_complete(cqe);
+			continue;
+		}
+
+		fd = (int)(uint32_t)cqe->user_data;
+		gen = (uint32_t)(cqe->user_data >> 32) & IOURING_GEN_MASK;
+		revents = cqe->res;
+
+		/* poll removes and cancels carry no user_data of their own */
+		if(tag == IOURING_TAG_NONE || fd >= ur_info->fds_size)
+		{
+#ifdef USING_IOURING_STREAMS
+			if(cqe->flags & IORING_CQE_F_BUFFER)
+				iouring_buf_recycle(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+#endif
+			continue;
+		}
+
+#ifdef USING_IOURING_STREAMS
+		if(tag == IOURING_TAG_RECV)
+		{
+			iouring_stream_complete(cqe, fd, gen);
+			continue;
+		}
+#endif
+
+		ufd = &ur_info->fds[fd];
+
+		/* a poll we have since removed or replaced */
+		if(gen != ufd->gen || ufd->armed == 0)
+			continue;
+
+		/* one-shot, so nothing is armed for this fd any more */
+		ufd->armed = 0;
+
+		F = rb_find_fd(fd);
+		if(F == NULL || !IsFDOpen(F))
+			continue;
+
+		if(revents < 0)
+			revents = POLLERR;
+
+		if(revents & (POLLIN | POLLHUP | POLLERR))
+		{
+			hdl = F->read_handler;
+			data = F->read_data;
+			F->read_handler = NULL;
+			F->read_data = NULL;
+			if(hdl)
+				hdl(F, data);
+		}
+
+		if(!IsFDOpen(F))
+			continue;
+
+		if(revents & (POLLOUT | POLLHUP | POLLERR))
+		{
+			hdl = F->write_handler;
+			data = F->write_data;
+			F->write_handler = NULL;
+			F->write_data = NULL;
+			if(hdl)
+				hdl(F, data);
+		}
+
+		if(!IsFDOpen(F))
+			continue;
+
+		F->pflags = 0;
+		if(F->read_handler != NULL)
+			F->pflags |= POLLIN;
+		if(F->write_handler != NULL)
+			F->pflags |= POLLOUT;
+
+		/* re-armed with the next submission */
+		if(F->pflags != 0)
+			iouring_mark_dirty(fd);
+	}
+
+	__atomic_store_n(ur_info->cq_head, head, __ATOMIC_RELEASE);
+#ifdef USING_IOURING_STREAMS
+	if(ur_info->buf_ring != NULL)
+		iouring_buf_publish();
+#endif
+	return RB_OK;
+}
+
+#else /* io_uring not supported here */
+int
+rb_init_netio_iouring(void)
+{
+	return ENOSYS;
+}
+
+void
+rb_setselect_iouring(rb_fde_t *F __attribute__((unused)), unsigned int type __attribute__((unused)), PF * handler __attribute__((unused)), void *client_data __attribute__((unused)))
+{
+	errno = ENOSYS;
+	return;
+}
+
+int
+rb_select_iouring(long delay __attribute__((unused)))
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int
+rb_setup_fd_iouring(rb_fde_t *F __attribute__((unused)))
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int
+rb_read_stream_iouring(rb_fde_t *F __attribute__((unused)), RSCB *cb __attribute__((unused)), void *data __attribute__((unused)))
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int
+rb_writev_async_iouring(rb_fde_t *F __attribute__((unused)), struct rb_iovec *vec __attribute__((unused)), int count __attribute__((unused)), WVCB *cb __attribute__((unused)), void *data __attribute__((unused)))
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+void
+rb_close_iouring(rb_fde_t *F __attribute__((unused)))
+{
+}
+
+#endif
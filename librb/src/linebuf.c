@@ -27,10 +27,39 @@
 #include <rb_lib.h>
 #include <commio-int.h>
 
-static rb_bh *rb_linebuf_heap;
+static rb_bh *rb_linebuf_heaps[LINEBUF_LINE_CLASSES];
+
+/* usable bytes of line data for each size class, smallest first */
+static const int rb_linebuf_class_size[LINEBUF_LINE_CLASSES] = {
+	128, 256, 512, LINEBUF_SIZE + CRLF_LEN + 1
+};
+
+#define LINEBUF_CLASS_FULL	(LINEBUF_LINE_CLASSES - 1)
+
+/* rings grow from this many slots, and are released once drained if
+ * they grew beyond LINEBUF_RING_KEEP so a burst does not pin memory */
+#define LINEBUF_RING_MIN	4
+#define LINEBUF_RING_KEEP	64
 
 static int bufline_count = 0;
 
+/*
+ * An rb_linebuf_flush_async() write in flight.  The lines it covers stay
+ * at the head of the queue until it completes; if the queue is torn
+ * down first, the write takes its own references to them instead.
+ */
+struct _linebuf_write
+{
+	buf_head_t *bufhead;	/* NULL once orphaned */
+	LBFCB *callback;
+	void *data;
+	int count;		/* lines covered by the write */
+	buf_line_t **lines;	/* our references, once orphaned */
+};
+
+/* one request kept back, so a steady stream of writes does not allocate */
+static struct _linebuf_write *linebuf_write_spare;
+
 /*
  * rb_linebuf_init
  *
@@ -40,14 +69,23 @@ static int bufline_count = 0;
 void
 rb_linebuf_init(size_t heap_size)
 {
-	rb_linebuf_heap = rb_bh_create(sizeof(buf_line_t), heap_size, "librb_linebuf_heap");
+	static const char *desc[LINEBUF_LINE_CLASSES] = {
+		"librb_linebuf_heap_128", "librb_linebuf_heap_256",
+		"librb_linebuf_heap_512", "librb_linebuf_heap"
+	};
+	int i;
+
+	for(i = 0; i < LINEBUF_LINE_CLASSES; i++)
+		rb_linebuf_heaps[i] = rb_bh_create(sizeof(buf_line_t) + rb_linebuf_class_size[i],
+						   heap_size, desc[i]);
 }
 
 static buf_line_t *
-rb_linebuf_allocate(void)
+rb_linebuf_allocate(int size_class)
 {
 	buf_line_t *t;
-	t = rb_bh_alloc(rb_linebuf_heap);
+	t = rb_bh_alloc(rb_linebuf_heaps[size_class]);
+	t->size_class = size_class;
 	return (t);
 
 }
@@ -55,7 +93,94 @@ rb_linebuf_allocate(void)
 static void
 rb_linebuf_free(buf_line_t * p)
 {
-	rb_bh_free(rb_linebuf_heap, p);
+	rb_bh_free(rb_linebuf_heaps[p->size_class], p);
+}
+
+/*
+ * rb_linebuf_size_class
+ *
+ * Pick the smallest size class able to hold len bytes plus the \0
+ */
+static inline int
+rb_linebuf_size_class(int len)
+{
+	int i;
+
+	for(i = 0; i < LINEBUF_CLASS_FULL; i++)
+	{
+		if(len < rb_linebuf_class_size[i])
+			return i;
+	}
+	return LINEBUF_CLASS_FULL;
+}
+
+/*
+ * rb_linebuf_nth
+ *
+ * Return the n'th queued line, counting from the oldest
+ */
+static inline buf_line_t *
+rb_linebuf_nth(buf_head_t * bufhead, int n)
+{
+	return bufhead->lines[(bufhead->first + n) & (bufhead->ringsize - 1)];
+}
+
+static inline buf_line_t *
+rb_linebuf_head(buf_head_t * bufhead)
+{
+	if(bufhead->numlines == 0)
+		return NULL;
+	return bufhead->lines[bufhead->first];
+}
+
+static inline buf_line_t *
+rb_linebuf_tail(buf_head_t * bufhead)
+{
+	if(bufhead->numlines == 0)
+		return NULL;
+	return rb_linebuf_nth(bufhead, bufhead->numlines - 1);
+}
+
+/*
+ * rb_linebuf_grow
+ *
+ * Double the ring, unwrapping the queued lines to the start of it
+ */
+static void
+rb_linebuf_grow(buf_head_t * bufhead)
+{
+	buf_line_t **lines;
+	int newsize, i;
+
+	newsize = bufhead->ringsize ? bufhead->ringsize * 2 : LINEBUF_RING_MIN;
+	lines = rb_malloc(sizeof(buf_line_t *) * newsize);
+
+	for(i = 0; i < bufhead->numlines; i++)
+		lines[i] = rb_linebuf_nth(bufhead, i);
+
+	rb_free(bufhead->lines);
+	bufhead->lines = lines;
+	bufhead->ringsize = newsize;
+	bufhead->first = 0;
+}
+
+/*
+ * rb_linebuf_push
+ *
+ * Queue a reference to the given line at the end of the linebuf
+ */
+static inline void
+rb_linebuf_push(buf_head_t * bufhead, buf_line_t * bufline)
+{
+	if(bufhead->numlines == bufhead->ringsize)
+		rb_linebuf_grow(bufhead);
+
+	bufhead->lines[(bufhead->first + bufhead->numlines) & (bufhead->ringsize - 1)] = bufline;
+	bufline->refcount++;
+
+	/* And finally, update the allocated size */
+	bufhead->alloclen++;
+	bufhead->numlines++;
 }
 
 /*
@@ -65,22 +190,17 @@ rb_linebuf_free(buf_line_t * p)
  * It will be initially empty.
  */
 static buf_line_t *
-rb_linebuf_new_line(buf_head_t * bufhead)
+rb_linebuf_new_line(buf_head_t * bufhead, int size_class)
 {
 	buf_line_t *bufline;
 
-	bufline = rb_linebuf_allocate();
+	bufline = rb_linebuf_allocate(size_class);
 	if(bufline == NULL)
 		return NULL;
 	++bufline_count;
 
 	/* Stick it at the end of the buf list */
-	rb_dlinkAddTailAlloc(bufline, &bufhead->list);
-	bufline->refcount++;
-
-	/* And finally, update the allocated size */
-	bufhead->alloclen++;
-	bufhead->numlines++;
+	rb_linebuf_push(bufhead, bufline);
 
 	return bufline;
 }
@@ -89,20 +209,11 @@ rb_linebuf_new_line(buf_head_t * bufhead)
 /*
  * rb_linebuf_done_line
  *
- * We've finished with the given line, so deallocate it
+ * We've finished with the oldest line, so drop our reference to it
  */
 static void
-rb_linebuf_done_line(buf_head_t * bufhead, buf_line_t * bufline, rb_dlink_node *node)
+rb_linebuf_unref(buf_line_t * bufline)
 {
-	/* Remove it from the linked list */
-	rb_dlinkDestroy(node, &bufhead->list);
-
-	/* Update the allocated size */
-	bufhead->alloclen--;
-	bufhead->len -= bufline->len;
-	lrb_assert(bufhead->len >= 0);
-	bufhead->numlines--;
-
 	bufline->refcount--;
 	lrb_assert(bufline->refcount >= 0);
 
@@ -115,6 +226,34 @@ rb_linebuf_done_line(buf_head_t * bufhead, buf_line_t * bufline, rb_dlink_node *
 	}
 }
 
+static void
+rb_linebuf_done_line(buf_head_t * bufhead)
+{
+	buf_line_t *bufline = bufhead->lines[bufhead->first];
+
+	/* Remove it from the ring */
+	bufhead->first = (bufhead->first + 1) & (bufhead->ringsize - 1);
+
+	/* Update the allocated size */
+	bufhead->alloclen--;
+	bufhead->len -= bufline->len;
+	lrb_assert(bufhead->len >= 0);
+	bufhead->numlines--;
+
+	if(bufhead->numlines == 0)
+	{
+		bufhead->first = 0;
+		if(bufhead->ringsize > LINEBUF_RING_KEEP)
+		{
+			rb_free(bufhead->lines);
+			bufhead->lines = NULL;
+			bufhead->ringsize = 0;
+		}
+	}
+
+	rb_linebuf_unref(bufline);
+}
+
 
 /*
  * skip to end of line or the crlfs, return the number of bytes ..
@@ -165,11 +304,28 @@ rb_linebuf_newbuf(buf_head_t * bufhead)
 void
 rb_linebuf_donebuf(buf_head_t * bufhead)
 {
-	while(bufhead->list.head != NULL)
+	struct _linebuf_write *req = bufhead->writing;
+	int i;
+
+	/* a write in flight keeps what it is writing */
+	if(req != NULL)
 	{
-		rb_linebuf_done_line(bufhead, (buf_line_t *) bufhead->list.head->data,
-				     bufhead->list.head);
+		req->lines = rb_malloc(sizeof(buf_line_t *) * req->count);
+		for(i = 0; i < req->count; i++)
+		{
+			req->lines[i] = rb_linebuf_nth(bufhead, i);
+			req->lines[i]->refcount++;
+		}
+		req->bufhead = NULL;
+		bufhead->writing = NULL;
 	}
+
+	while(bufhead->numlines > 0)
+		rb_linebuf_done_line(bufhead);
+
+	rb_free(bufhead->lines);
+	bufhead->lines = NULL;
+	bufhead->ringsize = 0;
 }
 
 /*
@@ -344,10 +500,10 @@ rb_linebuf_parse(buf_head_t * bufhead, char *data, int len, int raw)
 	int linecnt = 0;
 
 	/* First, if we have a partial buffer, try to squeze data into it */
-	if(bufhead->list.tail != NULL)
+	if(bufhead->numlines > 0)
 	{
 		/* Check we're doing the partial buffer thing */
-		bufline = bufhead->list.tail->data;
+		bufline = rb_linebuf_tail(bufhead);
 		/* just try, the worst it could do is *reject* us .. */
 		if(!raw)
 			cpylen = rb_linebuf_copy_line(bufhead, bufline, data, len);
@@ -372,7 +528,7 @@ rb_linebuf_parse(buf_head_t * bufhead, char *data, int len, int raw)
 	while(len > 0)
 	{
 		/* We obviously need a new buffer, so .. */
-		bufline = rb_linebuf_new_line(bufhead);
+		bufline = rb_linebuf_new_line(bufhead, LINEBUF_CLASS_FULL);
 
 		/* And parse */
 		if(!raw)
@@ -406,10 +562,10 @@ rb_linebuf_get(buf_head_t * bufhead, char *buf, int buflen, int partial, int raw
 	char *start, *ch;
 
 	/* make sure we have a line */
-	if(bufhead->list.head == NULL)
+	if(bufhead->numlines == 0)
 		return 0;	/* Obviously not.. hrm. */
 
-	bufline = bufhead->list.head->data;
+	bufline = rb_linebuf_head(bufhead);
 
 	/* make sure that the buffer was actually *terminated */
 	if(!(partial || bufline->terminated))
@@ -452,7 +608,7 @@ rb_linebuf_get(buf_head_t * bufhead, char *buf, int buflen, int partial, int raw
 	lrb_assert(cpylen >= 0);
 
 	/* Deallocate the line */
-	rb_linebuf_done_line(bufhead, bufline, bufhead->list.head);
+	rb_linebuf_done_line(bufhead);
 
 	/* return how much we copied */
 	return cpylen;
@@ -467,20 +623,14 @@ rb_linebuf_get(buf_head_t * bufhead, char *buf, int buflen, int partial, int raw
 void
 rb_linebuf_attach(buf_head_t * bufhead, buf_head_t * new)
 {
-	rb_dlink_node *ptr;
 	buf_line_t *line;
+	int i;
 
-	RB_DLINK_FOREACH(ptr, new->list.head)
+	for(i = 0; i < new->numlines; i++)
 	{
-		line = ptr->data;
-		rb_dlinkAddTailAlloc(line, &bufhead->list);
-
-		/* Update the allocated size */
-		bufhead->alloclen++;
+		line = rb_linebuf_nth(new, i);
+		rb_linebuf_push(bufhead, line);
 		bufhead->len += line->len;
-		bufhead->numlines++;
-
-		line->refcount++;
 	}
 }
 
@@ -492,20 +642,18 @@ rb_linebuf_attach(buf_head_t * bufhead, buf_head_t * new)
 void
 rb_linebuf_put(buf_head_t *bufhead, const rb_strf_t *strings)
 {
+	static char buf[LINEBUF_SIZE + CRLF_LEN + 1];
 	buf_line_t *bufline;
 	size_t len = 0;
 	int ret;
 
 	/* make sure the previous line is terminated */
-	if (bufhead->list.tail) {
-		bufline = bufhead->list.tail->data;
+	if (bufhead->numlines > 0) {
+		bufline = rb_linebuf_tail(bufhead);
 		lrb_assert(bufline->terminated);
 	}
 
-	/* create a new line */
-	bufline = rb_linebuf_new_line(bufhead);
-
-	ret = rb_fsnprint(bufline->buf, LINEBUF_SIZE + 1, strings);
+	ret = rb_fsnprint(buf, LINEBUF_SIZE + 1, strings);
 	if (ret > 0)
 		len += ret;
 
@@ -513,9 +661,13 @@ rb_linebuf_put(buf_head_t *bufhead, const rb_strf_t *strings)
 		len = LINEBUF_SIZE;
 
 	/* add trailing CRLF */
-	bufline->buf[len++] = '\r';
-	bufline->buf[len++] = '\n';
-	bufline->buf[len] = '\0';
+	buf[len++] = '\r';
+	buf[len++] = '\n';
+	buf[len] = '\0';
+
+	/* create a new line only as large as the data */
+	bufline = rb_linebuf_new_line(bufhead, rb_linebuf_size_class(len));
+	memcpy(bufline->buf, buf, len + 1);
 
 	bufline->terminated = 1;
 
@@ -523,6 +675,78 @@ rb_linebuf_put(buf_head_t *bufhead, const rb_strf_t *strings)
 	bufhead->len += len;
 }
 
+/*
+ * rb_linebuf_fill_vec
+ *
+ * Point vec at the terminated lines from the head of the queue, and
+ * return how many there are.
+ */
+static int
+rb_linebuf_fill_vec(buf_head_t * bufhead, struct rb_iovec *vec)
+{
+	buf_line_t *bufline;
+	int x = 0;
+
+	/* Check we actually have a first buffer */
+	if(bufhead->numlines == 0)
+		return 0;
+
+	bufline = rb_linebuf_head(bufhead);
+	if(!bufline->terminated)
+		return 0;
+
+	vec[x].iov_base = bufline->buf + bufhead->writeofs;
+	vec[x++].iov_len = bufline->len - bufhead->writeofs;
+
+	do
+	{
+		if(x >= bufhead->numlines)
+			break;
+
+		bufline = rb_linebuf_nth(bufhead, x);
+		if(!bufline->terminated)
+			break;
+
+		vec[x].iov_base = bufline->buf;
+		vec[x].iov_len = bufline->len;
+
+	}
+	while(++x < RB_UIO_MAXIOV);
+
+	return x;
+}
+
+/*
+ * rb_linebuf_wrote
+ *
+ * Move past xret bytes written from the first x lines, and return how
+ * many lines that finished.
+ */
+static int
+rb_linebuf_wrote(buf_head_t * bufhead, int xret, int x)
+{
+	buf_line_t *bufline;
+	int y;
+
+	for(y = 0; y < x; y++)
+	{
+		bufline = rb_linebuf_head(bufhead);
+
+		if(xret >= bufline->len - bufhead->writeofs)
+		{
+			xret -= bufline->len - bufhead->writeofs;
+			rb_linebuf_done_line(bufhead);
+			bufhead->writeofs = 0;
+		}
+		else
+		{
+			bufhead->writeofs += xret;
+			break;
+		}
+	}
+	return y;
+}
+
 /*
  * rb_linebuf_flush
  *
@@ -541,100 +765,48 @@ rb_linebuf_flush(rb_fde_t *F, buf_head_t * bufhead)
 	buf_line_t *bufline;
 	int retval;
 
+	/* rb_linebuf_flush_async() owns the head of the queue for now */
+	if(bufhead->writing != NULL)
+	{
+		errno = EWOULDBLOCK;
+		return -1;
+	}
+
 /*
  * autoconf checks for this..but really just want to use it if we have a
  * native version even if libircd provides a fake version...
  */
 	if(!rb_fd_ssl(F))
 	{
-		rb_dlink_node *ptr;
-		int x = 0, y;
-		int xret;
+		int x;
 		static struct rb_iovec vec[RB_UIO_MAXIOV];
 
-		memset(vec, 0, sizeof(vec));
-		/* Check we actually have a first buffer */
-		if(bufhead->list.head == NULL)
-		{
-			/* nope, so we return none .. */
-			errno = EWOULDBLOCK;
-			return -1;
-		}
-
-		ptr = bufhead->list.head;
-
-		bufline = ptr->data;
-		if(!bufline->terminated)
-		{
-			errno = EWOULDBLOCK;
-			return -1;
-
-		}
-
-		vec[x].iov_base = bufline->buf + bufhead->writeofs;
-		vec[x++].iov_len = bufline->len - bufhead->writeofs;
-		ptr = ptr->next;
-
-		do
-		{
-			if(ptr == NULL)
-				break;
-
-			bufline = ptr->data;
-			if(!bufline->terminated)
-				break;
-
-			vec[x].iov_base = bufline->buf;
-			vec[x].iov_len = bufline->len;
-			ptr = ptr->next;
-
-		}
-		while(++x < RB_UIO_MAXIOV);
-
+		x = rb_linebuf_fill_vec(bufhead, vec);
 		if(x == 0)
 		{
 			errno = EWOULDBLOCK;
 			return -1;
 		}
 
-		xret = retval = rb_writev(F, vec, x);
+		retval = rb_writev(F, vec, x);
 		if(retval <= 0)
 			return retval;
 
-		ptr = bufhead->list.head;
-
-		for(y = 0; y < x; y++)
-		{
-			bufline = ptr->data;
-
-			if(xret >= bufline->len - bufhead->writeofs)
-			{
-				xret -= bufline->len - bufhead->writeofs;
-				ptr = ptr->next;
-				rb_linebuf_done_line(bufhead, bufline, bufhead->list.head);
-				bufhead->writeofs = 0;
-			}
-			else
-			{
-				bufhead->writeofs += xret;
-				break;
-			}
-		}
-
+		rb_linebuf_wrote(bufhead, retval, x);
 		return retval;
 	}
 
 	/* this is the non-writev case */
 
 	/* Check we actually have a first buffer */
-	if(bufhead->list.head == NULL)
+	if(bufhead->numlines == 0)
 	{
 		/* nope, so we return none .. */
 		errno = EWOULDBLOCK;
 		return -1;
 	}
 
-	bufline = bufhead->list.head->data;
+	bufline = rb_linebuf_head(bufhead);
 
 	/* And that its actually full .. */
 	if(!bufline->terminated)
@@ -658,13 +830,88 @@ rb_linebuf_flush(rb_fde_t *F, buf_head_t * bufhead)
 	{
 		bufhead->writeofs = 0;
 		lrb_assert(bufhead->len >= 0);
-		rb_linebuf_done_line(bufhead, bufline, bufhead->list.head);
+		rb_linebuf_done_line(bufhead);
 	}
 
 	/* Return line length */
 	return retval;
 }
 
+static void
+rb_linebuf_flush_done(rb_fde_t *F, ssize_t retval, void *data)
+{
+	struct _linebuf_write *req = data;
+	buf_head_t *bufhead = req->bufhead;
+	int i, lines = 0, o_errno = errno;
+
+	if(bufhead == NULL)
+	{
+		/* the queue went away while we were writing */
+		for(i = 0; i < req->count; i++)
+			rb_linebuf_unref(req->lines[i]);
+		rb_free(req->lines);
+		rb_free(req);
+		return;
+	}
+
+	bufhead->writing = NULL;
+	if(retval > 0)
+		lines = rb_linebuf_wrote(bufhead, (int)retval, req->count);
+
+	errno = o_errno;
+	req->callback(F, (int)retval, lines, req->data);
+
+	if(linebuf_write_spare == NULL)
+		linebuf_write_spare = req;
+	else
+		rb_free(req);
+}
+
+/*
+ * rb_linebuf_flush_async
+ *
+ * Like rb_linebuf_flush(), but the write is handed to the network loop
+ * and cb is told the outcome once the queue has moved past what was
+ * written, with a NULL fd if F was closed meanwhile.  cb is not called
+ * if the queue was torn down first.  Returns 1 while a write is in
+ * flight, or 0 if it could not start one, in which case
+ * rb_linebuf_flush() is the fallback.
+ */
+int
+rb_linebuf_flush_async(rb_fde_t *F, buf_head_t * bufhead, LBFCB * cb, void *data)
+{
+	static struct rb_iovec vec[RB_UIO_MAXIOV];
+	struct _linebuf_write *req;
+	int x;
+
+	if(bufhead->writing != NULL)
+		return 1;
+
+	x = rb_linebuf_fill_vec(bufhead, vec);
+	if(x == 0)
+		return 0;
+
+	req = linebuf_write_spare;
+	linebuf_write_spare = NULL;
+	if(req == NULL)
+		req = rb_malloc(sizeof(struct _linebuf_write));
+
+	req->bufhead = bufhead;
+	req->callback = cb;
+	req->data = data;
+	req->count = x;
+	req->lines = NULL;
+
+	if(rb_writev_async(F, vec, x, rb_linebuf_flush_done, req) < 0)
+	{
+		linebuf_write_spare = req;
+		return 0;
+	}
+
+	bufhead->writing = req;
+	return 1;
+}
+
 
 
 /*
@@ -674,5 +921,16 @@ rb_linebuf_flush(rb_fde_t *F, buf_head_t * bufhead)
 void
 rb_count_rb_linebuf_memory(size_t *count, size_t *rb_linebuf_memory_used)
 {
-	rb_bh_usage(rb_linebuf_heap, count, NULL, rb_linebuf_memory_used, NULL);
+	size_t heap_count, heap_memory;
+	int i;
+
+	*count = 0;
+	*rb_linebuf_memory_used = 0;
+
+	for(i = 0; i < LINEBUF_LINE_CLASSES; i++)
+	{
+		rb_bh_usage(rb_linebuf_heaps[i], &heap_count, NULL, &heap_memory, NULL);
+		*count += heap_count;
+		*rb_linebuf_memory_used += heap_memory;
+	}
 }
@@ -690,6 +690,42 @@ rb_ssl_get_cipher(rb_fde_t *const F)
 	return buf;
 }
 
+void
+rb_ssl_set_ktls(const int enable __attribute__((unused)))
+{
+	return;
+}
+
+int
+rb_ssl_ktls(rb_fde_t *const F __attribute__((unused)))
+{
+	return 0;
+}
+
+int
+rb_ssl_set_ticket_keys(const uint8_t *const keys __attribute__((unused)), const int count __attribute__((unused)))
+{
+	return 0;
+}
+
+void
+rb_ssl_set_session_cache(const int size __attribute__((unused)), RB_SSL_SESSION_CB *const cb __attribute__((unused)))
+{
+	return;
+}
+
+int
+rb_ssl_add_session(const uint8_t *const data __attribute__((unused)), const size_t len __attribute__((unused)))
+{
+	return 0;
+}
+
+int
+rb_ssl_session_reused(rb_fde_t *const F __attribute__((unused)))
+{
+	return 0;
+}
+
 ssize_t
 rb_ssl_read(rb_fde_t *const F, void *const buf, const size_t count)
 {
@@ -180,4 +180,40 @@ rb_ssl_get_cipher(rb_fde_t *F __attribute__((unused)))
 	return NULL;
 }
 
+void
+rb_ssl_set_ktls(int enable __attribute__((unused)))
+{
+	return;
+}
+
+int
+rb_ssl_ktls(rb_fde_t *F __attribute__((unused)))
+{
+	return 0;
+}
+
+int
+rb_ssl_set_ticket_keys(const uint8_t *keys __attribute__((unused)), int count __attribute__((unused)))
+{
+	return 0;
+}
+
+void
+rb_ssl_set_session_cache(int size __attribute__((unused)), RB_SSL_SESSION_CB *cb __attribute__((unused)))
+{
+	return;
+}
+
+int
+rb_ssl_add_session(const uint8_t *data __attribute__((unused)), size_t len __attribute__((unused)))
+{
+	return 0;
+}
+
+int
+rb_ssl_session_reused(rb_fde_t *F __attribute__((unused)))
+{
+	return 0;
+}
+
 #endif /* !HAVE_OPENSSL */
@@ -44,6 +44,24 @@ typedef enum
 
 
 static SSL_CTX *ssl_ctx = NULL;
+static int ssl_ktls = 0;
+
+struct ssl_ticket_key
+{
+	uint8_t name[16];
+	uint8_t hmac[32];
+	uint8_t aes[32];
+};
+
+/* the first key issues tickets, the others only decrypt them */
+static struct ssl_ticket_key ssl_ticket_keys[RB_SSL_TICKET_KEYS_MAX];
+static int ssl_ticket_key_count = 0;
+
+static int ssl_session_cache_size = 0;
+static RB_SSL_SESSION_CB *ssl_session_cb = NULL;
+
+/* how long a session or ticket may be resumed, in seconds */
+#define RB_SSL_SESSION_TIMEOUT	3600
 
 struct ssl_connect
 {
@@ -54,6 +72,7 @@ struct ssl_connect
 
 static const char *rb_ssl_strerror(unsigned long);
 static void rb_ssl_connect_realcb(rb_fde_t *, int, struct ssl_connect *);
+static void rb_ssl_setup_sessions(SSL_CTX *);
 
 
 
@@ -245,6 +264,143 @@ rb_ssl_read_or_write(const int r_or_w, rb_fde_t *const F, void *const rbuf, cons
 	return ret;
 }
 
+static const struct ssl_ticket_key *
+rb_ssl_find_ticket_key(const unsigned char *const key_name)
+{
+	for(int i = 0; i < ssl_ticket_key_count; i++)
+		if(memcmp(ssl_ticket_keys[i].name, key_name, sizeof ssl_ticket_keys[i].name) == 0)
+			return &ssl_ticket_keys[i];
+
+	return NULL;
+}
+
+/*
+ * Ticket keys come from the ircd so that every ssld process can decrypt
+ * the tickets any of them issued.  Tickets under an older key are still
+ * accepted, but the client is sent a fresh one.
+ */
+#ifdef LRB_HAVE_TICKET_EVP_CB
+static int
+rb_ssl_ticket_cb(SSL *const ssl __attribute__((unused)), unsigned char *const key_name, unsigned char *const iv,
+                 EVP_CIPHER_CTX *const cctx, EVP_MAC_CTX *const hctx, const int enc)
+#else
+static int
+rb_ssl_ticket_cb(SSL *const ssl __attribute__((unused)), unsigned char *const key_name, unsigned char *const iv,
+                 EVP_CIPHER_CTX *const cctx, HMAC_CTX *const hctx, const int enc)
+#endif
+{
+	const struct ssl_ticket_key *key;
+
+	if(enc)
+	{
+		if(ssl_ticket_key_count == 0)
+			return 0;
+
+		key = &ssl_ticket_keys[0];
+		memcpy(key_name, key->name, sizeof key->name);
+		if(RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1)
+			return -1;
+		if(EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key->aes, iv) != 1)
+			return -1;
+	}
+	else
+	{
+		if((key = rb_ssl_find_ticket_key(key_name)) == NULL)
+			return 0;
+		if(EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key->aes, iv) != 1)
+			return -1;
+	}
+
+	#ifdef LRB_HAVE_TICKET_EVP_CB
+	/* OSSL_PARAM wants non-const pointers, so hand it copies */
+	static char digest[] = "sha256";
+	uint8_t hmac[sizeof key->hmac];
+	int ret;
+
+	memcpy(hmac, key->hmac, sizeof hmac);
+
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, hmac, sizeof hmac),
+		OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+		OSSL_PARAM_construct_end(),
+	};
+	ret = EVP_MAC_CTX_set_params(hctx, params);
+	OPENSSL_cleanse(hmac, sizeof hmac);
+	if(ret != 1)
+		return -1;
+	#else
+	if(HMAC_Init_ex(hctx, key->hmac, sizeof key->hmac, EVP_sha256(), NULL) != 1)
+		return -1;
+	#endif
+
+	return (enc || key == &ssl_ticket_keys[0]) ? 1 : 2;
+}
+
+static int
+rb_ssl_new_session_cb(SSL *const ssl __attribute__((unused)), SSL_SESSION *const sess)
+{
+	uint8_t buf[8192];
+	unsigned char *p = buf;
+
+	if(ssl_session_cb == NULL)
+		return 0;
+
+	const int len = i2d_SSL_SESSION(sess, NULL);
+
+	if(len <= 0 || (size_t) len > sizeof buf)
+		return 0;
+
+	if(i2d_SSL_SESSION(sess, &p) != len)
+		return 0;
+
+	ssl_session_cb(buf, (size_t) len);
+
+	/* OpenSSL keeps its own reference */
+	return 0;
+}
+
+static void
+rb_ssl_setup_sessions(SSL_CTX *const ctx)
+{
+	static const unsigned char sid_ctx[] = "librb";
+
+	if(ctx == NULL)
+		return;
+
+	/* resumption is refused without this when client certificates are requested */
+	(void) SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof sid_ctx - 1);
+	(void) SSL_CTX_set_timeout(ctx, RB_SSL_SESSION_TIMEOUT);
+
+	if(ssl_session_cache_size > 0)
+	{
+		(void) SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+		(void) SSL_CTX_sess_set_cache_size(ctx, ssl_session_cache_size);
+		SSL_CTX_sess_set_new_cb(ctx, rb_ssl_new_session_cb);
+	}
+	else
+	{
+		(void) SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+		SSL_CTX_sess_set_new_cb(ctx, NULL);
+	}
+
+	#ifdef SSL_OP_NO_TICKET
+	if(ssl_ticket_key_count > 0)
+	{
+		(void) SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+		#ifdef LRB_HAVE_TICKET_EVP_CB
+		(void) SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, rb_ssl_ticket_cb);
+		#else
+		(void) SSL_CTX_set_tlsext_ticket_key_cb(ctx, rb_ssl_ticket_cb);
+		#endif
+		#ifdef LRB_HAVE_TLS13
+		(void) SSL_CTX_set_num_tickets(ctx, 1);
+		#endif
+	}
+	else
+		(void) SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+	#endif
+}
+
 static int
 make_certfp(X509 *const cert, uint8_t certfp[const RB_SSL_CERTFP_LEN], const int method)
 {
@@ -469,7 +625,7 @@ rb_setup_ssl_server(const char *const certfile, const char *keyfile,
 	}
 
 
-	SSL_CTX_set_session_cache_mode(ssl_ctx_new, SSL_SESS_CACHE_OFF);
+	rb_ssl_setup_sessions(ssl_ctx_new);
 	SSL_CTX_set_verify(ssl_ctx_new, SSL_VERIFY_PEER | SSL_VERIFY_CLIENT_ONCE, verify_accept_all_cb);
 
 	#ifdef SSL_OP_DONT_INSERT_EMPTY_FRAGMENTS
@@ -480,10 +636,6 @@ rb_setup_ssl_server(const char *const certfile, const char *keyfile,
 	(void) SSL_CTX_set_options(ssl_ctx_new, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
 	#endif
 
-	#ifdef SSL_OP_NO_TICKET
-	(void) SSL_CTX_set_options(ssl_ctx_new, SSL_OP_NO_TICKET);
-	#endif
-
 	#ifdef SSL_OP_CIPHER_SERVER_PREFERENCE
 	(void) SSL_CTX_set_options(ssl_ctx_new, SSL_OP_CIPHER_SERVER_PREFERENCE);
 	#endif
@@ -496,6 +648,11 @@ rb_setup_ssl_server(const char *const certfile, const char *keyfile,
 	(void) SSL_CTX_set_options(ssl_ctx_new, SSL_OP_SINGLE_ECDH_USE);
 	#endif
 
+	#ifdef SSL_OP_ENABLE_KTLS
+	if(ssl_ktls)
+		(void) SSL_CTX_set_options(ssl_ctx_new, SSL_OP_ENABLE_KTLS);
+	#endif
+
 	#ifdef LRB_HAVE_TLS_ECDH_AUTO
 	(void) SSL_CTX_set_ecdh_auto(ssl_ctx_new, 1);
 	#endif
@@ -649,6 +806,108 @@ rb_ssl_get_cipher(rb_fde_t *const F)
 	return buf;
 }
 
+/*
+ * Kernel TLS is only asked for here; OpenSSL installs the session keys
+ * into the socket after the handshake if both it and the kernel support
+ * the negotiated cipher, and silently keeps doing the work itself
+ * otherwise.  Takes effect for contexts set up after the call.
+ */
+void
+rb_ssl_set_ktls(const int enable)
+{
+	ssl_ktls = enable;
+}
+
+int
+rb_ssl_ktls(rb_fde_t *const F)
+{
+	int dirs = 0;
+
+	if(F == NULL || F->ssl == NULL || !SSL_is_init_finished(SSL_P(F)))
+		return 0;
+
+	#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+	if(BIO_get_ktls_send(SSL_get_wbio(SSL_P(F))))
+		dirs |= RB_SSL_KTLS_SEND;
+
+	/* records OpenSSL already pulled off the socket must go through it */
+	if(BIO_get_ktls_recv(SSL_get_rbio(SSL_P(F))) && !SSL_has_pending(SSL_P(F)))
+		dirs |= RB_SSL_KTLS_RECV;
+	#endif
+
+	return dirs;
+}
+
+/*
+ * Replaces the session ticket keys.  keys holds count keys of
+ * RB_SSL_TICKET_KEY_LEN bytes each, newest first; with none, tickets are
+ * turned off.  Applies to the current context straight away.
+ */
+int
+rb_ssl_set_ticket_keys(const uint8_t *const keys, int count)
+{
+	if(count > RB_SSL_TICKET_KEYS_MAX)
+		count = RB_SSL_TICKET_KEYS_MAX;
+	if(count < 0)
+		count = 0;
+
+	for(int i = 0; i < count; i++)
+	{
+		const uint8_t *const key = keys + i * RB_SSL_TICKET_KEY_LEN;
+
+		memcpy(ssl_ticket_keys[i].name, key, 16);
+		memcpy(ssl_ticket_keys[i].hmac, key + 16, 32);
+		memcpy(ssl_ticket_keys[i].aes, key + 48, 32);
+	}
+	for(int i = count; i < ssl_ticket_key_count; i++)
+		OPENSSL_cleanse(&ssl_ticket_keys[i], sizeof ssl_ticket_keys[i]);
+
+	ssl_ticket_key_count = count;
+	rb_ssl_setup_sessions(ssl_ctx);
+	return 1;
+}
+
+/*
+ * Turns the server side session cache on with room for size sessions, or
+ * off when size is 0.  cb is handed every session the cache gains from a
+ * full handshake, serialised, so that it can be passed to
+ * rb_ssl_add_session() in other processes.
+ */
+void
+rb_ssl_set_session_cache(const int size, RB_SSL_SESSION_CB *const cb)
+{
+	ssl_session_cache_size = size > 0 ? size : 0;
+	ssl_session_cb = cb;
+	rb_ssl_setup_sessions(ssl_ctx);
+}
+
+int
+rb_ssl_add_session(const uint8_t *const data, const size_t len)
+{
+	const unsigned char *p = data;
+	SSL_SESSION *sess;
+	int ret;
+
+	if(ssl_ctx == NULL || ssl_session_cache_size == 0)
+		return 0;
+
+	if((sess = d2i_SSL_SESSION(NULL, &p, (long) len)) == NULL)
+		return 0;
+
+	ret = SSL_CTX_add_session(ssl_ctx, sess);
+	SSL_SESSION_free(sess);
+	return ret;
+}
+
+int
+rb_ssl_session_reused(rb_fde_t *const F)
+{
+	if(F == NULL || F->ssl == NULL)
+		return 0;
+
+	return SSL_session_reused(SSL_P(F));
+}
+
 ssize_t
 rb_ssl_read(rb_fde_t *const F, void *const buf, const size_t count)
 {
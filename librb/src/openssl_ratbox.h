@@ -99,6 +99,13 @@
 #  define LRB_HAVE_TLS13                1
 #endif
 
+#if !defined(LIBRESSL_VERSION_NUMBER) && (OPENSSL_VERSION_NUMBER >= 0x30000000L)
+#  define LRB_HAVE_TICKET_EVP_CB        1
+#  include <openssl/core_names.h>
+#else
+#  include <openssl/hmac.h>
+#endif
+
 
 
 /*
@@ -615,10 +615,117 @@ rb_radixtree_elem_find(rb_radixtree *dict, const char *key, int fuzzy)
 	return &delem->leaf;
 }
 
+/*
+ * leaf_from()
+ *
+ * Find the smallest leaf under delem's branches from val upwards,
+ * or failing that, the first leaf after delem's subtree.
+ *
+ * Inputs:
+ *     - node to start from
+ *     - first branch to look at
+ *
+ * Outputs:
+ *     - the leaf, or NULL if there are none left
+ *
+ * Side Effects:
+ *     - none
+ */
+static rb_radixtree_elem *
+leaf_from(rb_radixtree_elem *delem, int val)
+{
+	while (delem != NULL)
+	{
+		for (; val < POINTERS_PER_NODE; val++)
+			if (delem->node.down[val] != NULL)
+				return first_leaf(delem->node.down[val]);
+
+		val = delem->node.parent_val + 1;
+		delem = delem->node.parent;
+	}
+
+	return NULL;
+}
+
+/*
+ * elem_find_from()
+ *
+ * Find the first leaf whose key sorts at or after a canonized key,
+ * whether or not the key itself is in the tree.
+ *
+ * Inputs:
+ *     - patricia tree object
+ *     - canonized key
+ *
+ * Outputs:
+ *     - the leaf, or NULL if every key sorts before it
+ *
+ * Side Effects:
+ *     - none
+ */
+static rb_radixtree_elem *
+elem_find_from(rb_radixtree *dict, const char *ckey)
+{
+	rb_radixtree_elem *delem, *leaf;
+	int keylen = strlen(ckey);
+	int val, diff, i;
+	int kval, lval;
+
+	if (dict->root == NULL)
+		return NULL;
+
+	/* any leaf agreeing with the key on the nibbles tested on the way */
+	leaf = dict->root;
+	while (!IS_LEAF(leaf))
+	{
+		val = leaf->nibnum / 2 < keylen ? NIBBLE_VAL(ckey, leaf->nibnum) : 0;
+
+		if (leaf->node.down[val] != NULL)
+			leaf = leaf->node.down[val];
+		else
+			leaf = first_leaf(leaf);
+	}
+
+	/* the first nibble where they part; before it they agree */
+	for (i = 0; ckey[i] == leaf->leaf.key[i]; i++)
+		if (ckey[i] == '\0')
+			return leaf;
+
+	diff = i * 2;
+	if (((ckey[i] ^ leaf->leaf.key[i]) & 0xF0) == 0)
+		diff++;
+
+	/* the subtree of every key sharing those nibbles */
+	delem = dict->root;
+	while (!IS_LEAF(delem) && delem->nibnum < diff)
+	{
+		val = delem->nibnum / 2 < keylen ? NIBBLE_VAL(ckey, delem->nibnum) : 0;
+		delem = delem->node.down[val];
+	}
+
+	kval = NIBBLE_VAL(ckey, diff);
+	lval = NIBBLE_VAL(leaf->leaf.key, diff);
+
+	/* they branch on that nibble here, and the key's own branch is empty */
+	if (!IS_LEAF(delem) && delem->nibnum == diff)
+		return leaf_from(delem, kval + 1);
+
+	/* otherwise the whole subtree sorts on one side of the key */
+	if (kval < lval)
+		return first_leaf(delem);
+
+	if (IS_LEAF(delem))
+		return leaf_from(delem->leaf.parent, delem->leaf.parent_val + 1);
+
+	return leaf_from(delem->node.parent, delem->node.parent_val + 1);
+}
+
 /*
  * rb_radixtree_foreach_start_from(rb_radixtree *dtree, rb_radixtree_iteration_state *state, const char *key)
  *
- * Starts iteration from a specified key, by wrapping rb_radixtree_elem_find().
+ * Starts iteration from a specified key, or if it is not in the tree,
+ * from the first key after it.  Keys sharing a prefix are contiguous,
+ * so this also finds the first key starting with a given prefix.
  *
  * Inputs:
  *     - patricia tree object
@@ -639,9 +746,35 @@ rb_radixtree_foreach_start_from(rb_radixtree *dtree, rb_radixtree_iteration_stat
 
 	if (key != NULL)
 	{
-		STATE_NEXT(state) = rb_radixtree_elem_find(dtree, key, 1);
+		char ckey_store[256];
+		char *ckey_buf = NULL;
+		const char *ckey = key;
+
+		if (dtree->canonize_cb != NULL)
+		{
+			if (strlen(key) >= sizeof ckey_store)
+			{
+				ckey_buf = rb_strdup(key);
+				dtree->canonize_cb(ckey_buf);
+				ckey = ckey_buf;
+			}
+			else
+			{
+				rb_strlcpy(ckey_store, key, sizeof ckey_store);
+				dtree->canonize_cb(ckey_store);
+				ckey = ckey_store;
+			}
+		}
+
+		STATE_NEXT(state) = elem_find_from(dtree, ckey);
 		STATE_CUR(state) = STATE_NEXT(state);
 
+		if (ckey_buf != NULL)
+			rb_free(ckey_buf);
+
+		if (STATE_NEXT(state) == NULL)
+			return;
+
 		/* make STATE_CUR point to selected item and STATE_NEXT point to
 		 * next item in the tree */
 		rb_radixtree_foreach_next(dtree, state);
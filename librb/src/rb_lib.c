@@ -167,7 +167,6 @@ rb_lib_init(log_cb * ilog, restart_cb * irestart, die_cb * idie, int closeall, i
 void
 rb_lib_loop(long delay)
 {
-	time_t next;
 	rb_set_time();
 
 	if(rb_io_supports_event())
@@ -180,22 +179,12 @@ rb_lib_loop(long delay)
 	while(1)
 	{
 		if(delay == 0)
-		{
-			if((next = rb_event_next()) > 0)
-			{
-				next -= rb_current_time();
-				if(next <= 0)
-					next = 1000;
-				else
-					next *= 1000;
-			}
-			else
-				next = -1;
-			rb_select(next);
-		}
+			rb_select(rb_event_next_delay());
 		else
 			rb_select(delay);
 		rb_event_run();
+		/* anything the events deferred should not wait for the next poll */
+		rb_run_deferred();
 	}
 }
 
@@ -36,6 +36,7 @@
 #include "match.h"
 #include "s_conf.h"
 #include "s_newconf.h"
+#include "maskset.h"
 #include "msg.h"
 #include "modules.h"
 #include "hash.h"
@@ -296,6 +297,7 @@ ms_ban(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p
 			else
 			{
 				rb_dlinkAddAlloc(aconf, &xline_conf_list);
+				maskset_add(xline_maskset, aconf->host, aconf);
 				check_xlines();
 			}
 			break;
@@ -308,7 +310,10 @@ ms_ban(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p
 			break;
 		case CONF_RESV_NICK:
 			if (!(aconf->status & CONF_ILLEGAL))
+			{
 				rb_dlinkAddAlloc(aconf, &resv_conf_list);
+				maskset_add(resv_maskset, aconf->host, aconf);
+			}
 			break;
 	}
 	sendto_server(client_p, NULL, CAP_BAN|CAP_TS6, NOCAPS,
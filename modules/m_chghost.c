@@ -99,12 +99,14 @@ me_realhost(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *sou
 		return;
 
 	del_from_hostname_hash(source_p->orighost, source_p);
+	del_from_global_index(source_p);
 	rb_strlcpy(source_p->orighost, parv[1], sizeof source_p->orighost);
 	if (irccmp(source_p->host, source_p->orighost))
 		SetDynSpoof(source_p);
 	else
 		ClearDynSpoof(source_p);
 	add_to_hostname_hash(source_p->orighost, source_p);
+	add_to_global_index(source_p);
 }
 
 static bool
@@ -371,6 +371,26 @@ static struct InfoStruct info_table[] = {
 		"Client rejection cache duration",
 		INFO_DECIMAL(&ConfigFileEntry.reject_duration),
 	},
+	{
+		"auth_cache_accept_duration",
+		"Time authd reuses an accept for the same address",
+		INFO_DECIMAL(&ConfigFileEntry.auth_cache_accept_duration),
+	},
+	{
+		"auth_cache_reject_duration",
+		"Time authd reuses a reject for the same prefix",
+		INFO_DECIMAL(&ConfigFileEntry.auth_cache_reject_duration),
+	},
+	{
+		"auth_cache_ipv4_bitlen",
+		"Prefix length authd caches IPv4 rejects for",
+		INFO_DECIMAL(&ConfigFileEntry.auth_cache_ipv4_bitlen),
+	},
+	{
+		"auth_cache_ipv6_bitlen",
+		"Prefix length authd caches IPv6 rejects for",
+		INFO_DECIMAL(&ConfigFileEntry.auth_cache_ipv6_bitlen),
+	},
 	{
 		"short_motd",
 		"Do not show MOTD; only tell clients they should read it",
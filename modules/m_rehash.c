@@ -31,6 +31,7 @@
 #include "numeric.h"
 #include "s_conf.h"
 #include "s_newconf.h"
+#include "maskset.h"
 #include "logger.h"
 #include "send.h"
 #include "msg.h"
@@ -194,6 +195,7 @@ rehash_txlines(struct Client *source_p)
 		if(!aconf->hold || aconf->lifetime)
 			continue;
 
+		maskset_del(xline_maskset, aconf);
 		free_conf(aconf);
 		rb_dlinkDestroy(ptr, &xline_conf_list);
 	}
@@ -228,6 +230,7 @@ rehash_tresvs(struct Client *source_p)
 		if(!aconf->hold || aconf->lifetime)
 			continue;
 
+		maskset_del(resv_maskset, aconf);
 		free_conf(aconf);
 		rb_dlinkDestroy(ptr, &resv_conf_list);
 	}
@@ -33,6 +33,7 @@
 #include "modules.h"
 #include "s_conf.h"
 #include "s_newconf.h"
+#include "maskset.h"
 #include "hash.h"
 #include "logger.h"
 #include "bandbi.h"
@@ -356,6 +357,7 @@ parse_resv(struct Client *source_p, const char *name, const char *reason, int te
 		}
 
 		rb_dlinkAddAlloc(aconf, &resv_conf_list);
+		maskset_add(resv_maskset, aconf->host, aconf);
 		resv_nick_fnc(aconf->host, aconf->passwd, temp_time);
 	}
 	else
@@ -613,6 +615,7 @@ remove_resv(struct Client *source_p, const char *name, int propagated)
 		}
 		/* already have ptr from the loop above.. */
 		rb_dlinkDestroy(ptr, &resv_conf_list);
+		maskset_del(resv_maskset, aconf);
 	}
 	free_conf(aconf);
 
@@ -86,8 +86,10 @@ mr_starttls(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *sou
 
 	s_assert(client_p->localClient != NULL);
 
-	/* clear out any remaining plaintext lines */
+	/* clear out any remaining plaintext lines, and stop reading
+	 * the socket before ssld takes it over */
 	rb_linebuf_donebuf(&client_p->localClient->buf_recvq);
+	rb_read_stream(client_p->localClient->F, NULL, NULL);
 
 	sendto_one_numeric(client_p, RPL_STARTTLS, form_str(RPL_STARTTLS));
 	send_queued(client_p);
@@ -105,6 +105,7 @@ static void stats_tdeny(struct Client *);
 static void stats_deny(struct Client *);
 static void stats_exempt(struct Client *);
 static void stats_events(struct Client *);
+static void stats_hooks(struct Client *);
 static void stats_prop_klines(struct Client *);
 static void stats_auth(struct Client *);
 static void stats_tklines(struct Client *);
@@ -159,6 +160,7 @@ static struct stats_cmd stats_cmd_table[256] = {
 	['f'] = HANDLER_NORM(stats_comm,	true,	NULL),
 	['F'] = HANDLER_NORM(stats_comm,	true,	NULL),
 	['g'] = HANDLER_NORM(stats_prop_klines,	false,	"oper:general"),
+	['h'] = HANDLER_NORM(stats_hooks,	true,	NULL),
 	['i'] = HANDLER_NORM(stats_auth,	false,	NULL),
 	['I'] = HANDLER_NORM(stats_auth,	false,	NULL),
 	['k'] = HANDLER_NORM(stats_tklines,	false,	NULL),
@@ -286,6 +288,31 @@ stats_dns_servers (struct Client *source_p)
 	{
 		sendto_one_numeric(source_p, RPL_STATSDEBUG, "A :%s", (char *)n->data);
 	}
+
+	if(dns_cache_stats.updated != 0)
+	{
+		unsigned long lookups = dns_cache_stats.hits + dns_cache_stats.negative_hits +
+			dns_cache_stats.misses;
+
+		sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				"A :cache %lu/%lu entries, %lu hits (%lu negative), %lu misses, %lu%% hit rate, %lu evicted, %ld seconds ago",
+				dns_cache_stats.entries, dns_cache_stats.max,
+				dns_cache_stats.hits + dns_cache_stats.negative_hits,
+				dns_cache_stats.negative_hits, dns_cache_stats.misses,
+				lookups ? (dns_cache_stats.hits + dns_cache_stats.negative_hits) * 100 / lookups : 0,
+				dns_cache_stats.evictions,
+				(long) (rb_current_time() - dns_cache_stats.updated));
+	}
+
+	if(opm_stats.updated != 0 && rb_dlink_list_length(&opm_list) > 0)
+	{
+		sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				"A :opm %lu/%lu connections, %lu groups (%lu scanning, %lu queued), %lu connections made, %lu clients joined a scan, %lu proxies, %ld seconds ago",
+				opm_stats.inflight, opm_stats.max_scans, opm_stats.groups,
+				opm_stats.running, opm_stats.waiting, opm_stats.started,
+				opm_stats.joined, opm_stats.found,
+				(long) (rb_current_time() - opm_stats.updated));
+	}
 }
 
 static void
@@ -496,6 +523,23 @@ stats_events (struct Client *source_p)
 	rb_dump_events(stats_events_cb, source_p);
 }
 
+static void
+stats_hooks(struct Client *source_p)
+{
+	int i;
+
+	for(i = 0; i < max_hooks; i++)
+	{
+		if(hooks[i].name == NULL || (hooks[i].nfns == 0 && hooks[i].calls == 0))
+			continue;
+
+		sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				"h :%s %d hooked, %lu calls, %llu usec",
+				hooks[i].name, hooks[i].nfns, hooks[i].calls,
+				(unsigned long long)(hooks[i].nsec / 1000));
+	}
+}
+
 static void
 stats_prop_klines(struct Client *source_p)
 {
@@ -902,16 +946,20 @@ stats_secure(struct Client *source_p)
 }
 
 static void
-stats_ssld_foreach(void *data, pid_t pid, int cli_count, enum ssld_status status, const char *version)
+stats_ssld_foreach(void *data, const struct ssld_info *info)
 {
 	struct Client *source_p = data;
 
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
-			"S :%ld %c %u :%s",
-			(long)pid,
-			status == SSLD_DEAD ? 'D' : (status == SSLD_SHUTDOWN ? 'S' : 'A'),
-			cli_count,
-			version);
+			"S :%ld %c %u %d %u %u/%u :%s",
+			(long)info->pid,
+			info->status == SSLD_DEAD ? 'D' : (info->status == SSLD_SHUTDOWN ? 'S' : 'A'),
+			info->cli_count,
+			info->handshakes,
+			info->rate,
+			info->resumed,
+			info->completed,
+			info->version);
 }
 
 static void
@@ -1039,6 +1087,11 @@ stats_tstats (struct Client *source_p)
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
 			   "T :sasl successes %u fails %u",
 			   sp.is_ssuc, sp.is_sbad);
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			   "T :sendq writes %llu lines %llu (%llu.%02llu lines/write)",
+			   sp.is_sqw, sp.is_sql,
+			   sp.is_sqw ? sp.is_sql / sp.is_sqw : 0,
+			   sp.is_sqw ? (sp.is_sql * 100 / sp.is_sqw) % 100 : 0);
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "T :Client Server");
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
 			   "T :connected %u %u", sp.is_cl, sp.is_sv);
@@ -1170,6 +1223,17 @@ stats_class(struct Client *source_p)
 		report_classes(source_p);
 }
 
+static void
+stats_memory_heap(size_t bused, size_t bfree, size_t bmemusage, size_t heapalloc,
+		  const char *desc, void *data)
+{
+	struct Client *source_p = data;
+
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			   "z :heap %s used %zu(%zu) free %zu allocated %zu",
+			   desc, bused, bmemusage, bfree, heapalloc);
+}
+
 static void
 stats_memory (struct Client *source_p)
 {
@@ -1390,6 +1454,8 @@ stats_memory (struct Client *source_p)
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
 			   "z :TOTAL: %zu",
 			   total_memory);
+
+	rb_bh_usage_all(stats_memory_heap, source_p);
 }
 
 static void
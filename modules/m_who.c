@@ -31,6 +31,7 @@
 #include "send.h"
 #include "match.h"
 #include "s_conf.h"
+#include "hostmask.h"
 #include "logger.h"
 #include "msg.h"
 #include "parse.h"
@@ -39,6 +40,8 @@
 #include "s_newconf.h"
 #include "ratelimit.h"
 #include "supported.h"
+#include "class.h"
+#include "rb_radixtree.h"
 
 #define FIELD_CHANNEL    0x0001
 #define FIELD_HOP        0x0002
@@ -54,6 +57,17 @@
 #define FIELD_ACCOUNT    0x0800
 #define FIELD_OPLEVEL    0x1000 /* meaningless and stupid, but whatever */
 
+/* what a global mask is matched against, as in ircu */
+#define MATCHSEL_NICK    0x0001
+#define MATCHSEL_USER    0x0002
+#define MATCHSEL_HOST    0x0004
+#define MATCHSEL_IP      0x0008
+#define MATCHSEL_SERVER  0x0010
+#define MATCHSEL_INFO    0x0020
+#define MATCHSEL_DEFAULT (MATCHSEL_NICK | MATCHSEL_USER | MATCHSEL_HOST | MATCHSEL_SERVER | MATCHSEL_INFO)
+
+#define WHO_SLICE        25000	/* clients looked at per turn of an oper's global WHO */
+
 static const char who_desc[] =
 	"Provides the WHO command to display information for users on a channel";
 
@@ -63,12 +77,34 @@ struct who_format
 	const char *querytype;
 };
 
+/* an oper's global WHO still going, carried on from who_continue() */
+struct who_continuation
+{
+	struct Client *source_p;
+	char *mask;		/* NULL for everyone */
+	char *endmask;		/* as given, for RPL_ENDOFWHO */
+	int matchsel;
+	int server_oper;
+	struct who_format fmt;
+	char querytype[4];
+	char *resume;		/* nick to carry on from */
+
+	rb_dlink_node node;
+};
+
+static rb_dlink_list who_continuations;
+static struct ev_entry *who_continue_ev;
+
 static void m_who(struct MsgBuf *, struct Client *, struct Client *, int, const char **);
 
 static void do_who_on_channel(struct Client *source_p, struct Channel *chptr,
 			      int server_oper, int member,
 			      struct who_format *fmt);
-static void who_global(struct Client *source_p, const char *mask, int server_oper, struct who_format *fmt);
+static void who_global(struct Client *source_p, const char *mask, const char *endmask,
+		int matchsel, int server_oper, struct who_format *fmt);
+static void who_continue(void *unused);
+static void who_release(struct who_continuation *who, bool finished);
+static void who_check_cliexit(void *data);
 static void do_who(struct Client *source_p,
 		   struct Client *target_p, struct membership *msptr,
 		   struct who_format *fmt);
@@ -82,13 +118,20 @@ static int
 _modinit(void)
 {
 	add_isupport("WHOX", isupport_string, "");
+	who_continue_ev = rb_event_add("who_continue", who_continue, NULL, 1);
 	return 0;
 }
 
 static void
 _moddeinit(void)
 {
+	rb_dlink_node *ptr, *nptr;
+
 	delete_isupport("WHOX");
+	rb_event_delete(who_continue_ev);
+
+	RB_DLINK_FOREACH_SAFE(ptr, nptr, who_continuations.head)
+		who_release(ptr->data, true);
 }
 
 int doing_who_show_idle_hook;
@@ -98,12 +141,20 @@ mapi_hlist_av1 who_hlist[] = {
 	{ "doing_who_show_idle", &doing_who_show_idle_hook },
 	{ NULL, NULL }
 };
-DECLARE_MODULE_AV2(who, _modinit, _moddeinit, who_clist, who_hlist, NULL, NULL, NULL, who_desc);
+mapi_hfn_list_av1 who_hfnlist[] = {
+	{ "client_exit", who_check_cliexit },
+	{ NULL, NULL }
+};
+DECLARE_MODULE_AV2(who, _modinit, _moddeinit, who_clist, who_hlist, who_hfnlist, NULL, NULL, who_desc);
 
 /*
 ** m_who
 **      parv[1] = nickname mask list
 **      parv[2] = additional selection flag and format options
+**
+**      Before any '%', o limits the reply to opers, and n, u, h, i, s
+**      and r limit what a global mask is matched against to the nick,
+**      username, host, IP, server and realname.
 */
 static void
 m_who(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p, int parc, const char *parv[])
@@ -114,7 +165,8 @@ m_who(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p,
 	char *mask;
 	rb_dlink_node *lp;
 	struct Channel *chptr = NULL;
-	int server_oper = parc > 2 ? (*parv[2] == 'o') : 0;	/* Show OPERS only */
+	int server_oper = 0;	/* Show OPERS only */
+	int matchsel = 0;
 	int member;
 	struct who_format fmt;
 	const char *s;
@@ -122,6 +174,23 @@ m_who(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p,
 
 	fmt.fields = 0;
 	fmt.querytype = NULL;
+
+	for (s = parc > 2 ? parv[2] : ""; *s != '\0' && *s != '%'; s++)
+	{
+		switch (*s)
+		{
+			case 'o': server_oper = 1; break;
+			case 'n': matchsel |= MATCHSEL_NICK; break;
+			case 'u': matchsel |= MATCHSEL_USER; break;
+			case 'h': matchsel |= MATCHSEL_HOST; break;
+			case 'i': matchsel |= MATCHSEL_IP; break;
+			case 's': matchsel |= MATCHSEL_SERVER; break;
+			case 'r': matchsel |= MATCHSEL_INFO; break;
+		}
+	}
+	if (matchsel == 0)
+		matchsel = MATCHSEL_DEFAULT;
+
 	if (parc > 2 && (s = strchr(parv[2], '%')) != NULL)
 	{
 		s++;
@@ -262,18 +331,48 @@ m_who(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p,
 	 * with "/who" ;) --fl
 	 */
 	if((*(mask + 1) == '\0') && (*mask == '0'))
-		who_global(source_p, NULL, server_oper, &fmt);
+		who_global(source_p, NULL, mask, matchsel, server_oper, &fmt);
 	else
-		who_global(source_p, mask, server_oper, &fmt);
+		who_global(source_p, mask, mask, matchsel, server_oper, &fmt);
+}
 
-	sendto_one(source_p, form_str(RPL_ENDOFWHO),
-		   me.name, source_p->name, mask);
+/* who_matches
+ * inputs	- pointer to client requesting who
+ *		- pointer to client to check
+ *		- mask, or NULL for everyone
+ *		- MATCH_* fields to match the mask against
+ * output	- true if target_p matches
+ */
+static bool
+who_matches(struct Client *source_p, struct Client *target_p, const char *mask, int matchsel)
+{
+	if(mask == NULL)
+		return true;
+
+	if((matchsel & MATCHSEL_NICK) && match(mask, target_p->name))
+		return true;
+	if((matchsel & MATCHSEL_USER) && match(mask, target_p->username))
+		return true;
+	if((matchsel & MATCHSEL_HOST) && match(mask, target_p->host))
+		return true;
+	if((matchsel & MATCHSEL_SERVER) && match(mask, target_p->servptr->name))
+		return true;
+	if((matchsel & MATCHSEL_HOST) && IsOperGeneral(source_p) && match(mask, target_p->orighost))
+		return true;
+	if((matchsel & MATCHSEL_INFO) && match(mask, target_p->info))
+		return true;
+	if((matchsel & MATCHSEL_IP) && show_ip(source_p, target_p) &&
+			(match(mask, target_p->sockhost) || match_ips(mask, target_p->sockhost)))
+		return true;
+
+	return false;
 }
 
 /* who_common_channel
  * inputs	- pointer to client requesting who
  * 		- pointer to channel member chain.
  *		- char * mask to match
+ *		- MATCH_* fields to match against
  *		- int if oper on a server or not
  *		- pointer to int maxmatches
  *		- format options
@@ -283,7 +382,7 @@ m_who(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p,
  */
 static void
 who_common_channel(struct Client *source_p, struct Channel *chptr,
-		   const char *mask, int server_oper, int *maxmatches,
+		   const char *mask, int matchsel, int server_oper, int *maxmatches,
 		   struct who_format *fmt)
 {
 	struct membership *msptr;
@@ -303,19 +402,288 @@ who_common_channel(struct Client *source_p, struct Channel *chptr,
 
 		SetMark(target_p);
 
-		if(*maxmatches > 0)
+		if(*maxmatches > 0 && who_matches(source_p, target_p, mask, matchsel))
+		{
+			do_who(source_p, target_p, NULL, fmt);
+			--(*maxmatches);
+		}
+	}
+}
+
+/* who_one
+ * inputs	- pointer to client requesting who
+ *		- pointer to client to check
+ *		- mask, fields and format as for who_global
+ *		- pointer to int maxmatches
+ * output	- NONE
+ * side effects - lists target_p if it is visible and matches, clears
+ *		  marks left by who_common_channel
+ */
+static void
+who_one(struct Client *source_p, struct Client *target_p, const char *mask,
+	int matchsel, int server_oper, int *maxmatches, struct who_format *fmt)
+{
+	if(!IsPerson(target_p))
+		return;
+
+	if(IsInvisible(target_p) && !IsOper(source_p))
+	{
+		ClearMark(target_p);
+		return;
+	}
+
+	if(server_oper && !SeesOper(target_p, source_p))
+		return;
+
+	if(*maxmatches > 0 && who_matches(source_p, target_p, mask, matchsel))
+	{
+		do_who(source_p, target_p, NULL, fmt);
+		--(*maxmatches);
+	}
+}
+
+/* literal_prefix
+ * inputs	- mask
+ *		- buffer for the prefix
+ * output	- length of the part of the mask before any wildcard
+ */
+static size_t
+literal_prefix(const char *mask, char *buf, size_t buflen)
+{
+	size_t len = strcspn(mask, "*?");
+
+	if(len >= buflen)
+		len = buflen - 1;
+
+	memcpy(buf, mask, len);
+	buf[len] = '\0';
+	return len;
+}
+
+/* who_ip_network
+ * inputs	- mask
+ *		- address and prefix length to fill
+ * output	- true if the mask is an address or CIDR, or starts with
+ *		  whole octets or groups of one, which give the network
+ *		  every address it can match is within
+ */
+static bool
+who_ip_network(const char *mask, struct rb_sockaddr_storage *addr, int *bits)
+{
+	char prefix[HOSTIPLEN + 1];
+	char net[HOSTIPLEN + 4];
+	const char *end;
+	size_t len, i;
+	int groups = 0;
+	int type;
+
+	type = parse_netmask(mask, addr, bits);
+	if(type == HM_IPV4 || type == HM_IPV6)
+		return true;
+
+	len = literal_prefix(mask, prefix, sizeof prefix);
+
+	if(len > 0 && strspn(prefix, "0123456789.") == len)
+	{
+		for(i = 0; i < len; i++)
+			if(prefix[i] == '.')
+				groups++;
+		if(groups == 0 || groups > 3 || (end = strrchr(prefix, '.')) == NULL)
+			return false;
+
+		snprintf(net, sizeof net, "%.*s%s", (int)(end - prefix), prefix,
+				groups == 1 ? ".0.0.0" : groups == 2 ? ".0.0" : ".0");
+		*bits = groups * 8;
+	}
+	else if(len > 0 && strchr(prefix, ':') != NULL &&
+			strspn(prefix, "0123456789abcdefABCDEF:") == len)
+	{
+		/* the groups after a "::" could be anywhere */
+		if((end = strstr(prefix, "::")) != NULL)
+			prefix[end - prefix + 1] = '\0';
+
+		for(i = 0; prefix[i] != '\0'; i++)
+			if(prefix[i] == ':')
+				groups++;
+		if(prefix[0] == ':' || groups == 0 || groups > 7)
+			return false;
+
+		end = strrchr(prefix, ':');
+		snprintf(net, sizeof net, "%.*s::", (int)(end - prefix), prefix);
+		*bits = groups * 16;
+	}
+	else
+		return false;
+
+	return rb_inet_pton_sock(net, addr) > 0;
+}
+
+/* who_mask_shape
+ * inputs	- mask
+ * output	- MATCHSEL_* fields a mask given without any is matched
+ *		  against when general::who_indexes is set: an address
+ *		  against the IP and host, a host with a literal end against
+ *		  the host and server, a literal start against the nick, and
+ *		  anything else against every field
+ */
+static int
+who_mask_shape(const char *mask)
+{
+	struct rb_sockaddr_storage addr;
+	int bits;
+
+	if(who_ip_network(mask, &addr, &bits))
+		return MATCHSEL_HOST | MATCHSEL_IP;
+
+	/* nicks have no dots */
+	if(strchr(mask, '.') != NULL)
+		return host_mask_tail(mask) != NULL ? MATCHSEL_HOST | MATCHSEL_SERVER : MATCHSEL_DEFAULT;
+
+	if(strchr("*?", *mask) == NULL)
+		return MATCHSEL_NICK;
+
+	return MATCHSEL_DEFAULT;
+}
+
+/*
+ * who_index
+ *
+ * inputs	- as for who_global, and pointer to int maxmatches
+ * output	- true if an index could answer the query
+ * side effects - lists matching clients found through the nick tree
+ *		  (nick only masks with a literal start), the server user
+ *		  lists (server only masks), the IP index (IP masks that are
+ *		  an address or network) or the host suffix index (host
+ *		  masks with a literal end), rather than looking at everyone
+ */
+static bool
+who_index(struct Client *source_p, const char *mask, int matchsel,
+	  int server_oper, int *maxmatches, struct who_format *fmt)
+{
+	struct Client *target_p;
+	rb_dlink_list found = { NULL, NULL, 0 };
+	rb_dlink_node *ptr, *uptr, *next_ptr;
+	struct rb_sockaddr_storage addr;
+	char prefix[NICKLEN + 1];
+	size_t len;
+	int bits;
+
+	if(mask == NULL)
+		return false;
+
+	if((matchsel & MATCHSEL_IP) && (matchsel & ~(MATCHSEL_HOST | MATCHSEL_IP)) == 0 &&
+			who_ip_network(mask, &addr, &bits) &&
+			find_global_by_ip((struct sockaddr *)&addr, bits, &found))
+	{
+		/* a host is only looked for along with the address it is */
+		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, found.head)
 		{
-			if((mask == NULL) ||
-					match(mask, target_p->name) || match(mask, target_p->username) ||
-					match(mask, target_p->host) || match(mask, target_p->servptr->name) ||
-					(IsOperGeneral(source_p) && match(mask, target_p->orighost)) ||
-					match(mask, target_p->info))
+			who_one(source_p, ptr->data, mask, matchsel, server_oper, maxmatches, fmt);
+			rb_dlinkDestroy(ptr, &found);
+		}
+
+		return true;
+	}
+
+	if((matchsel & MATCHSEL_HOST) && (matchsel & ~(MATCHSEL_HOST | MATCHSEL_SERVER)) == 0 &&
+			find_global_by_hostmask(mask, &found))
+	{
+		/* by host here, and by server below for those whose host
+		 * does not match, so nobody is listed twice
+		 */
+		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, found.head)
+		{
+			who_one(source_p, ptr->data, mask, MATCHSEL_HOST, server_oper, maxmatches, fmt);
+			rb_dlinkDestroy(ptr, &found);
+		}
+
+		if(!(matchsel & MATCHSEL_SERVER))
+			return true;
+
+		RB_DLINK_FOREACH(ptr, global_serv_list.head)
+		{
+			struct Client *server_p = ptr->data;
+
+			if(!match(mask, server_p->name))
+				continue;
+
+			RB_DLINK_FOREACH(uptr, server_p->serv->users.head)
 			{
-				do_who(source_p, target_p, NULL, fmt);
-				--(*maxmatches);
+				target_p = uptr->data;
+				if(!who_matches(source_p, target_p, mask, MATCHSEL_HOST))
+					who_one(source_p, target_p, mask, matchsel, server_oper, maxmatches, fmt);
 			}
 		}
+
+		return true;
+	}
+
+	if(matchsel == MATCHSEL_NICK && (len = literal_prefix(mask, prefix, sizeof prefix)) > 0)
+	{
+		rb_radixtree_iteration_state iter;
+
+		/* nicks with a common prefix sit together in the tree */
+		RB_RADIXTREE_FOREACH_FROM(target_p, &iter, client_name_tree, prefix)
+		{
+			if(ircncmp(target_p->name, prefix, len))
+				break;
+
+			who_one(source_p, target_p, mask, matchsel, server_oper, maxmatches, fmt);
+		}
+
+		return true;
+	}
+
+	if(matchsel == MATCHSEL_SERVER)
+	{
+		RB_DLINK_FOREACH(ptr, global_serv_list.head)
+		{
+			struct Client *server_p = ptr->data;
+
+			if(!match(mask, server_p->name))
+				continue;
+
+			RB_DLINK_FOREACH(uptr, server_p->serv->users.head)
+				who_one(source_p, uptr->data, mask, matchsel, server_oper, maxmatches, fmt);
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * who_scan
+ *
+ * inputs	- pointer to continuation of an oper's global who
+ * output	- true once everyone has been looked at
+ * side effects - lists matching clients, up to WHO_SLICE at a time and
+ *		  only while the sendq is under half full, as safelist does
+ */
+static bool
+who_scan(struct who_continuation *who)
+{
+	struct Client *source_p = who->source_p;
+	struct Client *target_p;
+	rb_radixtree_iteration_state iter;
+	int maxmatches = INT_MAX;
+	int count = 0;
+
+	RB_RADIXTREE_FOREACH_FROM(target_p, &iter, client_name_tree, who->resume)
+	{
+		if(count++ >= WHO_SLICE ||
+		   rb_linebuf_len(&source_p->localClient->buf_sendq) > get_sendq(source_p) / 2)
+		{
+			rb_free(who->resume);
+			who->resume = rb_strdup(target_p->name);
+			return false;
+		}
+
+		who_one(source_p, target_p, who->mask, who->matchsel, who->server_oper, &maxmatches, &who->fmt);
 	}
+
+	return true;
 }
 
 /*
@@ -323,22 +691,32 @@ who_common_channel(struct Client *source_p, struct Channel *chptr,
  *
  * inputs	- pointer to client requesting who
  *		- char * mask to match
+ *		- mask as given, for RPL_ENDOFWHO
+ *		- MATCH_* fields to match against
  *		- int if oper on a server or not
  *		- format options
  * output	- NONE
- * side effects - do a global scan of all clients looking for match
- *		  this is slightly expensive on EFnet ...
+ * side effects - lists matching clients, from an index where the mask
+ *		  allows one, else by looking at everyone.  An oper's look at
+ *		  everyone is spread over several turns of the event loop.
  *		  marks assumed cleared for all clients initially
  *		  and will be left cleared on return
  */
 static void
-who_global(struct Client *source_p, const char *mask, int server_oper, struct who_format *fmt)
+who_global(struct Client *source_p, const char *mask, const char *endmask,
+	   int matchsel, int server_oper, struct who_format *fmt)
 {
 	struct membership *msptr;
 	struct Client *target_p;
 	rb_dlink_node *lp, *ptr;
 	int maxmatches = 500;
 
+	/* with the indexes kept, a mask given no fields to match is matched
+	 * against what it looks like, so that an index can answer it
+	 */
+	if(mask != NULL && matchsel == MATCHSEL_DEFAULT && ConfigFileEntry.who_indexes)
+		matchsel = who_mask_shape(mask);
+
 	/* first, list all matching INvisible clients on common channels
 	 */
 	if(!IsOper(source_p))
@@ -346,7 +724,7 @@ who_global(struct Client *source_p, const char *mask, int server_oper, struct wh
 		RB_DLINK_FOREACH(lp, source_p->user->channel.head)
 		{
 			msptr = lp->data;
-			who_common_channel(source_p, msptr->chptr, mask, server_oper, &maxmatches, fmt);
+			who_common_channel(source_p, msptr->chptr, mask, matchsel, server_oper, &maxmatches, fmt);
 		}
 	}
 	else
@@ -357,39 +735,126 @@ who_global(struct Client *source_p, const char *mask, int server_oper, struct wh
 	 * if this is an oper who, list all matching clients, no need
 	 * to clear marks
 	 */
-	RB_DLINK_FOREACH(ptr, global_client_list.head)
+	if(who_index(source_p, mask, matchsel, server_oper, &maxmatches, fmt))
 	{
-		target_p = ptr->data;
-		if(!IsPerson(target_p))
-			continue;
-
-		if(IsInvisible(target_p) && !IsOper(source_p))
+		/* an index only visits some clients, so clear the rest */
+		if(!IsOper(source_p))
 		{
-			ClearMark(target_p);
-			continue;
+			RB_DLINK_FOREACH(lp, source_p->user->channel.head)
+			{
+				msptr = lp->data;
+				RB_DLINK_FOREACH(ptr, msptr->chptr->members.head)
+					ClearMark(((struct membership *)ptr->data)->client_p);
+			}
 		}
+	}
+	else if(IsOper(source_p) && MyClient(source_p))
+	{
+		struct who_continuation *who;
+		rb_dlink_node *wptr;
 
-		if(server_oper && !SeesOper(target_p, source_p))
-			continue;
-
-		if(maxmatches > 0)
+		/* one at a time */
+		RB_DLINK_FOREACH(wptr, who_continuations.head)
 		{
-			if(!mask ||
-					match(mask, target_p->name) || match(mask, target_p->username) ||
-					match(mask, target_p->host) || match(mask, target_p->servptr->name) ||
-					(IsOperGeneral(source_p) && match(mask, target_p->orighost)) ||
-					match(mask, target_p->info))
+			who = wptr->data;
+			if(who->source_p == source_p)
 			{
-				do_who(source_p, target_p, NULL, fmt);
-				--maxmatches;
+				who_release(who, true);
+				break;
 			}
 		}
+
+		who = rb_malloc(sizeof(struct who_continuation));
+		who->source_p = source_p;
+		who->mask = mask != NULL ? rb_strdup(mask) : NULL;
+		who->endmask = rb_strdup(endmask);
+		who->matchsel = matchsel;
+		who->server_oper = server_oper;
+		who->fmt = *fmt;
+		if(fmt->querytype != NULL)
+		{
+			rb_strlcpy(who->querytype, fmt->querytype, sizeof who->querytype);
+			who->fmt.querytype = who->querytype;
+		}
+		rb_dlinkAdd(who, &who->node, &who_continuations);
+
+		if(who_scan(who))
+			who_release(who, true);
+		return;
+	}
+	else
+	{
+		RB_DLINK_FOREACH(ptr, global_client_list.head)
+		{
+			target_p = ptr->data;
+			who_one(source_p, target_p, mask, matchsel, server_oper, &maxmatches, fmt);
+		}
 	}
 
 	if (maxmatches <= 0)
 		sendto_one(source_p,
 			form_str(ERR_TOOMANYMATCHES),
 			me.name, source_p->name, "WHO");
+
+	sendto_one(source_p, form_str(RPL_ENDOFWHO),
+		   me.name, source_p->name, endmask);
+}
+
+/*
+ * who_release
+ *
+ * inputs	- continuation to finish
+ *		- true to end the reply
+ * output	- NONE
+ * side effects - the continuation is freed
+ */
+static void
+who_release(struct who_continuation *who, bool finished)
+{
+	if(finished)
+		sendto_one(who->source_p, form_str(RPL_ENDOFWHO),
+			   me.name, who->source_p->name, who->endmask);
+
+	rb_dlinkDelete(&who->node, &who_continuations);
+	rb_free(who->mask);
+	rb_free(who->endmask);
+	rb_free(who->resume);
+	rb_free(who);
+}
+
+static void
+who_continue(void *unused)
+{
+	rb_dlink_node *ptr, *nptr;
+
+	RB_DLINK_FOREACH_SAFE(ptr, nptr, who_continuations.head)
+	{
+		struct who_continuation *who = ptr->data;
+
+		if(who_scan(who))
+			who_release(who, true);
+	}
+}
+
+static void
+who_check_cliexit(void *data)
+{
+	hook_data_client_exit *hdata = data;
+	rb_dlink_node *ptr;
+
+	if(!MyClient(hdata->target))
+		return;
+
+	RB_DLINK_FOREACH(ptr, who_continuations.head)
+	{
+		struct who_continuation *who = ptr->data;
+
+		if(who->source_p == hdata->target)
+		{
+			who_release(who, false);
+			return;
+		}
+	}
 }
 
 /*
@@ -46,6 +46,7 @@
 #include "modules.h"
 #include "s_conf.h"
 #include "s_newconf.h"
+#include "maskset.h"
 #include "reject.h"
 #include "bandbi.h"
 #include "operhash.h"
@@ -328,6 +329,7 @@ apply_xline(struct Client *source_p, const char *name, const char *reason, int t
 	}
 
 	rb_dlinkAddAlloc(aconf, &xline_conf_list);
+	maskset_add(xline_maskset, aconf->host, aconf);
 	check_xlines();
 }
 
@@ -511,6 +513,7 @@ remove_xline(struct Client *source_p, const char *name, bool propagated)
 			}
 
 			remove_reject_mask(aconf->host, NULL);
+			maskset_del(xline_maskset, aconf);
 			free_conf(aconf);
 			rb_dlinkDestroy(ptr, &xline_conf_list);
 			return;
@@ -20,7 +20,11 @@
  */
 
 
+#include "setup.h"	/* first, for _GNU_SOURCE */
 #include "stdinc.h"
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif
 
 #define MAXPASSFD 4
 #ifndef READBUF_SIZE
@@ -92,6 +96,7 @@ typedef struct _conn
 #define FLAG_SSL_W_WANTS_R 0x10	/* output needs to wait until input possible */
 #define FLAG_SSL_R_WANTS_W 0x20	/* input needs to wait until output possible */
 #define FLAG_ZIPSSL	0x40
+#define FLAG_HANDSHAKE	0x80	/* counted in ssld_handshakes */
 
 #define IsSSL(x) ((x)->flags & FLAG_SSL)
 #define IsZip(x) ((x)->flags & FLAG_ZIP)
@@ -100,6 +105,7 @@ typedef struct _conn
 #define IsSSLWWantsR(x) ((x)->flags & FLAG_SSL_W_WANTS_R)
 #define IsSSLRWantsW(x) ((x)->flags & FLAG_SSL_R_WANTS_W)
 #define IsZipSSL(x)	((x)->flags & FLAG_ZIPSSL)
+#define IsHandshake(x)	((x)->flags & FLAG_HANDSHAKE)
 
 #define SetSSL(x) ((x)->flags |= FLAG_SSL)
 #define SetZip(x) ((x)->flags |= FLAG_ZIP)
@@ -107,10 +113,12 @@ typedef struct _conn
 #define SetDead(x) ((x)->flags |= FLAG_DEAD)
 #define SetSSLWWantsR(x) ((x)->flags |= FLAG_SSL_W_WANTS_R)
 #define SetSSLRWantsW(x) ((x)->flags |= FLAG_SSL_R_WANTS_W)
+#define SetHandshake(x) ((x)->flags |= FLAG_HANDSHAKE)
 
 #define ClearCork(x) ((x)->flags &= ~FLAG_CORK)
 #define ClearSSLWWantsR(x) ((x)->flags &= ~FLAG_SSL_W_WANTS_R)
 #define ClearSSLRWantsW(x) ((x)->flags &= ~FLAG_SSL_R_WANTS_W)
+#define ClearHandshake(x) ((x)->flags &= ~FLAG_HANDSHAKE)
 
 #define NO_WAIT 0x0
 #define WAIT_PLAIN 0x1
@@ -125,12 +133,28 @@ typedef struct _conn
 static rb_dlink_list connid_hash_table[CONN_HASH_SIZE];
 static rb_dlink_list dead_list;
 
+static int ssld_ktls;
+
+/* load reported to the ircd, see send_load() */
+static uint32_t ssld_handshakes;
+static uint32_t ssld_started;
+static uint64_t ssld_bytes;
+static uint32_t ssld_completed;
+static uint32_t ssld_resumed;
+
+/* largest session passed on to the ircd, which reads 4KB at a time */
+#define SSLD_SESSION_MAX	4000
+#ifdef HAVE_SPLICE
+static int splice_pipe[2] = { -1, -1 };
+#endif
+
 static void conn_mod_read_cb(rb_fde_t *fd, void *data);
 static void conn_mod_write_sendq(rb_fde_t *, void *data);
 static void conn_plain_write_sendq(rb_fde_t *, void *data);
 static void mod_write_ctl(rb_fde_t *, void *data);
 static void conn_plain_read_cb(rb_fde_t *fd, void *data);
 static void conn_plain_read_shutdown_cb(rb_fde_t *fd, void *data);
+static void end_handshake(conn_t * conn);
 static void mod_cmd_write_queue(mod_ctl_t * ctl, const void *data, size_t len);
 static const char *remote_closed = "Remote host closed the connection";
 static bool ssld_ssl_ok;
@@ -195,6 +219,7 @@ close_conn(conn_t * conn, int wait_plain, const char *fmt, ...)
 	rb_rawbuf_flush(conn->plainbuf_out, conn->plain_fd);
 	rb_close(conn->mod_fd);
 	SetDead(conn);
+	end_handshake(conn);
 
 	if(!IsZipSSL(conn))
 		rb_dlinkDelete(&conn->node, connid_hash(conn->id));
@@ -218,6 +243,23 @@ close_conn(conn_t * conn, int wait_plain, const char *fmt, ...)
 	mod_cmd_write_queue(conn->ctl, buf, len);
 }
 
+static void
+start_handshake(conn_t * conn)
+{
+	SetHandshake(conn);
+	ssld_handshakes++;
+	ssld_started++;
+}
+
+static void
+end_handshake(conn_t * conn)
+{
+	if(!IsHandshake(conn))
+		return;
+	ClearHandshake(conn);
+	ssld_handshakes--;
+}
+
 static conn_t *
 make_conn(mod_ctl_t * ctl, rb_fde_t *mod_fd, rb_fde_t *plain_fd)
 {
@@ -355,12 +397,77 @@ plain_check_cork(conn_t * conn)
 }
 
 
+#ifdef HAVE_SPLICE
+/*
+ * conn_ktls: whether the given direction of a connection's TLS session is
+ * handled by the kernel, so plaintext can be passed straight through
+ */
+static int
+conn_ktls(conn_t * conn, int dir)
+{
+	if(!ssld_ktls || !IsSSL(conn) || IsZip(conn))
+		return 0;
+	return rb_ssl_ktls(conn->mod_fd) & dir;
+}
+
+/*
+ * conn_splice: moves up to READBUF_SIZE bytes from src to dst through
+ * splice_pipe without copying them into ssld.  Returns the number of bytes
+ * taken from src, 0 at end of file or -1 with errno set.  Whatever dst does
+ * not take right away is read back out of the pipe and queued on dstq, so
+ * the pipe is empty between calls.
+ */
+static ssize_t
+conn_splice(rb_fde_t *src, rb_fde_t *dst, rawbuf_head_t * dstq, uint64_t *dst_count)
+{
+	char buf[READBUF_SIZE];
+	ssize_t length, ret;
+	size_t left;
+
+	if(splice_pipe[0] == -1 && pipe2(splice_pipe, O_NONBLOCK | O_CLOEXEC) == -1)
+		splice_pipe[0] = splice_pipe[1] = -2;
+
+	if(splice_pipe[0] < 0)
+	{
+		errno = ENOSYS;
+		return -1;
+	}
+
+	length = splice(rb_get_fd(src), NULL, splice_pipe[1], NULL, READBUF_SIZE,
+			SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if(length <= 0)
+		return length;
+
+	for(left = length; left > 0; left -= ret)
+	{
+		ret = splice(splice_pipe[0], NULL, rb_get_fd(dst), NULL, left,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if(ret <= 0)
+			break;
+		*dst_count += ret;
+	}
+
+	/* dst is full, or failed and its write path will say so */
+	while(left > 0)
+	{
+		ret = read(splice_pipe[0], buf, left);
+		if(ret <= 0)
+			break;
+		rb_rawbuf_append(dstq, buf, ret);
+		left -= ret;
+	}
+
+	return length;
+}
+#endif
+
 static void
 conn_plain_read_cb(rb_fde_t *fd, void *data)
 {
 	char inbuf[READBUF_SIZE];
 	conn_t *conn = data;
 	int length;
+	bool spliced;
 	if(conn == NULL)
 		return;
 
@@ -375,7 +482,21 @@ conn_plain_read_cb(rb_fde_t *fd, void *data)
 		if(IsDead(conn))
 			return;
 
-		length = rb_read(conn->plain_fd, inbuf, sizeof(inbuf));
+		spliced = false;
+#ifdef HAVE_SPLICE
+		/* with kernel TLS on the way out, writing plaintext to the
+		 * socket is all SSL_write() would do; anything queued must
+		 * go first though
+		 */
+		if(rb_rawbuf_length(conn->modbuf_out) == 0 && !IsSSLWWantsR(conn) &&
+				conn_ktls(conn, RB_SSL_KTLS_SEND))
+		{
+			length = conn_splice(conn->plain_fd, conn->mod_fd, conn->modbuf_out, &conn->mod_out);
+			spliced = length >= 0 || rb_ignore_errno(errno);
+		}
+#endif
+		if(!spliced)
+			length = rb_read(conn->plain_fd, inbuf, sizeof(inbuf));
 
 		if(length == 0 || (length < 0 && !rb_ignore_errno(errno)))
 		{
@@ -390,8 +511,10 @@ conn_plain_read_cb(rb_fde_t *fd, void *data)
 			return;
 		}
 		conn->plain_in += length;
+		ssld_bytes += length;
 
-		conn_mod_write(conn, inbuf, length);
+		if(!spliced)
+			conn_mod_write(conn, inbuf, length);
 		if(IsDead(conn))
 			return;
 		if(plain_check_cork(conn))
@@ -434,6 +557,7 @@ conn_mod_read_cb(rb_fde_t *fd, void *data)
 	char inbuf[READBUF_SIZE];
 	conn_t *conn = data;
 	int length;
+	bool spliced;
 	if(conn == NULL)
 		return;
 	if(IsDead(conn))
@@ -452,7 +576,20 @@ conn_mod_read_cb(rb_fde_t *fd, void *data)
 		if(IsDead(conn))
 			return;
 
-		length = rb_read(conn->mod_fd, inbuf, sizeof(inbuf));
+		spliced = false;
+#ifdef HAVE_SPLICE
+		/* the kernel hands out application data as plaintext and
+		 * refuses anything else, e.g. alerts or key updates, which
+		 * then go through SSL_read() below
+		 */
+		if(rb_rawbuf_length(conn->plainbuf_out) == 0 && conn_ktls(conn, RB_SSL_KTLS_RECV))
+		{
+			length = conn_splice(conn->mod_fd, conn->plain_fd, conn->plainbuf_out, &conn->plain_out);
+			spliced = length >= 0 || rb_ignore_errno(errno);
+		}
+#endif
+		if(!spliced)
+			length = rb_read(conn->mod_fd, inbuf, sizeof(inbuf));
 
 		if(length == 0 || (length < 0 && !rb_ignore_errno(errno)))
 		{
@@ -484,7 +621,9 @@ conn_mod_read_cb(rb_fde_t *fd, void *data)
 			return;
 		}
 		conn->mod_in += length;
-		conn_plain_write(conn, inbuf, length);
+		ssld_bytes += length;
+		if(!spliced)
+			conn_plain_write(conn, inbuf, length);
 	}
 }
 
@@ -582,8 +721,12 @@ ssl_process_accept_cb(rb_fde_t *F, int status, struct sockaddr *addr, rb_socklen
 {
 	conn_t *conn = data;
 
+	end_handshake(conn);
 	if(status == RB_OK)
 	{
+		ssld_completed++;
+		if(rb_ssl_session_reused(conn->mod_fd))
+			ssld_resumed++;
 		ssl_send_cipher(conn);
 		ssl_send_certfp(conn);
 		ssl_send_open(conn);
@@ -601,6 +744,7 @@ ssl_process_connect_cb(rb_fde_t *F, int status, void *data)
 {
 	conn_t *conn = data;
 
+	end_handshake(conn);
 	if(status == RB_OK)
 	{
 		ssl_send_cipher(conn);
@@ -646,6 +790,7 @@ ssl_process_accept(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
 	if(rb_get_type(conn->plain_fd) == RB_FD_UNKNOWN)
 		rb_set_type(conn->plain_fd, RB_FD_SOCKET);
 
+	start_handshake(conn);
 	rb_ssl_start_accepted(ctlb->F[0], ssl_process_accept_cb, conn, 10);
 }
 
@@ -673,9 +818,102 @@ ssl_process_connect(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
 		rb_set_type(conn->plain_fd, RB_FD_SOCKET);
 
 
+	start_handshake(conn);
 	rb_ssl_start_connected(ctlb->F[0], ssl_process_connect_cb, conn, 10);
 }
 
+/*
+ * send_load: tells the ircd how many handshakes are in progress and how
+ * many bytes per second went through in the last interval, so it can
+ * weigh these when picking an ssld for a new connection, along with how
+ * many accepted handshakes completed and how many of those resumed a
+ * session.  Nothing is sent while none of it changes.
+ */
+static void
+send_load(void *unused)
+{
+	static uint32_t last_handshakes, last_started, last_completed, last_rate;
+	static uint64_t last_bytes;
+	static time_t last_time;
+	uint8_t buf[17];
+	uint32_t rate;
+	time_t delta;
+
+	delta = rb_current_time() - last_time;
+	if(delta <= 0)
+		delta = 1;
+	rate = (ssld_bytes - last_bytes) / delta;
+	last_bytes = ssld_bytes;
+	last_time = rb_current_time();
+
+	/* the ircd keeps the last count, so it must hear when it drops to 0 */
+	if(ssld_handshakes == last_handshakes && ssld_started == last_started &&
+	   ssld_completed == last_completed && rate == last_rate)
+		return;
+
+	last_handshakes = ssld_handshakes;
+	last_started = ssld_started;
+	last_completed = ssld_completed;
+	last_rate = rate;
+
+	buf[0] = 'L';
+	uint32_to_buf(&buf[1], ssld_handshakes);
+	uint32_to_buf(&buf[5], rate);
+	uint32_to_buf(&buf[9], ssld_completed);
+	uint32_to_buf(&buf[13], ssld_resumed);
+	mod_cmd_write_queue(mod_ctl, buf, sizeof(buf));
+}
+
+/*
+ * share_session: passes a session that just went into our cache to the
+ * ircd, which hands it on to the other sslds so a client can resume it
+ * whichever of them it reconnects through
+ */
+static void
+share_session(const uint8_t *data, size_t len)
+{
+	uint8_t buf[SSLD_SESSION_MAX];
+
+	if(len + 1 > sizeof(buf))
+		return;
+
+	buf[0] = 'R';
+	memcpy(&buf[1], data, len);
+	mod_cmd_write_queue(mod_ctl, buf, len + 1);
+}
+
+static void
+set_ticket_keys(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
+{
+	rb_ssl_set_ticket_keys(&ctlb->buf[1], (ctlb->buflen - 1) / RB_SSL_TICKET_KEY_LEN);
+}
+
+/*
+ * set_cpu: pins ssld to the cpu the ircd picked for it, or lets it run
+ * anywhere again when that is UINT32_MAX
+ */
+static void
+set_cpu(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+	uint32_t cpu = buf_to_uint32(&ctlb->buf[1]);
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	if(cpu == UINT32_MAX)
+	{
+		for(int i = 0; i < CPU_SETSIZE; i++)
+			CPU_SET(i, &set);
+	}
+	else if(cpu < CPU_SETSIZE)
+		CPU_SET(cpu, &set);
+	else
+		return;
+
+	(void) sched_setaffinity(0, sizeof(set), &set);
+#endif
+}
+
 static void
 process_stats(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
 {
@@ -709,6 +947,7 @@ ssl_new_keys(mod_ctl_t * ctl, mod_ctl_buf_t * ctl_buf)
 {
 	char *buf;
 	char *cert, *key, *dhparam, *cipher_list;
+	int session_cache = 0;
 
 	buf = (char *) &ctl_buf->buf[2];
 	cert = buf;
@@ -718,6 +957,22 @@ ssl_new_keys(mod_ctl_t * ctl, mod_ctl_buf_t * ctl_buf)
 	dhparam = buf;
 	buf += strlen(dhparam) + 1;
 	cipher_list = buf;
+	buf += strlen(cipher_list) + 1;
+
+	/* older ircds stop after the cipher list */
+	if((uint8_t *) buf < ctl_buf->buf + ctl_buf->buflen)
+	{
+		ssld_ktls = (*buf == '1');
+		buf += strlen(buf) + 1;
+	}
+	else
+		ssld_ktls = 0;
+	rb_ssl_set_ktls(ssld_ktls);
+
+	if((uint8_t *) buf < ctl_buf->buf + ctl_buf->buflen)
+		session_cache = atoi(buf);
+	rb_ssl_set_session_cache(session_cache, session_cache > 0 ? share_session : NULL);
+
 	if(strlen(key) == 0)
 		key = cert;
 	if(strlen(dhparam) == 0)
@@ -835,6 +1090,16 @@ mod_process_cmd_recv(mod_ctl_t * ctl)
 				ssl_change_certfp_method(ctl, ctl_buf);
 				break;
 			}
+		case 'P':
+			{
+				if (ctl_buf->buflen != 5)
+				{
+					cleanup_bad_message(ctl, ctl_buf);
+					break;
+				}
+				set_cpu(ctl, ctl_buf);
+				break;
+			}
 		case 'K':
 			{
 				if(!ssld_ssl_ok)
@@ -845,6 +1110,22 @@ mod_process_cmd_recv(mod_ctl_t * ctl)
 				ssl_new_keys(ctl, ctl_buf);
 				break;
 			}
+		case 'T':
+			{
+				if ((ctl_buf->buflen - 1) % RB_SSL_TICKET_KEY_LEN != 0)
+				{
+					cleanup_bad_message(ctl, ctl_buf);
+					break;
+				}
+				set_ticket_keys(ctl, ctl_buf);
+				break;
+			}
+		case 'R':
+			{
+				if(ssld_ssl_ok)
+					rb_ssl_add_session(&ctl_buf->buf[1], ctl_buf->buflen - 1);
+				break;
+			}
 		case 'S':
 			{
 				process_stats(ctl, ctl_buf);
@@ -1008,6 +1289,7 @@ main(int argc, char **argv)
 	rb_set_nb(mod_ctl->F_pipe);
 	rb_event_addish("clean_dead_conns", clean_dead_conns, NULL, 10);
 	rb_event_add("check_handshake_flood", check_handshake_flood, NULL, 10);
+	rb_event_add("send_load", send_load, NULL, 1);
 	read_pipe_ctl(mod_ctl->F_pipe, NULL);
 	mod_read_ctl(mod_ctl->F, mod_ctl);
 	send_version(mod_ctl);
@@ -0,0 +1,391 @@
+/*
+ *  burst1.c: Test the streamed server burst
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "s_serv.h"
+#include "channel.h"
+#include "hash.h"
+#include "send.h"
+#include "bburst.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define USERS		2000
+#define CHANNELS	20
+
+static struct Client *users[USERS];
+static struct Client *server2;
+
+struct burst_seen
+{
+	int uid[USERS];		/* times each user was introduced */
+	int sjoin[CHANNELS + 1];	/* times each channel was sent */
+	int lines;
+	int steps;
+	int max_sendq;
+	int last_burst;		/* line number of the last UID or SJOIN */
+	int ping;		/* line number of the end of burst PING */
+	int live;		/* line number of the line held back */
+	int quit;
+	int late;
+	int fresh;
+	int frames;		/* binary burst lines */
+	char *frame[1000];
+};
+
+static void
+seen_line(struct burst_seen *seen, const char *line)
+{
+	const char *p;
+	int n;
+
+	seen->lines++;
+
+	if(*line == BBURST_FRAME)
+	{
+		if(seen->frames < 1000)
+			seen->frame[seen->frames] = rb_strdup(line);
+		seen->frames++;
+		seen->last_burst = seen->lines;
+		return;
+	}
+
+	if((p = strstr(line, " UID ")) != NULL)
+	{
+		if(sscanf(p, " UID u%d ", &n) == 1 && n >= 0 && n < USERS)
+			seen->uid[n]++;
+		else if(!strncmp(p, " UID late ", 10))
+			seen->late++;
+		else if(!strncmp(p, " UID fresh ", 11))
+		{
+			/* held back behind the burst, not part of it */
+			seen->fresh++;
+			seen->live = seen->lines;
+			return;
+		}
+		seen->last_burst = seen->lines;
+	}
+	else if((p = strstr(line, " SJOIN ")) != NULL)
+	{
+		if((p = strstr(p, " #c")) != NULL && sscanf(p, " #c%d ", &n) == 1 && n >= 0 && n <= CHANNELS)
+			seen->sjoin[n]++;
+		seen->last_burst = seen->lines;
+	}
+	else if(!strcmp(line, "PING :" TEST_ME_ID CRLF))
+		seen->ping = seen->lines;
+	else if(strstr(line, " NOTICE * :held back") != NULL)
+		seen->live = seen->lines;
+	else if(strstr(line, " QUIT ") != NULL)
+		seen->quit = seen->lines;
+}
+
+static void
+drain(struct Client *target, struct burst_seen *seen)
+{
+	const char *line;
+
+	if(rb_linebuf_len(&target->localClient->buf_sendq) > seen->max_sendq)
+		seen->max_sendq = rb_linebuf_len(&target->localClient->buf_sendq);
+
+	while((line = get_client_sendq(target)) && strcmp(line, ""))
+		seen_line(seen, line);
+}
+
+/* hand the burst over as a socket would, a sendq at a time */
+static void
+run_burst(struct Client *target, struct burst_seen *seen)
+{
+	while(target->localClient->burst != NULL && seen->steps < 10000)
+	{
+		drain(target, seen);
+		burst_continue(target);
+		seen->steps++;
+	}
+	drain(target, seen);
+}
+
+static void
+setup(void)
+{
+	struct Channel *chptr;
+	char name[NICKLEN];
+	int i;
+
+	server2 = make_remote_server_full(&me, TEST_SERVER2_NAME, TEST_SERVER2_ID);
+
+	for(i = 0; i < USERS; i++)
+	{
+		snprintf(name, sizeof(name), "u%d", i);
+		users[i] = make_remote_person_nick(server2, name);
+		snprintf(users[i]->id, sizeof(users[i]->id), "%s%06d", TEST_SERVER2_ID, i);
+		add_to_id_hash(users[i]->id, users[i]);
+		rb_dlinkAddTail(users[i], &users[i]->node, &global_client_list);
+	}
+
+	/* #c0 to #c19 have twenty members each, #c20 has everyone */
+	for(i = 0; i <= CHANNELS; i++)
+	{
+		snprintf(name, sizeof(name), "#c%d", i);
+		chptr = get_or_create_channel(users[0], name, NULL);
+		chptr->channelts = 1000000000 + i;
+	}
+	for(i = 0; i < USERS; i++)
+	{
+		add_user_to_channel(find_channel("#c20"), users[i], i == 0 ? CHFL_CHANOP : CHFL_PEON);
+		if(i < CHANNELS * 20)
+		{
+			snprintf(name, sizeof(name), "#c%d", i % CHANNELS);
+			add_user_to_channel(find_channel(name), users[i], CHFL_PEON);
+		}
+	}
+}
+
+static void
+burst_stream1(void)
+{
+	struct Client *target = make_remote_server_full(&me, TEST_SERVER_NAME, TEST_SERVER_ID);
+	struct burst_seen seen;
+	int i, once;
+
+	memset(&seen, 0, sizeof(seen));
+	target->localClient->caps = CAP_TS6;
+
+	burst_start(target);
+	ok(target->localClient->burst != NULL, MSG);
+
+	/* the first helping is nowhere near the whole burst */
+	ok(rb_linebuf_len(&target->localClient->buf_sendq) < 80000, MSG);
+
+	/* anything else sent meanwhile waits behind it */
+	sendto_one(target, ":%s NOTICE * :held back", me.id);
+
+	run_burst(target, &seen);
+	ok(target->localClient->burst == NULL, MSG);
+	ok(seen.steps > 1, MSG);
+	ok(seen.max_sendq < 80000, MSG);
+
+	for(i = 0, once = 0; i < USERS; i++)
+		once += seen.uid[i] == 1;
+	is_int(USERS, once, MSG);
+
+	for(i = 0, once = 0; i <= CHANNELS; i++)
+		once += seen.sjoin[i] >= 1;
+	is_int(CHANNELS + 1, once, MSG);
+
+	/* a channel too big for one line is split, others are not */
+	ok(seen.sjoin[CHANNELS] > 1, MSG);
+	is_int(1, seen.sjoin[0], MSG);
+
+	ok(seen.ping > seen.last_burst, MSG);
+	ok(seen.live > seen.ping, MSG);
+
+	remove_remote_server(target);
+}
+
+static void
+burst_cursor1(void)
+{
+	struct Client *target = make_remote_server_full(&me, TEST_SERVER3_NAME, TEST_SERVER3_ID);
+	struct Client *late;
+	struct burst_seen seen;
+	int i, once;
+
+	memset(&seen, 0, sizeof(seen));
+	target->localClient->caps = CAP_TS6;
+
+	burst_start(target);
+	drain(target, &seen);
+	ok(seen.uid[USERS - 1] == 0, MSG);
+
+	/* gone before their turn, so never burst */
+	exit_client(NULL, users[USERS - 1], &me, "Gone");
+	destroy_channel(find_channel("#c19"));
+
+	/* came after the burst started, so left to live traffic */
+	late = make_remote_person_nick(server2, "late");
+	rb_strlcpy(late->id, TEST_SERVER2_ID "999999", sizeof(late->id));
+	rb_dlinkAddTail(late, &late->node, &global_client_list);
+
+	run_burst(target, &seen);
+	ok(target->localClient->burst == NULL, MSG);
+
+	for(i = 0, once = 0; i < USERS - 1; i++)
+		once += seen.uid[i] == 1;
+	is_int(USERS - 1, once, MSG);
+	is_int(0, seen.uid[USERS - 1], MSG);
+	is_int(0, seen.late, MSG);
+	is_int(0, seen.sjoin[19], MSG);
+	is_int(1, seen.sjoin[18], MSG);
+
+	/* the quit went out live, after the burst */
+	ok(seen.quit > seen.ping, MSG);
+
+	remove_remote_server(target);
+}
+
+static void
+burst_register1(void)
+{
+	struct Client *target = make_remote_server_full(&me, TEST_SERVER3_NAME, TEST_SERVER3_ID);
+	struct Client *user = make_local_unknown();
+	struct burst_seen seen;
+
+	memset(&seen, 0, sizeof(seen));
+	target->localClient->caps = CAP_TS6;
+
+	/* connected but not yet registered, as authd leaves it */
+	rb_dlinkAddTail(user, &user->node, &global_client_list);
+	rb_inet_pton_sock(TEST_IP, &user->localClient->ip);
+	rb_strlcpy(user->host, TEST_HOSTNAME, sizeof(user->host));
+	rb_inet_ntop_sock((struct sockaddr *)&user->localClient->ip, user->sockhost, sizeof(user->sockhost));
+	user->localClient->random_ping = 1;
+	user->flags |= FLAGS_PING_COOKIE;
+
+	burst_start(target);
+	drain(target, &seen);
+	ok(target->localClient->burst != NULL, MSG);
+
+	/* registers while the cursor is yet to reach it */
+	client_util_parse(user, "NICK fresh" CRLF);
+	client_util_parse(user, "USER " TEST_USERNAME " 0 0 :" TEST_REALNAME CRLF);
+	ok(IsClient(user), MSG);
+
+	run_burst(target, &seen);
+	ok(target->localClient->burst == NULL, MSG);
+
+	/* introduced live, after the burst, and only then */
+	is_int(1, seen.fresh, MSG);
+	ok(seen.ping > seen.last_burst, MSG);
+	ok(seen.live > seen.ping, MSG);
+
+	exit_client(NULL, user, &me, "Gone");
+	remove_remote_server(target);
+}
+
+static void
+burst_binary1(void)
+{
+	struct Client *target = make_remote_server_full(&me, TEST_SERVER_NAME, TEST_SERVER_ID);
+	struct Client *target_p;
+	struct Channel *chptr;
+	struct burst_seen seen;
+	rb_dlink_node *ptr, *nptr;
+	int i, users, text;
+
+	memset(&seen, 0, sizeof(seen));
+	target->localClient->caps = CAP_TS6 | CAP_EUID | CAP_BBURST;
+
+	burst_start(target);
+	run_burst(target, &seen);
+	ok(target->localClient->burst == NULL, MSG);
+
+	/* users and channels went as records, far fewer lines than text */
+	ok(seen.frames > 0, MSG);
+	ok(seen.frames < seen.lines, MSG);
+	ok(seen.frames < 1000, MSG);
+	for(i = 0, text = 0; i < USERS; i++)
+		text += seen.uid[i];
+	is_int(0, text, MSG);
+	ok(seen.ping > seen.last_burst, MSG);
+
+	remove_remote_server(target);
+
+	/* replay it from the users' own server, once they have gone */
+	RB_DLINK_FOREACH_SAFE(ptr, nptr, global_client_list.head)
+	{
+		target_p = ptr->data;
+		if(IsPerson(target_p) && target_p->servptr == server2)
+			exit_client(NULL, target_p, &me, "Gone");
+	}
+	ok(find_channel("#c20") == NULL, MSG);
+
+	server2->localClient->caps = CAP_TS6 | CAP_EUID | CAP_BBURST;
+	for(i = 0; i < seen.frames && i < 1000; i++)
+	{
+		client_util_parse(server2, seen.frame[i]);
+		rb_free(seen.frame[i]);
+	}
+
+	for(i = 0, users = 0; i < USERS - 1; i++)
+	{
+		char nick[NICKLEN];
+
+		snprintf(nick, sizeof(nick), "u%d", i);
+		users += find_person(nick) != NULL;
+	}
+	is_int(USERS - 1, users, MSG);
+
+	if(ok((target_p = find_person("u7")) != NULL, MSG))
+	{
+		is_string(TEST_SERVER2_ID "000007", target_p->id, MSG);
+		is_string(TEST_USERNAME, target_p->username, MSG);
+		is_string(TEST_HOSTNAME, target_p->host, MSG);
+		is_string(TEST_IP, target_p->sockhost, MSG);
+		is_string(TEST_REALNAME, target_p->info, MSG);
+		ok(target_p->servptr == server2, MSG);
+	}
+
+	if(ok((chptr = find_channel("#c20")) != NULL, MSG))
+	{
+		is_int(1000000020, chptr->channelts, MSG);
+		is_int(USERS - 1, rb_dlink_list_length(&chptr->members), MSG);
+		ok(is_chanop(find_channel_membership(chptr, find_person("u0"))), MSG);
+		ok(!is_chanop(find_channel_membership(chptr, find_person("u1"))), MSG);
+	}
+	if(ok((chptr = find_channel("#c3")) != NULL, MSG))
+		is_int(20, rb_dlink_list_length(&chptr->members), MSG);
+}
+
+static void
+bburst_malformed1(void)
+{
+	struct Client *link = make_remote_server_full(&me, TEST_SERVER3_NAME, TEST_SERVER3_ID);
+
+	link->localClient->caps = CAP_TS6 | CAP_EUID | CAP_BBURST;
+
+	/* a record longer than the line it is in */
+	client_util_parse(link, "\001U\177abc");
+	ok(IsAnyDead(link), MSG);
+}
+
+int main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	setup();
+	burst_stream1();
+	burst_cursor1();
+	burst_register1();
+	burst_binary1();
+	bburst_malformed1();
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
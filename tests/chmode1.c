@@ -101,6 +101,134 @@ test_chmode_limits(void)
 	remove_hook("get_channel_access", chmode_access_hook);
 }
 
+void
+test_ban_index(void)
+{
+	struct Client *other = make_local_person_full("other", "user", "other.test", "192.0.2.77", "other");
+	const char *forward = NULL;
+	char mask[BANLEN];
+
+	/* enough unrelated bans that the list gets indexed */
+	for (int i = 0; i < 20; i++)
+	{
+		snprintf(mask, sizeof mask, "*!*@host%d.test", i);
+		add_id(&me, channel, mask, NULL, &channel->banlist, CHFL_BAN);
+	}
+
+	is_int(0, is_banned(channel, client, NULL, NULL, NULL), MSG);
+	is_int(0, is_banned(channel, other, NULL, NULL, NULL), MSG);
+
+	/* literal host */
+	add_id(&me, channel, "*!*@OTHER.test", "#first", &channel->banlist, CHFL_BAN);
+	is_int(CHFL_BAN, is_banned(channel, other, NULL, NULL, &forward), MSG);
+	is_string("#first", forward, MSG);
+	is_int(0, is_banned(channel, client, NULL, NULL, NULL), MSG);
+	del_id(channel, "*!*@OTHER.test", &channel->banlist, CHFL_BAN);
+	is_int(0, is_banned(channel, other, NULL, NULL, NULL), MSG);
+
+	/* CIDR, v4 and v6 */
+	add_id(&me, channel, "*!*@192.0.2.0/24", NULL, &channel->banlist, CHFL_BAN);
+	is_int(CHFL_BAN, is_banned(channel, other, NULL, NULL, NULL), MSG);
+	is_int(0, is_banned(channel, client, NULL, NULL, NULL), MSG);
+	add_id(&me, channel, "*!*@2001:db8::/32", NULL, &channel->banlist, CHFL_BAN);
+	is_int(CHFL_BAN, is_banned(channel, client, NULL, NULL, NULL), MSG);
+
+	/* the nick and user parts still have to match */
+	add_id(&me, channel, "nobody!*@example.test", NULL, &channel->banlist, CHFL_BAN);
+	del_id(channel, "*!*@2001:db8::/32", &channel->banlist, CHFL_BAN);
+	is_int(0, is_banned(channel, client, NULL, NULL, NULL), MSG);
+
+	/* wildcard hosts, and the first matching ban supplies the forward */
+	add_id(&me, channel, "*!*@*.test", "#second", &channel->banlist, CHFL_BAN);
+	add_id(&me, channel, "*!*@192.0.2.77", "#third", &channel->banlist, CHFL_BAN);
+	is_int(CHFL_BAN, is_banned(channel, client, NULL, NULL, &forward), MSG);
+	is_string("#second", forward, MSG);
+	is_int(CHFL_BAN, is_banned(channel, other, NULL, NULL, &forward), MSG);
+	is_string("#third", forward, MSG);
+
+	/* exceptions are indexed the same way */
+	for (int i = 0; i < 20; i++)
+	{
+		snprintf(mask, sizeof mask, "*!*@except%d.test", i);
+		add_id(&me, channel, mask, NULL, &channel->exceptlist, CHFL_EXCEPTION);
+	}
+	is_int(CHFL_BAN, is_banned(channel, other, NULL, NULL, NULL), MSG);
+	add_id(&me, channel, "other!*@192.0.2.64/26", NULL, &channel->exceptlist, CHFL_EXCEPTION);
+	is_int(CHFL_EXCEPTION, is_banned(channel, other, NULL, NULL, NULL), MSG);
+	is_int(CHFL_BAN, is_banned(channel, client, NULL, NULL, NULL), MSG);
+
+	remove_local_person(other);
+}
+
+static void
+test_member_index(void)
+{
+	struct Channel *big = make_channel();
+	struct Client *members[200];
+	struct membership *msptr;
+	char nick[NICKLEN];
+	int found = 0, flags_ok = 0;
+
+	big->mode.mode |= MODE_PERMANENT;
+
+	for (int i = 0; i < 200; i++)
+	{
+		snprintf(nick, sizeof nick, "member%d", i);
+		members[i] = make_local_person_nick(nick);
+		add_user_to_channel(big, members[i], i % 2 ? CHFL_CHANOP : CHFL_PEON);
+	}
+
+	is_int(200, big->memberv.count, MSG);
+	is_int(200, big->locmemberv.count, MSG);
+	is_bool(true, big->member_index != NULL, MSG);
+
+	for (int i = 0; i < 200; i++)
+	{
+		msptr = find_channel_membership(big, members[i]);
+		if (msptr != NULL && msptr->client_p == members[i])
+			found++;
+		if (msptr != NULL && is_chanop(msptr) == (i % 2))
+			flags_ok++;
+	}
+	is_int(200, found, MSG);
+	is_int(200, flags_ok, MSG);
+	is_bool(true, find_channel_membership(big, client) == NULL, MSG);
+
+	/* holes get filled from the end of the array */
+	for (int i = 0; i < 200; i += 3)
+		remove_user_from_channel(find_channel_membership(big, members[i]));
+
+	found = 0;
+	for (int i = 0; i < 200; i++)
+	{
+		msptr = find_channel_membership(big, members[i]);
+		if ((msptr != NULL) == (i % 3 != 0))
+			found++;
+		if (msptr != NULL && big->memberv.v[msptr->memberidx].msptr != msptr)
+			found = -1000;
+	}
+	is_int(200, found, MSG);
+	is_int(133, big->memberv.count, MSG);
+
+	/* small channels drop the index and go back to scanning */
+	for (int i = 0; i < 190; i++)
+	{
+		if (i % 3 != 0)
+			remove_user_from_channel(find_channel_membership(big, members[i]));
+	}
+	is_bool(true, big->member_index == NULL, MSG);
+	is_int(7, big->memberv.count, MSG);
+	is_bool(true, find_channel_membership(big, members[197]) != NULL, MSG);
+	is_bool(true, find_channel_membership(big, members[198]) == NULL, MSG);
+
+	for (int i = 0; i < 200; i++)
+		remove_local_person(members[i]);
+
+	is_int(0, big->memberv.count, MSG);
+	is_int(0, big->locmemberv.count, MSG);
+	free_channel(big);
+}
+
 static void
 chmode_init(void)
 {
@@ -120,6 +248,8 @@ main(int argc, char *argv[])
 
 	test_chmode_parse();
 	test_chmode_limits();
+	test_ban_index();
+	test_member_index();
 
 	client_util_free();
 	ircd_util_free();
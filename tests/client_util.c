@@ -164,7 +164,7 @@ struct Client *make_remote_person_full(struct Client *server, const char *nick,
 	SetRemoteClient(client);
 
 	client->servptr = server;
-	rb_dlinkAdd(server, &server->lnode, &server->servptr->serv->users);
+	rb_dlinkAdd(client, &client->lnode, &client->servptr->serv->users);
 
 	rb_inet_pton_sock(ip, &addr);
 	rb_strlcpy(client->name, nick, sizeof(client->name));
@@ -175,6 +175,7 @@ struct Client *make_remote_person_full(struct Client *server, const char *nick,
 
 	add_to_client_hash(nick, client);
 	add_to_hostname_hash(client->host, client);
+	add_to_global_index(client);
 
 	return client;
 }
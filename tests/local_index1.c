@@ -0,0 +1,198 @@
+/*
+ *  local_index1.c: Test the local user IP and host suffix indexes
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "hash.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+/* connect and register a local user the way a socket would */
+static struct Client *
+connect_user(const char *nick, const char *ip, const char *host)
+{
+	struct Client *client = make_local_unknown();
+	char buf[BUFSIZE];
+
+	rb_dlinkAddTail(client, &client->node, &global_client_list);
+	rb_inet_pton_sock(ip, &client->localClient->ip);
+	rb_strlcpy(client->host, host, sizeof(client->host));
+	rb_inet_ntop_sock((struct sockaddr *)&client->localClient->ip, client->sockhost, sizeof(client->sockhost));
+
+	/* as if it had answered the ping cookie */
+	client->localClient->random_ping = 1;
+	client->flags |= FLAGS_PING_COOKIE;
+
+	snprintf(buf, sizeof(buf), "NICK %s" CRLF, nick);
+	client_util_parse(client, buf);
+	client_util_parse(client, "USER " TEST_USERNAME " 0 0 :" TEST_REALNAME CRLF);
+	ok(IsClient(client), MSG);
+
+	while(get_client_sendq(client)[0] != '\0')
+		;
+
+	return client;
+}
+
+/* how many times the client is in the results, -1 for none at all */
+static int
+count_found(rb_dlink_list *found, struct Client *client)
+{
+	rb_dlink_node *ptr, *nptr;
+	int n = 0;
+
+	if(rb_dlink_list_length(found) == 0)
+		n = -1;
+
+	RB_DLINK_FOREACH_SAFE(ptr, nptr, found->head)
+	{
+		if(ptr->data == client)
+			n++;
+		rb_dlinkDestroy(ptr, found);
+	}
+
+	return n;
+}
+
+static int
+by_ip(struct Client *client, const char *ip, int bits)
+{
+	struct rb_sockaddr_storage addr;
+	rb_dlink_list found = { NULL, NULL, 0 };
+
+	rb_inet_pton_sock(ip, &addr);
+	find_local_by_ip((struct sockaddr *)&addr, bits, &found);
+	return count_found(&found, client);
+}
+
+static int
+by_host(struct Client *client, const char *mask)
+{
+	rb_dlink_list found = { NULL, NULL, 0 };
+
+	if(!find_local_by_hostmask(mask, &found))
+		return -2;
+	return count_found(&found, client);
+}
+
+static void
+connect1(void)
+{
+	struct Client *user = connect_user("alpha", "2001:db8::1", "host.example.test");
+
+	is_int(1, by_ip(user, "2001:db8::1", 128), MSG);
+	is_int(1, by_ip(user, "2001:db8::", 64), MSG);
+	is_int(-1, by_ip(user, "2001:db9::", 64), MSG);
+
+	/* each whole label suffix, and the host itself */
+	is_int(1, by_host(user, "host.example.test"), MSG);
+	is_int(1, by_host(user, "*.example.test"), MSG);
+	is_int(1, by_host(user, "*.test"), MSG);
+	is_int(1, by_host(user, "*st.example.test"), MSG);
+	is_int(-1, by_host(user, "*.example.org"), MSG);
+
+	/* the IP text is a host too */
+	is_int(1, by_host(user, "2001:db8::1"), MSG);
+
+	/* nothing left to look up */
+	is_int(-2, by_host(user, "*"), MSG);
+	is_int(-2, by_host(user, "host.exa*"), MSG);
+
+	exit_client(NULL, user, &me, "Gone");
+}
+
+static void
+nick_change1(void)
+{
+	struct Client *user = connect_user("beta", "192.0.2.1", "beta.example.test");
+
+	client_util_parse(user, "NICK gamma" CRLF);
+	is_string("gamma", user->name, MSG);
+
+	/* still there, and only once */
+	is_int(1, by_ip(user, "192.0.2.1", 32), MSG);
+	is_int(1, by_ip(user, "192.0.2.0", 24), MSG);
+	is_int(1, by_host(user, "*.example.test"), MSG);
+	is_int(1, by_host(user, "beta.example.test"), MSG);
+
+	exit_client(NULL, user, &me, "Gone");
+}
+
+static void
+exit1(void)
+{
+	struct Client *user1 = connect_user("delta", "2001:db8::2", "shared.example.test");
+	struct Client *user2 = connect_user("epsilon", "2001:db8::2", "shared.example.test");
+
+	is_int(1, by_ip(user1, "2001:db8::2", 128), MSG);
+	is_int(1, by_ip(user2, "2001:db8::2", 128), MSG);
+	is_int(1, by_host(user1, "*.example.test"), MSG);
+	is_int(1, by_host(user2, "*.example.test"), MSG);
+
+	/* the other user on the same address and hosts stays */
+	exit_client(NULL, user1, &me, "Gone");
+	is_int(0, by_ip(user1, "2001:db8::2", 128), MSG);
+	is_int(1, by_ip(user2, "2001:db8::2", 128), MSG);
+	is_int(0, by_host(user1, "*.example.test"), MSG);
+	is_int(1, by_host(user2, "shared.example.test"), MSG);
+
+	/* and once the last one goes, so do the entries */
+	exit_client(NULL, user2, &me, "Gone");
+	is_int(-1, by_ip(user2, "2001:db8::", 32), MSG);
+	is_int(-1, by_host(user2, "*.example.test"), MSG);
+	is_int(-1, by_host(user2, "shared.example.test"), MSG);
+}
+
+static void
+tunnel1(void)
+{
+	/* 6to4 for 192.0.2.99 */
+	struct Client *user = connect_user("zeta", "2002:c000:263::1", "tunnel.example.test");
+
+	is_int(1, by_ip(user, "2002:c000:263::1", 128), MSG);
+	is_int(1, by_ip(user, "192.0.2.99", 32), MSG);
+	is_int(1, by_ip(user, "192.0.2.0", 24), MSG);
+
+	exit_client(NULL, user, &me, "Gone");
+	is_int(-1, by_ip(user, "192.0.2.0", 24), MSG);
+	is_int(-1, by_ip(user, "2002::", 16), MSG);
+}
+
+int main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	connect1();
+	nick_change1();
+	exit1();
+	tunnel1();
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ *  maskset1.c: Test compiled sets of match_esc() masks.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "client.h"
+#include "match.h"
+#include "maskset.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+struct Client me;
+
+static const char *masks[] = {
+	"*free\\sporn*",
+	"spambot*",
+	"*.example.com",
+	"??bot",
+	"exact",
+	"#@*",
+	"*",
+	"a\\*",
+	"x*\\*??",
+	"*mid*dle*",
+	"nick[away]",
+	NULL,
+};
+
+static void
+test_basic(void)
+{
+	struct maskset *set = maskset_create();
+	int i;
+
+	is_bool(true, maskset_find(set, "anything") == NULL, MSG);
+
+	for(i = 0; masks[i] != NULL; i++)
+		if(strcmp(masks[i], "*"))
+			maskset_add(set, masks[i], (void *)masks[i]);
+
+	is_string("*free\\sporn*", maskset_find(set, "get FREE porn now"), MSG);
+	is_bool(true, maskset_find(set, "get freeporn now") == NULL, MSG);
+	is_string("spambot*", maskset_find(set, "SpamBot 3000"), MSG);
+	is_bool(true, maskset_find(set, "a spambot") == NULL, MSG);
+	is_string("*.example.com", maskset_find(set, "host.example.com"), MSG);
+	is_bool(true, maskset_find(set, "host.example.com.au") == NULL, MSG);
+	is_string("??bot", maskset_find(set, "MYbot"), MSG);
+	is_bool(true, maskset_find(set, "mybots") == NULL, MSG);
+	is_string("exact", maskset_find(set, "EXACT"), MSG);
+	is_bool(true, maskset_find(set, "exactly") == NULL, MSG);
+	is_string("#@*", maskset_find(set, "1a"), MSG);
+	is_string("a\\*", maskset_find(set, "a*"), MSG);
+	/* match_esc() lets these through, so we must too */
+	is_string("a\\*", maskset_find(set, "a*bc"), MSG);
+	is_string("x*\\*??", maskset_find(set, "xy*zzzz"), MSG);
+	is_string("*mid*dle*", maskset_find(set, "amidstmiddle"), MSG);
+	is_string("nick[away]", maskset_find(set, "NICK{AWAY}"), MSG);
+
+	/* the most recently added match wins */
+	maskset_add(set, "*", (void *)"*");
+	is_string("*", maskset_find(set, "exact"), MSG);
+	maskset_del(set, (void *)"*");
+	is_string("exact", maskset_find(set, "exact"), MSG);
+
+	maskset_del(set, (void *)masks[4]);
+	is_bool(true, maskset_find(set, "exact") == NULL, MSG);
+
+	maskset_destroy(set);
+}
+
+/* masks and names from a small alphabet, so that they often match */
+static void
+random_string(char *buf, size_t max, const char *alphabet)
+{
+	size_t len = rand() % max, i, n = strlen(alphabet);
+
+	for(i = 0; i < len; i++)
+		buf[i] = alphabet[rand() % n];
+	if(len > 0 && buf[len - 1] == '\\')
+		len--;
+	buf[len] = '\0';
+}
+
+static void *
+linear_find(char masklist[][16], bool *live, int count, const char *name)
+{
+	int i;
+
+	for(i = count - 1; i >= 0; i--)
+		if(live[i] && match_esc(masklist[i], name))
+			return masklist[i];
+	return NULL;
+}
+
+static void
+test_random(void)
+{
+	static char masklist[2000][16];
+	static bool live[2000];
+	struct maskset *set = maskset_create();
+	char name[16];
+	int i, j, bad = 0, hits = 0;
+
+	srand(1);
+
+	for(i = 0; i < 2000; i++)
+	{
+		random_string(masklist[i], 10, "abAB*?*#@\\s1 ");
+		maskset_add(set, masklist[i], masklist[i]);
+		live[i] = true;
+
+		/* delete some along the way, both compiled and pending */
+		if(i > 0 && rand() % 4 == 0)
+		{
+			j = rand() % i;
+			maskset_del(set, masklist[j]);
+			live[j] = false;
+		}
+
+		for(j = 0; j < 10; j++)
+		{
+			void *want, *got;
+
+			random_string(name, 12, "abAB1 *?");
+			want = linear_find(masklist, live, i + 1, name);
+			got = maskset_find(set, name);
+			if(want != got)
+				bad++;
+			if(want != NULL)
+				hits++;
+		}
+	}
+
+	is_int(0, bad, MSG);
+	ok(hits > 1000, MSG);
+
+	maskset_destroy(set);
+}
+
+int
+main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	test_basic();
+	test_random();
+
+	return 0;
+}
@@ -2799,6 +2799,44 @@ static void para_no_origin_no_cmd_no_target(void)
 	}
 }
 
+static void cache_shared_tagset(void)
+{
+	struct MsgBuf msgbuf = {
+		.n_tags = 2,
+		.tags = {
+			{ .key = "tag1", .value = "value1", .capmask = 1 | 2 },
+			{ .key = "tag2", .value = "value2", .capmask = 4 },
+		},
+
+		.cmd = "PRIVMSG",
+		.origin = "origin",
+		.target = "#test",
+
+		.n_para = 3,
+		.para = { "PRIVMSG", "#test", "test" },
+	};
+	rb_strf_t strings = { .format = ":origin PRIVMSG #test :test", .format_args = NULL, .next = NULL };
+	struct MsgBuf_cache cache;
+	buf_head_t *buf1, *buf2;
+
+	msgbuf_cache_init(&cache, &msgbuf, &strings);
+
+	/* different caps selecting the same tags share a line */
+	buf1 = msgbuf_cache_get(&cache, 1);
+	buf2 = msgbuf_cache_get(&cache, 2);
+	is_bool(true, buf1 == buf2, MSG);
+	buf2 = msgbuf_cache_get(&cache, 2 | 8);
+	is_bool(true, buf1 == buf2, MSG);
+
+	buf2 = msgbuf_cache_get(&cache, 1 | 4);
+	is_bool(false, buf1 == buf2, MSG);
+	buf1 = msgbuf_cache_get(&cache, 0);
+	is_bool(false, buf1 == buf2, MSG);
+	is_bool(true, buf1 == msgbuf_cache_get(&cache, 8), MSG);
+
+	msgbuf_cache_free(&cache);
+}
+
 int main(int argc, char *argv[])
 {
 	memset(&me, 0, sizeof(me));
@@ -2943,6 +2981,10 @@ int main(int argc, char *argv[])
 	para_no_cmd_no_target();
 	para_no_origin_no_cmd_no_target();
 
+	rb_init_bh();
+	rb_linebuf_init(16);
+	cache_shared_tagset();
+
 	// TODO msgbuf_vunparse_fmt
 
 	return 0;
@@ -0,0 +1,304 @@
+/*
+ *  rb_commio1.c: Test the io_uring poller through commio.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "ircd_defs.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+static int reads, writes;
+
+static char stream_buf[64];
+static int stream_len, stream_eof;
+
+static ssize_t wrote_ret;
+static int wrote_calls, wrote_lines;
+static rb_fde_t *wrote_F;
+
+static void
+read_ready(rb_fde_t *F, void *data)
+{
+	char buf[16];
+
+	reads++;
+	is_int(5, rb_read(F, buf, sizeof(buf)), MSG);
+}
+
+static void
+write_ready(rb_fde_t *F, void *data)
+{
+	writes++;
+}
+
+static void
+iotype1(void)
+{
+	const char *iotype = rb_get_iotype();
+
+	/* a kernel without io_uring falls back to the usual order */
+	ok(!strcmp(iotype, "iouring") || !strcmp(iotype, "epoll"), MSG);
+	if(strcmp(iotype, "iouring"))
+		diag("io_uring unavailable, using %s", iotype);
+}
+
+static void
+readiness1(void)
+{
+	rb_fde_t *F1, *F2;
+	int i;
+
+	if(!ok(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1, &F2, "rb_commio1") == 0, MSG))
+		return;
+
+	/* nothing to read yet */
+	rb_setselect(F1, RB_SELECT_READ, read_ready, NULL);
+	rb_select(10);
+	is_int(0, reads, MSG);
+
+	is_int(5, rb_write(F2, "hello", 5), MSG);
+	for(i = 0; i < 10 && reads == 0; i++)
+		rb_select(100);
+	is_int(1, reads, MSG);
+
+	/* one-shot until asked again */
+	rb_write(F2, "again", 5);
+	rb_select(10);
+	is_int(1, reads, MSG);
+	rb_setselect(F1, RB_SELECT_READ, read_ready, NULL);
+	for(i = 0; i < 10 && reads == 1; i++)
+		rb_select(100);
+	is_int(2, reads, MSG);
+
+	/* a cleared interest is never reported */
+	rb_setselect(F1, RB_SELECT_READ, read_ready, NULL);
+	rb_setselect(F1, RB_SELECT_READ, NULL, NULL);
+	rb_write(F2, "third", 5);
+	rb_select(10);
+	is_int(2, reads, MSG);
+
+	rb_setselect(F2, RB_SELECT_WRITE, write_ready, NULL);
+	for(i = 0; i < 10 && writes == 0; i++)
+		rb_select(100);
+	is_int(1, writes, MSG);
+
+	rb_close(F1);
+	rb_close(F2);
+}
+
+static void
+stream_read(rb_fde_t *F, char *buf, int len, void *data)
+{
+	if(len <= 0)
+	{
+		stream_eof++;
+		return;
+	}
+	if(stream_len + len < (int)sizeof(stream_buf))
+	{
+		memcpy(stream_buf + stream_len, buf, len);
+		stream_len += len;
+	}
+}
+
+static void
+stream1(void)
+{
+	rb_fde_t *F1, *F2;
+	int i, old_reads = reads;
+
+	if(!ok(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1, &F2, "rb_commio1") == 0, MSG))
+		return;
+
+	if(rb_read_stream(F1, stream_read, NULL) != 0)
+	{
+		diag("stream reads unavailable, skipping");
+		rb_close(F1);
+		rb_close(F2);
+		return;
+	}
+
+	/* the stream stays armed across completions */
+	rb_write(F2, "hello", 5);
+	for(i = 0; i < 10 && stream_len < 5; i++)
+		rb_select(100);
+	rb_write(F2, "world", 5);
+	for(i = 0; i < 10 && stream_len < 10; i++)
+		rb_select(100);
+	is_int(10, stream_len, MSG);
+	ok(!memcmp(stream_buf, "helloworld", 10), MSG);
+	is_int(old_reads, reads, MSG);
+
+	/* nothing is delivered once stopped */
+	is_int(0, rb_read_stream(F1, NULL, NULL), MSG);
+	rb_select(10);
+	rb_write(F2, "x", 1);
+	rb_select(10);
+	is_int(10, stream_len, MSG);
+
+	/* EOF ends the stream */
+	is_int(0, rb_read_stream(F1, stream_read, NULL), MSG);
+	rb_select(10);
+	rb_close(F2);
+	for(i = 0; i < 10 && stream_eof == 0; i++)
+		rb_select(100);
+	is_int(1, stream_eof, MSG);
+
+	rb_close(F1);
+	rb_select(10);
+}
+
+static void
+wrote(rb_fde_t *F, ssize_t ret, void *data)
+{
+	wrote_calls++;
+	wrote_ret = ret;
+	wrote_F = F;
+}
+
+static void
+writev_async1(void)
+{
+	rb_fde_t *F1, *F2;
+	struct rb_iovec vec[2];
+	char buf[16];
+	int i;
+
+	if(!ok(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1, &F2, "rb_commio1") == 0, MSG))
+		return;
+
+	vec[0].iov_base = "ab";
+	vec[0].iov_len = 2;
+	vec[1].iov_base = "cd";
+	vec[1].iov_len = 2;
+
+	if(rb_writev_async(F1, vec, 2, wrote, NULL) != 0)
+	{
+		diag("async writes unavailable, skipping");
+		rb_close(F1);
+		rb_close(F2);
+		return;
+	}
+
+	/* one write at a time */
+	is_int(-1, rb_writev_async(F1, vec, 2, wrote, NULL), MSG);
+	is_int(0, wrote_calls, MSG);
+
+	for(i = 0; i < 10 && wrote_calls == 0; i++)
+		rb_select(100);
+	is_int(1, wrote_calls, MSG);
+	is_int(4, wrote_ret, MSG);
+	ok(wrote_F == F1, MSG);
+	is_int(4, rb_read(F2, buf, sizeof(buf)), MSG);
+	ok(!memcmp(buf, "abcd", 4), MSG);
+
+	/* a write queued before close still goes out, but is disowned */
+	is_int(0, rb_writev_async(F1, vec, 1, wrote, NULL), MSG);
+	rb_close(F1);
+	for(i = 0; i < 10 && wrote_calls == 1; i++)
+		rb_select(100);
+	is_int(2, wrote_calls, MSG);
+	ok(wrote_F == NULL, MSG);
+	is_int(2, rb_read(F2, buf, sizeof(buf)), MSG);
+
+	rb_close(F2);
+}
+
+static void
+flushed(rb_fde_t *F, int ret, int lines, void *data)
+{
+	wrote_calls++;
+	wrote_ret = ret;
+	wrote_lines = lines;
+}
+
+static void
+linebuf_async1(void)
+{
+	rb_fde_t *F1, *F2;
+	buf_head_t bh;
+	rb_strf_t line1 = { .format = "one" }, line2 = { .format = "two" };
+	char buf[32];
+	int i;
+
+	if(!ok(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1, &F2, "rb_commio1") == 0, MSG))
+		return;
+
+	rb_linebuf_newbuf(&bh);
+	rb_linebuf_put(&bh, &line1);
+	rb_linebuf_put(&bh, &line2);
+
+	wrote_calls = 0;
+	if(!rb_linebuf_flush_async(F1, &bh, flushed, NULL))
+	{
+		diag("async writes unavailable, skipping");
+		rb_linebuf_donebuf(&bh);
+		rb_close(F1);
+		rb_close(F2);
+		return;
+	}
+
+	/* the queue is left alone until the write completes */
+	is_int(1, rb_linebuf_flush_async(F1, &bh, flushed, NULL), MSG);
+	is_int(-1, rb_linebuf_flush(F1, &bh), MSG);
+	is_int(10, rb_linebuf_len(&bh), MSG);
+
+	for(i = 0; i < 10 && wrote_calls == 0; i++)
+		rb_select(100);
+	is_int(1, wrote_calls, MSG);
+	is_int(10, wrote_ret, MSG);
+	is_int(2, wrote_lines, MSG);
+	is_int(0, rb_linebuf_len(&bh), MSG);
+	is_int(10, rb_read(F2, buf, sizeof(buf)), MSG);
+	ok(!memcmp(buf, "one\r\ntwo\r\n", 10), MSG);
+
+	/* tearing the queue down under a write keeps the lines alive */
+	rb_linebuf_put(&bh, &line1);
+	is_int(1, rb_linebuf_flush_async(F1, &bh, flushed, NULL), MSG);
+	rb_linebuf_donebuf(&bh);
+	for(i = 0; i < 10; i++)
+		rb_select(10);
+	is_int(1, wrote_calls, MSG);
+	is_int(5, rb_read(F2, buf, sizeof(buf)), MSG);
+	ok(!memcmp(buf, "one\r\n", 5), MSG);
+
+	rb_close(F1);
+	rb_close(F2);
+}
+
+int main(int argc, char *argv[])
+{
+	setenv("LIBRB_USE_IOTYPE", "iouring", 1);
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+	rb_linebuf_init(LINEBUF_HEAP_SIZE);
+
+	plan_lazy();
+
+	iotype1();
+	readiness1();
+	stream1();
+	writev_async1();
+	linebuf_async1();
+
+	return 0;
+}
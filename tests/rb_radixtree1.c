@@ -0,0 +1,135 @@
+/*
+ *  rb_radixtree1.c: Test rb_radixtree
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "ircd_defs.h"
+#include "client.h"
+#include "rb_radixtree.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define NKEYS 500
+
+static const char *keys[] = {
+	"a", "ab", "abc", "abd", "b", "ba", "bb", "nick", "nick_", "nick__", "nickname", "zz",
+};
+
+/* the first key at or after key, by brute force */
+static const char *
+expect_from(const char **set, int n, const char *key)
+{
+	const char *best = NULL;
+	int i;
+
+	for(i = 0; i < n; i++)
+		if(strcmp(set[i], key) >= 0 && (best == NULL || strcmp(set[i], best) < 0))
+			best = set[i];
+
+	return best;
+}
+
+static const char *
+start_from(rb_radixtree *tree, const char *key)
+{
+	rb_radixtree_iteration_state iter;
+
+	rb_radixtree_foreach_start_from(tree, &iter, key);
+	return rb_radixtree_foreach_cur(tree, &iter);
+}
+
+static void
+from_fixed1(void)
+{
+	rb_radixtree *tree = rb_radixtree_create("from_fixed1", NULL);
+	size_t i;
+
+	for(i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+		rb_radixtree_add(tree, keys[i], (void *)keys[i]);
+
+	is_string("abc", start_from(tree, "abc"), MSG);
+	is_string("abd", start_from(tree, "abca"), MSG);
+	is_string("b", start_from(tree, "abz"), MSG);
+	is_string("nick", start_from(tree, "ni"), MSG);
+	is_string("nick_", start_from(tree, "nick!"), MSG);
+	is_string("nickname", start_from(tree, "nick___"), MSG);
+	is_string("a", start_from(tree, ""), MSG);
+	ok(start_from(tree, "zzz") == NULL, MSG);
+}
+
+static void
+from_random1(void)
+{
+	rb_radixtree *tree = rb_radixtree_create("from_random1", NULL);
+	static char store[NKEYS][8];
+	const char *set[NKEYS];
+	int i, n = 0, bad = 0;
+
+	srand(1);
+	for(i = 0; i < NKEYS; i++)
+	{
+		int j, len = 1 + rand() % 6;
+
+		for(j = 0; j < len; j++)
+			store[i][j] = 'a' + rand() % 4;
+		store[i][len] = '\0';
+
+		if(rb_radixtree_retrieve(tree, store[i]) == NULL)
+		{
+			rb_radixtree_add(tree, store[i], store[i]);
+			set[n++] = store[i];
+		}
+	}
+
+	for(i = 0; i < 2000; i++)
+	{
+		char probe[8];
+		int j, len = rand() % 7;
+		const char *want, *got;
+
+		for(j = 0; j < len; j++)
+			probe[j] = 'a' + rand() % 5;
+		probe[len] = '\0';
+
+		want = expect_from(set, n, probe);
+		got = start_from(tree, probe);
+
+		if(want != got && (want == NULL || got == NULL || strcmp(want, got)))
+			bad++;
+	}
+
+	is_int(0, bad, MSG);
+}
+
+int main(int argc, char *argv[])
+{
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+	rb_linebuf_init(LINEBUF_HEAP_SIZE);
+
+	plan_lazy();
+
+	from_fixed1();
+	from_random1();
+
+	return 0;
+}
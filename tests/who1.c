@@ -0,0 +1,214 @@
+/*
+ *  who1.c: Test WHO
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "s_serv.h"
+#include "s_conf.h"
+#include "s_user.h"
+#include "hash.h"
+#include "privilege.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+static struct Client *user;
+static struct Client *server, *server2;
+
+/* the nicks in a WHO reply, sorted, up to RPL_ENDOFWHO */
+static const char *
+who_nicks(const char *command)
+{
+	static char result[BUFSIZE];
+	char *nicks[16];
+	const char *line;
+	int n = 0, i, j;
+
+	client_util_parse(user, command);
+
+	result[0] = '\0';
+	while((line = get_client_sendq(user)) && strcmp(line, ""))
+	{
+		const char *nick;
+
+		if(strstr(line, " 315 ") != NULL)
+			break;
+
+		if(strstr(line, " 354 ") == NULL || (nick = strrchr(line, ' ')) == NULL || n == 16)
+			continue;
+
+		nicks[n] = rb_strdup(nick + 1);
+		nicks[n][strcspn(nicks[n], "\r\n")] = '\0';
+		n++;
+	}
+
+	for(i = 0; i < n; i++)
+		for(j = i + 1; j < n; j++)
+			if(strcmp(nicks[j], nicks[i]) < 0)
+			{
+				char *tmp = nicks[i];
+				nicks[i] = nicks[j];
+				nicks[j] = tmp;
+			}
+
+	for(i = 0; i < n; i++)
+	{
+		rb_snprintf_append(result, sizeof(result), "%s%s", i ? " " : "", nicks[i]);
+		rb_free(nicks[i]);
+	}
+
+	return result;
+}
+
+static void
+setup(void)
+{
+	user = make_local_person();
+	make_local_person_oper(user);
+
+	/* opers are not paced */
+	privilegeset_unref(user->user->privset);
+	user->user->privset = privilegeset_ref(privilegeset_set_new("who1", "oper:general", 0));
+
+	server = make_remote_server_name(&me, TEST_SERVER_NAME);
+	server2 = make_remote_server_name(&me, TEST_SERVER2_NAME);
+
+	make_remote_person_full(server, "alpha1", "a1", "one.test", "192.0.2.1", "First");
+	make_remote_person_full(server2, "alpha2", "a2", "two.test", "192.0.2.2", "Second");
+	make_remote_person_full(server, "beta1", "b1", "three.test", "198.51.100.1", "alpha person");
+	make_remote_person_full(server2, "gamma1", "g1", "four.test", "2001:db8::1", "Fourth");
+}
+
+static void
+who_nick_prefix1(void)
+{
+	is_string("alpha1 alpha2", who_nicks("WHO alpha* n%n" CRLF), MSG);
+	is_string("alpha1", who_nicks("WHO ALPHA1* n%n" CRLF), MSG);
+	is_string("", who_nicks("WHO omega* n%n" CRLF), MSG);
+	is_string("alpha1 alpha2", who_nicks("WHO al?ha* n%n" CRLF), MSG);
+}
+
+static void
+who_fields1(void)
+{
+	is_string("beta1", who_nicks("WHO alpha* r%n" CRLF), MSG);
+	is_string("alpha2", who_nicks("WHO two.test h%n" CRLF), MSG);
+	is_string("alpha1 alpha2", who_nicks("WHO 192.0.2.0/24 i%n" CRLF), MSG);
+	is_string("alpha1 alpha2 beta1", who_nicks("WHO alpha* nr%n" CRLF), MSG);
+
+	/* without the indexes, every field but the IP */
+	ConfigFileEntry.who_indexes = 0;
+	rehash_global_index();
+
+	is_string("alpha1 alpha2 beta1", who_nicks("WHO alpha* %n" CRLF), MSG);
+	is_string("", who_nicks("WHO 192.0.2.0/24 %n" CRLF), MSG);
+	is_string("alpha2", who_nicks("WHO *o.test %n" CRLF), MSG);
+	is_string("alpha1 alpha2", who_nicks("WHO 192.0.2.0/24 i%n" CRLF), MSG);
+
+	ConfigFileEntry.who_indexes = 1;
+	rehash_global_index();
+}
+
+static void
+who_shape1(void)
+{
+	/* a literal start is a nick */
+	is_string("alpha1 alpha2", who_nicks("WHO alpha* %n" CRLF), MSG);
+	is_string("beta1", who_nicks("WHO b?ta1 %n" CRLF), MSG);
+
+	/* an address, network or address prefix is an IP */
+	is_string("alpha1 alpha2", who_nicks("WHO 192.0.2.0/24 %n" CRLF), MSG);
+	is_string("alpha1 alpha2", who_nicks("WHO 192.0.2.* %n" CRLF), MSG);
+	is_string("alpha1 alpha2", who_nicks("WHO 192.0.* %n" CRLF), MSG);
+	is_string("alpha2", who_nicks("WHO 192.0.2.2 %n" CRLF), MSG);
+	is_string("beta1", who_nicks("WHO 198.51.100.? %n" CRLF), MSG);
+	is_string("", who_nicks("WHO 203.0.113.* %n" CRLF), MSG);
+	is_string("gamma1", who_nicks("WHO 2001:db8:* %n" CRLF), MSG);
+	is_string("gamma1", who_nicks("WHO 2001:db8::* %n" CRLF), MSG);
+	is_string("gamma1", who_nicks("WHO 2001:db8::/32 %n" CRLF), MSG);
+	is_string("", who_nicks("WHO 2001:db9:* %n" CRLF), MSG);
+
+	/* a host with a literal end is a host or server */
+	is_string("alpha2", who_nicks("WHO *o.test %n" CRLF), MSG);
+	is_string("alpha2", who_nicks("WHO two.test %n" CRLF), MSG);
+	is_string("alpha1 beta1", who_nicks("WHO *e.test %n" CRLF), MSG);
+	is_string("alpha1 alpha2 beta1 gamma1", who_nicks("WHO *.test h%n" CRLF), MSG);
+	is_string("alpha2 gamma1", who_nicks("WHO " TEST_SERVER2_NAME " %n" CRLF), MSG);
+	is_string("alpha2 gamma1", who_nicks("WHO *2.test %n" CRLF), MSG);
+	is_string("", who_nicks("WHO *.example %n" CRLF), MSG);
+
+	/* and anything else is everything */
+	is_string("beta1", who_nicks("WHO *person %n" CRLF), MSG);
+}
+
+static void
+who_index_upkeep1(void)
+{
+	struct Client *delta = make_remote_person_full(server, "delta1", "d1", "five.test", "203.0.113.5", "Fifth");
+
+	is_string("delta1", who_nicks("WHO 203.0.113.* %n" CRLF), MSG);
+	is_string("delta1", who_nicks("WHO *ive.test %n" CRLF), MSG);
+
+	change_nick_user_host(delta, "delta1", "d1", "moved.example", 0, "Moved");
+	is_string("delta1", who_nicks("WHO *.example %n" CRLF), MSG);
+	is_string("", who_nicks("WHO *ive.test %n" CRLF), MSG);
+
+	exit_client(NULL, delta, delta->servptr, "Test client removed");
+	is_string("", who_nicks("WHO 203.0.113.* %n" CRLF), MSG);
+	is_string("", who_nicks("WHO *.example %n" CRLF), MSG);
+}
+
+static void
+who_server1(void)
+{
+	is_string("alpha2 gamma1", who_nicks("WHO " TEST_SERVER2_NAME " s%n" CRLF), MSG);
+	is_string("alpha1 alpha2 beta1 gamma1", who_nicks("WHO remote* s%n" CRLF), MSG);
+}
+
+static void
+who_everyone1(void)
+{
+	is_string("alpha1 alpha2 beta1 gamma1 " TEST_NICK, who_nicks("WHO 0 %n" CRLF), MSG);
+}
+
+int main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	setup();
+
+	who_nick_prefix1();
+	who_fields1();
+	who_shape1();
+	who_index_upkeep1();
+	who_server1();
+	who_everyone1();
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
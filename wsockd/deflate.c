@@ -0,0 +1,424 @@
+/*
+ *  deflate.c: permessage-deflate (RFC 7692) for wsockd
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+/*
+ * Server to client messages are compressed.  A connection that keeps its
+ * context between messages has its own compressor; the others all share
+ * one, reset after every message.  Clients are always told not to keep
+ * their context, so their messages are inflated by a single shared
+ * decompressor as well.
+ *
+ * Any message may be sent uncompressed, which is how the memory cap and
+ * the cpu budget are enforced once a connection has compression: a
+ * message the compressor never saw cannot be referred to later.
+ */
+
+#include "stdinc.h"
+#include "deflate.h"
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+
+#define PMD_NAME		"permessage-deflate"
+#define PMD_MIN_WINDOW		9	/* zlib cannot make raw 8 bit windows */
+#define PMD_MAX_WINDOW		15
+#define PMD_MIN_MESSAGE		32	/* not worth compressing below this */
+#define PMD_MAX_INFLATE		65536	/* per message, from the client */
+
+struct ws_deflate
+{
+	z_stream *zs;		/* NULL: the shared compressor */
+	int window_bits;
+	bool context_takeover;
+	size_t memory;
+};
+
+static struct ws_deflate_conf conf;
+
+static z_stream shared_zs;
+static int shared_window_bits;	/* 0 until shared_zs is set up */
+static z_stream inflate_zs;
+static bool inflate_ready;
+
+static size_t memory_used;
+
+static time_t budget_second;
+static uint64_t budget_spent_us;
+
+static const uint8_t pmd_tail[4] = { 0x00, 0x00, 0xff, 0xff };
+
+/* smaller windows get smaller hash tables too */
+static int
+mem_level(int window_bits)
+{
+	int level = window_bits - 7;
+
+	return level > MAX_MEM_LEVEL ? MAX_MEM_LEVEL : level;
+}
+
+/* zlib's own estimate, see zconf.h */
+static size_t
+deflate_memory(int window_bits)
+{
+	return (1 << (window_bits + 2)) + (1 << (mem_level(window_bits) + 9)) + sizeof(z_stream) + 6 * 1024;
+}
+
+static bool
+zs_init(z_stream *zs, int window_bits)
+{
+	memset(zs, 0, sizeof(*zs));
+	return deflateInit2(zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -window_bits,
+			mem_level(window_bits), Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+void
+ws_deflate_configure(const struct ws_deflate_conf *newconf)
+{
+	conf = *newconf;
+
+	if(conf.window_bits < PMD_MIN_WINDOW)
+		conf.window_bits = PMD_MIN_WINDOW;
+	if(conf.window_bits > PMD_MAX_WINDOW)
+		conf.window_bits = PMD_MAX_WINDOW;
+
+	/* set up again with the new window when next needed */
+	if(shared_window_bits != 0 && shared_window_bits != conf.window_bits)
+	{
+		deflateEnd(&shared_zs);
+		shared_window_bits = 0;
+	}
+}
+
+static bool
+over_budget(void)
+{
+	if(conf.cpu_ms == 0)
+		return false;
+
+	if(budget_second != rb_current_time())
+	{
+		budget_second = rb_current_time();
+		budget_spent_us = 0;
+	}
+
+	return budget_spent_us >= (uint64_t) conf.cpu_ms * 1000;
+}
+
+static uint64_t
+now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * parse_offer: reads the parameters of one permessage-deflate offer, up to
+ * the next ',' or the end.  Returns false for parameters we do not know,
+ * as the offer must then be declined.
+ */
+static bool
+parse_offer(const char *p, const char *end, int *server_window, bool *server_no_takeover)
+{
+	*server_window = PMD_MAX_WINDOW;
+	*server_no_takeover = false;
+
+	while(p < end)
+	{
+		char name[32], value[8];
+		size_t nlen = 0, vlen = 0;
+
+		while(p < end && (*p == ';' || *p == ' ' || *p == '\t'))
+			p++;
+		if(p == end)
+			break;
+
+		while(p < end && *p != '=' && *p != ';' && *p != ' ' && *p != '\t')
+		{
+			if(nlen + 1 < sizeof(name))
+				name[nlen++] = *p;
+			p++;
+		}
+		name[nlen] = '\0';
+
+		while(p < end && (*p == ' ' || *p == '\t'))
+			p++;
+		if(p < end && *p == '=')
+		{
+			p++;
+			while(p < end && (*p == ' ' || *p == '\t' || *p == '"'))
+				p++;
+			while(p < end && *p != ';' && *p != ' ' && *p != '\t' && *p != '"')
+			{
+				if(vlen + 1 < sizeof(value))
+					value[vlen++] = *p;
+				p++;
+			}
+			while(p < end && *p == '"')
+				p++;
+		}
+		value[vlen] = '\0';
+
+		if(!strcmp(name, "server_no_context_takeover"))
+			*server_no_takeover = true;
+		else if(!strcmp(name, "server_max_window_bits"))
+		{
+			*server_window = atoi(value);
+			if(*server_window < 8 || *server_window > PMD_MAX_WINDOW)
+				return false;
+		}
+		else if(!strcmp(name, "client_no_context_takeover"))
+			;
+		else if(!strcmp(name, "client_max_window_bits"))
+			;	/* we inflate with the largest window anyway */
+		else
+			return false;
+	}
+
+	return true;
+}
+
+struct ws_deflate *
+ws_deflate_negotiate(const char *offers, char *reply, size_t replylen)
+{
+	const char *p = offers;
+
+	if(!conf.enabled)
+		return NULL;
+
+	while(*p != '\0')
+	{
+		const char *end = strchr(p, ',');
+		const char *params;
+		int server_window;
+		bool server_no_takeover;
+
+		if(end == NULL)
+			end = p + strlen(p);
+
+		while(*p == ' ' || *p == '\t')
+			p++;
+
+		params = p + strlen(PMD_NAME);
+		if(end - p >= (ptrdiff_t) strlen(PMD_NAME) && !strncasecmp(p, PMD_NAME, strlen(PMD_NAME)) &&
+		   (params == end || *params == ';' || *params == ' ' || *params == '\t') &&
+		   parse_offer(params, end, &server_window, &server_no_takeover) &&
+		   server_window >= PMD_MIN_WINDOW)
+		{
+			struct ws_deflate *d;
+			int window_bits = server_window < conf.window_bits ? server_window : conf.window_bits;
+			bool takeover = conf.context_takeover && !server_no_takeover;
+			size_t memory = 0;
+
+			/* the shared compressor only does the configured window */
+			if(takeover || window_bits != conf.window_bits)
+			{
+				memory = deflate_memory(window_bits);
+				if(memory_used + memory > conf.memory)
+					return NULL;
+			}
+
+			d = rb_malloc(sizeof(struct ws_deflate));
+			d->window_bits = window_bits;
+			d->context_takeover = takeover;
+			if(memory != 0)
+			{
+				d->zs = rb_malloc(sizeof(z_stream));
+				if(!zs_init(d->zs, window_bits))
+				{
+					rb_free(d->zs);
+					rb_free(d);
+					return NULL;
+				}
+				d->memory = memory;
+				memory_used += memory;
+			}
+
+			snprintf(reply, replylen, PMD_NAME "; client_no_context_takeover%s",
+				 takeover ? "" : "; server_no_context_takeover");
+			if(window_bits < PMD_MAX_WINDOW)
+				rb_snprintf_append(reply, replylen, "; server_max_window_bits=%d", window_bits);
+			return d;
+		}
+
+		p = *end == ',' ? end + 1 : end;
+	}
+
+	return NULL;
+}
+
+void
+ws_deflate_free(struct ws_deflate *d)
+{
+	if(d == NULL)
+		return;
+
+	if(d->zs != NULL)
+	{
+		deflateEnd(d->zs);
+		rb_free(d->zs);
+		memory_used -= d->memory;
+	}
+	rb_free(d);
+}
+
+size_t
+ws_deflate_bound(size_t len)
+{
+	/* deflateBound()'s general case, plus the sync flush marker */
+	return len + ((len + 7) >> 3) + ((len + 63) >> 6) + 5 + 6;
+}
+
+ssize_t
+ws_deflate_message(struct ws_deflate *d, const void *in, size_t len, void *out, size_t outlen)
+{
+	z_stream *zs = d->zs;
+	uint64_t start;
+	size_t produced;
+	int ret;
+
+	if(!conf.enabled || len < PMD_MIN_MESSAGE || outlen < ws_deflate_bound(len) || over_budget())
+		return -1;
+
+	if(zs == NULL)
+	{
+		if(d->window_bits != conf.window_bits)
+			return -1;	/* negotiated before a rehash */
+		if(shared_window_bits == 0)
+		{
+			if(!zs_init(&shared_zs, conf.window_bits))
+				return -1;
+			shared_window_bits = conf.window_bits;
+		}
+		zs = &shared_zs;
+	}
+
+	start = now_us();
+
+	zs->next_in = (Bytef *) in;
+	zs->avail_in = len;
+	zs->next_out = out;
+	zs->avail_out = outlen;
+	ret = deflate(zs, Z_SYNC_FLUSH);
+	produced = outlen - zs->avail_out;
+
+	if(!d->context_takeover)
+		deflateReset(zs);
+
+	budget_spent_us += now_us() - start;
+
+	if(ret != Z_OK || zs->avail_in != 0 || zs->avail_out == 0 || produced < sizeof(pmd_tail))
+	{
+		/* the client never sees any of this, so start over clean */
+		deflateReset(zs);
+		return -1;
+	}
+
+	produced -= sizeof(pmd_tail);
+
+	/* without shared context, the client does not need to see it */
+	if(!d->context_takeover && produced >= len)
+		return -1;
+
+	return produced;
+}
+
+bool
+ws_inflate_message(const void *in, size_t len, ws_inflate_cb *cb, void *data)
+{
+	char out[16384];
+	size_t total = 0;
+	int pass, ret = Z_OK;
+
+	if(!inflate_ready)
+	{
+		memset(&inflate_zs, 0, sizeof(inflate_zs));
+		if(inflateInit2(&inflate_zs, -PMD_MAX_WINDOW) != Z_OK)
+			return false;
+		inflate_ready = true;
+	}
+	else
+		inflateReset(&inflate_zs);
+
+	for(pass = 0; pass < 2; pass++)
+	{
+		inflate_zs.next_in = pass == 0 ? (Bytef *) in : (Bytef *) pmd_tail;
+		inflate_zs.avail_in = pass == 0 ? len : sizeof(pmd_tail);
+
+		do
+		{
+			inflate_zs.next_out = (Bytef *) out;
+			inflate_zs.avail_out = sizeof(out);
+			ret = inflate(&inflate_zs, Z_SYNC_FLUSH);
+			if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+				return false;
+
+			total += sizeof(out) - inflate_zs.avail_out;
+			if(total > PMD_MAX_INFLATE)
+				return false;
+			if(inflate_zs.avail_out != sizeof(out))
+				cb(data, out, sizeof(out) - inflate_zs.avail_out);
+		}
+		while(inflate_zs.avail_out == 0 && ret != Z_STREAM_END);
+
+		if(ret == Z_STREAM_END)
+			break;
+	}
+
+	return true;
+}
+
+#else /* !HAVE_LIBZ */
+
+void
+ws_deflate_configure(const struct ws_deflate_conf *conf)
+{
+}
+
+struct ws_deflate *
+ws_deflate_negotiate(const char *offers, char *reply, size_t replylen)
+{
+	return NULL;
+}
+
+void
+ws_deflate_free(struct ws_deflate *d)
+{
+}
+
+size_t
+ws_deflate_bound(size_t len)
+{
+	return 0;
+}
+
+ssize_t
+ws_deflate_message(struct ws_deflate *d, const void *in, size_t len, void *out, size_t outlen)
+{
+	return -1;
+}
+
+bool
+ws_inflate_message(const void *in, size_t len, ws_inflate_cb *cb, void *data)
+{
+	return false;
+}
+
+#endif /* HAVE_LIBZ */
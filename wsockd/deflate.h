@@ -0,0 +1,57 @@
+/*
+ *  deflate.h: permessage-deflate (RFC 7692) for wsockd
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#ifndef WSOCKD_DEFLATE_H
+#define WSOCKD_DEFLATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct ws_deflate;
+
+struct ws_deflate_conf
+{
+	bool enabled;
+	int window_bits;	/* 9 to 15 */
+	bool context_takeover;
+	size_t memory;		/* cap on compressor memory, all connections */
+	unsigned int cpu_ms;	/* compression time allowed per second, 0 for any */
+};
+
+typedef void ws_inflate_cb(void *data, const char *buf, size_t len);
+
+void ws_deflate_configure(const struct ws_deflate_conf *conf);
+
+/* returns NULL if none of the offers in the Sec-WebSocket-Extensions
+ * value can be accepted, else fills in the reply value */
+struct ws_deflate *ws_deflate_negotiate(const char *offers, char *reply, size_t replylen);
+void ws_deflate_free(struct ws_deflate *d);
+
+/* worst case output of ws_deflate_message() for len bytes */
+size_t ws_deflate_bound(size_t len);
+
+/* returns the compressed length, or -1 if the message is to be sent as is */
+ssize_t ws_deflate_message(struct ws_deflate *d, const void *in, size_t len, void *out, size_t outlen);
+
+/* returns false if the message is corrupt or inflates to too much */
+bool ws_inflate_message(const void *in, size_t len, ws_inflate_cb *cb, void *data);
+
+#endif
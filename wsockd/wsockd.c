@@ -22,6 +22,7 @@
 
 #include "stdinc.h"
 #include "sha1.h"
+#include "deflate.h"
 
 #define MAXPASSFD 4
 #ifndef READBUF_SIZE
@@ -31,6 +32,14 @@
 #define WEBSOCKET_SERVER_KEY "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
 #define WEBSOCKET_ANSWER_STRING_1 "HTTP/1.1 101 Switching Protocols\r\nAccess-Control-Allow-Origin: *\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: "
 #define WEBSOCKET_ANSWER_STRING_2 "\r\n\r\n"
+#define WEBSOCKET_ANSWER_PROTOCOL "\r\nSec-WebSocket-Protocol: "
+#define WEBSOCKET_ANSWER_EXTENSIONS "\r\nSec-WebSocket-Extensions: "
+
+/*
+ * subprotocol a client offers to say it splits frames on CRLF itself, so
+ * several lines may be sent in one frame
+ */
+#define WEBSOCKET_PROTOCOL_COALESCE "irc.coalesce"
 
 static void setup_signals(void);
 static pid_t ppid;
@@ -93,6 +102,8 @@ typedef struct _conn
 	uint8_t flags;
 
 	char client_key[37];		/* maximum 36 bytes + nul */
+	struct ws_deflate *deflate;	/* permessage-deflate, if negotiated */
+	char *deflate_reply;
 } conn_t;
 
 #define WEBSOCKET_OPCODE_TEXT_FRAME          1
@@ -143,6 +154,20 @@ ws_frame_set_fin(ws_frame_hdr_t *header, int fin)
 	header->opcode_rsv_fin |= (fin << 7) & (0x1 << 7);
 }
 
+/* rsv1 marks a compressed message under permessage-deflate */
+static inline void
+ws_frame_set_rsv1(ws_frame_hdr_t *header, int rsv1)
+{
+	header->opcode_rsv_fin &= ~(0x1 << 6);
+	header->opcode_rsv_fin |= (rsv1 << 6) & (0x1 << 6);
+}
+
+static inline int
+ws_frame_get_rsv1(const ws_frame_hdr_t *header)
+{
+	return (header->opcode_rsv_fin >> 6) & 0x1;
+}
+
 static void close_conn(conn_t * conn, int wait_plain, const char *fmt, ...);
 static void conn_mod_read_cb(rb_fde_t *fd, void *data);
 static void conn_plain_read_cb(rb_fde_t *fd, void *data);
@@ -152,15 +177,18 @@ static void conn_plain_process_recvq(conn_t *conn);
 #define FLAG_DEAD	0x02
 #define FLAG_WSOCK	0x04
 #define FLAG_KEYED	0x08
+#define FLAG_COALESCE	0x10
 
 #define IsCork(x) ((x)->flags & FLAG_CORK)
 #define IsDead(x) ((x)->flags & FLAG_DEAD)
 #define IsKeyed(x) ((x)->flags & FLAG_KEYED)
+#define IsCoalesce(x) ((x)->flags & FLAG_COALESCE)
 
 #define SetCork(x) ((x)->flags |= FLAG_CORK)
 #define SetDead(x) ((x)->flags |= FLAG_DEAD)
 #define SetWS(x)   ((x)->flags |= FLAG_WSOCK)
 #define SetKeyed(x) ((x)->flags |= FLAG_KEYED)
+#define SetCoalesce(x) ((x)->flags |= FLAG_COALESCE)
 
 #define ClearCork(x) ((x)->flags &= ~FLAG_CORK)
 
@@ -238,6 +266,8 @@ free_conn(conn_t * conn)
 	rb_free_rawbuffer(conn->modbuf_in);
 	rb_free_rawbuffer(conn->modbuf_out);
 
+	ws_deflate_free(conn->deflate);
+	rb_free(conn->deflate_reply);
 	rb_free(conn);
 }
 
@@ -322,48 +352,71 @@ conn_mod_write(conn_t * conn, void *data, size_t len)
 	rb_rawbuf_append(conn->modbuf_out, data, len);
 }
 
+/*
+ * conn_mod_writev: writes straight from the caller's buffers when nothing
+ * is queued ahead, and queues only what the socket did not take
+ */
 static void
-conn_mod_write_short_frame(conn_t * conn, void *data, int len)
+conn_mod_writev(conn_t *conn, struct rb_iovec *vec, int count)
 {
-	ws_frame_hdr_t hdr = WEBSOCKET_FRAME_HDR_INIT;
+	ssize_t ret = 0;
+	int i;
+
+	if(IsDead(conn))	/* no point in queueing to a dead man */
+		return;
 
-	ws_frame_set_opcode(&hdr, WEBSOCKET_OPCODE_TEXT_FRAME);
-	ws_frame_set_fin(&hdr, 1);
-	hdr.payload_length_mask = (len + 2) & 0x7f;
+	if(rb_rawbuf_length(conn->modbuf_out) == 0)
+	{
+		ret = rb_writev(conn->mod_fd, vec, count);
+		if(ret < 0)
+		{
+			if(!rb_ignore_errno(errno))
+			{
+				close_conn(conn, WAIT_PLAIN, "Write error: %s", strerror(errno));
+				return;
+			}
+			ret = 0;
+		}
+		conn->mod_out += ret;
+	}
 
-	conn_mod_write(conn, &hdr, sizeof(hdr));
-	conn_mod_write(conn, data, len);
-	conn_mod_write(conn, "\r\n", 2);
+	for(i = 0; i < count; i++)
+	{
+		if((size_t) ret >= vec[i].iov_len)
+		{
+			ret -= vec[i].iov_len;
+			continue;
+		}
+
+		rb_rawbuf_append(conn->modbuf_out, (char *) vec[i].iov_base + ret, vec[i].iov_len - ret);
+		ret = 0;
+	}
 }
 
-static void
-conn_mod_write_long_frame(conn_t * conn, void *data, int len)
+/*
+ * ws_frame_header: fills in the header of an unmasked text frame carrying
+ * len bytes, which is never 64KB or more, and returns its length
+ */
+static size_t
+ws_frame_header(uint8_t *buf, size_t len, int compressed)
 {
 	ws_frame_ext_t hdr = WEBSOCKET_FRAME_EXT_INIT;
 
 	ws_frame_set_opcode(&hdr.header, WEBSOCKET_OPCODE_TEXT_FRAME);
 	ws_frame_set_fin(&hdr.header, 1);
-	hdr.header.payload_length_mask = 126;
-	hdr.payload_length_extended = htons(len + 2);
-
-	conn_mod_write(conn, &hdr, sizeof(hdr));
-	conn_mod_write(conn, data, len);
-	conn_mod_write(conn, "\r\n", 2);
-}
-
-static void
-conn_mod_write_frame(conn_t *conn, void *data, int len)
-{
-	if(IsDead(conn))	/* no point in queueing to a dead man */
-		return;
+	ws_frame_set_rsv1(&hdr.header, compressed);
 
-	if (len < 123)
+	if(len <= WEBSOCKET_MAX_UNEXTENDED_PAYLOAD_DATA_LENGTH)
 	{
-		conn_mod_write_short_frame(conn, data, len);
-		return;
+		hdr.header.payload_length_mask = len & 0x7f;
+		memcpy(buf, &hdr.header, sizeof(hdr.header));
+		return sizeof(hdr.header);
 	}
 
-	conn_mod_write_long_frame(conn, data, len);
+	hdr.header.payload_length_mask = 126;
+	hdr.payload_length_extended = htons(len);
+	memcpy(buf, &hdr, sizeof(hdr));
+	return sizeof(hdr);
 }
 
 static void
@@ -480,13 +533,68 @@ cleanup_bad_message(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
 		rb_close(ctlb->F[i]);
 }
 
+/*
+ * ws_frame_unmask: XORs the payload with the mask a machine word at a
+ * time.  The bytes up to the first aligned word are done singly, and the
+ * word mask is the 4 byte mask rotated to line up with that position.
+ */
 static void
 ws_frame_unmask(char *msg, int length, const uint8_t maskval[WEBSOCKET_MASK_LENGTH])
 {
-	int i;
+	uint8_t *p = (uint8_t *) msg, *end = p + length;
+	uint8_t maskbytes[sizeof(uint64_t)];
+	uint64_t mask;
+	size_t i;
+
+	for (; p < end && ((uintptr_t) p & (sizeof(mask) - 1)) != 0; p++)
+		*p ^= maskval[(p - (uint8_t *) msg) & 3];
+
+	for (i = 0; i < sizeof(maskbytes); i++)
+		maskbytes[i] = maskval[(p - (uint8_t *) msg + i) & 3];
+	memcpy(&mask, maskbytes, sizeof(mask));
+
+	for (; end - p >= (ptrdiff_t) sizeof(mask); p += sizeof(mask))
+	{
+		uint64_t word;
+
+		memcpy(&word, p, sizeof(word));
+		word ^= mask;
+		memcpy(p, &word, sizeof(word));
+	}
+
+	for (; p < end; p++)
+		*p ^= maskval[(p - (uint8_t *) msg) & 3];
+}
+
+static void
+conn_inflate_cb(void *data, const char *buf, size_t len)
+{
+	conn_t *conn = data;
+
+	rb_linebuf_parse(&conn->plainbuf_out, (char *) buf, len, 1);
+}
+
+/*
+ * conn_mod_deliver: passes a client message on to the ircd, inflating it
+ * first if it came compressed
+ */
+static void
+conn_mod_deliver(conn_t *conn, ws_frame_hdr_t *hdr, char *msg, int len)
+{
+	if (!ws_frame_get_rsv1(hdr))
+	{
+		rb_linebuf_parse(&conn->plainbuf_out, msg, len, 1);
+		return;
+	}
 
-	for (i = 0; i < length; i++)
-		msg[i] = msg[i] ^ maskval[i % 4];
+	if (conn->deflate == NULL)
+	{
+		close_conn(conn, WAIT_PLAIN, "websocket error: compressed frame without permessage-deflate");
+		return;
+	}
+
+	if (!ws_inflate_message(msg, len, conn_inflate_cb, conn))
+		close_conn(conn, WAIT_PLAIN, "websocket error: fault inflating message");
 }
 
 static void
@@ -517,7 +625,7 @@ conn_mod_process_frame(conn_t *conn, ws_frame_hdr_t *hdr, int masked)
 	if (masked)
 		ws_frame_unmask(msg, dolen, maskval);
 
-	rb_linebuf_parse(&conn->plainbuf_out, msg, dolen, 1);
+	conn_mod_deliver(conn, hdr, msg, dolen);
 }
 
 static void
@@ -528,8 +636,6 @@ conn_mod_process_large(conn_t *conn, ws_frame_hdr_t *hdr, int masked)
 	uint8_t maskval[WEBSOCKET_MASK_LENGTH];
 	int dolen;
 
-	memset(msg, 0, sizeof msg);
-
 	dolen = rb_rawbuf_get(conn->modbuf_in, &msglen, sizeof(msglen));
 	if (!dolen)
 	{
@@ -559,7 +665,7 @@ conn_mod_process_large(conn_t *conn, ws_frame_hdr_t *hdr, int masked)
 	if (masked)
 		ws_frame_unmask(msg, dolen, maskval);
 
-	rb_linebuf_parse(&conn->plainbuf_out, msg, dolen, 1);
+	conn_mod_deliver(conn, hdr, msg, dolen);
 }
 
 static void
@@ -615,6 +721,33 @@ conn_mod_handshake_process(conn_t *conn)
 		if (!dolen)
 			break;
 
+		/* before the key, which gets cut off at its line end below */
+		if ((p = rb_strcasestr(inbuf, "Sec-WebSocket-Protocol:")) != NULL)
+		{
+			char *end = strpbrk(p, "\r\n");
+			char *token = strstr(p, WEBSOCKET_PROTOCOL_COALESCE);
+
+			if (token != NULL && (end == NULL || token < end))
+				SetCoalesce(conn);
+		}
+
+		if (conn->deflate == NULL && (p = rb_strcasestr(inbuf, "Sec-WebSocket-Extensions:")) != NULL)
+		{
+			char offers[512], reply[128];
+			size_t len;
+
+			p += strlen("Sec-WebSocket-Extensions:");
+			len = strcspn(p, "\r\n");
+			if (len >= sizeof(offers))
+				len = sizeof(offers) - 1;
+			memcpy(offers, p, len);
+			offers[len] = '\0';
+
+			conn->deflate = ws_deflate_negotiate(offers, reply, sizeof(reply));
+			if (conn->deflate != NULL)
+				conn->deflate_reply = rb_strdup(reply);
+		}
+
 		if ((p = rb_strcasestr(inbuf, "Sec-WebSocket-Key:")) != NULL)
 		{
 			char *start, *end;
@@ -656,6 +789,18 @@ conn_mod_handshake_process(conn_t *conn)
 
 		conn_mod_write(conn, WEBSOCKET_ANSWER_STRING_1, strlen(WEBSOCKET_ANSWER_STRING_1));
 		conn_mod_write(conn, resp, strlen(resp));
+		if (IsCoalesce(conn))
+		{
+			conn_mod_write(conn, WEBSOCKET_ANSWER_PROTOCOL, strlen(WEBSOCKET_ANSWER_PROTOCOL));
+			conn_mod_write(conn, WEBSOCKET_PROTOCOL_COALESCE, strlen(WEBSOCKET_PROTOCOL_COALESCE));
+		}
+		if (conn->deflate_reply != NULL)
+		{
+			conn_mod_write(conn, WEBSOCKET_ANSWER_EXTENSIONS, strlen(WEBSOCKET_ANSWER_EXTENSIONS));
+			conn_mod_write(conn, conn->deflate_reply, strlen(conn->deflate_reply));
+			rb_free(conn->deflate_reply);
+			conn->deflate_reply = NULL;
+		}
 		conn_mod_write(conn, WEBSOCKET_ANSWER_STRING_2, strlen(WEBSOCKET_ANSWER_STRING_2));
 
 		rb_free(resp);
@@ -736,20 +881,87 @@ plain_check_cork(conn_t * conn)
 	return false;
 }
 
+/*
+ * conn_plain_process_recvq: turns the lines from the ircd into frames.
+ * The lines are gathered, each followed by CRLF, and written together
+ * with their frame headers in one writev.  Clients that accept it get as
+ * many lines per frame as fit in WS_COALESCE_MAX, the rest one line each.
+ * Frames are compressed into zbuf where permessage-deflate allows.
+ */
+#define WS_FRAMES_MAX	64
+#define WS_COALESCE_MAX	4096
+
 static void
 conn_plain_process_recvq(conn_t *conn)
 {
 	char inbuf[READBUF_SIZE];
-
-	memset(inbuf, 0, sizeof inbuf);
+	char zbuf[READBUF_SIZE + READBUF_SIZE / 4 + WS_FRAMES_MAX * 16];
+	uint8_t hdrs[WS_FRAMES_MAX][sizeof(ws_frame_ext_t)];
+	struct rb_iovec vec[WS_FRAMES_MAX * 2];
+	int nframes = 0;
+	size_t used = 0, start = 0, zused = 0;
 
 	while (1)
 	{
-		int dolen = rb_linebuf_get(&conn->plainbuf_in, inbuf, sizeof inbuf, LINEBUF_COMPLETE, LINEBUF_PARSED);
-		if (!dolen)
-			break;
+		bool room = nframes < WS_FRAMES_MAX && sizeof(inbuf) - used > LINEBUF_SIZE + CRLF_LEN;
+		int dolen = 0;
+
+		if (room)
+			dolen = rb_linebuf_get(&conn->plainbuf_in, inbuf + used, sizeof(inbuf) - used - 1,
+					LINEBUF_COMPLETE, LINEBUF_PARSED);
+
+		if (dolen > 0)
+		{
+			memcpy(inbuf + used + dolen, "\r\n", CRLF_LEN);
+			used += dolen + CRLF_LEN;
+
+			if (IsCoalesce(conn) && used - start + LINEBUF_SIZE + CRLF_LEN <= WS_COALESCE_MAX)
+				continue;
+		}
+
+		/* close the frame being built */
+		if (used > start)
+		{
+			ssize_t zlen = -1;
+
+			if (conn->deflate != NULL)
+				zlen = ws_deflate_message(conn->deflate, inbuf + start, used - start,
+						zbuf + zused, sizeof(zbuf) - zused);
+
+			if (zlen >= 0)
+			{
+				vec[nframes * 2].iov_len = ws_frame_header(hdrs[nframes], zlen, 1);
+				vec[nframes * 2 + 1].iov_base = zbuf + zused;
+				vec[nframes * 2 + 1].iov_len = zlen;
+				zused += zlen;
+			}
+			else
+			{
+				vec[nframes * 2].iov_len = ws_frame_header(hdrs[nframes], used - start, 0);
+				vec[nframes * 2 + 1].iov_base = inbuf + start;
+				vec[nframes * 2 + 1].iov_len = used - start;
+			}
+			vec[nframes * 2].iov_base = hdrs[nframes];
+			nframes++;
+			start = used;
+		}
+
+		if (dolen > 0)
+			continue;
+
+		if (nframes > 0)
+		{
+			conn_mod_writev(conn, vec, nframes * 2);
+			if (IsDead(conn))
+				return;
+			nframes = 0;
+			used = start = zused = 0;
+		}
 
-		conn_mod_write_frame(conn, inbuf, dolen);
+		/* stopped for lack of room rather than lines */
+		if (!room)
+			continue;
+		break;
 	}
 
 	if (IsKeyed(conn))
@@ -856,6 +1068,23 @@ wsock_process(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
 	conn_plain_read_cb(conn->plain_fd, conn);
 }
 
+/*
+ * set_deflate: 'D' from the ircd, with the permessage-deflate settings as
+ * enabled, window bits, context takeover, memory cap and cpu budget
+ */
+static void
+set_deflate(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
+{
+	struct ws_deflate_conf conf;
+
+	conf.enabled = buf_to_uint32(&ctlb->buf[1]) != 0;
+	conf.window_bits = buf_to_uint32(&ctlb->buf[5]);
+	conf.context_takeover = buf_to_uint32(&ctlb->buf[9]) != 0;
+	conf.memory = buf_to_uint32(&ctlb->buf[13]);
+	conf.cpu_ms = buf_to_uint32(&ctlb->buf[17]);
+	ws_deflate_configure(&conf);
+}
+
 static void
 mod_process_cmd_recv(mod_ctl_t * ctl)
 {
@@ -878,6 +1107,16 @@ mod_process_cmd_recv(mod_ctl_t * ctl)
 				wsock_process(ctl, ctl_buf);
 				break;
 			}
+		case 'D':
+			{
+				if (ctl_buf->buflen != 21)
+				{
+					cleanup_bad_message(ctl, ctl_buf);
+					break;
+				}
+				set_deflate(ctl, ctl_buf);
+				break;
+			}
 		default:
 			break;
 			/* Log unknown commands */